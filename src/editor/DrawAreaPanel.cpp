@@ -67,13 +67,12 @@ void DrawAreaPanel::draw(gcn::Graphics *g)
 
     
     // draw box around the drawing area
-    uint32 pixdim = _mgr->GetMaxPixelDim() + 2;
     Point cam = _engine->GetCamera();
     gcn::Rectangle clip(
         -cam.x - 1,
         -cam.y - 1,
-        pixdim,
-        pixdim);
+        _mgr->GetPixelWidth() + 2,
+        _mgr->GetPixelHeight() + 2);
 
 
     g->setColor(gcn::Color(255, 0, 0, 180));
@@ -106,7 +105,7 @@ void DrawAreaPanel::mouseMoved(gcn::MouseEvent& me)
     if(_frame.x < _blockOffsX || _frame.y < _blockOffsY)
         _showSelRect = false;
     // bottom, right
-    if(_frame.x - _blockOffsX + _blockW > (int32)_mgr->GetMaxPixelDim() || _frame.y - _blockOffsY + _blockH > (int32)_mgr->GetMaxPixelDim())
+    if(_frame.x - _blockOffsX + _blockW > (int32)_mgr->GetPixelWidth() || _frame.y - _blockOffsY + _blockH > (int32)_mgr->GetPixelHeight())
         _showSelRect = false;
 }
 
@@ -59,6 +59,7 @@ EditorEngine::EditorEngine()
     _topWidget = new gcn::Container();
     _fileDlg = NULL;
     _drawBackground = false; // here, guichan draws the black background, no reason to do it twice
+    _streamMaps = false; // maps are edited as a whole
     _ignoreInput = false;
 }
 
@@ -180,7 +181,7 @@ void EditorEngine::_Render(void)
 void EditorEngine::SetupEditorLayers(void)
 {
     _layermgr->Clear();
-    _layermgr->SetMaxDim(128); // TODO: make this changeable later
+    _layermgr->SetSize(128, 128); // TODO: make this changeable later
 
     for(uint32 i = LAYER_REARMOST_BACKGROUND; i < LAYER_MAX; i++)
     {
@@ -196,20 +197,21 @@ void EditorEngine::PanDrawingArea(int32 x, int32 y)
     _cameraPos.x += x;
     _cameraPos.y += y;
 
-    int32 pixdim = _layermgr->GetMaxPixelDim();
+    int32 pixw = _layermgr->GetPixelWidth();
+    int32 pixh = _layermgr->GetPixelHeight();
     int32 halfx = GetResX() / 2;
     int32 halfy = GetResY() / 2;
 
     // limit view
     if(_cameraPos.x < -halfx)
         _cameraPos.x = -halfx;
-    else if(_cameraPos.x > pixdim - halfx)
-        _cameraPos.x = pixdim - halfx;
+    else if(_cameraPos.x > pixw - halfx)
+        _cameraPos.x = pixw - halfx;
 
     if(_cameraPos.y < -halfy)
         _cameraPos.y = -halfy;
-    else if(_cameraPos.y > pixdim - halfy)
-        _cameraPos.y = pixdim - halfy;
+    else if(_cameraPos.y > pixh - halfy)
+        _cameraPos.y = pixh - halfy;
 
     GetVisibleBlockRect(); // to trigger recalc
 }
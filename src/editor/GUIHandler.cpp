@@ -118,8 +118,8 @@ void EditorEngine::SetupInterface(void)
 // and resize them if required
 void EditorEngine::SetupInterfaceLayers(void)
 {
-    uint32 resmax = std::max(GetResX(), GetResY());
-    uint32 tilesmax = resmax / 16; // TODO: fix for tile size != 16
+    uint32 tilesw = GetResX() / 16; // TODO: fix for tile size != 16
+    uint32 tilesh = GetResY() / 16;
     TileLayer *tl;
 
     {
@@ -137,8 +137,8 @@ void EditorEngine::SetupInterfaceLayers(void)
             tl = tblayerv[0];
         }
 
-        if(tl->GetArraySize() < tilesmax)
-            tl->Resize(tilesmax);
+        if(tl->GetWidth() < tilesw || tl->GetHeight() < tilesh)
+            tl->Resize(std::max(tl->GetWidth(), tilesw), std::max(tl->GetHeight(), tilesh));
     }
 
     {
@@ -155,8 +155,8 @@ void EditorEngine::SetupInterfaceLayers(void)
         {
             tl = tblayerv[0];
         }
-        if(tl->GetArraySize() < tilesmax)
-            tl->Resize(tilesmax);
+        if(tl->GetWidth() < tilesw || tl->GetHeight() < tilesh)
+            tl->Resize(std::max(tl->GetWidth(), tilesw), std::max(tl->GetHeight(), tilesh));
     }
 
     
@@ -8,8 +8,9 @@ void EditorEngine::SaveData(void)
 {
     // save tilebox layer
     LayerMgr mgr(this);
-    mgr.SetMaxDim(panTilebox->GetTiles()[0]->GetArraySize());
-    mgr.SetLayer(panTilebox->GetTiles()[0], 0);
+    TileLayer *tiles = panTilebox->GetTiles()[0];
+    mgr.SetSize(tiles->GetWidth(), tiles->GetHeight());
+    mgr.SetLayer(tiles, 0);
     CreateDir("saved_data");
     CreateDir("saved_data/editor");
     bool result = MapFile::SaveAsFileDirect("saved_data/editor/last.tilebox", &mgr);
@@ -52,9 +52,8 @@ void TileboxPanel::mouseReleased(gcn::MouseEvent& me)
         // enlarge tile storage as necessary
         uint32 tilesw = GetSelBlocksW();
         uint32 tilesh = GetSelBlocksH();
-        uint32 reqdim = std::max<uint32>(tilesw, tilesh);
-        if(ptiles->GetArraySize() < reqdim)
-            ptiles->Resize(reqdim);
+        if(ptiles->GetWidth() < tilesw || ptiles->GetHeight() < tilesh)
+            ptiles->Resize(std::max(ptiles->GetWidth(), tilesw), std::max(ptiles->GetHeight(), tilesh));
 
         // copy tiles into the storage
         GetTileLayer()->CopyTo(GetSelBlocksX(), GetSelBlocksY(), ptiles, 0, 0, tilesw, tilesh);
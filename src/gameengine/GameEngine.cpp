@@ -7,6 +7,7 @@
 #include "AppFalconGame.h"
 #include "Objects.h"
 #include "ObjectMgr.h"
+#include "TimerWheel.h"
 #include "GameEngine.h"
 #include <falcon/engine.h>
 #include "FalconGameModule.h"
@@ -32,6 +33,9 @@ GameEngine::~GameEngine()
 void GameEngine::Shutdown(void)
 {
     objmgr->RemoveAll(); // this will unbind all objects BEFORE dropping falcon
+    scheduler->Clear(); // same for scheduled script calls
+    if(LVPAFile *basepak = resMgr.vfs.GetBase())
+        basepak->SetThreadPool(NULL); // the worker threads are about to go away
     delete falcon;
     Falcon::Engine::PerformGC();
     Falcon::Engine::Shutdown();
@@ -60,8 +64,12 @@ bool GameEngine::Setup(void)
 
     // setup the VFS and the container to read from
     logdetail("Initializing virtual file system...");
+    // the solid blocks are unpacked in the background, reading a file waits only for the block it is in.
+    // the CRCs are checked in the background too, nothing has to wait for that.
     LVPAFile *basepak = new LVPAFileReadOnly;
-    basepak->LoadFrom("basepak.lvpa", LVPALOAD_SOLID);
+    basepak->SetThreadPool(workers);
+    basepak->SetCRCPolicy(LVPACRC_BACKGROUND);
+    basepak->LoadFrom("basepak.lvpa", LVPALoadFlags(LVPALOAD_SOLID | LVPALOAD_ASYNC));
     resMgr.vfs.LoadBase(basepak, true);
     resMgr.vfs.LoadFileSysRoot();
     resMgr.vfs.Prepare();
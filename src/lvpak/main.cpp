@@ -4,6 +4,7 @@
 #include "LVPAFile.h"
 #include "MyCrc32.h"
 #include "SHA256Hash.h"
+#include "ThreadPool.h"
 
 // WARNING: The code in this file SUCKS. Badly.
 
@@ -101,6 +102,7 @@ static uint8 g_hdrAlgo = LVPAPACK_INHERIT;
 static bool g_hdrEncr = false;
 static uint8 g_mode = 0;
 static uint32 g_filesDone = 0;
+static uint32 g_threads = 1; // 0: one per CPU
 static std::string g_relPath;
 static LVPAFile *g_lvpa = NULL;
 
@@ -114,7 +116,7 @@ static bool _IsFileMode(void)
 
 static bool _IsAddMode(void)
 {
-    switch(g_mode) { case 'a': case 'c': return true; }
+    switch(g_mode) { case 'a': case 'c': case 'r': return true; }
     return false;
 }
 
@@ -394,28 +396,37 @@ static void usage(void)
            "\n"
            "Modes:\n"
            "  c - create new archive (overwrite if exist)\n"
-           "  a - append to archive or create new\n"
+           "  a - append to archive or create new. only new and changed files are\n"
+           "      written, after the existing data; replaced data stay as unused space\n"
+           "  k - compact archive: rewrite it without unused space (also 'compact')\n"
          //"  d - delete file or directory inside archive\n"
            "  e - extract to current directory\n"
            "  x - extract with full path\n"
            "  t - test archive\n"
            "  l - list files, mode, and stats\n"
-         //"  r - repack with a different compression level\n"
+           "  r - repack archive: write all files again, with the settings of\n"
+           "      -c, -e, -S, -H and -E (files keep their own if not given)\n"
            "\n"
            "Flags:\n"
            "  -p <PATH> - use PATH as relative path to prepend each file, or as outdir.\n"   // PC_SET_PATH
          //"  -d DIR - add all files inside directory\n"
          //"  -D DIR - same as -d, but recursive\n"
            "  -c<A><#> - default compression level and algorithm\n"                              // PC_SET_COMPR
-           "     A - can be none, lzo, lzma, or i (inherit)\n"
+           "     A - can be none, lzo, deflate, lzma, auto, or i (inherit)\n"
            "     # - a number in 0..9 or i (inherit)\n"
+           "     auto picks store/lzo/deflate/lzma per file by sampling its data;\n"
+           "     # is then what matters more: 1-2 fast loading .. 6-9 small size.\n"
+           "     'lvpak l' shows what was chosen.\n"
            "  -f <FILE> - use a listfile\n"                                                      // processed inline
            "  -s<NAME> - put the following files into a solid block with name NAME.\n"           // PC_MAKE_SOLID
            "             (NAME can be empty)\n"
            "  -n - not solid block. This disables -s.\n"                                         // PC_NOT_SOLID
-           "  -e[0] - encrypt the following files. -e0 turns off encryption.\n"                  // PC_SET_ENCRYPT
+           "  -e[0|c] - encrypt the following files. -e0 turns off encryption.\n"                // PC_SET_ENCRYPT
+           "     c - use ChaCha20, which allows reading encrypted files in parts\n"
+           "         (files can't be read by lvpak versions older than that).\n"
            "  -x[0] - scramble the following files. -x0 turns off scrambling.\n"                 // PC_SET_SCRAMBLE
            "  -v - be verbose\n"                                                                 // processed inline
+           "  -j[N] - compress using N threads. -j alone uses one thread per CPU.\n"             // processed inline
            "  -S<NAME>=<A><#> - choose compression params for solid block (see -c, -s).\n"       // PC_SET_SOLID_COMPR
            "  -H<A><#> - choose compression params for headers (see -c).\n"                      // PC_SET_HDR_COMPR
            "  -E - turn on header encryption\n"                                                  // PC_SET_HDR_ENCRYPT
@@ -431,6 +442,7 @@ static void usage(void)
            "If files have no explicit compression/encryption settings,\n"
            "they will be inherited from the headers.\n"
            "Note that LZMA level >= 7 takes large amounts of memory and time!\n"
+           "(and with -j, every thread needs that much memory)\n"
            "\n"
            "Examples: lvpak c -Hlzo9 -E -Kbh secret file01.txt file02...\n"
            "          lvpak x arch.lvpa -p extractdir\n"
@@ -444,7 +456,8 @@ static void unknown(char *what)
     printf("Unknown parameter: '%s'\n", what);
 }
 
-// parses for example -c0 (no compression), -cnone, -c9 (max. default algo), -clzma (default lzma), -clzma9 (max lzma), -clzo3 (fast lzo), etc
+// parses for example -c0 (no compression), -cnone, -c9 (max. default algo), -clzma (default lzma), -clzma9 (max lzma), -clzo3 (fast lzo),
+// -cauto2 (pick per file, prefer fast loading), etc
 // also supports -ci9 (use max level of inherited compression), -ci (inherit everything) -clzoi (use lzo, but inherit compression level)
 // this function is used for -H, -S, -c.
 static bool parseCompressString(const char *str, uint8 *algo, uint8 *level)
@@ -509,6 +522,18 @@ static bool parseCompressString(const char *str, uint8 *algo, uint8 *level)
                         *level = LVPAPACK_NONE;
                         return true;
                     }
+                    else if(!strnicmp(str, "auto", 4))
+                    {
+                        *algo = LVPAPACK_AUTO;
+                        *level = LVPAPACK_INHERIT;
+                        return parseCompressString(str + 4, NULL, level);
+                    }
+                    else if(l >= 7 && !strnicmp(str, "deflate", 7))
+                    {
+                        *algo = LVPAPACK_DEFLATE;
+                        *level = LVPAPACK_INHERIT;
+                        return parseCompressString(str + 7, NULL, level);
+                    }
                 }
             }
         }
@@ -597,7 +622,8 @@ static bool parseSingleCmd(char **argv, uint32 available, PackDef &pd, uint32& s
         case 'e':
         {
             ++str; // skip "-e"
-            pd.encrypt = (str[0] != '0'); // if its just -e, this is \0
+            // if its just -e, this is \0
+            pd.encrypt = str[0] == '0' ? LVPAENCR_NONE : (str[0] == 'c' ? LVPAENCR_CHACHA : LVPAENCR_ENABLED);
             pd.init(PC_SET_ENCRYPT);
             return true;
         }
@@ -668,6 +694,15 @@ static void parseArgv(std::list<PackDef>& cmds, uint32 argc, char **argv, bool i
 
                 processListfile(listfile, cmds);
             }
+            else if(p[1] == 'j') // may be given as "-jN", "-j N", or just "-j"
+            {
+                if(p[2])
+                    g_threads = atoi(p + 2);
+                else if(i + 1 < argc && isdigit(argv[i + 1][0]))
+                    g_threads = atoi(argv[++i]);
+                else
+                    g_threads = 0;
+            }
             else
             {
                 PackDef pd;
@@ -819,6 +854,8 @@ int main(int argc, char *argv[])
 
     if(argv[1][0] && !argv[1][1]) // mode may be 1 single char only, otherwise ignore, and error out
         g_mode = argv[1][0];
+    else if(!strcmp(argv[1], "compact"))
+        g_mode = 'k';
 
     archive = argv[2];
 
@@ -861,19 +898,21 @@ int main(int argc, char *argv[])
                 const char *algoStr = "UNK";
                 switch(h.algo)
                 {
-                    case LVPAPACK_NONE:  algoStr = "None"; break;
-                    case LVPAPACK_LZMA:  algoStr = "Lzma"; break;
-                    case LVPAPACK_LZO1X: algoStr = "Lzo "; break;
+                    case LVPAPACK_NONE:    algoStr = "None"; break;
+                    case LVPAPACK_LZMA:    algoStr = "Lzma"; break;
+                    case LVPAPACK_LZO1X:   algoStr = "Lzo "; break;
+                    case LVPAPACK_DEFLATE: algoStr = "Defl"; break;
                 }
                 printf("[%c%c%c%c,%s%c%s%s] '%s' (%u KB, %.2f%%)%s\n",
                     h.flags & LVPAFLAG_PACKED ? 'P' : '-',
-                    h.flags & LVPAFLAG_SOLID ? 'S' : (h.flags & LVPAFLAG_SOLIDBLOCK ? '#' : '-'),
-                    h.flags & LVPAFLAG_ENCRYPTED ? 'E' : '-',
+                    h.flags & LVPAFLAG_SOLID ? 'S' : (h.flags & LVPAFLAG_SOLIDBLOCK ? '#' : (h.flags & LVPAFLAG_ALIAS ? 'A' : '-')),
+                    h.flags & LVPAFLAG_ENCRYPTED ? (h.flags & LVPAFLAG_CHACHA ? 'C' : 'E') : '-',
                     h.flags & LVPAFLAG_SCRAMBLED ? 'X' : '-',
                     algoStr,
                     lvlc,
-                    h.flags & LVPAFLAG_SOLID ? "," : "",
-                    h.flags & LVPAFLAG_SOLID ? lvpa.GetFileInfo(h.blockId).filename.c_str() : "",
+                    h.flags & (LVPAFLAG_SOLID | LVPAFLAG_ALIAS) ? "," : "",
+                    h.flags & LVPAFLAG_SOLID ? lvpa.GetFileInfo(h.blockId).filename.c_str()
+                        : h.flags & LVPAFLAG_ALIAS ? lvpa.GetFileInfo(h.aliasId).filename.c_str() : "",
                     h.flags & LVPAFLAG_SCRAMBLED ? "?#scrambled#?" : h.filename.c_str(), // otherwise it would be empty anyways
                     h.realSize >> 10,
                     (float(h.packedSize) / float(h.realSize)) * 100.0f,
@@ -883,14 +922,29 @@ int main(int argc, char *argv[])
             printf("%u files present.\n", lvpa.HeaderCount());
             printf("Total compression ratio: %u KB -> %u KB (%.2f%%)\n", lvpa.GetRealSize() >> 10, lvpa.GetPackedSize() >> 10,
                  float(lvpa.GetPackedSize()) / float(lvpa.GetRealSize()) * 100.0f);
+            if(lvpa.GetUnusedSize())
+                printf("%u KB unused, use 'lvpak k' to compact.\n", lvpa.GetUnusedSize() >> 10);
             result = true;
             break;
         }
 
+        case 'k':
+        {
+            processPackDefList(lvpa, cmds, glob);
+            uint32 unused_kb = lvpa.GetUnusedSize() >> 10;
+
+            // everything is copied as it is stored, only the headers are packed again
+            result = lvpa.SaveAs(archive.c_str(), g_hdrLevel, g_hdrAlgo, g_hdrEncr || lvpa.HasEncryptedHeaders());
+            if(result)
+                printf("Compacted, %u KB freed.\n", unused_kb);
+            break;
+        }
+
         case 'a':
         case 'c':
+        case 'r':
         {
-            if(cmds.empty())
+            if(cmds.empty() && g_mode != 'r')
             {
                 printf("Add mode: Nothing to do\n");
                 break;
@@ -913,12 +967,36 @@ int main(int argc, char *argv[])
             if(g_hdrLevel == LVPACOMP_INHERIT)
                 g_hdrLevel = glob.level;
 
-            result = lvpa.SaveAs(archive.c_str(), g_hdrLevel, g_hdrAlgo, g_hdrEncr);
+            // without this, files that are in the archive already are copied as they are stored
+            if(g_mode == 'r' && !lvpa.Repack(glob.level, glob.algo, glob.encrypt))
+            {
+                logerror("Repack mode: not all files could be loaded");
+                break;
+            }
+
+            // the calling thread does its share of the work, so one less is needed
+            ThreadPool *pool = NULL;
+            if(g_threads != 1)
+            {
+                pool = new ThreadPool(g_threads ? g_threads - 1 : uint32(-1));
+                printf("Compressing with %u threads\n", pool->GetThreadCount() + 1);
+                lvpa.SetThreadPool(pool);
+            }
+
+            if(g_mode == 'a') // keep encrypting the headers if they were
+                result = lvpa.Update(g_hdrLevel, g_hdrAlgo, g_hdrEncr || lvpa.HasEncryptedHeaders());
+            else if(g_mode == 'r')
+                result = lvpa.SaveAs(archive.c_str(), g_hdrLevel, g_hdrAlgo, g_hdrEncr || lvpa.HasEncryptedHeaders());
+            else
+                result = lvpa.SaveAs(archive.c_str(), g_hdrLevel, g_hdrAlgo, g_hdrEncr);
+
+            lvpa.SetThreadPool(NULL);
+            delete pool;
             if(result)
             {
                 uint32 real_kb = lvpa.GetRealSize() >> 10;
                 uint32 packed_kb = lvpa.GetPackedSize() >> 10;
-                printf("%u files packed.\n", g_filesDone);
+                printf("%u files packed.\n", g_mode == 'r' ? lvpa.Count() : g_filesDone);
                 printf("Total compression ratio: %u KB -> %u KB (%.2f%%)\n", real_kb, packed_kb,
                     float(lvpa.GetPackedSize()) / float(lvpa.GetRealSize()) * 100.0f);
             }
@@ -42,8 +42,9 @@ AsciiLevel *ParseAsciiLevel(char *strbuf)
             break;
     }
 
-    uint32 lineNum = 0;
-    uint32 maxdim = 0;
+    // then the level itself, one character per tile
+    std::vector<std::string> rows;
+    uint32 width = 0;
     for( ; lin != lines.end(); lin++)
     {
         if(lin->empty())
@@ -51,29 +52,15 @@ AsciiLevel *ParseAsciiLevel(char *strbuf)
         if(lin->length() < 3)
             continue;
 
-        line = *lin;
-        if(!maxdim)
-        {
-          maxdim = std::max((uint32)line.length(), lineNum);
-          if(level->tiles.size1d() < maxdim)
-          {
-              level->tiles.resize(maxdim, 0);
-          }
-        }
-        if(level->tiles.size1d() < lineNum || level->tiles.size1d() < line.length())
-        {
-            logerror("AsciiLevelParser: array2d too small, or level too large!");
-            break;
-        }
-
-        for(uint32 i = 0; i < line.length(); ++i)
-        {
-            level->tiles(i, lineNum) = line[i];
-        }
-
-        lineNum++;
+        rows.push_back(*lin);
+        width = std::max(width, (uint32)lin->length());
     }
 
+    level->tiles.resize(width, rows.size(), 0);
+    for(uint32 y = 0; y < rows.size(); ++y)
+        for(uint32 x = 0; x < rows[y].length(); ++x)
+            level->tiles(x, y) = rows[y][x];
+
     return level;
 }
 
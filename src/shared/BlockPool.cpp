@@ -0,0 +1,33 @@
+#include "common.h"
+#include "BlockPool.h"
+
+BlockPool *BlockPool::s_first = NULL;
+
+BlockPool::BlockPool(const char *name, uint32 blocksize, uint32 perChunk /* = 64 */)
+: _name(name), _free(NULL), _cur(NULL), _curLeft(0), _perChunk(perChunk),
+  _hits(0), _misses(0), _used(0)
+{
+    // every block must be able to hold the free list pointer, and be suitably aligned for any type
+    const uint32 align = sizeof(void*) * 2;
+    if(blocksize < sizeof(FreeBlock))
+        blocksize = sizeof(FreeBlock);
+    _blocksize = (blocksize + (align - 1)) & ~(align - 1);
+
+    _next = s_first;
+    s_first = this;
+}
+
+BlockPool::~BlockPool()
+{
+    DEBUG(if(_used) logerror("BlockPool '%s': destroyed with %u blocks still in use!", _name, _used));
+    for(uint32 i = 0; i < _chunks.size(); ++i)
+        delete [] _chunks[i];
+
+    // unlink from the global pool list
+    for(BlockPool **pp = &s_first; *pp; pp = &(*pp)->_next)
+        if(*pp == this)
+        {
+            *pp = _next;
+            break;
+        }
+}
@@ -0,0 +1,99 @@
+#ifndef BLOCKPOOL_H
+#define BLOCKPOOL_H
+
+#include <vector>
+
+// Fixed-size block allocator.
+// Freed blocks are kept in a free list and handed out again on the next allocation;
+// memory is taken from the system in chunks and only released when the pool is destroyed.
+// Not thread safe.
+class BlockPool
+{
+public:
+    BlockPool(const char *name, uint32 blocksize, uint32 perChunk = 64);
+    ~BlockPool();
+
+    inline void *Alloc(void)
+    {
+        ++_used;
+        if(_free)
+        {
+            ++_hits;
+            FreeBlock *blk = _free;
+            _free = blk->next;
+            return blk;
+        }
+        ++_misses;
+        if(!_curLeft)
+        {
+            _cur = new uint8[_blocksize * _perChunk];
+            _chunks.push_back(_cur);
+            _curLeft = _perChunk;
+        }
+        void *p = _cur;
+        _cur += _blocksize;
+        --_curLeft;
+        return p;
+    }
+
+    inline void Free(void *p)
+    {
+        if(!p)
+            return;
+        DEBUG(ASSERT(_used));
+        --_used;
+        FreeBlock *blk = (FreeBlock*)p;
+        blk->next = _free;
+        _free = blk;
+    }
+
+    inline const char *GetName(void) const { return _name; }
+    inline uint32 GetBlockSize(void) const { return _blocksize; }
+    inline uint32 GetUsed(void) const { return _used; } // blocks currently handed out
+    inline uint32 GetCapacity(void) const { return _chunks.size() * _perChunk; } // blocks allocated from the system
+    inline uint64 GetHits(void) const { return _hits; } // allocations served from the free list
+    inline uint64 GetMisses(void) const { return _misses; } // allocations that needed fresh memory
+    inline float GetHitRate(void) const { return (_hits + _misses) ? float(double(_hits) / double(_hits + _misses)) : 0.0f; }
+    inline BlockPool *GetNext(void) const { return _next; }
+
+    // all existing pools, for statistics
+    inline static BlockPool *GetFirst(void) { return s_first; }
+
+private:
+    BlockPool(const BlockPool&); // forbid copy
+    BlockPool& operator=(const BlockPool&);
+
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+
+    const char *_name;
+    FreeBlock *_free;
+    uint8 *_cur; // next unused block in the current chunk
+    uint32 _curLeft; // unused blocks left in the current chunk
+    uint32 _blocksize;
+    uint32 _perChunk;
+    std::vector<uint8*> _chunks;
+    uint64 _hits;
+    uint64 _misses;
+    uint32 _used;
+    BlockPool *_next;
+
+    static BlockPool *s_first;
+};
+
+// Put this into the public part of a class declaration to make 'new' and 'delete' use a BlockPool.
+// Subclasses that do not declare their own pool are larger than the pool's blocks, and fall back to the global heap.
+#define DECLARE_POOLED_ALLOC \
+    static void *operator new(size_t size); \
+    static void operator delete(void *p, size_t size); \
+    static BlockPool& GetPool(void);
+
+#define IMPLEMENT_POOLED_ALLOC(cls, perChunk) \
+    BlockPool& cls::GetPool(void) { static BlockPool pool(#cls, sizeof(cls), (perChunk)); return pool; } \
+    void *cls::operator new(size_t size) { return size == sizeof(cls) ? GetPool().Alloc() : ::operator new(size); } \
+    void cls::operator delete(void *p, size_t size) { if(size == sizeof(cls)) GetPool().Free(p); else ::operator delete(p); }
+
+
+#endif
@@ -82,6 +82,7 @@ void DeflateCompressor::decompress(void *dst, uint32 *origsize, const void *src,
     stream.next_in = (Bytef*)src;
     stream.avail_in = (uInt)size;
     stream.next_out = (Bytef*)dst;
+    stream.avail_out = (uInt)*origsize;
     stream.zalloc = (alloc_func)0;
     stream.zfree = (free_func)0;
 
@@ -97,6 +98,7 @@ void DeflateCompressor::decompress(void *dst, uint32 *origsize, const void *src,
     {
         inflateEnd(&stream);
         *origsize = 0;
+        return;
     }
     *origsize = stream.total_out;
 
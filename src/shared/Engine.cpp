@@ -11,6 +11,10 @@
 #include "ObjectMgr.h"
 #include "MyCrc32.h"
 #include "MapFile.h"
+#include "TimerWheel.h"
+#include "ThreadPool.h"
+#include "ResourcePreloader.h"
+#include "MapStreamer.h"
 
 
 // see Engine.h for comments about these
@@ -27,9 +31,9 @@ std::vector<SDL_Joystick*> Engine::s_joysticks;
 Engine *Engine::s_instance = NULL;
 
 Engine::Engine()
-: _screen(NULL), _fps(0), _sleeptime(0), _framecounter(0), _paused(false),
-_debugFlags(EDBG_NONE), _reset(false), _bgcolor(0), _drawBackground(true),
-_fpsMin(60), _fpsMax(70), falcon(NULL), _mouseX(0), _mouseY(0)
+: falcon(NULL), _preloader(NULL), _streamer(NULL), _streamMaps(true),
+_screen(NULL), _fps(0), _framecounter(0), _fpsMin(60), _fpsMax(70), _sleeptime(0),
+_debugFlags(EDBG_NONE), _bgcolor(0), _mouseX(0), _mouseY(0), _paused(false), _reset(false), _drawBackground(true)
 {
     log("Game Engine start.");
 
@@ -49,12 +53,18 @@ _fpsMin(60), _fpsMax(70), falcon(NULL), _mouseX(0), _mouseY(0)
     _layermgr = new LayerMgr(this);
     _fpsclock = s_lastFrameTimeReal  = s_ignoredTicks = SDL_GetTicks();
     
+    workers = new ThreadPool;
+    logdetail("Using %u worker threads", workers->GetThreadCount());
+    resMgr.SetThreadPool(workers);
+
     physmgr = new PhysicsMgr;
     physmgr->SetLayerMgr(_layermgr);
     objmgr = new ObjectMgr(this);
     physmgr->SetObjMgr(objmgr);
     objmgr->SetLayerMgr(_layermgr);
     objmgr->SetPhysicsMgr(physmgr);
+    objmgr->SetThreadPool(workers);
+    scheduler = new TimerWheel;
     _InitJoystick();
 
     _resPoolTimer.SetInterval(5000);
@@ -69,9 +79,17 @@ void Engine::Shutdown(void)
     // this should not be called from inside Engine::Run()
 
     sndCore.StopMusic();
+    resMgr.CancelAsync();
+    delete _preloader;
+    _preloader = NULL;
+    delete _streamer;
+    _streamer = NULL;
+    delete scheduler;
     delete objmgr;
     delete physmgr;
     delete _layermgr;
+    resMgr.SetThreadPool(NULL);
+    delete workers;
     resMgr.pool.Cleanup(true); // force deletion of everything
     resMgr.DropUnused(); // at this point, all resources should have a refcount of 0, so this removes all.
     sndCore.Destroy(); // must be deleted after all sounds were dropped by the ResourceMgr
@@ -313,9 +331,16 @@ bool Engine::Setup(void)
 
 void Engine::_Process(void)
 {
+    scheduler->Update(GetCurFrameTime());
+    if(_streamer)
+        _streamer->Update(GetCamera().x, GetCamera().y, GetResX(), GetResY());
     _layermgr->Update(GetCurFrameTime());
     objmgr->Update(GetTimeDiff(), GetTimeDiffF(), GetCurFrameTime());
 
+    resMgr.UpdateAsync(ASYNC_MAX_MS_PER_FRAME);
+    if(_preloader && !_preloader->IsDone())
+        _preloader->Update(PRELOAD_MAX_MS_PER_FRAME);
+
     _resPoolTimer.Update(s_diffTimeReal);
 
     if(_resPoolTimer.Passed())
@@ -454,14 +479,20 @@ void Engine::_Reset(void)
 {
     DEBUG(logdetail("Before Reset Cleanup: Memory leak detector says: %u", MLD_COUNTER));
     _reset = false;
+    scheduler->Clear();
     objmgr->RemoveAll();
+    delete _streamer;
+    _streamer = NULL;
     _layermgr->Clear();
     physmgr->SetDefaults();
+    resMgr.CancelAsync(); // no script callbacks after this point, and nothing reads from the VFS anymore
     resMgr.pool.Cleanup();
-    resMgr.DropUnused();
+    delete _preloader;
+    _preloader = NULL;
+    resMgr.DropUnused(true); // keeps what fits into the memory budget, for the next map
     DEBUG(logdetail("After Reset Cleanup: Memory leak detector says: %u", MLD_COUNTER));
-    resMgr.vfs.Prepare(true);
-    resMgr.vfs.Reload(true);
+    resMgr.vfs.Prepare(true); // unmounts what was added since startup
+    resMgr.vfs.Reload(true); // rescans only directories that changed
     ResetTime();
 }
 
@@ -507,6 +538,23 @@ void Engine::SetResizable(bool b)
 bool Engine::LoadMapFile(const char *fn)
 {
     logdetail("Loading map from '%s'", fn);
+    if(_preloader && _preloader->GetName() == fn)
+        _preloader->Finish();
+
+    delete _streamer;
+    _streamer = NULL;
+    if(_streamMaps)
+    {
+        MapStreamer *ms = new MapStreamer(_layermgr);
+        if(ms->Open(resMgr.vfs.GetFile(fn)))
+        {
+            _streamer = ms;
+            _streamer->Update(GetCamera().x, GetCamera().y, GetResX(), GetResY());
+            return true;
+        }
+        delete ms; // not chunked, load it completely
+    }
+
     memblock *mb = resMgr.LoadFile((char*)fn);
     if(!mb)
     {
@@ -530,6 +578,33 @@ bool Engine::LoadMapFile(const char *fn)
     return true;
 }
 
+// starts loading everything the map uses in the background, see _Process().
+// the resources stay loaded until the next map is preloaded, or the engine is reset.
+bool Engine::PreloadMap(const char *fn)
+{
+    if(_preloader && _preloader->GetName() == fn)
+        return true;
+
+    ResourcePreloader *pre = new ResourcePreloader(workers);
+    if(!pre->AddMap(fn))
+    {
+        logerror("Engine::PreloadMap: Failed to read map '%s'", fn);
+        delete pre;
+        return false;
+    }
+    pre->SetName(fn);
+    logdetail("Preloading %u resources for map '%s'", pre->GetTotalCount(), fn);
+
+    delete _preloader; // only drops references, resources used by both maps are still there when the new one gets to them
+    _preloader = pre;
+    return true;
+}
+
+float Engine::GetPreloadProgress(void)
+{
+    return _preloader ? _preloader->GetProgress() : 1.0f;
+}
+
 void Engine::PrintSystemSpecs(void)
 {
     logcustom(0, LGREEN, "System/Engine specs:");
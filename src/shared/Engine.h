@@ -13,9 +13,18 @@
 class LayerMgr;
 class ObjectMgr;
 class PhysicsMgr;
+class TimerWheel;
+class ThreadPool;
+class ResourcePreloader;
+class MapStreamer;
 class AppFalcon;
 class BaseObject;
 
+// time spent starting loads for the preloader per frame
+#define PRELOAD_MAX_MS_PER_FRAME 5
+// time spent finishing asynchronous loads per frame (image conversion, adding to the ResourceMgr, script callbacks)
+#define ASYNC_MAX_MS_PER_FRAME 10
+
 enum EngineDebugFlags
 {
     EDBG_NONE                   = 0x00,
@@ -66,6 +75,8 @@ public:
     virtual bool OnRawEvent(SDL_Event& evt); // return true to pass this event to the following internal event handlers, false to proceed with next event
     virtual void OnObjectCreated(BaseObject *obj); // called in FalconObjectModule.cpp, fal_ObjectCarrier::init()
     virtual bool LoadMapFile(const char *fn);
+    bool PreloadMap(const char *fn);
+    float GetPreloadProgress(void); // 0 .. 1, 1 if nothing is preloaded
 
     void SetTitle(const char *title);
     inline void SetReset(bool r = true) { _reset = r; }
@@ -118,11 +129,16 @@ public:
 
     ObjectMgr *objmgr;
     PhysicsMgr *physmgr;
+    TimerWheel *scheduler; // timed calls, in game time
+    ThreadPool *workers; // for native work that can be done in parallel
     AppFalcon *falcon;
 
 protected:
 
     LayerMgr *_layermgr;
+    ResourcePreloader *_preloader;
+    MapStreamer *_streamer; // for the current map, if it is chunked
+    bool _streamMaps; // LoadMapFile() streams chunked maps around the camera, instead of loading them completely
 
     virtual void _ProcessEvents(void);
     virtual void _CalcFPS(void);
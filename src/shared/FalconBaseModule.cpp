@@ -24,6 +24,7 @@ Base module file, providing some engine core function bindings
 #include "VFSDir.h"
 #include "VFSFile.h"
 #include "MyCrc32.h"
+#include "TimerWheel.h"
 
 // graphics/SDL related
 #include <SDL/SDL.h>
@@ -317,6 +318,7 @@ This drops all custom paths or containers added.
 */
 FALCON_FUNC fal_VFS_Clear( Falcon::VMachine *vm )
 {
+    resMgr.WaitAsync(); // pending loads may still read from containers that are removed now
     resMgr.vfs.Prepare(true);
 }
 
@@ -326,6 +328,7 @@ FALCON_FUNC fal_VFS_Clear( Falcon::VMachine *vm )
 
 This should be called if files or directories on the file system were added or removed,
 to refresh the virtual file system tree.
+Only directories whose modification time changed are read again.
 */
 FALCON_FUNC fal_VFS_Reload( Falcon::VMachine *vm )
 {
@@ -440,15 +443,7 @@ FALCON_FUNC fal_VFS_Merge( Falcon::VMachine *vm )
     Falcon::AutoCString csrc(src_i->asString());
     Falcon::AutoCString ctarg(targ_i->asString());
 
-    VFSDir *targetdir = resMgr.vfs.GetDir(ctarg.c_str(), force);
-    VFSDir *srcdir = resMgr.vfs.GetDir(csrc.c_str());
-    if(targetdir && srcdir)
-    {
-        targetdir->merge(srcdir);
-        vm->retval(true);
-    }
-    else
-        vm->retval(false);
+    vm->retval(resMgr.vfs.Merge(csrc.c_str(), ctarg.c_str(), force));
 }
 
 /*#
@@ -488,6 +483,101 @@ FALCON_FUNC fal_VFS_GetFileAsBuf( Falcon::VMachine *vm )
     vm->retval(mbuf);
 }
 
+// Calls a script function when an asynchronous load is finished, with a parameter depending on what was loaded
+class FalconAsyncCallback : public AsyncLoadListener
+{
+public:
+    enum Action
+    {
+        PASS_SUCCESS, // true if loaded
+        PASS_MEMBUF, // file contents, or nil
+        PLAY_MUSIC // starts the music, then passes true if it plays
+    };
+
+    FalconAsyncCallback(Falcon::VMachine *vm, Falcon::Item *itm, Action action)
+        : _vm(vm), _lock(itm && !itm->isNil() ? new Falcon::GarbageLock(*itm) : NULL), _action(action)
+    {
+    }
+
+    virtual ~FalconAsyncCallback()
+    {
+        delete _lock;
+    }
+
+    virtual void OnLoaded(AsyncLoad *req)
+    {
+        Falcon::Item result;
+        switch(_action)
+        {
+            case PASS_SUCCESS:
+                result.setBoolean(req->GetResource() != NULL);
+                break;
+
+            case PASS_MEMBUF:
+                if(memblock *mb = (memblock*)req->TakeResource())
+                {
+                    Falcon::MemBuf_1 *mbuf = new Falcon::MemBuf_1(mb->size);
+                    mbuf->length(mb->size);
+                    memcpy(mbuf->data(), mb->ptr, mb->size);
+                    result.setMemBuf(mbuf);
+                    resMgr.Drop(mb, true); // the script has its own copy now
+                }
+                break;
+
+            case PLAY_MUSIC:
+                result.setBoolean(sndCore.PlayMusic(req->GetName().c_str())); // loaded already, unless it failed
+                break;
+        }
+
+        if(!_lock)
+            return;
+        try
+        {
+            _vm->pushParam(result);
+            _vm->callItem(_lock->item(), 1);
+        }
+        catch(Falcon::Error *err)
+        {
+            Falcon::AutoCString edesc( err->toString() );
+            logerror("AsyncLoad: Error in callback for '%s': %s", req->GetName().c_str(), edesc.c_str());
+            err->decref();
+        }
+    }
+
+private:
+    Falcon::VMachine *_vm;
+    Falcon::GarbageLock *_lock;
+    Action _action;
+};
+
+static void CheckAsyncParams(Falcon::VMachine *vm, bool needFunc)
+{
+    Falcon::Item *i_func = vm->param(1);
+    if(!vm->param(0)->isString() || (needFunc && !i_func) || (i_func && !i_func->isNil() && !i_func->isCallable()))
+    {
+        throw new Falcon::ParamError(Falcon::ErrorParam( Falcon::e_inv_params, __LINE__ )
+            .extra(needFunc ? "S, C" : "S [, C]") );
+    }
+}
+
+/*#
+@method GetFileAsBufAsync VFS
+@brief Reads a file in the background, and passes its contents to a function
+@param filename The filename and path of the file
+@param func Callable item, called with a MemBuf if the file was read, nil otherwise
+
+Reading and unpacking the file is done by worker threads, the function is called
+by the engine at the start of a later frame.
+*/
+FALCON_FUNC fal_VFS_GetFileAsBufAsync( Falcon::VMachine *vm )
+{
+    FALCON_REQUIRE_PARAMS_EXTRA(2, "S, C");
+    CheckAsyncParams(vm, true);
+    Falcon::AutoCString fn(vm->param(0)->asString());
+    AsyncLoad *req = resMgr.LoadFileAsync(fn.c_str(), new FalconAsyncCallback(vm, vm->param(1), FalconAsyncCallback::PASS_MEMBUF));
+    req->ref--;
+}
+
 /*#
 @method AddBufAsFile VFS
 @brief Creates a virtual file in the VFS tree
@@ -513,7 +603,7 @@ FALCON_FUNC fal_VFS_AddBufAsFile( Falcon::VMachine *vm )
     Falcon::MemBuf *mbuf = i_mbuf->asMemBuf();
 
     VFSFileMem *vf = new VFSFileMem(fn.c_str(), mbuf->data(), mbuf->size(), true); // copy
-    vm->retval(resMgr.vfs.GetDirRoot()->addRecursive(vf, true));
+    vm->retval(resMgr.vfs.AddFile(vf, true));
     --(vf->ref);
 }
 
@@ -748,6 +838,24 @@ FALCON_FUNC fal_Music_Play(Falcon::VMachine *vm)
     vm->retval(playing);
 }
 
+/*#
+@method PlayAsync Music
+@brief Loads a music file in the background, and plays it when it is loaded
+@param filename Music file, relative to the music directory
+@optparam func Callable item, called with true if the music is playing, false otherwise
+
+Use this to change the music without stalling the game while the file is read and unpacked.
+Music.Play() is still needed to unpause the music.
+*/
+FALCON_FUNC fal_Music_PlayAsync(Falcon::VMachine *vm)
+{
+    FALCON_REQUIRE_PARAMS_EXTRA(1, "S [, C]");
+    CheckAsyncParams(vm, false);
+    Falcon::AutoCString fn(vm->param(0)->asString());
+    AsyncLoad *req = resMgr.LoadMusicAsync(fn.c_str(), new FalconAsyncCallback(vm, vm->param(1), FalconAsyncCallback::PLAY_MUSIC));
+    req->ref--;
+}
+
 FALCON_FUNC fal_Music_Pause(Falcon::VMachine *vm)
 {
     sndCore.PauseMusic();
@@ -763,6 +871,121 @@ FALCON_FUNC fal_Music_IsPlaying(Falcon::VMachine *vm)
     sndCore.IsPlayingMusic();
 }
 
+/*#
+@class Scheduler
+@ingroup group_internal
+@brief Singleton class to call functions after a delay
+
+Scheduled calls are kept in a timer wheel in the engine core and are processed
+once per frame, using the engine time (see Engine.GetTime()).
+Only calls that are due cost processing time.
+*/
+
+class SchedulerCallback : public TimerCallback
+{
+public:
+    SchedulerCallback(Falcon::VMachine *vm, const Falcon::Item& itm)
+        : _vm(vm), _lock(new Falcon::GarbageLock(itm))
+    {
+    }
+
+    virtual ~SchedulerCallback()
+    {
+        delete _lock;
+    }
+
+    virtual void Call(uint32 id)
+    {
+        try
+        {
+            _vm->callItem(_lock->item(), 0);
+        }
+        catch(Falcon::Error *err)
+        {
+            Falcon::AutoCString edesc( err->toString() );
+            logerror("Scheduler: Error in call #%u: %s", id, edesc.c_str());
+            err->decref();
+        }
+    }
+
+private:
+    Falcon::VMachine *_vm;
+    Falcon::GarbageLock *_lock;
+};
+
+// time when a call with a delay of 'ms' milliseconds from now is due. negative delays mean as soon as possible.
+static uint32 getScheduleTime(Falcon::Item *ms)
+{
+    Falcon::int64 delay = ms->forceInteger();
+    return Engine::GetCurFrameTime() + uint32(delay > 0 ? delay : 0);
+}
+
+/*#
+@method Schedule Scheduler
+@param func Callable item
+@param ms Delay in milliseconds, negative is the same as 0
+@return The id of the scheduled call
+@brief Calls a function after a delay
+
+The function is called without parameters. The returned id can be used to cancel or move the call.
+*/
+FALCON_FUNC fal_Scheduler_Schedule( Falcon::VMachine *vm )
+{
+    FALCON_REQUIRE_PARAMS_EXTRA(2, "C, N");
+    if(!vm->param(0)->isCallable())
+    {
+        throw new Falcon::ParamError(Falcon::ErrorParam( Falcon::e_param_type, __LINE__ )
+            .extra("C, N") );
+    }
+    uint32 when = getScheduleTime(vm->param(1));
+    uint32 id = Engine::GetInstance()->scheduler->Schedule(when, new SchedulerCallback(vm, *vm->param(0)));
+    vm->retval(Falcon::int64(id));
+}
+
+/*#
+@method Cancel Scheduler
+@param id Id returned by Schedule()
+@return True if the call was pending and is now removed, false otherwise
+@brief Cancels a scheduled call
+*/
+FALCON_FUNC fal_Scheduler_Cancel( Falcon::VMachine *vm )
+{
+    FALCON_REQUIRE_PARAMS_EXTRA(1, "N");
+    vm->retval(Engine::GetInstance()->scheduler->Cancel(uint32(vm->param(0)->forceInteger())));
+}
+
+/*#
+@method Reschedule Scheduler
+@param id Id returned by Schedule()
+@param ms New delay in milliseconds, counted from now. Negative is the same as 0.
+@return True if the call was pending, false otherwise
+@brief Changes the time a scheduled call is due
+*/
+FALCON_FUNC fal_Scheduler_Reschedule( Falcon::VMachine *vm )
+{
+    FALCON_REQUIRE_PARAMS_EXTRA(2, "N, N");
+    uint32 when = getScheduleTime(vm->param(1));
+    vm->retval(Engine::GetInstance()->scheduler->Reschedule(uint32(vm->param(0)->forceInteger()), when));
+}
+
+/*#
+@method Count Scheduler
+@return The amount of pending calls
+*/
+FALCON_FUNC fal_Scheduler_Count( Falcon::VMachine *vm )
+{
+    vm->retval(Falcon::int64(Engine::GetInstance()->scheduler->GetCount()));
+}
+
+/*#
+@method Clear Scheduler
+@brief Cancels all pending calls
+*/
+FALCON_FUNC fal_Scheduler_Clear( Falcon::VMachine *vm )
+{
+    Engine::GetInstance()->scheduler->Clear();
+}
+
 FALCON_FUNC fal_Engine_GetName(Falcon::VMachine *vm)
 {
     vm->retval(new Falcon::CoreString(Engine::GetInstance()->GetName()));
@@ -813,6 +1036,64 @@ FALCON_FUNC fal_Engine_LoadMap(Falcon::VMachine *vm)
     vm->retval(Engine::GetInstance()->LoadMapFile(cstr.c_str()));
 }
 
+/*#
+@method PreloadMap Engine
+@param filename The map file
+@return True if the map was found
+@brief Starts loading all resources a map uses in the background
+
+Loads all tiles used by the map, and every file listed in "<filename>.preload", one per line.
+Use PreloadProgress() to show a loading screen. LoadMap() waits until preloading is done.
+*/
+FALCON_FUNC fal_Engine_PreloadMap(Falcon::VMachine *vm)
+{
+    FALCON_REQUIRE_PARAMS_EXTRA(1,"S filename");
+    Falcon::AutoCString cstr(vm->param(0)->asString());
+    vm->retval(Engine::GetInstance()->PreloadMap(cstr.c_str()));
+}
+
+/*#
+@method PreloadProgress Engine
+@return A number between 0 and 1
+@brief Returns how much of the resources started by PreloadMap() is loaded
+*/
+FALCON_FUNC fal_Engine_PreloadProgress(Falcon::VMachine *vm)
+{
+    vm->retval(Falcon::numeric(Engine::GetInstance()->GetPreloadProgress()));
+}
+
+/*#
+@method LoadAsync Engine
+@param filename Full path of an image (gfx/...), sound (sfx/...), music (music/...) or any other file
+@optparam func Callable item, called with true if the file was loaded, false otherwise
+@brief Loads a resource in the background
+
+Reading and decoding is done by worker threads, the function is called by the engine at the start
+of a later frame. The resource stays in memory while it is used, or until the next map is loaded,
+so that creating a Sound or Tile with it afterwards does not have to wait for the file.
+*/
+FALCON_FUNC fal_Engine_LoadAsync(Falcon::VMachine *vm)
+{
+    FALCON_REQUIRE_PARAMS_EXTRA(1, "S [, C]");
+    CheckAsyncParams(vm, false);
+    Falcon::AutoCString cfn(vm->param(0)->asString());
+    const char *fn = cfn.c_str();
+    while(*fn == '/')
+        ++fn;
+    std::string s(fn);
+    FalconAsyncCallback *cb = new FalconAsyncCallback(vm, vm->param(1), FalconAsyncCallback::PASS_SUCCESS);
+    AsyncLoad *req;
+    if(s.substr(0, 4) == "gfx/")
+        req = resMgr.LoadImgAsync(fn, cb);
+    else if(s.substr(0, 4) == "sfx/")
+        req = resMgr.LoadSoundAsync(fn + 4, cb);
+    else if(s.substr(0, 6) == "music/")
+        req = resMgr.LoadMusicAsync(fn + 6, cb);
+    else
+        req = resMgr.LoadFileAsync(fn, cb);
+    req->ref--;
+}
+
 FALCON_FUNC fal_Engine_Exit(Falcon::VMachine *vm)
 {
     Engine::GetInstance()->SetQuit(true);
@@ -882,6 +1163,33 @@ FALCON_FUNC fal_Engine_ResourceCleanup(Falcon::VMachine *vm)
     resMgr.DropUnused();
 }
 
+FALCON_FUNC fal_Engine_ResourceBudget(Falcon::VMachine *vm)
+{
+    if(vm->paramCount())
+        resMgr.SetMemBudget((uint32)vm->param(0)->forceInteger());
+    vm->retval((Falcon::int64)resMgr.GetMemBudget());
+}
+
+FALCON_FUNC fal_Engine_ResourceWarmMem(Falcon::VMachine *vm)
+{
+    vm->retval((Falcon::int64)resMgr.GetWarmMem());
+}
+
+FALCON_FUNC fal_Engine_ResourceHits(Falcon::VMachine *vm)
+{
+    vm->retval((Falcon::int64)resMgr.GetCacheHits());
+}
+
+FALCON_FUNC fal_Engine_ResourceMisses(Falcon::VMachine *vm)
+{
+    vm->retval((Falcon::int64)resMgr.GetCacheMisses());
+}
+
+FALCON_FUNC fal_Engine_ResourceEvictions(Falcon::VMachine *vm)
+{
+    vm->retval((Falcon::int64)resMgr.GetEvictions());
+}
+
 FALCON_FUNC fal_Engine_GetSpeed(Falcon::VMachine *vm)
 {
     vm->retval(Falcon::numeric(Engine::GetSpeed()));
@@ -990,11 +1298,22 @@ FALCON_FUNC fal_Screen_IsFullscreen(Falcon::VMachine *vm)
     vm->retval(Engine::GetInstance()->IsFullscreen());
 }
 
+// the larger side, for scripts written when maps were always square
 FALCON_FUNC fal_EngineMap_GetLayerSize(Falcon::VMachine *vm)
 {
     vm->retval((Falcon::int32)Engine::GetInstance()->_GetLayerMgr()->GetMaxDim());
 }
 
+FALCON_FUNC fal_EngineMap_GetLayerWidth(Falcon::VMachine *vm)
+{
+    vm->retval((Falcon::int32)Engine::GetInstance()->_GetLayerMgr()->GetWidth());
+}
+
+FALCON_FUNC fal_EngineMap_GetLayerHeight(Falcon::VMachine *vm)
+{
+    vm->retval((Falcon::int32)Engine::GetInstance()->_GetLayerMgr()->GetHeight());
+}
+
 FALCON_FUNC fal_EngineMap_GetTileInfo(Falcon::VMachine *vm)
 {
     FALCON_REQUIRE_PARAMS_EXTRA(2, "N, N");
@@ -1006,8 +1325,7 @@ FALCON_FUNC fal_EngineMap_GetTileInfo(Falcon::VMachine *vm)
         throw new EngineError( Falcon::ErrorParam( Falcon::e_undef_state ).
             extra( "TileInfoLayer not created" ) );
     }
-    uint32 m = lm->GetMaxDim();
-    if( !(x < m && y < m) )
+    if( !(x < lm->GetWidth() && y < lm->GetHeight()) )
     {
         throw new Falcon::AccessError( Falcon::ErrorParam( Falcon::e_arracc ) );
     }
@@ -1026,8 +1344,7 @@ FALCON_FUNC fal_EngineMap_SetTileInfo(Falcon::VMachine *vm)
         throw new EngineError( Falcon::ErrorParam( Falcon::e_undef_state ).
             extra( "TileInfoLayer not created" ) );
     }
-    uint32 m = lm->GetMaxDim();
-    if( !(x < m && y < m) )
+    if( !(x < lm->GetWidth() && y < lm->GetHeight()) )
     {
         throw new Falcon::AccessError( Falcon::ErrorParam( Falcon::e_arracc ) );
     }
@@ -1079,7 +1396,7 @@ FALCON_FUNC fal_Screen_GetCameraY(Falcon::VMachine *vm)
 FALCON_FUNC fal_EngineMap_UpdateCollisionMap(Falcon::VMachine *vm)
 {
     LayerMgr *lm = Engine::GetInstance()->_GetLayerMgr();
-    if(!lm->HasCollisionMap() || lm->GetMaxPixelDim() != lm->GetCollisionMap().size1d()) // TODO: move 2nd check to a better place?
+    if(!lm->HasCollisionMap() || lm->GetPixelWidth() != lm->GetCollisionMap().width() || lm->GetPixelHeight() != lm->GetCollisionMap().height()) // TODO: move 2nd check to a better place?
     {
         lm->CreateCollisionMap();
     }
@@ -1273,6 +1590,9 @@ Falcon::Module *FalconBaseModule_create(void)
     m->addClassMethod(clsEngine, "GetName", fal_Engine_GetName);
     m->addClassMethod(clsEngine, "LoadLevel", fal_Engine_LoadLevel); // TODO: deprecate
     m->addClassMethod(clsEngine, "LoadMap", fal_Engine_LoadMap);
+    m->addClassMethod(clsEngine, "PreloadMap", fal_Engine_PreloadMap);
+    m->addClassMethod(clsEngine, "PreloadProgress", fal_Engine_PreloadProgress);
+    m->addClassMethod(clsEngine, "LoadAsync", fal_Engine_LoadAsync);
     m->addClassMethod(clsEngine, "Exit", fal_Engine_Exit);
     m->addClassMethod(clsEngine, "LoadPropFile", fal_Engine_LoadPropFile);
     m->addClassMethod(clsEngine, "SetFileProperty", fal_Engine_SetFileProperty);
@@ -1282,6 +1602,11 @@ Falcon::Module *FalconBaseModule_create(void)
     m->addClassMethod(clsEngine, "ResourceCount", fal_Engine_ResourceCount);
     m->addClassMethod(clsEngine, "ResourceMem", fal_Engine_ResourceMem);
     m->addClassMethod(clsEngine, "ResourceCleanup", fal_Engine_ResourceCleanup);
+    m->addClassMethod(clsEngine, "ResourceBudget", fal_Engine_ResourceBudget);
+    m->addClassMethod(clsEngine, "ResourceWarmMem", fal_Engine_ResourceWarmMem);
+    m->addClassMethod(clsEngine, "ResourceHits", fal_Engine_ResourceHits);
+    m->addClassMethod(clsEngine, "ResourceMisses", fal_Engine_ResourceMisses);
+    m->addClassMethod(clsEngine, "ResourceEvictions", fal_Engine_ResourceEvictions);
     m->addClassMethod(clsEngine, "SetSpeed", fal_Engine_SetSpeed);
     m->addClassMethod(clsEngine, "GetSpeed", fal_Engine_GetSpeed);
     m->addClassMethod(clsEngine, "ResetTime", fal_Engine_ResetTime);
@@ -1307,6 +1632,8 @@ Falcon::Module *FalconBaseModule_create(void)
     Falcon::Symbol *clsEngineMap = symEngineMap->getInstance();
     m->addClassMethod(clsEngineMap, "GetLayer", &fal_EngineMap_GetLayer);
     m->addClassMethod(clsEngineMap, "GetLayerSize", &fal_EngineMap_GetLayerSize);
+    m->addClassMethod(clsEngineMap, "GetLayerWidth", &fal_EngineMap_GetLayerWidth);
+    m->addClassMethod(clsEngineMap, "GetLayerHeight", &fal_EngineMap_GetLayerHeight);
     m->addClassMethod(clsEngineMap, "SetTileInfo", &fal_EngineMap_SetTileInfo); // TODO: deprecate?
     m->addClassMethod(clsEngineMap, "GetTileInfo", &fal_EngineMap_GetTileInfo); // TODO: deprecate?
     m->addClassMethod(clsEngineMap, "CreateInfoLayer", &fal_EngineMap_CreateInfoLayer); // TODO: deprecate?
@@ -1318,6 +1645,7 @@ Falcon::Module *FalconBaseModule_create(void)
     Falcon::Symbol *symMusic = m->addSingleton("Music");
     Falcon::Symbol *clsMusic = symMusic->getInstance();
     m->addClassMethod(clsMusic, "Play", fal_Music_Play);
+    m->addClassMethod(clsMusic, "PlayAsync", fal_Music_PlayAsync);
     m->addClassMethod(clsMusic, "Stop", fal_Music_Stop);
     m->addClassMethod(clsMusic, "Pause", fal_Music_Pause);
     m->addClassMethod(clsMusic, "SetVolume", fal_Music_SetVolume);
@@ -1337,6 +1665,14 @@ Falcon::Module *FalconBaseModule_create(void)
     m->addClassMethod(clsFont, "GetHeight", fal_Font_GetHeight);
     clsFont->setWKS(true);
 
+    Falcon::Symbol *symScheduler = m->addSingleton("Scheduler");
+    Falcon::Symbol *clsScheduler = symScheduler->getInstance();
+    m->addClassMethod(clsScheduler, "Schedule", fal_Scheduler_Schedule);
+    m->addClassMethod(clsScheduler, "Cancel", fal_Scheduler_Cancel);
+    m->addClassMethod(clsScheduler, "Reschedule", fal_Scheduler_Reschedule);
+    m->addClassMethod(clsScheduler, "Count", fal_Scheduler_Count);
+    m->addClassMethod(clsScheduler, "Clear", fal_Scheduler_Clear);
+
     Falcon::Symbol *symVFS = m->addSingleton("VFS");
     Falcon::Symbol *clsVFS = symVFS->getInstance();
     m->addClassMethod(clsVFS, "AddContainer", fal_VFS_AddContainer);
@@ -1348,6 +1684,7 @@ Falcon::Module *FalconBaseModule_create(void)
     m->addClassMethod(clsVFS, "Merge", fal_VFS_Merge);
     m->addClassMethod(clsVFS, "AddBufAsFile", fal_VFS_AddBufAsFile);
     m->addClassMethod(clsVFS, "GetFileAsBuf", fal_VFS_GetFileAsBuf);
+    m->addClassMethod(clsVFS, "GetFileAsBufAsync", fal_VFS_GetFileAsBufAsync);
 
     Falcon::Symbol *clsSurface = m->addClass("Surface", fal_Surface::init);
     clsSurface->setWKS(true);
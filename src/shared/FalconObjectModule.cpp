@@ -1,3 +1,4 @@
+#include <new>
 #include <falcon/engine.h>
 #include "common.h"
 #include "AppFalcon.h"
@@ -15,6 +16,26 @@
 #include "FalconObjectModule.h"
 
 
+IMPLEMENT_POOLED_ALLOC(FalconProxyObject, 128)
+
+// Falcon::GarbageLock comes with its own operator new, so it is constructed in pooled memory manually
+static BlockPool& GetGCLockPool(void)
+{
+    static BlockPool pool("GarbageLock", sizeof(Falcon::GarbageLock), 128);
+    return pool;
+}
+
+static Falcon::GarbageLock *NewGCLock(const Falcon::Item& itm)
+{
+    return ::new(GetGCLockPool().Alloc()) Falcon::GarbageLock(itm);
+}
+
+static void DeleteGCLock(Falcon::GarbageLock *lock)
+{
+    lock->~GarbageLock();
+    GetGCLockPool().Free(lock);
+}
+
 FalconProxyObject::~FalconProxyObject()
 {
     // remove cross-references
@@ -22,7 +43,7 @@ FalconProxyObject::~FalconProxyObject()
     self()->_obj = NULL;
 
     // allow the garbage collector to cleanup the remains (the fal_ObjectCarrier)
-    delete gclock;
+    DeleteGCLock(gclock);
 }
 
 Falcon::Item *FalconProxyObject::CallMethod(const char *m)
@@ -185,7 +206,7 @@ void fal_ObjectCarrier::init(Falcon::VMachine *vm)
     FalconProxyObject *fobj = self->GetFalObj();
     BaseObject *obj = self->GetObj();
     fobj->vm = vm;
-    fobj->gclock = new Falcon::GarbageLock(Falcon::Item(self));
+    fobj->gclock = NewGCLock(Falcon::Item(self));
     obj->SetLayerMgr(Engine::GetInstance()->_GetLayerMgr());
     obj->Init(); // correctly set type of object
     obj->_falObj = fobj;
@@ -291,6 +312,23 @@ bool fal_ObjectCarrier::setProperty( const Falcon::String &prop, const Falcon::I
         if(prop == "physics") { ((Object*)_obj)->SetAffectedByPhysics(value.isTrue()); return true; }
         if(prop == "layerId") { ((Object*)_obj)->SetLayer(uint32(value.forceInteger())); return true; }
         if(prop == "visible") { ((Object*)_obj)->SetVisible(value.isTrue()); return true; }
+        if(prop == "updateInterval")
+        {
+            Falcon::int64 ms = value.forceInteger();
+            ((Object*)_obj)->SetUpdateInterval(uint32(ms > 0 ? ms : 0)); // negative means every frame, as 0
+            return true;
+        }
+        if(prop == "updatePriority")
+        {
+            uint32 prio = uint32(value.forceInteger());
+            if(prio >= UPDATE_PRIO_MAX)
+            {
+                throw new Falcon::AccessError( Falcon::ErrorParam( Falcon::e_param_range ).
+                    extra( "updatePriority must be one of UPDATE_PRIO_*" ) );
+            }
+            ((Object*)_obj)->SetUpdatePriority(prio);
+            return true;
+        }
     }
 
     return FalconObject::setProperty(prop, value);
@@ -343,6 +381,8 @@ bool fal_ObjectCarrier::getProperty( const Falcon::String &prop, Falcon::Item &r
         if(prop == "physics") { ret = ((Object*)_obj)->IsAffectedByPhysics(); return true; }
         if(prop == "layerId") { ret = Falcon::uint32(((Object*)_obj)->GetLayer()); return true; }
         if(prop == "visible") { ret = ((Object*)_obj)->IsVisible(); return true; }
+        if(prop == "updateInterval") { ret = Falcon::int64(((Object*)_obj)->GetUpdateInterval()); return true; }
+        if(prop == "updatePriority") { ret = Falcon::int32(((Object*)_obj)->GetUpdatePriority()); return true; }
 
     }
 
@@ -763,7 +803,7 @@ FALCON_FUNC fal_TileLayer_SetTile(Falcon::VMachine *vm)
     uint32 y = vm->param(1)->forceInteger();
 
 
-    if(x >= self->GetLayer()->GetArraySize() || y >= self->GetLayer()->GetArraySize())
+    if(x >= self->GetLayer()->GetWidth() || y >= self->GetLayer()->GetHeight())
     {
         throw new Falcon::AccessError( Falcon::ErrorParam( Falcon::e_arracc ) );
     }
@@ -826,6 +866,18 @@ FALCON_FUNC fal_TileLayer_GetArraySize(Falcon::VMachine *vm)
     vm->retval((Falcon::int32)self->GetLayer()->GetArraySize());
 }
 
+FALCON_FUNC fal_TileLayer_GetWidth(Falcon::VMachine *vm)
+{
+    fal_TileLayer *self = Falcon::dyncast<fal_TileLayer*>( vm->self().asObject() );
+    vm->retval((Falcon::int32)self->GetLayer()->GetWidth());
+}
+
+FALCON_FUNC fal_TileLayer_GetHeight(Falcon::VMachine *vm)
+{
+    fal_TileLayer *self = Falcon::dyncast<fal_TileLayer*>( vm->self().asObject() );
+    vm->retval((Falcon::int32)self->GetLayer()->GetHeight());
+}
+
 FALCON_FUNC fal_TileLayer_SetCollisionEnabled(Falcon::VMachine *vm)
 {
     FALCON_REQUIRE_PARAMS_EXTRA(1, "B");
@@ -923,6 +975,44 @@ FALCON_FUNC fal_Objects_GetAllInRect(Falcon::VMachine *vm)
     vm->retval(arr);
 }
 
+FALCON_FUNC fal_Objects_SetUpdateBudget(Falcon::VMachine *vm)
+{
+    FALCON_REQUIRE_PARAMS_EXTRA(1, "N ms");
+    Engine::GetInstance()->objmgr->SetUpdateBudget(uint32(vm->param(0)->forceInteger()));
+}
+
+FALCON_FUNC fal_Objects_GetUpdateBudget(Falcon::VMachine *vm)
+{
+    vm->retval((Falcon::int64)Engine::GetInstance()->objmgr->GetUpdateBudget());
+}
+
+// returns [updated, deferred] for the objects that were subject to the update budget in the last frame
+FALCON_FUNC fal_Objects_GetUpdateStats(Falcon::VMachine *vm)
+{
+    ObjectMgr *mgr = Engine::GetInstance()->objmgr;
+    Falcon::CoreArray *arr = new Falcon::CoreArray(2);
+    arr->append(Falcon::int64(mgr->GetLastUpdatesRun()));
+    arr->append(Falcon::int64(mgr->GetLastUpdatesDeferred()));
+    vm->retval(arr);
+}
+
+// returns a dictionary: pool name -> [blocks in use, blocks allocated, hits, misses, hit rate]
+FALCON_FUNC fal_Objects_GetPoolStats(Falcon::VMachine *vm)
+{
+    Falcon::CoreDict *dict = new Falcon::CoreDict(new Falcon::LinearDict());
+    for(BlockPool *pool = BlockPool::GetFirst(); pool; pool = pool->GetNext())
+    {
+        Falcon::CoreArray *arr = new Falcon::CoreArray(5);
+        arr->append(Falcon::int64(pool->GetUsed()));
+        arr->append(Falcon::int64(pool->GetCapacity()));
+        arr->append(Falcon::int64(pool->GetHits()));
+        arr->append(Falcon::int64(pool->GetMisses()));
+        arr->append(Falcon::numeric(pool->GetHitRate()));
+        dict->put(new Falcon::CoreString(pool->GetName()), arr);
+    }
+    vm->retval(dict);
+}
+
 FALCON_FUNC fal_Objects_GetAll(Falcon::VMachine *vm)
 {
     const ObjectMap& m = Engine::GetInstance()->objmgr->GetAllObjects();
@@ -950,6 +1040,10 @@ Falcon::Module *FalconObjectModule_create(void)
     m->addClassMethod(clsObjects, "Get", fal_Objects_Get);
     m->addClassMethod(clsObjects, "GetLastId", fal_Objects_GetLastId);
     m->addClassMethod(clsObjects, "GetCount", fal_Objects_GetCount);
+    m->addClassMethod(clsObjects, "GetPoolStats", fal_Objects_GetPoolStats);
+    m->addClassMethod(clsObjects, "SetUpdateBudget", fal_Objects_SetUpdateBudget);
+    m->addClassMethod(clsObjects, "GetUpdateBudget", fal_Objects_GetUpdateBudget);
+    m->addClassMethod(clsObjects, "GetUpdateStats", fal_Objects_GetUpdateStats);
 
     Falcon::Symbol *clsTileLayer = m->addClass("TileLayer", &forbidden_init);
     clsTileLayer->setWKS(true);
@@ -958,6 +1052,8 @@ Falcon::Module *FalconObjectModule_create(void)
     m->addClassMethod(clsTileLayer, "SetTile", &fal_TileLayer_SetTile);
     m->addClassMethod(clsTileLayer, "GetTile", &fal_TileLayer_GetTile);
     m->addClassMethod(clsTileLayer, "GetArraySize", &fal_TileLayer_GetArraySize); // TODO: deprecate?
+    m->addClassMethod(clsTileLayer, "GetWidth", &fal_TileLayer_GetWidth);
+    m->addClassMethod(clsTileLayer, "GetHeight", &fal_TileLayer_GetHeight);
     m->addClassMethod(clsTileLayer, "SetCollisionEnabled", &fal_TileLayer_SetCollisionEnabled);
     m->addClassMethod(clsTileLayer, "IstCollisionEnabled", &fal_TileLayer_IsCollisionEnabled);
     m->addClassMethod(clsTileLayer, "GetParallaxMulti", &fal_TileLayer_GetParallaxMulti);
@@ -998,7 +1094,7 @@ Falcon::Module *FalconObjectModule_create(void)
     m->addClassMethod(clsRect, "OnLeave", fal_NullFunc);
     m->addClassMethod(clsRect, "OnTouch", fal_NullFunc);
     m->addClassMethod(clsRect, "OnEnteredBy", fal_NullFunc);
-    m->addClassMethod(clsRect, "OnLeftBy", fal_NullFunc); // TODO: NYI
+    m->addClassMethod(clsRect, "OnLeftBy", fal_NullFunc);
     m->addClassMethod(clsRect, "OnTouchedBy", fal_NullFunc);
     m->addClassMethod(clsRect, "SetBBox", fal_ActiveRect_SetBBox);
     m->addClassMethod(clsRect, "SetPos", fal_ActiveRect_SetPos);
@@ -1035,6 +1131,12 @@ Falcon::Module *FalconObjectModule_create(void)
     m->addClassProperty(clsObject, "phys");
     m->addClassProperty(clsObject, "gfxOffsX");
     m->addClassProperty(clsObject, "gfxOffsY");
+    m->addClassProperty(clsObject, "updateInterval");
+    m->addClassProperty(clsObject, "updatePriority");
+    m->addConstant("UPDATE_PRIO_ALWAYS", (Falcon::int64)UPDATE_PRIO_ALWAYS, true);
+    m->addConstant("UPDATE_PRIO_HIGH", (Falcon::int64)UPDATE_PRIO_HIGH, true);
+    m->addConstant("UPDATE_PRIO_NORMAL", (Falcon::int64)UPDATE_PRIO_NORMAL, true);
+    m->addConstant("UPDATE_PRIO_LOW", (Falcon::int64)UPDATE_PRIO_LOW, true);
 
     Falcon::Symbol *clsUnit = m->addClass("Unit", &fal_ObjectCarrier::init);
     Falcon::InheritDef *inhUnit = new Falcon::InheritDef(clsUnit);
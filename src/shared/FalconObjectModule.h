@@ -1,6 +1,7 @@
 #ifndef FALCON_OBJECT_MODULE_H
 #define FALCON_OBJECT_MODULE_H
 
+#include "BlockPool.h"
 
 class BaseObject;
 class TileLayer;
@@ -17,6 +18,8 @@ class FalconProxyObject
     friend class ObjectMgr;
 
 public:
+    DECLARE_POOLED_ALLOC
+
     FalconProxyObject(BaseObject *base) : obj(base) {}
     ~FalconProxyObject();
 
@@ -0,0 +1,242 @@
+#ifndef FLATHASHMAP_H
+#define FLATHASHMAP_H
+
+#include <vector>
+#include <string>
+
+// default hash functions for FlatHashMap
+template <typename K> struct FlatHash;
+
+template <> struct FlatHash<uint32>
+{
+    inline uint32 operator()(uint32 k) const
+    {
+        // integer finalizer from MurmurHash3, ids are often sequential
+        k ^= k >> 16;
+        k *= 0x85ebca6b;
+        k ^= k >> 13;
+        k *= 0xc2b2ae35;
+        k ^= k >> 16;
+        return k;
+    }
+};
+
+template <> struct FlatHash<uint64>
+{
+    inline uint32 operator()(uint64 k) const
+    {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ULL;
+        k ^= k >> 33;
+        return uint32(k);
+    }
+};
+
+template <typename T> struct FlatHash<T*>
+{
+    inline uint32 operator()(T *p) const
+    {
+        return FlatHash<uint64>()(uint64(size_t(p)));
+    }
+};
+
+template <> struct FlatHash<std::string>
+{
+    inline uint32 operator()(const std::string& s) const
+    {
+        // FNV-1a
+        uint32 h = 2166136261u;
+        for(std::string::const_iterator it = s.begin(); it != s.end(); ++it)
+        {
+            h ^= uint8(*it);
+            h *= 16777619u;
+        }
+        return h;
+    }
+};
+
+// Hash map with open addressing (linear probing) in a single array.
+// Lookups touch only a few adjacent slots, and no memory is allocated per element.
+// Erased entries leave no tombstones, the entries after them are moved back instead.
+// Inserting or erasing invalidates iterators and pointers to values, except for the iterator returned by erase(iterator).
+template <typename K, typename V, typename H = FlatHash<K> > class FlatHashMap
+{
+    struct Slot
+    {
+        Slot() : used(false) {}
+        K key;
+        V value;
+        bool used;
+    };
+    typedef std::vector<Slot> SlotVector;
+
+public:
+    // visits the slots starting after a free one, so that no run of entries wraps around the end of the iteration.
+    // erasing then only moves entries that were not visited yet back to the current slot, see erase(iterator).
+    class iterator
+    {
+        friend class FlatHashMap;
+    public:
+        iterator() : _s(NULL), _start(0), _i(0) {}
+        iterator(SlotVector *s, uint32 start, uint32 i) : _s(s), _start(start), _i(i) { _Skip(); }
+        inline const K& key(void) const { return (*_s)[_Slot()].key; }
+        inline V& value(void) const { return (*_s)[_Slot()].value; }
+        inline iterator& operator++(void) { ++_i; _Skip(); return *this; }
+        inline bool operator==(const iterator& o) const { return _i == o._i; }
+        inline bool operator!=(const iterator& o) const { return _i != o._i; }
+    private:
+        inline uint32 _Slot(void) const { return (_start + _i) & (_s->size() - 1); }
+        inline void _Skip(void) { while(_i < _s->size() && !(*_s)[_Slot()].used) ++_i; }
+        SlotVector *_s;
+        uint32 _start; // a free slot
+        uint32 _i; // counted from _start
+    };
+
+    FlatHashMap() : _size(0), _mask(0) {}
+
+    inline uint32 size(void) const { return _size; }
+    inline bool empty(void) const { return !_size; }
+    inline iterator begin(void) { return iterator(&_slots, _FirstFree(), 0); }
+    inline iterator end(void) { return iterator(&_slots, 0, _slots.size()); }
+
+    // returns NULL if not found
+    inline V *find(const K& k)
+    {
+        int32 i = _Find(k);
+        return i >= 0 ? &_slots[i].value : NULL;
+    }
+    inline const V *find(const K& k) const
+    {
+        int32 i = _Find(k);
+        return i >= 0 ? &_slots[i].value : NULL;
+    }
+
+    // inserts a default-constructed value if the key does not exist yet
+    V& operator[](const K& k)
+    {
+        int32 i = _Find(k);
+        if(i >= 0)
+            return _slots[i].value;
+        return _slots[_Insert(k, V())].value;
+    }
+
+    // returns false and leaves the map unchanged if the key exists already
+    bool insert(const K& k, const V& v)
+    {
+        if(_Find(k) >= 0)
+            return false;
+        _Insert(k, v);
+        return true;
+    }
+
+    bool erase(const K& k)
+    {
+        int32 found = _Find(k);
+        if(found < 0)
+            return false;
+        _EraseSlot(found);
+        return true;
+    }
+
+    // erases the entry at it and returns the iterator to the next one.
+    // continuing with that iterator visits each of the remaining entries exactly once.
+    iterator erase(iterator it)
+    {
+        _EraseSlot(it._Slot());
+        it._Skip(); // an entry may have been moved to this slot
+        return it;
+    }
+
+    void clear(void)
+    {
+        SlotVector().swap(_slots);
+        _size = 0;
+        _mask = 0;
+    }
+
+    void reserve(uint32 n)
+    {
+        uint32 cap = 16;
+        while(cap * 3 < n * 4)
+            cap <<= 1;
+        if(cap > _slots.size())
+            _Rehash(cap);
+    }
+
+private:
+    void _EraseSlot(uint32 found)
+    {
+        // move following entries of the probe sequence back, so that no tombstones are needed
+        uint32 i = found;
+        uint32 j = i;
+        while(true)
+        {
+            j = (j + 1) & _mask;
+            if(!_slots[j].used)
+                break;
+            uint32 home = H()(_slots[j].key) & _mask;
+            // the entry at j can fill the gap at i only if its home slot is not in (i, j] (cyclically)
+            bool between = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+            if(between)
+                continue;
+            _slots[i].key = _slots[j].key;
+            _slots[i].value = _slots[j].value;
+            i = j;
+        }
+        _slots[i] = Slot();
+        --_size;
+    }
+
+    // there is always one, the load factor is kept below 3/4
+    uint32 _FirstFree(void) const
+    {
+        uint32 i = 0;
+        while(i < _slots.size() && _slots[i].used)
+            ++i;
+        return i;
+    }
+
+    int32 _Find(const K& k) const
+    {
+        if(!_size)
+            return -1;
+        for(uint32 i = H()(k) & _mask; _slots[i].used; i = (i + 1) & _mask)
+            if(_slots[i].key == k)
+                return int32(i);
+        return -1;
+    }
+
+    uint32 _Insert(const K& k, const V& v)
+    {
+        // keep the load factor below 3/4
+        if((_size + 1) * 4 > _slots.size() * 3)
+            _Rehash(_slots.size() ? _slots.size() * 2 : 16);
+        uint32 i = H()(k) & _mask;
+        while(_slots[i].used)
+            i = (i + 1) & _mask;
+        _slots[i].key = k;
+        _slots[i].value = v;
+        _slots[i].used = true;
+        ++_size;
+        return i;
+    }
+
+    void _Rehash(uint32 cap)
+    {
+        SlotVector old(cap);
+        old.swap(_slots);
+        _mask = cap - 1;
+        _size = 0;
+        for(uint32 i = 0; i < old.size(); ++i)
+            if(old[i].used)
+                _Insert(old[i].key, old[i].value);
+    }
+
+    SlotVector _slots;
+    uint32 _size;
+    uint32 _mask;
+};
+
+#endif
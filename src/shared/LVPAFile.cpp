@@ -9,6 +9,20 @@
 #include "LVPAStreamCipher.h"
 #include "SHA256Hash.h"
 #include "ProgressBar.h"
+#include "ThreadPool.h"
+
+#include <SDL/SDL.h>
+#include <SDL/SDL_thread.h>
+
+#ifdef _WIN32
+#  define WIN32_LEAN_AND_MEAN
+#  include <windows.h>
+#  include <io.h>
+#  include "UndefUselessCrap.h"
+#else
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
 
 
 // not the best way...
@@ -44,6 +58,7 @@ static ICompressor *allocCompressor(uint8 algo)
             return new DeflateCompressor;
 
         case LVPAPACK_NONE:
+        case LVPAPACK_AUTO: // only holds the data until the algorithm is chosen, see resolveAutoCompression()
             return new ICompressor; // does nothing
     }
 
@@ -51,6 +66,97 @@ static ICompressor *allocCompressor(uint8 algo)
     return NULL;
 }
 
+// For LVPAPACK_AUTO: picks an algorithm and level for data by looking at samples from the start, middle and end,
+// instead of trying each algorithm on everything.
+// The order-0 entropy tells how much an entropy coder (Deflate, LZMA) could gain on its own,
+// a quick LZO run tells how much repetition there is.
+static uint8 chooseCompression(const uint8 *data, uint32 size, uint8 bias, uint8 *level)
+{
+    // too small to gain anything, also the per-file overhead of the compressors would eat it up
+    if(size < 64 || bias == LVPACOMP_NONE)
+    {
+        *level = LVPACOMP_NONE;
+        return LVPAPACK_NONE;
+    }
+    if(bias > LVPACOMP_ULTRA)
+        bias = LVPACOMP_ULTRA;
+
+    LZOCompressor trial;
+    uint32 counts[256];
+    memset(&counts[0], 0, sizeof(counts));
+    uint32 sampleSize = std::min<uint32>(size, LVPA_AUTO_SAMPLE_SIZE);
+    uint32 starts[3] = { 0, (size - sampleSize) / 2, size - sampleSize };
+    uint32 samples = size <= 3 * LVPA_AUTO_SAMPLE_SIZE ? 1 : 3;
+    if(samples == 1)
+        sampleSize = size;
+    for(uint32 i = 0; i < samples; ++i)
+    {
+        const uint8 *p = data + starts[i];
+        for(uint32 k = 0; k < sampleSize; ++k)
+            ++counts[p[k]];
+        trial.append(p, sampleSize);
+    }
+    uint32 total = trial.size();
+    trial.Compress(1);
+    double lzoRatio = trial.Compressed() ? double(trial.size()) / double(total) : 1.0;
+
+    double bits = 0; // per byte
+    for(uint32 i = 0; i < 256; ++i)
+        if(counts[i])
+        {
+            double p = double(counts[i]) / double(total);
+            bits -= p * log(p);
+        }
+    bits /= log(2.0);
+
+    uint8 algo;
+    if(lzoRatio > 0.97 && bits > 7.8)
+        algo = LVPAPACK_NONE; // already compressed (PNG, OGG, ...), or random
+    else if(lzoRatio > 0.97)
+        algo = bias < 3 ? LVPAPACK_NONE : bias < 6 ? LVPAPACK_DEFLATE : LVPAPACK_LZMA; // only an entropy coder can gain something
+    else if(bias < 3 || (bias < 6 && lzoRatio < 0.15))
+        algo = LVPAPACK_LZO1X; // fastest to decode, and good enough for very redundant data
+    else
+        algo = bias < 6 ? LVPAPACK_DEFLATE : LVPAPACK_LZMA;
+
+    *level = algo == LVPAPACK_NONE ? LVPACOMP_NONE : bias;
+    DEBUG(logdebug("LVPA auto: %u bytes, %.2f bits/byte, LZO %.2f -> algo %u, level %u", size, bits, lzoRatio, uint32(algo), uint32(*level)));
+    return algo;
+}
+
+// moves the data into a compressor of the chosen algorithm
+static void resolveAutoCompression(uint8& algo, uint8& level, ICompressor *& buf)
+{
+    algo = chooseCompression((const uint8*)buf->contents(), buf->size(), level, &level);
+    if(algo == LVPAPACK_NONE)
+        return; // the holder buffer does that just fine
+    ICompressor *c = allocCompressor(algo);
+    c->append(buf->contents(), buf->size());
+    delete buf;
+    buf = c;
+}
+
+// chunks that did not get smaller are stored as-is
+static bool unpackChunk(uint8 algo, const uint8 *src, uint32 packedSize, uint8 *dst, uint32 realSize)
+{
+    if(packedSize == realSize)
+    {
+        memcpy(dst, src, realSize);
+        return true;
+    }
+    std::auto_ptr<ICompressor> buf(allocCompressor(algo));
+    if(!buf.get())
+        return false;
+    buf->append(src, packedSize);
+    buf->Compressed(true);
+    buf->RealSize(realSize);
+    buf->Decompress();
+    if(buf->size() != realSize)
+        return false;
+    buf->read(dst, realSize);
+    return true;
+}
+
 
 ByteBuffer &operator >> (ByteBuffer& bb, LVPAMasterHeader& hdr)
 {
@@ -82,6 +188,9 @@ ByteBuffer &operator << (ByteBuffer& bb, LVPAMasterHeader& hdr)
     return bb;
 }
 
+// of the master header as stored in the file, see above
+static const uint32 gMasterHdrSize = 9 * sizeof(uint32) + sizeof(uint8);
+
 ByteBuffer &operator >> (ByteBuffer& bb, LVPAFileHeader& h)
 {
     bb >> h.flags;
@@ -93,6 +202,22 @@ ByteBuffer &operator >> (ByteBuffer& bb, LVPAFileHeader& h)
     else
         bb >> h.filename;
 
+    if(h.flags & LVPAFLAG_ALIAS)
+    {
+        // no data of its own, none of the fields below apply
+        bb >> h.aliasId;
+        h.packedSize = h.crcPacked = 0;
+        h.algo = LVPAPACK_NONE;
+        h.level = LVPACOMP_NONE;
+        h.blockId = 0;
+        h.cipherWarmup = 0;
+        h.cipherNonce = 0;
+        h.chunkSize = 0;
+        h.chunks.clear();
+        return bb;
+    }
+    h.aliasId = 0;
+
     if(h.flags & LVPAFLAG_PACKED)
     {
         bb >> h.packedSize;
@@ -117,13 +242,29 @@ ByteBuffer &operator >> (ByteBuffer& bb, LVPAFileHeader& h)
         h.blockId = 0;
     }
 
+    h.cipherWarmup = 0;
+    h.cipherNonce = 0;
     if(h.flags & (LVPAFLAG_ENCRYPTED | LVPAFLAG_SCRAMBLED))
     {
-        bb >> h.cipherWarmup;
+        if(h.flags & LVPAFLAG_CHACHA)
+            bb >> h.cipherNonce;
+        else
+            bb >> h.cipherWarmup;
+    }
+
+    if(h.flags & LVPAFLAG_CHUNKED)
+    {
+        uint32 count;
+        bb >> h.chunkSize;
+        bb >> count;
+        h.chunks.resize(count);
+        for(uint32 i = 0; i < count; ++i)
+            bb >> h.chunks[i].packedSize;
     }
     else
     {
-        h.cipherWarmup = 0;
+        h.chunkSize = 0;
+        h.chunks.clear();
     }
 
     return bb;
@@ -140,6 +281,12 @@ ByteBuffer &operator << (ByteBuffer& bb, LVPAFileHeader& h)
     else
         bb << h.filename;
 
+    if(h.flags & LVPAFLAG_ALIAS)
+    {
+        bb << h.aliasId;
+        return bb;
+    }
+
     if(h.flags & LVPAFLAG_PACKED)
     {
         bb << h.packedSize;
@@ -154,25 +301,45 @@ ByteBuffer &operator << (ByteBuffer& bb, LVPAFileHeader& h)
     }
 
     if(h.flags & (LVPAFLAG_ENCRYPTED | LVPAFLAG_SCRAMBLED))
-        bb << h.cipherWarmup;
+    {
+        if(h.flags & LVPAFLAG_CHACHA)
+            bb << h.cipherNonce;
+        else
+            bb << h.cipherWarmup;
+    }
+
+    if(h.flags & LVPAFLAG_CHUNKED)
+    {
+        bb << h.chunkSize;
+        bb << uint32(h.chunks.size());
+        for(uint32 i = 0; i < h.chunks.size(); ++i)
+            bb << h.chunks[i].packedSize;
+    }
 
     return bb;
 }
 
 
 LVPAFile::LVPAFile()
-: _handle(NULL), _realSize(0), _packedSize(0)
+: _handle(NULL), _realSize(0), _packedSize(0), _unusedSize(0), _hdrEncrypted(false), _useMapping(false), _mapPtr(NULL), _mapSize(0),
+  _threadPool(NULL), _crcPolicy(LVPACRC_FIRST_LOAD), _verifyTask(NULL), _chunkSize(LVPA_DEFAULT_CHUNK_SIZE), _dedup(true),
+  _cachedBlock(-1), _cachedChunk(-1)
 {
+    _fileMtx = SDL_CreateMutex();
 }
 
 LVPAFile::~LVPAFile()
 {
     Clear();
     _CloseFile();
+    _UnmapFile();
+    SDL_DestroyMutex(_fileMtx);
 }
 
 void LVPAFile::Clear(bool del /* = true */)
 {
+    _WaitAllLoaded();
+    _StopVerify(true);
     for(uint32 i = 0; i < _headers.size(); ++i)
     {
         // never try to delete files that are part of a bigger allocated block
@@ -190,6 +357,8 @@ void LVPAFile::Clear(bool del /* = true */)
     }
     _headers.clear();
     _indexes.clear();
+    _cachedBlock = -1;
+    std::vector<uint8>().swap(_chunkCache);
 }
 
 bool LVPAFile::_OpenFile(void)
@@ -202,11 +371,108 @@ bool LVPAFile::_OpenFile(void)
 
 void LVPAFile::_CloseFile(void)
 {
+    SDL_mutexP(_fileMtx); // an LVPAStream might be reading
     if(_handle)
     {
         fclose(_handle);
         _handle = NULL;
     }
+    SDL_mutexV(_fileMtx);
+}
+
+// maps the whole file copy-on-write, the mapping stays valid after the file handle is closed
+bool LVPAFile::_MapFile(void)
+{
+    if(_mapPtr)
+        return true;
+    if(!_OpenFile())
+        return false;
+
+#ifdef _WIN32
+    HANDLE fh = (HANDLE)_get_osfhandle(_fileno(_handle));
+    DWORD size = GetFileSize(fh, NULL);
+    if(size == INVALID_FILE_SIZE || !size)
+        return false;
+    HANDLE mh = CreateFileMapping(fh, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    if(!mh)
+        return false;
+    void *p = MapViewOfFile(mh, FILE_MAP_COPY, 0, 0, 0);
+    CloseHandle(mh); // the view keeps the mapping alive
+    if(!p)
+        return false;
+#else
+    int fd = fileno(_handle);
+    struct stat st;
+    if(fstat(fd, &st) || st.st_size <= 0 || uint64(st.st_size) > 0xFFFFFFFF)
+        return false;
+    uint32 size = uint32(st.st_size);
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if(p == MAP_FAILED)
+        return false;
+#endif
+
+    _mapPtr = (uint8*)p;
+    _mapSize = size;
+    DEBUG(logdebug("LVPA: mapped '%s', %u bytes", _ownName.c_str(), _mapSize));
+    return true;
+}
+
+void LVPAFile::_UnmapFile(void)
+{
+    if(!_mapPtr)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(_mapPtr);
+#else
+    munmap(_mapPtr, _mapSize);
+#endif
+    _mapPtr = NULL;
+    _mapSize = 0;
+}
+
+bool LVPAFile::_IsMappable(const LVPAFileHeader& h) const
+{
+    return _mapPtr
+        && !(h.flags & (LVPAFLAG_PACKED | LVPAFLAG_ENCRYPTED | LVPAFLAG_SCRAMBLED | LVPAFLAG_SOLID | LVPAFLAG_ALIAS))
+        && h.packedSize == h.realSize
+        && h.offset + h.packedSize <= _mapSize
+        && h.offset + h.packedSize >= h.offset; // overflow
+}
+
+void LVPAFile::_ReleaseMapping(void)
+{
+    if(!_mapPtr)
+        return;
+
+    // copy solid blocks and regular files first...
+    for(uint32 i = 0; i < _headers.size(); ++i)
+    {
+        LVPAFileHeader& h = _headers[i];
+        if(h.mapped && !(h.flags & (LVPAFLAG_SOLID | LVPAFLAG_ALIAS)))
+        {
+            uint8 *p = new uint8[h.data.size + LVPA_EXTRA_BUFSIZE];
+            memcpy(p, h.data.ptr, h.data.size);
+            memset(p + h.data.size, 0, LVPA_EXTRA_BUFSIZE);
+            h.data.ptr = p;
+            h.mapped = false;
+            h.otherMem = false;
+        }
+    }
+    // ... then point the files inside solid blocks to the new memory, and aliases to their (lower numbered, thus already moved) files
+    for(uint32 i = 0; i < _headers.size(); ++i)
+    {
+        LVPAFileHeader& h = _headers[i];
+        if(h.mapped)
+        {
+            if(h.flags & LVPAFLAG_ALIAS)
+                h.data.ptr = _headers[h.aliasId].data.ptr;
+            else
+                h.data.ptr = _headers[h.blockId].data.ptr + h.offset;
+            h.mapped = false;
+        }
+    }
+
+    _UnmapFile();
 }
 
 uint32 LVPAFile::GetId(const char *fn)
@@ -243,17 +509,22 @@ void LVPAFile::_MakeSolid(LVPAFileHeader& h, const char *solidBlockName)
 
     // if at least one file inside the solid block must be encrypted, encrypt the whole solid block
     _headers[h.blockId].flags |= (h.flags & LVPAFLAG_ENCRYPTED);
+    _headers[h.blockId].dirty = true;
 }
 
 uint32 LVPAFile::SetSolidBlock(const char *name, uint8 compression /* = LVPACOMP_INHERIT */, uint8 algo /* = LVPAPACK_INHERIT */)
 {
+    _WaitAllLoaded(); // _headers may be reallocated
     std::string n(name);
     n += '*';
     uint32 id;
     if(_FindHeaderByName(n.c_str(), &id))
     {
-        _headers[id].algo = algo;
-        _headers[id].level = compression;
+        if(_headers[id].algo != algo || _headers[id].level != compression)
+            _LoadToRewrite(id); // unpacked with the old settings
+        LVPAFileHeader& h = _headers[id];
+        h.algo = algo;
+        h.level = compression;
     }
     else // add new solid block
     {
@@ -273,15 +544,21 @@ void LVPAFile::Add(const char *fn, memblock mb, const char *solidBlockName /* =
                    uint8 algo /* = LVPAPACK_INHERIT */, uint8 level /* = LVPACOMP_INHERIT */,
                    uint8 encrypt /* = LVPAENCR_INHERIT */, bool scramble /* = false */)
 {
+    _WaitAllLoaded(); // _headers may be reallocated
     uint32 id;
     if(_FindHeaderByName(fn, &id))
     {
+        _DetachAliases(id); // they keep the old content
+
         // already exists, overwrite old with new info
         LVPAFileHeader& hdrRef = _headers[id];
-        if(hdrRef.data.ptr && hdrRef.data.ptr != mb.ptr)
+        _SetDirty(hdrRef); // it may leave its old solid block
+        if(hdrRef.data.ptr != mb.ptr)
         {
-            delete [] hdrRef.data.ptr;
+            if(hdrRef.data.ptr && !hdrRef.otherMem)
+                delete [] hdrRef.data.ptr;
             hdrRef.otherMem = false;
+            hdrRef.mapped = false;
             // will be overwritten anyways, not necessary here to set to null values
         }
     }
@@ -308,6 +585,7 @@ void LVPAFile::Add(const char *fn, memblock mb, const char *solidBlockName /* =
     h.encryption = encrypt;
     h.algo = algo;
     h.level = level;
+    h.dirty = true;
     _MakeSolid(h, solidBlockName); // this will also fix up flags a bit if necessary
 }
 
@@ -316,7 +594,12 @@ memblock LVPAFile::Remove(const char  *fn)
     uint32 id;
     memblock mb;
     if(_FindHeaderByName(fn, &id))
+    {
+        _WaitLoaded(id);
+        _DetachAliases(id); // the memory belongs to the caller now
         mb = _headers[id].data; // copy ptr
+        _SetDirty(_headers[id]); // written as empty file from now on
+    }
 
     _headers[id].data = memblock(); // overwrite with empty
     _indexes.erase(fn); // remove entry
@@ -329,6 +612,9 @@ bool LVPAFile::Delete(const char *fn)
     uint32 id;
     if(_FindHeaderByName(fn, &id))
     {
+        _WaitLoaded(id);
+        _DetachAliases(id);
+        _SetDirty(_headers[id]); // written as empty file from now on
         memblock mb = _headers[id].data;
         _headers[id].data = memblock(); // overwrite with empty
         _indexes.erase(fn); // remove entry
@@ -347,13 +633,355 @@ memblock LVPAFile::Get(const char *fn, bool checkCRC /* = true */)
     uint32 id;
     memblock mb;
     if(_FindHeaderByName(fn, &id))
-        mb = _PrepareFile(_headers[id], checkCRC);
+        mb = Get(id, checkCRC);
     return mb;
 }
 
 memblock LVPAFile::Get(uint32 index, bool checkCRC /* = true */)
 {
-    return _PrepareFile(_headers[index], checkCRC);
+    _WaitLoaded(index);
+    return _PrepareFile(_headers[index], checkCRC && _NeedCRC(index));
+}
+
+class LVPALoadTask : public ThreadPoolTask
+{
+public:
+    LVPALoadTask(LVPAFile *f, LVPAFileHeader *h, bool crc) : file(f), hdr(h), checkCRC(crc), loaded(false) {}
+    virtual void Run(void)
+    {
+        file->_PrepareFile(*hdr, checkCRC);
+        SDL_mutexP(file->_fileMtx);
+        loaded = true;
+        SDL_mutexV(file->_fileMtx);
+    }
+
+    LVPAFile *file;
+    LVPAFileHeader *hdr;
+    bool checkCRC; // decided when the task is created, _NeedCRC() is not for worker threads
+    bool loaded; // protected by the file's mutex. only for IsReady(), use ThreadPool::Wait() before deleting the task
+};
+
+void LVPAFile::SetThreadPool(ThreadPool *pool)
+{
+    _WaitAllLoaded();
+    _StopVerify();
+    _threadPool = pool;
+}
+
+bool LVPAFile::Prefetch(const char *fn)
+{
+    uint32 id;
+    return _FindHeaderByName(fn, &id) && Prefetch(id);
+}
+
+bool LVPAFile::Prefetch(uint32 id)
+{
+    if(!_threadPool || id >= _headers.size())
+        return false;
+
+    // aliases are ready as soon as the file with their data is
+    if(_headers[id].flags & LVPAFLAG_ALIAS)
+        id = _headers[id].aliasId;
+
+    // files inside a solid block are ready as soon as their block is
+    if(_headers[id].flags & LVPAFLAG_SOLID)
+    {
+        id = _headers[id].blockId;
+        if(id >= _headers.size())
+            return false;
+    }
+
+    LVPAFileHeader& h = _headers[id];
+    if((h.flags & LVPAFLAG_SCRAMBLED) && h.filename.empty())
+        return false; // can't decrypt without knowing the name
+
+    if(_loadTasks.size() < _headers.size())
+        _loadTasks.resize(_headers.size(), NULL);
+    if(_loadTasks[id] || h.data.ptr)
+        return true; // on the way or already there
+
+    LVPALoadTask *t = new LVPALoadTask(this, &h, _NeedCRC(id));
+    _loadTasks[id] = t;
+    _threadPool->Add(t);
+    return true;
+}
+
+bool LVPAFile::IsReady(uint32 id) const
+{
+    if(id >= _headers.size())
+        return false;
+    if(_headers[id].flags & LVPAFLAG_ALIAS)
+        return _headers[id].data.ptr || IsReady(_headers[id].aliasId);
+    if(_headers[id].data.ptr && (_headers[id].flags & LVPAFLAG_SOLID))
+        return true; // unpacked on its own, from a chunked block
+    if(_headers[id].flags & LVPAFLAG_SOLID)
+        id = _headers[id].blockId;
+    if(id >= _headers.size())
+        return false;
+    if(id < _loadTasks.size() && _loadTasks[id] && !_IsLoaded(_loadTasks[id]))
+        return false;
+    return _headers[id].data.ptr != NULL;
+}
+
+void LVPAFile::_WaitLoaded(uint32 id)
+{
+    if(id >= _loadTasks.size())
+        return;
+    LVPALoadTask *t = _loadTasks[id];
+    if(!t)
+        return;
+    _threadPool->Wait(t);
+    delete t;
+    _loadTasks[id] = NULL;
+}
+
+bool LVPAFile::_IsLoaded(const LVPALoadTask *t) const
+{
+    SDL_mutexP(_fileMtx);
+    bool loaded = t->loaded;
+    SDL_mutexV(_fileMtx);
+    return loaded;
+}
+
+void LVPAFile::_WaitAllLoaded(void)
+{
+    for(uint32 i = 0; i < _loadTasks.size(); ++i)
+        _WaitLoaded(i);
+    _loadTasks.clear();
+}
+
+// Checks the data of files and solid blocks as they are stored in the container, without unpacking them.
+// Works on copies of the header fields it needs, the headers themselves belong to the main thread.
+class LVPAVerifyTask : public ThreadPoolTask
+{
+public:
+    enum State
+    {
+        UNCHECKED, // not checked by this task, see LVPAFile::_NeedCRC()
+        PENDING,
+        GOOD,
+        BAD
+    };
+
+    struct Job
+    {
+        uint32 id;
+        uint32 offset;
+        uint32 size;
+        uint32 crc;
+        std::string filename;
+    };
+
+    LVPAVerifyTask(LVPAFile *f, uint32 headers) : file(f), state(headers, UNCHECKED), cancel(false) {}
+
+    virtual void Run(void)
+    {
+        std::vector<uint8> buf(LVPA_VERIFY_BUFSIZE);
+        for(uint32 i = 0; i < jobs.size() && !cancel; ++i)
+        {
+            const Job& j = jobs[i];
+            CRC32 crc;
+            uint32 pos = 0;
+            bool ok = true;
+            while(pos < j.size && !cancel)
+            {
+                uint32 n = std::min<uint32>(j.size - pos, buf.size());
+                if(file->_ReadRaw(&buf[0], j.offset + pos, n) != n)
+                {
+                    ok = false;
+                    break;
+                }
+                crc.Update(&buf[0], n);
+                pos += n;
+            }
+            if(cancel)
+                break;
+            crc.Finalize();
+            ok = ok && crc.Result() == j.crc;
+            if(!ok)
+                logerror("CRC mismatch for stored '%s', file is corrupt", j.filename.c_str());
+
+            SDL_mutexP(file->_fileMtx);
+            state[j.id] = ok ? GOOD : BAD;
+            SDL_mutexV(file->_fileMtx);
+        }
+    }
+
+    LVPAFile *file;
+    std::vector<Job> jobs;
+    std::vector<uint8> state; // indexed like the file's headers, protected by the file's mutex
+    volatile bool cancel;
+};
+
+bool LVPAFile::_NeedCRC(uint32 id) const
+{
+    const LVPAFileHeader& h = _headers[id];
+    switch(_crcPolicy)
+    {
+        case LVPACRC_ALWAYS:
+            return true;
+
+        case LVPACRC_NEVER:
+            return false;
+
+        case LVPACRC_BACKGROUND:
+            if(_verifyTask)
+            {
+                // aliases are good if their file is, files in a solid block are good if the block is
+                uint32 k = (h.flags & LVPAFLAG_ALIAS) ? h.aliasId : id;
+                if(_headers[k].flags & LVPAFLAG_SOLID)
+                    k = _headers[k].blockId;
+                uint8 st = LVPAVerifyTask::UNCHECKED;
+                SDL_mutexP(_fileMtx);
+                if(k < _verifyTask->state.size())
+                    st = _verifyTask->state[k];
+                SDL_mutexV(_fileMtx);
+                if(st == LVPAVerifyTask::BAD)
+                    return true; // the check on load fails as well, and takes care of the error handling
+                if(st == LVPAVerifyTask::GOOD || (st == LVPAVerifyTask::PENDING && !_verifyTask->IsDone()))
+                    return false;
+            }
+            // not covered by the task, or it was cancelled
+            return !h.verified;
+
+        default: // LVPACRC_FIRST_LOAD
+            return !h.verified;
+    }
+}
+
+void LVPAFile::_StartVerify(void)
+{
+    // a pool without threads would run the task only when it is waited for
+    if(_verifyTask || !_threadPool || !_threadPool->GetThreadCount())
+        return;
+
+    LVPAVerifyTask *t = new LVPAVerifyTask(this, _headers.size());
+    for(uint32 i = 0; i < _headers.size(); ++i)
+    {
+        const LVPAFileHeader& h = _headers[i];
+        // files in solid blocks are covered by their block, aliases have no data. encrypted data must be decrypted
+        // to be checked, which is left to loading them.
+        if(!h.good || (h.flags & (LVPAFLAG_SOLID | LVPAFLAG_ALIAS | LVPAFLAG_ENCRYPTED | LVPAFLAG_SCRAMBLED)))
+            continue;
+        LVPAVerifyTask::Job j;
+        j.id = i;
+        j.offset = h.offset;
+        j.size = h.packedSize;
+        j.crc = (h.flags & LVPAFLAG_PACKED) ? h.crcPacked : h.crcReal;
+        j.filename = h.filename;
+        t->jobs.push_back(j);
+        t->state[i] = LVPAVerifyTask::PENDING;
+    }
+    _verifyTask = t;
+    _threadPool->Add(t);
+}
+
+bool LVPAFile::IsVerifying(void) const
+{
+    return _verifyTask && !_verifyTask->IsDone();
+}
+
+void LVPAFile::_StopVerify(bool del /* = false */)
+{
+    if(!_verifyTask)
+        return;
+    if(!_verifyTask->IsDone())
+    {
+        _verifyTask->cancel = true;
+        _threadPool->Wait(_verifyTask);
+    }
+    if(del)
+    {
+        delete _verifyTask;
+        _verifyTask = NULL;
+    }
+}
+
+void LVPAFile::_UnlinkAliases(uint32 id)
+{
+    // aliases always come after their file
+    for(uint32 i = id + 1; i < _headers.size(); ++i)
+    {
+        LVPAFileHeader& h = _headers[i];
+        if((h.flags & LVPAFLAG_ALIAS) && h.aliasId == id && h.otherMem) // not if it has a copy of its own, see _AdoptHeaders()
+        {
+            h.data = memblock(); // loaded again via the file if required
+            h.mapped = false;
+        }
+    }
+}
+
+void LVPAFile::_DetachAliases(uint32 id)
+{
+    for(uint32 i = id + 1; i < _headers.size(); ++i)
+    {
+        if(!(_headers[i].flags & LVPAFLAG_ALIAS) || _headers[i].aliasId != id)
+            continue;
+        LVPAFileHeader& h = _headers[i];
+        h.flags &= ~LVPAFLAG_ALIAS;
+        h.dirty = true;
+        if(h.data.ptr && !h.otherMem)
+            continue; // already has its own copy
+        memblock mem = _PrepareFile(_headers[id], _NeedCRC(id));
+        h.otherMem = false;
+        h.mapped = false;
+        if(mem.ptr)
+        {
+            h.data.ptr = new uint8[mem.size + LVPA_EXTRA_BUFSIZE];
+            h.data.size = mem.size;
+            memcpy(h.data.ptr, mem.ptr, mem.size);
+            memset(h.data.ptr + mem.size, 0, LVPA_EXTRA_BUFSIZE);
+        }
+        else
+        {
+            logerror("Unable to load file '%s' for its alias '%s'", _headers[id].filename.c_str(), h.filename.c_str());
+            h.data = memblock();
+            h.good = false;
+        }
+    }
+}
+
+void LVPAFile::_SetDirty(LVPAFileHeader& h)
+{
+    h.dirty = true;
+    if(h.flags & LVPAFLAG_SOLID)
+        _headers[h.blockId].dirty = true;
+}
+
+bool LVPAFile::_LoadToRewrite(uint32 id)
+{
+    LVPAFileHeader& h = _headers[id];
+    if(h.flags & LVPAFLAG_SOLIDBLOCK)
+    {
+        bool ok = true;
+        for(uint32 i = 0; i < _headers.size(); ++i)
+            if((_headers[i].flags & LVPAFLAG_SOLID) && _headers[i].blockId == id)
+                ok = _LoadToRewrite(i) && ok;
+        if(ok)
+            h.dirty = true; // otherwise, the files that were loaded did that
+        return ok;
+    }
+    if(h.dirty)
+        return true; // in memory already
+    if(!h.good)
+        return false;
+
+    uint8 flags = h.flags;
+    if((h.flags & LVPAFLAG_SOLID) && h.blockId < _headers.size())
+        flags |= _headers[h.blockId].flags;
+    if(((flags & LVPAFLAG_ENCRYPTED) && _masterKey.empty()) || ((h.flags & LVPAFLAG_SCRAMBLED) && h.filename.empty()))
+        return false; // can't be read now
+
+    if(h.realSize)
+    {
+        // everything in the block is needed, unpack it as a whole instead of chunk by chunk
+        if((h.flags & LVPAFLAG_SOLID) && h.blockId < _headers.size())
+            _PrepareFile(_headers[h.blockId], _NeedCRC(h.blockId));
+        if(!_PrepareFile(h, _NeedCRC(id)).ptr)
+            return false;
+    }
+    _SetDirty(h);
+    return true;
 }
 
 bool LVPAFile::Free(const char *fn)
@@ -366,9 +994,11 @@ bool LVPAFile::Free(const char *fn)
 
 bool LVPAFile::Free(uint32 id)
 {
+    _WaitLoaded(id);
     LVPAFileHeader& hdrRef = _headers[id];
     if(hdrRef.data.ptr && !hdrRef.otherMem)
     {
+        _UnlinkAliases(id);
         delete [] hdrRef.data.ptr;
         hdrRef.data.ptr = NULL;
         hdrRef.data.size = 0;
@@ -387,9 +1017,11 @@ bool LVPAFile::Drop(const char *fn)
 
 bool LVPAFile::Drop(uint32 id)
 {
+    _WaitLoaded(id);
     LVPAFileHeader& hdrRef = _headers[id];
     if(hdrRef.data.ptr && !hdrRef.otherMem)
     {
+        _UnlinkAliases(id);
         hdrRef.data.ptr = NULL;
         hdrRef.data.size = 0;
         return true;
@@ -405,6 +1037,7 @@ bool LVPAFile::LoadFrom(const char *fn, LVPALoadFlags loadFlags /* = LVPALOAD_NO
         return false;
 
     Clear();
+    _UnmapFile();
 
     uint32 bytes;
     char magic[4];
@@ -426,7 +1059,7 @@ bool LVPAFile::LoadFrom(const char *fn, LVPALoadFlags loadFlags /* = LVPALOAD_NO
     DEBUG(logdebug("master: version: %u", masterHdr.version));
     DEBUG(logdebug("master: flags: %u", masterHdr.flags));
 
-    if(masterHdr.version != gVersion)
+    if(masterHdr.version > gVersion)
     {
         logerror("Unsupported LVPA file version: %u", masterHdr.version);
         _CloseFile();
@@ -542,7 +1175,15 @@ bool LVPAFile::LoadFrom(const char *fn, LVPALoadFlags loadFlags /* = LVPALOAD_NO
     {
         LVPAFileHeader &h = _headers[i];
         *hdrBuf >> h;
+        if((masterHdr.flags & LVPAHDR_OFFSETS) && !(h.flags & (LVPAFLAG_SOLID | LVPAFLAG_ALIAS)))
+            *hdrBuf >> h.offset;
         h.good = true;
+        h.dirty = false;
+        // so that the file stays encrypted if it is written again
+        if(h.flags & LVPAFLAG_ENCRYPTED)
+            h.encryption = (h.flags & LVPAFLAG_CHACHA) ? LVPAENCR_CHACHA : LVPAENCR_ENABLED;
+        else
+            h.encryption = LVPAENCR_NONE;
 
         DEBUG(logdebug("'%s' bytes: %u; blockId: %u; [%s%s%s%s%s]",
             h.filename.c_str(), h.packedSize, h.blockId,
@@ -570,34 +1211,129 @@ bool LVPAFile::LoadFrom(const char *fn, LVPALoadFlags loadFlags /* = LVPALOAD_NO
             _realSize += h.realSize;
     }
 
+    // whatever is left in the file was replaced by Update()
+    fseek(_handle, 0, SEEK_END);
+    uint32 usedSize = 4 + gMasterHdrSize + masterHdr.packedHdrSize + _packedSize;
+    long fileSize = ftell(_handle);
+    _unusedSize = fileSize > long(usedSize) ? uint32(fileSize) - usedSize : 0;
+    _hdrEncrypted = (masterHdr.flags & LVPAHDR_ENCRYPTED) != 0;
+
     // at this point we have processed all headers
     _CreateIndexes();
-    _CalcOffsets(masterHdr.dataOffs);
+    _CalcOffsets(masterHdr.dataOffs, (masterHdr.flags & LVPAHDR_OFFSETS) != 0);
+    for(uint32 i = 0; i < _headers.size(); ++i)
+    {
+        LVPAFileHeader& h = _headers[i];
+        if((h.flags & LVPAFLAG_CHUNKED) && !_CalcChunkOffsets(h))
+        {
+            logerror("Solid block '%s' has a broken chunk index", h.filename.c_str());
+            h.good = false;
+        }
+        if(h.flags & LVPAFLAG_ALIAS)
+        {
+            // must refer to an earlier regular file with the same content, so that there are no chains or loops
+            const LVPAFileHeader *a = h.aliasId < i ? &_headers[h.aliasId] : NULL;
+            if(!a || (a->flags & (LVPAFLAG_ALIAS | LVPAFLAG_SOLIDBLOCK | LVPAFLAG_SCRAMBLED)) || a->realSize != h.realSize
+                || a->crcReal != h.crcReal || (h.flags & (LVPAFLAG_SOLID | LVPAFLAG_SOLIDBLOCK)))
+            {
+                logerror("File '%s' is a broken alias", h.filename.c_str());
+                h.good = false;
+            }
+        }
+    }
+
+    if(_useMapping && !_MapFile())
+    {
+        DEBUG(logdebug("LVPA: Failed to map '%s', reading normally", fn));
+    }
 
     // iterate over all files if requested
     if(loadFlags & LVPALOAD_SOLID)
     {
+        bool all = (loadFlags & LVPALOAD_ALL) == LVPALOAD_ALL;
+        bool async = (loadFlags & LVPALOAD_ASYNC) && _threadPool;
         for(uint32 i = 0; i < masterHdr.hdrEntries; ++i)
-            if(_headers[i].flags & LVPAFLAG_SOLID || loadFlags & LVPALOAD_ALL)
+            if(_headers[i].flags & LVPAFLAG_SOLID || all)
                 if(!(_headers[i].flags & LVPAFLAG_SCRAMBLED))
-                    _PrepareFile(_headers[i], true);
-
-        if(loadFlags & LVPALOAD_ALL)
+                {
+                    if(async)
+                        Prefetch(i);
+                    else
+                    {
+                        // everything in the block is needed, unpack it as a whole instead of chunk by chunk
+                        if((_headers[i].flags & LVPAFLAG_SOLID) && _headers[i].blockId < _headers.size())
+                            _PrepareFile(_headers[_headers[i].blockId], _NeedCRC(_headers[i].blockId));
+                        _PrepareFile(_headers[i], _NeedCRC(i));
+                    }
+                }
+
+        if(all && !async)
             _CloseFile(); // got everything, file can be closed
     }
     // leave the file open, as we may want to read more later on
 
+    // after the prefetching above, which is more urgent
+    if(_crcPolicy == LVPACRC_BACKGROUND)
+        _StartVerify();
+
     return true;
 }
 
+class LVPAPackTask : public ThreadPoolTask
+{
+public:
+    LVPAPackTask() : file(NULL), hdr(NULL), block(NULL), packed(0) {}
+    virtual void Run(void) { packed = file->_PackFile(*hdr, *block, false); }
+
+    LVPAFile *file;
+    LVPAFileHeader *hdr;
+    ICompressor **block;
+    uint32 packed;
+};
+
+static void waitPackTask(ThreadPool *pool, LVPAPackTask& t, ProgressBar& bar)
+{
+    pool->Wait(&t);
+    if(*t.block)
+    {
+        bar.done = t.hdr->realSize / 1024; // show in kB
+        bar.PartialFix();
+    }
+}
+
 bool LVPAFile::Save(uint8 compression, uint8 algo /* = LVPAPACK_INHERIT */, bool encrypt /* = false */)
 {
     return SaveAs(_ownName.c_str(), compression, algo, encrypt);
 }
 
-// note: this function must NOT modify existing headers in memory!
 bool LVPAFile::SaveAs(const char *fn, uint8 compression /* = LVPA_DEFAULT_LEVEL */, uint8 algo /* = LVPAPACK_INHERIT */,
                       bool encrypt /* = false */)
+{
+    return _Write(fn, compression, algo, encrypt, false);
+}
+
+bool LVPAFile::Update(uint8 compression /* = LVPA_DEFAULT_LEVEL */, uint8 algo /* = LVPAPACK_INHERIT */, bool encrypt /* = false */)
+{
+    return _Write(_ownName.c_str(), compression, algo, encrypt, true);
+}
+
+// save helper: files and solid blocks follow each other in the order of their headers, starting at offs.
+// when appending, kept ones stay where they are. returns the end of the data.
+static uint32 calcStoredOffsets(std::vector<LVPAFileHeader>& hdrs, const std::vector<uint8>& keep, bool append, uint32 offs)
+{
+    for(uint32 i = 0; i < hdrs.size(); ++i)
+    {
+        LVPAFileHeader& h = hdrs[i];
+        if(!h.good || (h.flags & (LVPAFLAG_SOLID | LVPAFLAG_ALIAS)) || (append && keep[i]))
+            continue;
+        h.offset = offs;
+        offs += h.packedSize;
+    }
+    return offs;
+}
+
+// note: this function must NOT modify existing headers in memory, except via _AdoptHeaders() once the own file was written!
+bool LVPAFile::_Write(const char *fn, uint8 compression, uint8 algo, bool encrypt, bool append)
 {
     // check before showing progress bar
     if(!_headers.size())
@@ -606,8 +1342,23 @@ bool LVPAFile::SaveAs(const char *fn, uint8 compression /* = LVPA_DEFAULT_LEVEL
         return false;
     }
 
-    // compressing is possibly going to take some time, better to show a progress bar
-    ProgressBar bar;
+    _WaitAllLoaded();
+    _StopVerify(); // reads the old file
+
+    // files that were loaded from the own file and not changed since are copied from it as they are.
+    // those that can't be, but were not changed, are loaded now.
+    std::vector<uint8> keep;
+    if(!_FindUnchanged(keep))
+        return false;
+    bool anyKept = std::find(keep.begin(), keep.end(), 1) != keep.end();
+    append = append && anyKept; // nothing to append to otherwise
+
+    // the file may be overwritten, nothing must point into its mapping anymore.
+    // (this does not change any data, only where they are stored)
+    _ReleaseMapping();
+
+    // compressing is possibly going to take some time, better to show a progress bar
+    ProgressBar bar;
     gProgress = &bar;
     bar.msg = "Preparing:    ";
 
@@ -637,6 +1388,8 @@ bool LVPAFile::SaveAs(const char *fn, uint8 compression /* = LVPA_DEFAULT_LEVEL
     for(uint32 i = 0; i < headersCopy.size(); ++i)
     {
         LVPAFileHeader& h = headersCopy[i];
+        if(keep[i])
+            continue;
 
         if(!h.good)
         {
@@ -645,6 +1398,10 @@ bool LVPAFile::SaveAs(const char *fn, uint8 compression /* = LVPA_DEFAULT_LEVEL
         }
 
         h.crcPacked = h.crcReal = 0;
+        h.flags &= ~(LVPAFLAG_CHUNKED | LVPAFLAG_CHACHA | LVPAFLAG_ALIAS); // decided again below
+        h.aliasId = 0;
+        h.chunkSize = 0;
+        h.chunks.clear();
 
         // make used algo/compression level consistent
         // level 0 is always no algorithm, and vice versa
@@ -684,9 +1441,16 @@ bool LVPAFile::SaveAs(const char *fn, uint8 compression /* = LVPA_DEFAULT_LEVEL
                 h.flags &= ~LVPAFLAG_ENCRYPTED;
             else
                 h.flags |= LVPAFLAG_ENCRYPTED;
+
+            if(h.encryption == LVPAENCR_CHACHA)
+                h.flags |= LVPAFLAG_CHACHA;
         }
     }
 
+    // files with the same content as an earlier one become aliases, and are left alone by everything below
+    if(_dedup)
+        _FindDuplicates(headersCopy, encrypt, keep);
+
     // one buf for each file - not all have to be used.
     // it WILL be used if a file has LVPAFLAG_PACKED set, which means the data went into a compressor
     // they might not be packed if the data are incompressible, in this case, the original data in memory are used
@@ -696,7 +1460,7 @@ bool LVPAFile::SaveAs(const char *fn, uint8 compression /* = LVPA_DEFAULT_LEVEL
     for(uint32 i = 0; i < headersCopy.size(); ++i)
     {
         LVPAFileHeader& h = headersCopy[i];
-        if(!h.good)
+        if(!h.good || keep[i])
             continue;
 
         // files in a solid block are never marked as packed, because the solid block itself is already packed
@@ -720,10 +1484,12 @@ bool LVPAFile::SaveAs(const char *fn, uint8 compression /* = LVPA_DEFAULT_LEVEL
             // inherit from global settings, or just encrypt right away if set to do so
             // in case a file inside a solid block should be encrypted, the whole solid block needs to be encrypted,
             // so adjust its settings if necessary.
-            if(h.encryption == LVPAENCR_ENABLED || (encrypt && h.encryption == LVPAENCR_INHERIT))
+            if(h.encryption == LVPAENCR_ENABLED || h.encryption == LVPAENCR_CHACHA || (encrypt && h.encryption == LVPAENCR_INHERIT))
             {
                 h.flags &= ~LVPAFLAG_ENCRYPTED; // remove it from this file, because the solid block gets encrypted, not this file
                 sh.flags |= LVPAFLAG_ENCRYPTED;
+                if(h.encryption == LVPAENCR_CHACHA)
+                    sh.flags |= LVPAFLAG_CHACHA; // if one file wants it, the whole block gets it
             }
             else // not encrypting this file, but do not change the solid block's settings, as there may be other encrypted files in it.
             {
@@ -737,9 +1503,20 @@ bool LVPAFile::SaveAs(const char *fn, uint8 compression /* = LVPA_DEFAULT_LEVEL
     // second iteration - allocate the buffers and reserve sizes
     for(uint32 i = 0; i < headersCopy.size(); ++i)
     {
-        const LVPAFileHeader& h = headersCopy[i];
+        LVPAFileHeader& h = headersCopy[i];
+        if(keep[i])
+            continue;
+
+        // large solid blocks are split into chunks. the RC4-like cipher can't start in the middle of the data, so not if encrypted with that.
+        if(h.good && (h.flags & LVPAFLAG_SOLIDBLOCK) && _chunkSize && h.realSize > _chunkSize
+            && h.level != LVPACOMP_NONE && (!(h.flags & LVPAFLAG_ENCRYPTED) || (h.flags & LVPAFLAG_CHACHA)))
+        {
+            h.flags |= LVPAFLAG_CHUNKED;
+            h.chunkSize = _chunkSize;
+        }
+
         // that indicates we need to write the file to a buffer
-        if(h.good && !(h.flags & LVPAFLAG_SOLID) && ((h.flags & LVPAFLAG_SOLIDBLOCK) || h.level != LVPACOMP_NONE))
+        if(h.good && !(h.flags & (LVPAFLAG_SOLID | LVPAFLAG_ALIAS)) && ((h.flags & LVPAFLAG_SOLIDBLOCK) || h.level != LVPACOMP_NONE))
         {
             // each file (or solid block) can have its own compression algo, and level
             fileBufs.v[i] = allocCompressor(h.algo);
@@ -752,77 +1529,100 @@ bool LVPAFile::SaveAs(const char *fn, uint8 compression /* = LVPA_DEFAULT_LEVEL
     for(uint32 i = 0; i < headersCopy.size(); ++i)
     {
         LVPAFileHeader& h = headersCopy[i];
-        if(h.good && (h.flags & LVPAFLAG_SOLID))
+        if(h.good && !keep[i] && (h.flags & LVPAFLAG_SOLID))
         {
             ICompressor *solidblock = fileBufs.v[h.blockId];
             DEBUG(ASSERT(solidblock));
+            h.offset = solidblock->size(); // as _CalcOffsets() will find it
             solidblock->append(h.data.ptr, h.data.size);
             solidblock->append(&solidPadding[0], LVPA_EXTRA_BUFSIZE);
         }
     }
 
-    bar.msg = "Compressing:  ";
-
-    // fourth iteration - append each non-solid file to its buffer, and compress each file / solid block
-    // also append each header to the header compressor buf
-    uint32 writtenHeaders = 0;
+    // fourth iteration - append each non-solid file to its buffer.
+    // also pick the cipher warmups here, always in the same order, so that the output does not depend on the threads used.
     for(uint32 i = 0; i < headersCopy.size(); ++i)
     {
         LVPAFileHeader& h = headersCopy[i];
-        if(!h.good)
+        if(!h.good || keep[i])
             continue;
         ICompressor *block = fileBufs.v[i];
-        if(block)
+        // solid blocks were already filled, and solid files didn't get their own buf allocated
+        if(block && !(h.flags & (LVPAFLAG_SOLID | LVPAFLAG_SOLIDBLOCK)))
         {
-            // solid blocks were already filled, and solid files didn't get their own buf allocated
-            if(!(h.flags & (LVPAFLAG_SOLID | LVPAFLAG_SOLIDBLOCK)))
-            {
-                DEBUG(ASSERT(block->size() == 0));
-                block->append(h.data.ptr, h.data.size);
-            }
-
-            // calc unpacked crc before compressing
-            if(block->size())
-                h.crcReal = CRC32::Calc(block->contents(), block->size());
-
-            if(h.level != LVPACOMP_NONE)
-                block->Compress(h.level, drawCompressProgressBar);
+            DEBUG(ASSERT(block->size() == 0));
+            block->append(h.data.ptr, h.data.size);
+        }
+        if(!h.cipherWarmup && (h.flags & (LVPAFLAG_ENCRYPTED | LVPAFLAG_SCRAMBLED)) && (block ? block->size() : h.data.size))
+            h.cipherWarmup = urand(25, 120) * sizeof(uint32); // for speed, we always use full uint32 blocks
+        // a new one each time, the same key and nonce must never be used for different data
+        if(h.flags & LVPAFLAG_CHACHA)
+            h.cipherNonce = (uint64(urand(0, 0xFFFFFFFF)) << 32) | urand(0, 0xFFFFFFFF);
+    }
 
-            h.packedSize = block->size();
-            if(block->Compressed())
-            {
-                h.flags |= LVPAFLAG_PACKED; // this flag was cleared earlier
-                h.crcPacked = CRC32::Calc(block->contents(), block->size());
-            }
+    bar.msg = "Compressing:  ";
 
-            // encrypt? these blocks will be thrown away, so we can just directly apply encryption
-            if(block->size())
-                _CryptBlock((uint8*)block->contents(), h, true);
+    // fifth iteration - compress each file / solid block.
+    // these do not depend on each other, so if possible, spread them over the thread pool.
+    // only a few are in flight at a time, each compressor may need a lot of memory.
+    std::vector<LVPAPackTask> tasks(headersCopy.size());
+    std::deque<uint32> pending;
+    uint32 maxPending = _threadPool ? _threadPool->GetThreadCount() + 1 : 0;
+    for(uint32 i = 0; i < headersCopy.size(); ++i)
+    {
+        LVPAFileHeader& h = headersCopy[i];
+        if(!h.good || keep[i] || (h.flags & LVPAFLAG_ALIAS))
+            continue;
+        LVPAPackTask& t = tasks[i];
+        t.file = this;
+        t.hdr = &h;
+        t.block = &fileBufs.v[i];
 
+        if(!_threadPool)
+        {
+            t.packed = _PackFile(h, fileBufs.v[i], true);
             bar.PartialFix();
-
-            // for stats
-            _packedSize += block->size();
+            continue;
         }
-        else
+
+        _threadPool->Add(&t);
+        pending.push_back(i);
+        if(pending.size() >= maxPending)
         {
-            // we still need to calc crc
-            h.crcReal = CRC32::Calc(h.data.ptr, h.data.size);
+            waitPackTask(_threadPool, tasks[pending.front()], bar);
+            pending.pop_front();
+        }
+    }
+    for( ; !pending.empty(); pending.pop_front())
+        waitPackTask(_threadPool, tasks[pending.front()], bar);
 
-            // if the file should be encrypted, we have to make a copy anyways.
-            if(h.data.size && (h.flags & (LVPAFLAG_ENCRYPTED | LVPAFLAG_SCRAMBLED)))
-            {
-                fileBufs.v[i] = new ICompressor;
-                fileBufs.v[i]->append(h.data.ptr, h.data.size);
-                _CryptBlock((uint8*)fileBufs.v[i]->contents(), h, true);
-            }
+    // append each header to the header compressor buf
+    uint32 writtenHeaders = 0;
+    bool chunked = false, chacha = false, alias = false;
+    for(uint32 i = 0; i < headersCopy.size(); ++i)
+    {
+        LVPAFileHeader& h = headersCopy[i];
+        if(!h.good)
+            continue;
 
-            // for stats - not encrypted, but it needs to be accounted
-            if(!(h.flags & LVPAFLAG_SOLID))
-                _packedSize += h.data.size;
+        if(h.flags & LVPAFLAG_ALIAS)
+        {
+            if(!keep[i])
+                h.crcReal = headersCopy[h.aliasId].crcReal; // the same data, no need to calculate it again
+            alias = true;
         }
 
-        *zhdr << h;
+        chunked = chunked || (h.flags & LVPAFLAG_CHUNKED);
+        chacha = chacha || ((h.flags & LVPAFLAG_CHACHA) && (h.flags & (LVPAFLAG_ENCRYPTED | LVPAFLAG_SCRAMBLED)));
+        if(keep[i]) // for stats, as in LoadFrom()
+        {
+            if(!(h.flags & LVPAFLAG_SOLID))
+                _packedSize += h.packedSize;
+            if(!(h.flags & LVPAFLAG_SOLIDBLOCK))
+                _realSize += h.realSize;
+        }
+        else
+            _packedSize += tasks[i].packed; // for stats
         ++writtenHeaders;
     }
 
@@ -832,11 +1632,41 @@ bool LVPAFile::SaveAs(const char *fn, uint8 compression /* = LVPA_DEFAULT_LEVEL
         return false;
     }
 
+    // when appending, the new data go to the end of the file, and each header says where its data are.
+    // otherwise, everything follows the headers in order, and the offsets are only known once the headers are packed.
+    uint32 dataStart = 0, dataEnd = 0;
+    bool own = _ownName == fn;
+    if(append)
+    {
+        _CloseFile(); // nothing must be read from a buffer that does not know about the new data
+        FILE *f = fopen(fn, "rb");
+        if(!f)
+        {
+            logerror("Failed to open '%s' for appending!", fn);
+            return false;
+        }
+        fseek(f, 0, SEEK_END);
+        dataStart = ftell(f);
+        fclose(f);
+        dataEnd = calcStoredOffsets(headersCopy, keep, true, dataStart);
+    }
+
+    for(uint32 i = 0; i < headersCopy.size(); ++i)
+    {
+        LVPAFileHeader& h = headersCopy[i];
+        if(!h.good)
+            continue;
+        *zhdr << h;
+        if(append && !(h.flags & (LVPAFLAG_SOLID | LVPAFLAG_ALIAS)))
+            *zhdr << h.offset;
+    }
+
     // prepare master header (unfinished!)
     LVPAMasterHeader masterHdr;
     ByteBuffer masterBuf;
 
-    masterHdr.version = gVersion;
+    // the lowest version that can be read, for compatibility
+    masterHdr.version = append ? 4 : alias ? 3 : chacha ? 2 : chunked ? 1 : 0;
     masterHdr.hdrEntries = writtenHeaders;
     masterHdr.algo = algo;
     masterHdr.realHdrSize = zhdr->size();
@@ -848,6 +1678,12 @@ bool LVPAFile::SaveAs(const char *fn, uint8 compression /* = LVPA_DEFAULT_LEVEL
         masterHdr.hdrCrcReal = CRC32::Calc(zhdr->contents(), zhdr->size());
 
         // now we can compress the headers
+        if(algo == LVPAPACK_AUTO)
+        {
+            ICompressor *buf = zhdr.release();
+            resolveAutoCompression(masterHdr.algo, compression, buf);
+            zhdr.reset(buf);
+        }
         if(compression)
             zhdr->Compress(compression);
 
@@ -858,50 +1694,26 @@ bool LVPAFile::SaveAs(const char *fn, uint8 compression /* = LVPA_DEFAULT_LEVEL
     masterHdr.flags = zhdr->Compressed() ? LVPAHDR_PACKED : LVPAHDR_NONE;
     if(encrypt)
         masterHdr.flags |= LVPAHDR_ENCRYPTED;
+    if(append)
+        masterHdr.flags |= LVPAHDR_OFFSETS;
     // its not bad if its not packed now, then packed and unpacked sizes are just equal
     masterHdr.packedHdrSize = zhdr->size();
 
-    // we don't know these yet
-    masterHdr.hdrOffset = 0;
-    masterHdr.dataOffs = 0;
-
-    masterBuf << masterHdr;
-
-
-    // -- write everything into the container file --
-    gProgress = NULL;
-    bar.Reset();
-    bar.msg = "Writing file: ";
-    bar.total = writtenHeaders;
-    bar.Update();
-
-    // close the file if already open, to allow overwriting
-    _CloseFile();
-
-    FILE *outfile = fopen(fn, "wb");
-    if(!outfile)
+    // now we know all fields of the master header
+    if(append)
     {
-        logerror("Failed to open '%s' for writing!", fn);
-        return false;
+        masterHdr.hdrOffset = dataEnd; // the new headers follow the new data
+        masterHdr.dataOffs = dataStart;
     }
-
-    uint32 written = fwrite(gMagic, 1, 4, outfile);
-    written += fwrite(masterBuf.contents(), 1, masterBuf.size(), outfile); // this will be overwritten later
-    if(written != masterBuf.size() + 4)
+    else
     {
-        logerror("Failed writing master header to LVPA file - disk full?");
-        fclose(outfile);
-        return false;
+        masterHdr.hdrOffset = 4 + gMasterHdrSize; // after "LVPA"
+        masterHdr.dataOffs = masterHdr.hdrOffset + zhdr->size(); // data follows directly after the headers
+        calcStoredOffsets(headersCopy, keep, false, masterHdr.dataOffs);
     }
 
-    // ... space for additional data ...
-
-    // now we know all fields of the master header, write it again
-    masterHdr.hdrOffset = ftell(outfile);
-    masterHdr.dataOffs = masterHdr.hdrOffset + zhdr->size(); // data follows directly after the headers, so we can safely assume this here
-
-    masterBuf.wpos(0); // overwrite
     masterBuf << masterHdr;
+    DEBUG(ASSERT(masterBuf.size() == gMasterHdrSize));
 
     if(encrypt)
     {
@@ -913,30 +1725,64 @@ bool LVPAFile::SaveAs(const char *fn, uint8 compression /* = LVPA_DEFAULT_LEVEL
         hdrCiph.Apply((uint8*)zhdr->contents(), zhdr->size());
     }
 
-    // write headers (we are still at the correct position in the file)
-    written = fwrite(zhdr->contents(), 1, zhdr->size(), outfile);
-    if(written != zhdr->size())
+
+    // -- write everything into the container file --
+    gProgress = NULL;
+    bar.Reset();
+    bar.msg = "Writing file: ";
+    bar.total = writtenHeaders;
+    bar.Update();
+
+    // When appending, the master header is written last. Until then, the file still holds its old state, if anything goes wrong.
+    // When overwriting the own file, and files are copied from it, a temporary file is written first, and replaces it at the end.
+    std::string outName(fn);
+    if(own && !append)
     {
-        logerror("Failed writing headers block to LVPA file - disk full?");
-        fclose(outfile);
+        if(anyKept)
+            outName += ".tmp";
+        else
+            _CloseFile(); // close the file if already open, to allow overwriting
+    }
+
+    FILE *outfile = fopen(outName.c_str(), append ? "r+b" : "wb");
+    if(!outfile)
+    {
+        logerror("Failed to open '%s' for writing!", outName.c_str());
         return false;
     }
 
-    // write fixed master header
-    fseek(outfile, 4, SEEK_SET); // after "LVPA"
-    fwrite(masterBuf.contents(), 1, masterBuf.size(), outfile);
-    fseek(outfile, masterHdr.dataOffs, SEEK_SET); // seek back
+    uint32 written;
+    if(append)
+        fseek(outfile, dataStart, SEEK_SET);
+    else
+    {
+        written = fwrite(gMagic, 1, 4, outfile);
+        written += fwrite(masterBuf.contents(), 1, masterBuf.size(), outfile);
+        written += fwrite(zhdr->contents(), 1, zhdr->size(), outfile);
+        if(written != masterBuf.size() + zhdr->size() + 4)
+        {
+            logerror("Failed writing headers to LVPA file - disk full?");
+            fclose(outfile);
+            return false;
+        }
+    }
 
     // write the files
     for(uint32 i = 0; i < headersCopy.size(); ++i)
     {
         LVPAFileHeader& h = headersCopy[i];
-        if(!h.good || (h.flags & LVPAFLAG_SOLID))
+        if(!h.good || (h.flags & (LVPAFLAG_SOLID | LVPAFLAG_ALIAS)) || (append && keep[i]))
             continue;
         ICompressor *block = fileBufs.v[i];
         uint32 expected;
 
-        if(block && block->size())
+        DEBUG(ASSERT(uint32(ftell(outfile)) == h.offset));
+        if(keep[i])
+        {
+            expected = h.packedSize;
+            written = _CopyRaw(outfile, _headers[i].offset, h.packedSize) ? h.packedSize : 0;
+        }
+        else if(block && block->size())
         {
             written = fwrite(block->contents(), 1, block->size(), outfile);
             expected = block->size();
@@ -958,12 +1804,350 @@ bool LVPAFile::SaveAs(const char *fn, uint8 compression /* = LVPA_DEFAULT_LEVEL
         bar.Update();
     }
 
+    if(append)
+    {
+        // the new headers, then make the master header point to them
+        written = fwrite(zhdr->contents(), 1, zhdr->size(), outfile);
+        if(written != zhdr->size() || fflush(outfile))
+        {
+            logerror("Failed writing headers block to LVPA file - disk full?");
+            fclose(outfile);
+            return false;
+        }
+        fseek(outfile, 4, SEEK_SET); // after "LVPA"
+        if(fwrite(masterBuf.contents(), 1, masterBuf.size(), outfile) != masterBuf.size())
+        {
+            logerror("Failed writing master header to LVPA file!");
+            fclose(outfile);
+            return false;
+        }
+    }
+
     fclose(outfile);
+
+    if(outName != fn)
+    {
+        _CloseFile();
+        remove(fn);
+        if(rename(outName.c_str(), fn))
+        {
+            logerror("Failed to rename '%s' to '%s'", outName.c_str(), fn);
+            return false;
+        }
+    }
+
+    if(own)
+    {
+        _AdoptHeaders(headersCopy, keep);
+        _unusedSize = append ? dataEnd - (4 + gMasterHdrSize) - _packedSize : 0;
+    }
+
     bar.Finalize();
     return true;
 }
 
-memblock LVPAFile::_PrepareFile(LVPAFileHeader& h, bool checkCRC /* = true */)
+// hashes the data of some of the files to be saved, for LVPAFile::_FindDuplicates()
+class LVPAHashRange : public ParallelRange
+{
+public:
+    LVPAHashRange(const std::vector<LVPAFileHeader>& h, const std::vector<uint32>& i, uint8 *d) : hdrs(h), ids(i), digests(d) {}
+    virtual void Run(uint32 begin, uint32 end, uint32 part)
+    {
+        for(uint32 i = begin; i < end; ++i)
+        {
+            const memblock& mb = hdrs[ids[i]].data;
+            LVPAHash::Calc(digests + i * LVPAHash_Size, mb.ptr, mb.size);
+        }
+    }
+
+    const std::vector<LVPAFileHeader>& hdrs;
+    const std::vector<uint32>& ids;
+    uint8 *digests;
+};
+
+void LVPAFile::_FindDuplicates(std::vector<LVPAFileHeader>& hdrs, bool encrypt, const std::vector<uint8>& keep)
+{
+    // scrambled files must not give away that they have the same content as another file.
+    // kept files can only be compared if they are loaded anyway.
+    std::vector<uint32> ids;
+    for(uint32 i = 0; i < hdrs.size(); ++i)
+    {
+        const LVPAFileHeader& h = hdrs[i];
+        if(h.good && h.data.ptr && h.data.size && !(h.flags & (LVPAFLAG_SOLIDBLOCK | LVPAFLAG_SCRAMBLED))
+            && !(keep[i] && (h.flags & LVPAFLAG_ALIAS)))
+            ids.push_back(i);
+    }
+    if(ids.size() < 2)
+        return;
+
+    std::vector<uint8> digests(ids.size() * LVPAHash_Size);
+    LVPAHashRange job(hdrs, ids, &digests[0]);
+    if(_threadPool)
+        _threadPool->ParallelFor(job, ids.size());
+    else
+        job.Run(0, ids.size(), 0);
+
+    // the first file with a given content, by whether it is encrypted.
+    // an alias is stored like its file, so it can refer to an encrypted file, but an encrypted one can't refer to a plain file.
+    std::map<std::string, uint32> known[2];
+    for(uint32 k = 0; k < ids.size(); ++k)
+    {
+        LVPAFileHeader& h = hdrs[ids[k]];
+        bool enc;
+        if(keep[ids[k]]) // as stored
+            enc = (((h.flags & LVPAFLAG_SOLID) ? hdrs[h.blockId].flags : h.flags) & LVPAFLAG_ENCRYPTED) != 0;
+        else if(h.flags & LVPAFLAG_SOLID) // encryption is not yet decided for these, see SaveAs()
+            enc = h.encryption == LVPAENCR_ENABLED || h.encryption == LVPAENCR_CHACHA || (encrypt && h.encryption == LVPAENCR_INHERIT);
+        else
+            enc = (h.flags & LVPAFLAG_ENCRYPTED) != 0;
+
+        std::string digest((const char*)&digests[k * LVPAHash_Size], LVPAHash_Size);
+        uint32 target = uint32(-1);
+        std::map<std::string, uint32>::iterator it = known[enc].find(digest);
+        if(it != known[enc].end())
+            target = it->second;
+        else if(!enc && (it = known[1].find(digest)) != known[1].end())
+            target = it->second;
+        if(target == uint32(-1))
+        {
+            known[enc][digest] = ids[k];
+            continue;
+        }
+        if(keep[ids[k]])
+            continue; // stays as it is stored
+
+        const LVPAFileHeader& a = hdrs[target];
+        if(a.data.size != h.data.size || (a.data.ptr != h.data.ptr && memcmp(a.data.ptr, h.data.ptr, h.data.size)))
+            continue; // better be sure
+
+        DEBUG(logdebug("LVPA: '%s' has the same content as '%s', storing once", h.filename.c_str(), a.filename.c_str()));
+        if(h.flags & LVPAFLAG_SOLID)
+            _realSize += h.data.size; // for stats, solid files are not yet accounted
+        h.flags = (h.flags & ~(LVPAFLAG_SOLID | LVPAFLAG_PACKED | LVPAFLAG_ENCRYPTED | LVPAFLAG_CHACHA)) | LVPAFLAG_ALIAS;
+        h.aliasId = target;
+        h.blockId = 0;
+        h.realSize = h.data.size;
+        h.packedSize = 0;
+        h.algo = LVPAPACK_NONE;
+        h.level = LVPACOMP_NONE;
+    }
+}
+
+bool LVPAFile::_FindUnchanged(std::vector<uint8>& keep)
+{
+    keep.resize(_headers.size());
+    for(uint32 i = 0; i < _headers.size(); ++i)
+        keep[i] = !_headers[i].dirty && _headers[i].good;
+
+    // a solid block is written again if one of its files changed, and then needs all of them.
+    // aliases are written again if their file is, they always come after it.
+    for(uint32 i = 0; i < _headers.size(); ++i)
+        if(!keep[i] && (_headers[i].flags & LVPAFLAG_SOLID))
+            keep[_headers[i].blockId] = 0;
+    for(uint32 i = 0; i < _headers.size(); ++i)
+    {
+        const LVPAFileHeader& h = _headers[i];
+        if(keep[i] && (((h.flags & LVPAFLAG_SOLID) && !keep[h.blockId]) || ((h.flags & LVPAFLAG_ALIAS) && !keep[h.aliasId])))
+            keep[i] = 0;
+    }
+
+    for(uint32 i = 0; i < _headers.size(); ++i)
+    {
+        LVPAFileHeader& h = _headers[i];
+        if(keep[i] || h.dirty || !h.good || h.data.ptr || !h.realSize || (h.flags & LVPAFLAG_SOLIDBLOCK))
+            continue;
+        if(!_PrepareFile(h, _NeedCRC(i)).ptr)
+        {
+            logerror("LVPA: Unable to load '%s' to write it again", h.filename.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+// gives a file its own copy of the memory it shares with another one
+static void copyData(LVPAFileHeader& h)
+{
+    uint8 *p = new uint8[h.data.size + LVPA_EXTRA_BUFSIZE];
+    memcpy(p, h.data.ptr, h.data.size);
+    memset(p + h.data.size, 0, LVPA_EXTRA_BUFSIZE);
+    h.data.ptr = p;
+    h.otherMem = false;
+    h.mapped = false;
+}
+
+void LVPAFile::_AdoptHeaders(const std::vector<LVPAFileHeader>& hdrs, const std::vector<uint8>& keep)
+{
+    // solid blocks that were written again are laid out differently now, nothing may point into their old memory
+    for(uint32 i = 0; i < _headers.size(); ++i)
+    {
+        LVPAFileHeader& b = _headers[i];
+        if(keep[i] || !(b.flags & LVPAFLAG_SOLIDBLOCK) || !b.data.ptr || b.otherMem)
+            continue;
+        for(uint32 j = 0; j < _headers.size(); ++j)
+        {
+            LVPAFileHeader& h = _headers[j];
+            if(j != i && h.otherMem && h.data.ptr >= b.data.ptr && h.data.ptr <= b.data.ptr + b.data.size)
+                copyData(h);
+        }
+        delete [] b.data.ptr;
+        b.data = memblock();
+    }
+
+    for(uint32 i = 0; i < _headers.size(); ++i)
+    {
+        LVPAFileHeader& h = _headers[i];
+        const LVPAFileHeader& c = hdrs[i];
+        if(!c.good)
+            continue; // was not written
+        // an alias that is a regular file now must not depend on its former file anymore
+        if((h.flags & LVPAFLAG_ALIAS) && !(c.flags & LVPAFLAG_ALIAS) && h.otherMem && h.data.ptr)
+            copyData(h);
+        h.flags = c.flags;
+        h.packedSize = c.packedSize;
+        h.realSize = c.realSize;
+        h.crcPacked = c.crcPacked;
+        h.crcReal = c.crcReal;
+        h.blockId = c.blockId;
+        h.aliasId = c.aliasId;
+        h.chunkSize = c.chunkSize;
+        h.chunks = c.chunks;
+        h.cipherWarmup = c.cipherWarmup;
+        h.cipherNonce = c.cipherNonce;
+        h.algo = c.algo;
+        h.level = c.level;
+        h.offset = c.offset;
+        memcpy(h.hash, c.hash, LVPAHash_Size);
+        h.dirty = false;
+    }
+    _cachedBlock = -1;
+}
+
+bool LVPAFile::_CopyRaw(FILE *dst, uint32 offset, uint32 size)
+{
+    std::vector<uint8> buf(std::min<uint32>(size, LVPA_COPY_BUFSIZE));
+    for(uint32 pos = 0; pos < size; )
+    {
+        uint32 n = std::min<uint32>(size - pos, buf.size());
+        if(_ReadRaw(&buf[0], offset + pos, n) != n || fwrite(&buf[0], 1, n, dst) != n)
+            return false;
+        pos += n;
+    }
+    return true;
+}
+
+uint32 LVPAFile::_PackFile(LVPAFileHeader& h, ICompressor *& block, bool progress)
+{
+    if(block)
+    {
+        // calc unpacked crc before compressing
+        if(block->size())
+            h.crcReal = CRC32::Calc(block->contents(), block->size());
+
+        if(h.algo == LVPAPACK_AUTO)
+        {
+            resolveAutoCompression(h.algo, h.level, block);
+            if(h.level == LVPACOMP_NONE) // nothing to compress, so no chunks either
+            {
+                h.flags &= ~LVPAFLAG_CHUNKED;
+                h.chunkSize = 0;
+            }
+        }
+
+        if(h.flags & LVPAFLAG_CHUNKED)
+            _PackChunks(h, block, progress);
+        else if(h.level != LVPACOMP_NONE)
+            block->Compress(h.level, progress ? drawCompressProgressBar : NULL);
+
+        h.packedSize = block->size();
+        if(block->Compressed())
+        {
+            h.flags |= LVPAFLAG_PACKED; // this flag was cleared earlier
+            h.crcPacked = CRC32::Calc(block->contents(), block->size());
+        }
+
+        // encrypt? these blocks will be thrown away, so we can just directly apply encryption
+        if(block->size())
+            _CryptBlock((uint8*)block->contents(), h, true);
+
+        return block->size();
+    }
+
+    // we still need to calc crc
+    h.crcReal = CRC32::Calc(h.data.ptr, h.data.size);
+
+    // if the file should be encrypted, we have to make a copy anyways.
+    if(h.data.size && (h.flags & (LVPAFLAG_ENCRYPTED | LVPAFLAG_SCRAMBLED)))
+    {
+        block = new ICompressor;
+        block->append(h.data.ptr, h.data.size);
+        _CryptBlock((uint8*)block->contents(), h, true);
+    }
+
+    // not encrypted, but it needs to be accounted
+    return (h.flags & LVPAFLAG_SOLID) ? 0 : h.data.size;
+}
+
+void LVPAFile::_PackChunks(LVPAFileHeader& h, ICompressor *block, bool progress)
+{
+    uint32 size = block->size();
+    uint32 count = (size + h.chunkSize - 1) / h.chunkSize;
+    h.chunks.resize(count);
+    ByteBuffer packed;
+    packed.reserve(size);
+    bool any = false;
+    for(uint32 i = 0; i < count; ++i)
+    {
+        uint32 start = i * h.chunkSize;
+        uint32 len = std::min(h.chunkSize, size - start);
+        std::auto_ptr<ICompressor> c(allocCompressor(h.algo));
+        c->append(block->contents() + start, len);
+        c->Compress(h.level, progress ? drawCompressProgressBar : NULL);
+        h.chunks[i].offset = packed.size();
+        if(c->Compressed() && c->size() < len)
+        {
+            packed.append(c->contents(), c->size());
+            any = true;
+        }
+        else
+            packed.append(block->contents() + start, len); // stored as-is
+        h.chunks[i].packedSize = packed.size() - h.chunks[i].offset;
+    }
+
+    if(!any) // nothing compressible, store as a regular uncompressed solid block
+    {
+        h.flags &= ~LVPAFLAG_CHUNKED;
+        h.chunkSize = 0;
+        h.chunks.clear();
+        return;
+    }
+
+    block->clear();
+    block->append(packed.contents(), packed.size());
+    block->Compressed(true);
+    block->RealSize(size);
+}
+
+bool LVPAFile::_CalcChunkOffsets(LVPAFileHeader& h)
+{
+    if(!(h.flags & LVPAFLAG_SOLIDBLOCK) || !h.chunkSize
+        || h.chunks.size() != (uint64(h.realSize) + h.chunkSize - 1) / h.chunkSize)
+        return false;
+
+    uint32 offs = 0;
+    for(uint32 i = 0; i < h.chunks.size(); ++i)
+    {
+        LVPAChunk& c = h.chunks[i];
+        uint32 real = std::min(h.chunkSize, h.realSize - i * h.chunkSize);
+        if(c.packedSize > real || c.packedSize > h.packedSize - offs)
+            return false;
+        c.offset = offs;
+        offs += c.packedSize;
+    }
+    return offs == h.packedSize;
+}
+
+memblock LVPAFile::_PrepareFile(LVPAFileHeader& h, bool checkCRC)
 {
     // h.good is set to false if there was a previous attempt to load the file that failed irrecoverably
     if(!h.good)
@@ -976,42 +2160,99 @@ memblock LVPAFile::_PrepareFile(LVPAFileHeader& h, bool checkCRC /* = true */)
     }
     else
     {
-        if(h.flags & LVPAFLAG_SOLID)
+        if(h.flags & LVPAFLAG_ALIAS)
         {
-            // these can never appear on files inside solid blocks
-            h.flags &= ~(LVPAFLAG_PACKED | LVPAFLAG_ENCRYPTED | LVPAFLAG_SCRAMBLED);
-
-            if(h.blockId >= _headers.size())
+            if(h.aliasId >= _headers.size())
             {
-                logerror("File '%s' is marked as solid (block %u), but there is no solid block with that ID", h.filename.c_str(), h.blockId);
+                logerror("File '%s' is an alias of %u, but there is no such file", h.filename.c_str(), h.aliasId);
                 h.good = false;
                 return memblock();
             }
 
-            memblock solidMem = _PrepareFile(_headers[h.blockId], checkCRC);
-            if(!solidMem.ptr)
+            // share the memory of the file that has the data
+            _WaitLoaded(h.aliasId);
+            LVPAFileHeader& ah = _headers[h.aliasId];
+            memblock mem = _PrepareFile(ah, checkCRC && _NeedCRC(h.aliasId));
+            if(!mem.ptr)
             {
-                logerror("Unable to load solid block for file '%s'", h.filename.c_str());
+                logerror("Unable to load file '%s' for its alias '%s'", ah.filename.c_str(), h.filename.c_str());
                 return memblock();
             }
+            h.data = mem;
+            h.otherMem = true;
+            h.mapped = ah.mapped;
 
-            if(h.offset + h.packedSize <= solidMem.size)
+            // no need to check the same data twice
+            if(ah.verified && ah.crcReal == h.crcReal)
             {
-                h.data.ptr = solidMem.ptr + h.offset;
-                h.data.size = h.realSize;
-                h.otherMem = true;
+                h.verified = true;
+                checkCRC = false;
             }
-            else
+        }
+        else if(h.flags & LVPAFLAG_SOLID)
+        {
+            // these can never appear on files inside solid blocks
+            h.flags &= ~(LVPAFLAG_PACKED | LVPAFLAG_ENCRYPTED | LVPAFLAG_SCRAMBLED);
+
+            if(h.blockId >= _headers.size())
             {
-                logerror("Solid file '%s' exceeds solid block length, can't read", h.filename.c_str());
+                logerror("File '%s' is marked as solid (block %u), but there is no solid block with that ID", h.filename.c_str(), h.blockId);
                 h.good = false;
                 return memblock();
             }
+
+            _WaitLoaded(h.blockId);
+            LVPAFileHeader& sh = _headers[h.blockId];
+            if((sh.flags & (LVPAFLAG_CHUNKED | LVPAFLAG_PACKED)) == (LVPAFLAG_CHUNKED | LVPAFLAG_PACKED) && !sh.data.ptr && sh.good)
+            {
+                // unpack only the part of the block that is needed
+                if(h.offset + h.packedSize > sh.realSize)
+                {
+                    logerror("Solid file '%s' exceeds solid block length, can't read", h.filename.c_str());
+                    h.good = false;
+                    return memblock();
+                }
+                h.otherMem = false;
+                h.mapped = false;
+                h.data = _UnpackSolidFile(h, sh);
+            }
+            else
+            {
+                memblock solidMem = _PrepareFile(sh, checkCRC && _NeedCRC(h.blockId));
+                if(!solidMem.ptr)
+                {
+                    logerror("Unable to load solid block for file '%s'", h.filename.c_str());
+                    return memblock();
+                }
+
+                if(h.offset + h.packedSize <= solidMem.size)
+                {
+                    h.data.ptr = solidMem.ptr + h.offset;
+                    h.data.size = h.realSize;
+                    h.otherMem = true;
+                    h.mapped = sh.mapped;
+                }
+                else
+                {
+                    logerror("Solid file '%s' exceeds solid block length, can't read", h.filename.c_str());
+                    h.good = false;
+                    return memblock();
+                }
+            }
+        }
+        else if(_IsMappable(h))
+        {
+            // stored as-is, no need to copy anything
+            h.data.ptr = _mapPtr + h.offset;
+            h.data.size = h.realSize;
+            h.otherMem = true;
+            h.mapped = true;
         }
         else
         {
             h.otherMem = false;
-            h.data = _UnpackFile(h);
+            h.mapped = false;
+            h.data = _UnpackFile(h, checkCRC);
         }
 
         if(!h.data.ptr) // if its still NULL, it failed to load
@@ -1022,18 +2263,28 @@ memblock LVPAFile::_PrepareFile(LVPAFileHeader& h, bool checkCRC /* = true */)
 
     // optionally check CRC32 of the unpacked data
     // -- for uncompressed files, this is the only chance to find out whether the decryption key was correct
-    if(checkCRC && CRC32::Calc(h.data.ptr, h.data.size) != h.crcReal)
+    if(checkCRC)
     {
-        logerror("CRC mismatch for unpacked '%s', file is corrupt, or decrypt fail", h.filename.c_str());
-        if(!(h.flags & LVPAFLAG_ENCRYPTED))
-            h.good = false; // if its not encrypted, there is nothing that could fix this
-        return memblock();
+        if(CRC32::Calc(h.data.ptr, h.data.size) != h.crcReal)
+        {
+            logerror("CRC mismatch for unpacked '%s', file is corrupt, or decrypt fail", h.filename.c_str());
+            if(!(h.flags & LVPAFLAG_ENCRYPTED))
+                h.good = false; // if its not encrypted, there is nothing that could fix this
+            // not kept, so that it is loaded and checked again, e.g. with another key
+            if(!h.otherMem)
+                delete [] h.data.ptr;
+            h.data = memblock();
+            h.otherMem = false;
+            h.mapped = false;
+            return memblock();
+        }
+        h.verified = true;
     }
 
     return h.data;
 }
 
-memblock LVPAFile::_UnpackFile(LVPAFileHeader& h)
+memblock LVPAFile::_UnpackFile(LVPAFileHeader& h, bool checkCRC)
 {
     DEBUG(ASSERT(h.good && !(h.flags & LVPAFLAG_SOLID))); // if this flag is set this function should not be entered
 
@@ -1069,23 +2320,46 @@ memblock LVPAFile::_UnpackFile(LVPAFileHeader& h)
     if(buf)
     {
         // check CRC32 of the packed data
-        if(CRC32::Calc(target.ptr, target.size) != h.crcPacked)
+        if(checkCRC && CRC32::Calc(target.ptr, target.size) != h.crcPacked)
         {
             logerror("CRC mismatch for packed '%s', file is corrupt, or decrypt fail", h.filename.c_str());
             if(!(h.flags & LVPAFLAG_ENCRYPTED))
                 h.good = false; // if its not encrypted, there is nothing that could fix this
+            delete buf;
             return memblock();
         }
 
-        buf->Compressed(true); // tell the buf that it is compressed so it will allow decompression
-        buf->RealSize(h.realSize);
-        DEBUG(logdebug("'%s': uncompressing %u -> %u", h.filename.c_str(), h.packedSize, h.realSize));
-        buf->Decompress();
-        target.size = buf->size();
-        target.ptr = new uint8[target.size + LVPA_EXTRA_BUFSIZE];
-
-        if(target.size)
-            buf->read(target.ptr, target.size);
+        if(h.flags & LVPAFLAG_CHUNKED)
+        {
+            DEBUG(logdebug("'%s': uncompressing %u chunks, %u -> %u", h.filename.c_str(), uint32(h.chunks.size()), h.packedSize, h.realSize));
+            target.size = h.realSize;
+            target.ptr = new uint8[target.size + LVPA_EXTRA_BUFSIZE];
+            for(uint32 i = 0; i < h.chunks.size(); ++i)
+            {
+                const LVPAChunk& c = h.chunks[i];
+                uint32 start = i * h.chunkSize;
+                if(!unpackChunk(h.algo, buf->contents() + c.offset, c.packedSize, target.ptr + start, std::min(h.chunkSize, h.realSize - start)))
+                {
+                    logerror("Failed to unpack chunk %u of '%s'", i, h.filename.c_str());
+                    delete [] target.ptr;
+                    delete buf;
+                    h.good = false;
+                    return memblock();
+                }
+            }
+        }
+        else
+        {
+            buf->Compressed(true); // tell the buf that it is compressed so it will allow decompression
+            buf->RealSize(h.realSize);
+            DEBUG(logdebug("'%s': uncompressing %u -> %u", h.filename.c_str(), h.packedSize, h.realSize));
+            buf->Decompress();
+            target.size = buf->size();
+            target.ptr = new uint8[target.size + LVPA_EXTRA_BUFSIZE];
+
+            if(target.size)
+                buf->read(target.ptr, target.size);
+        }
 
         memset(target.ptr + target.size, 0, LVPA_EXTRA_BUFSIZE); // zero out extra space
 
@@ -1116,14 +2390,7 @@ bool LVPAFile::_LoadFile(memblock& target, LVPAFileHeader& h)
 {
     DEBUG(ASSERT(h.good && !(h.flags & LVPAFLAG_SOLID))); // if this flag is set this function should not be entered
 
-    if(!_OpenFile())
-        return false;
-
-    // seek if necessary
-    if(ftell(_handle) != h.offset)
-        fseek(_handle, h.offset, SEEK_SET);
-
-    uint32 bytes = fread(target.ptr, 1, target.size, _handle);
+    uint32 bytes = _ReadRaw(target.ptr, h.offset, target.size);
     if(bytes != h.packedSize)
     {
         logerror("Unable to read enough data for file '%s'", h.filename.c_str());
@@ -1133,6 +2400,84 @@ bool LVPAFile::_LoadFile(memblock& target, LVPAFileHeader& h)
     return true;
 }
 
+uint32 LVPAFile::_ReadRaw(uint8 *dst, uint32 offset, uint32 size)
+{
+    if(_mapPtr && offset + size <= _mapSize && offset + size >= offset)
+    {
+        // already in memory, and safe to use from multiple threads
+        memcpy(dst, _mapPtr + offset, size);
+        return size;
+    }
+
+    uint32 bytes = 0;
+    SDL_mutexP(_fileMtx);
+    if(_OpenFile())
+    {
+        // seek if necessary
+        if(ftell(_handle) != offset)
+            fseek(_handle, offset, SEEK_SET);
+
+        bytes = fread(dst, 1, size, _handle);
+    }
+    SDL_mutexV(_fileMtx);
+    return bytes;
+}
+
+memblock LVPAFile::_UnpackSolidFile(LVPAFileHeader& h, LVPAFileHeader& block)
+{
+    memblock mb(new uint8[h.realSize + LVPA_EXTRA_BUFSIZE], h.realSize);
+    memset(mb.ptr + h.realSize, 0, LVPA_EXTRA_BUFSIZE);
+
+    uint32 pos = h.offset;
+    uint32 end = h.offset + h.realSize;
+    while(pos < end)
+    {
+        uint32 idx = pos / block.chunkSize;
+        const uint8 *chunk = _GetChunk(block, idx);
+        if(!chunk)
+        {
+            logerror("Unable to unpack chunk %u of solid block for file '%s'", idx, h.filename.c_str());
+            delete [] mb.ptr;
+            return memblock();
+        }
+        uint32 cstart = idx * block.chunkSize;
+        uint32 cend = std::min(cstart + block.chunkSize, block.realSize);
+        uint32 n = std::min(end, cend) - pos;
+        memcpy(mb.ptr + (pos - h.offset), chunk + (pos - cstart), n);
+        pos += n;
+    }
+    return mb;
+}
+
+const uint8 *LVPAFile::_GetChunk(LVPAFileHeader& block, uint32 idx)
+{
+    if(_cachedBlock == block.id && _cachedChunk == idx)
+        return &_chunkCache[0];
+
+    _cachedBlock = -1;
+    const LVPAChunk& c = block.chunks[idx];
+    uint32 real = std::min(block.chunkSize, block.realSize - idx * block.chunkSize);
+    std::vector<uint8> packed(c.packedSize);
+    if(c.packedSize && _ReadRaw(&packed[0], block.offset + c.offset, c.packedSize) != c.packedSize)
+        return NULL;
+    if(c.packedSize && (block.flags & (LVPAFLAG_ENCRYPTED | LVPAFLAG_SCRAMBLED)))
+    {
+        LVPAFileCipher ciph;
+        if(!_InitCipher(ciph, block, false) || !ciph.IsSeekable())
+            return NULL;
+        ciph.Seek(c.offset);
+        ciph.Apply(&packed[0], c.packedSize);
+    }
+
+    _chunkCache.resize(real);
+    if(!real || !unpackChunk(block.algo, c.packedSize ? &packed[0] : NULL, c.packedSize, &_chunkCache[0], real))
+        return NULL;
+
+    _cachedBlock = block.id;
+    _cachedChunk = idx;
+    return &_chunkCache[0];
+}
+
 const LVPAFileHeader& LVPAFile::GetFileInfo(uint32 i) const
 {
     DEBUG(ASSERT(i < _headers.size()));
@@ -1154,7 +2499,7 @@ void LVPAFile::_CreateIndexes(void)
     }
 }
 
-void LVPAFile::_CalcOffsets(uint32 startOffset)
+void LVPAFile::_CalcOffsets(uint32 startOffset, bool stored)
 {
     std::vector<uint32> solidOffsets(_headers.size());
     std::fill(solidOffsets.begin(), solidOffsets.end(), 0);
@@ -1163,6 +2508,9 @@ void LVPAFile::_CalcOffsets(uint32 startOffset)
     {
         LVPAFileHeader& h = _headers[i];
 
+        if(h.flags & LVPAFLAG_ALIAS) // not stored at all
+            continue;
+
         if(h.flags & LVPAFLAG_SOLID) // solid files use relative addressing inside their solid block
         {
             uint32& o = solidOffsets[h.blockId];
@@ -1170,7 +2518,7 @@ void LVPAFile::_CalcOffsets(uint32 startOffset)
             o += h.realSize + LVPA_EXTRA_BUFSIZE;
             DEBUG(logdebug("Rel offset %u for '%s'", h.offset, h.filename.c_str()));
         }
-        else // non-solid files or solid blocks themselves use absolute file position addressing
+        else if(!stored) // non-solid files or solid blocks themselves use absolute file position addressing
         {
             h.offset = startOffset;
             startOffset += h.packedSize;
@@ -1189,8 +2537,72 @@ bool LVPAFile::AllGood(void) const
     return true;
 }
 
+bool LVPAFile::Repack(uint8 compression /* = LVPACOMP_INHERIT */, uint8 algo /* = LVPAPACK_INHERIT */, uint8 encrypt /* = LVPAENCR_INHERIT */)
+{
+    _WaitAllLoaded();
+    std::vector<uint32> stored;
+    for(uint32 i = 0; i < _headers.size(); ++i)
+        if(!_headers[i].dirty && _headers[i].good)
+            stored.push_back(i);
+
+    bool ok = true;
+    for(uint32 k = 0; k < stored.size(); ++k)
+    {
+        if(_LoadToRewrite(stored[k]))
+            continue;
+        logerror("LVPA: Unable to load file #%u ('%s') to repack it, it stays as stored", stored[k], _headers[stored[k]].filename.c_str());
+        ok = false;
+    }
+
+    for(uint32 k = 0; k < stored.size(); ++k)
+    {
+        LVPAFileHeader& h = _headers[stored[k]];
+        if(!h.dirty)
+            continue;
+        // an alias is stored like its file, in case it becomes a regular file
+        if((h.flags & LVPAFLAG_ALIAS) && h.aliasId < _headers.size())
+        {
+            const LVPAFileHeader& a = _headers[h.aliasId];
+            h.algo = a.algo;
+            h.level = a.level;
+            h.encryption = a.encryption;
+        }
+        if(compression != LVPACOMP_INHERIT)
+            h.level = compression;
+        if(algo != LVPAPACK_INHERIT)
+            h.algo = algo;
+        if(encrypt != LVPAENCR_INHERIT)
+            h.encryption = encrypt;
+    }
+    return ok;
+}
+
 void LVPAFile::SetMasterKey(const uint8 *key, uint32 size)
 {
+    if(size == _masterKey.size() && (!size || !memcmp(&_masterKey[0], key, size)))
+        return; // same key, nothing changes
+
+    // files from the container that are read with the old key are loaded now, and written again with the new one.
+    // those that can't be read with it (e.g. because there was no key) are checked again, if they decrypt fine with the new one.
+    _WaitAllLoaded();
+    uint32 unnamed = 0;
+    for(uint32 i = 0; i < _headers.size(); ++i)
+    {
+        LVPAFileHeader& h = _headers[i];
+        uint8 flags = h.flags;
+        if((h.flags & LVPAFLAG_SOLID) && h.blockId < _headers.size())
+            flags |= _headers[h.blockId].flags;
+        if(!(flags & (LVPAFLAG_ENCRYPTED | LVPAFLAG_SCRAMBLED)) || h.dirty)
+            continue;
+        if(_LoadToRewrite(i))
+            continue;
+        h.verified = false;
+        if((h.flags & LVPAFLAG_SCRAMBLED) && h.filename.empty())
+            ++unnamed;
+    }
+    if(unnamed)
+        logerror("WARNING: LVPAFile: %u scrambled files with unknown names keep the old key", unnamed);
+
     _masterKey.resize(size);
     if(size)
     {
@@ -1208,13 +2620,52 @@ void LVPAFile::_CalcSaltedFilenameHash(uint8 *dst, const std::string& fn)
     sha.Finalize();
 }
 
+// applies a seekable cipher to parts of a buffer in parallel, in units of 64 byte blocks
+class LVPACryptRange : public ParallelRange
+{
+public:
+    LVPACryptRange(const LVPAFileCipher& c, uint8 *b, uint32 s) : ciph(c), buf(b), size(s) {}
+    virtual void Run(uint32 begin, uint32 end, uint32 part)
+    {
+        LVPAFileCipher c(ciph);
+        uint32 start = begin * 64;
+        c.Seek(start);
+        c.Apply(buf + start, std::min(end * 64, size) - start);
+    }
+
+    const LVPAFileCipher& ciph;
+    uint8 *buf;
+    uint32 size;
+};
+
 bool LVPAFile::_CryptBlock(uint8 *buf, LVPAFileHeader& hdr, bool writeMode)
 {
     if(!(hdr.flags & (LVPAFLAG_ENCRYPTED | LVPAFLAG_SCRAMBLED)))
         return true; // not encrypted, not scrambled, nothing to do, all fine
 
+    LVPAFileCipher ciph;
+    if(!_InitCipher(ciph, hdr, writeMode))
+        return false;
+
+    // packedSize because the file is encrypted AFTER compression!
+    if(_threadPool && ciph.IsSeekable() && hdr.packedSize >= LVPA_PARALLEL_CRYPT_SIZE)
+    {
+        LVPACryptRange job(ciph, buf, hdr.packedSize);
+        _threadPool->ParallelFor(job, (hdr.packedSize + 63) / 64, LVPA_PARALLEL_CRYPT_SIZE / 64 / 4);
+    }
+    else
+        ciph.Apply(buf, hdr.packedSize);
+
+    // CRC is checked elsewhere
+
+    return true;
+}
+
+bool LVPAFile::_InitCipher(LVPAFileCipher& ciph, LVPAFileHeader& hdr, bool writeMode)
+{
     uint8 mem[LVPAHash_Size];
-    LVPACipher ciph;
+    const uint8 *key = NULL;
+    uint32 keySize = 0;
 
     if(hdr.flags & LVPAFLAG_SCRAMBLED)
     {
@@ -1245,29 +2696,44 @@ bool LVPAFile::_CryptBlock(uint8 *buf, LVPAFileHeader& hdr, bool writeMode)
             sha.Finalize();
         }
 
-        ciph.Init(&mem[0], LVPAHash_Size);
+        key = &mem[0];
+        keySize = LVPAHash_Size;
     }
     else if(hdr.flags & LVPAFLAG_ENCRYPTED)
     {
         if(_masterKey.size())
-            ciph.Init(&_masterKey[0], _masterKey.size());
+        {
+            key = &_masterKey[0];
+            keySize = _masterKey.size();
+        }
         else
         {
             DEBUG(logerror("_CryptBlock: encrypted, not scrambled, and no master key!"));
             return false;
         }
     }
+    if(!key)
+        return false;
+
+    if(hdr.flags & LVPAFLAG_CHACHA)
+    {
+        // ChaCha20 takes a 32 byte key, the master key may have any size
+        if(key != &mem[0])
+        {
+            LVPAHash::Calc(&mem[0], key, keySize);
+            key = &mem[0];
+            keySize = LVPAHash_Size;
+        }
+        ciph.InitChaCha(key, keySize, hdr.cipherNonce);
+        return true;
+    }
 
     if(!hdr.cipherWarmup)
     {
         hdr.cipherWarmup = urand(25, 120) * sizeof(uint32); // for speed, we always use full uint32 blocks
     }
 
-    ciph.WarmUp(hdr.cipherWarmup);
-    ciph.Apply(buf, hdr.packedSize); // packedSize because the file is encrypted AFTER compression!
-
-    // CRC is checked elsewhere
-
+    ciph.InitRC4Like(key, keySize, hdr.cipherWarmup);
     return true;
 }
 
@@ -10,6 +10,21 @@
 // each buffer allocated for files gets this amount of extra bytes (for pure text files that need to end with \0, for example)
 #define LVPA_EXTRA_BUFSIZE 4
 
+// solid blocks larger than this are compressed as independent chunks of this size, see LVPAFile::SetChunkSize()
+#define LVPA_DEFAULT_CHUNK_SIZE (256 * 1024)
+
+// for LVPAPACK_AUTO, up to 3 pieces of this size are sampled from each file or solid block
+#define LVPA_AUTO_SAMPLE_SIZE (32 * 1024)
+
+// encrypted data at least this large are decrypted in parallel, if the cipher allows it and there is a thread pool
+#define LVPA_PARALLEL_CRYPT_SIZE (1024 * 1024)
+
+// for LVPACRC_BACKGROUND, stored data are read in pieces of this size
+#define LVPA_VERIFY_BUFSIZE (64 * 1024)
+
+// files copied as they are stored when saving, see SaveAs(), are read in pieces of this size
+#define LVPA_COPY_BUFSIZE (256 * 1024)
+
 // multiple ciphers would be a bit overkill right now, so we use only this
 #define LVPACipher HPRC4LikeCipher
 #define LVPAHash SHA256Hash
@@ -17,7 +32,9 @@
 
 // these are part of the header of each file
 #define LVPA_MAGIC "LVPA";
-#define LVPA_VERSION 0;
+#define LVPA_VERSION 4; // highest version supported. 1 added LVPAFLAG_CHUNKED, 2 added LVPAFLAG_CHACHA, 3 added LVPAFLAG_ALIAS,
+                          // 4 added LVPAHDR_OFFSETS.
+                          // files are written with the lowest version that fits
 #define LVPA_HDR_CIPHER_WARMUP 1337
 
 
@@ -26,6 +43,8 @@ enum LVPAMasterFlags
     LVPAHDR_NONE        = 0x00,
     LVPAHDR_PACKED      = 0x01,
     LVPAHDR_ENCRYPTED   = 0x02,
+    LVPAHDR_OFFSETS     = 0x04, // the offset of each file and solid block is stored in its header, instead of all following
+                                // each other after the headers. written by LVPAFile::Update() (version 4+)
 };
 
 enum LVPAFileFlags
@@ -39,13 +58,30 @@ enum LVPAFileFlags
                                 // Note: the actual "salt" is HASH(master key), be sure to have one set should you use this,
                                 // otherwise it is possible to extract the file without knowing its name by simply using its hash !!
                                 // If ENCRYPTED and SCRAMBLED are combined, the key to encrypt the file will be HASH(master key .. HASH(filename))
+    LVPAFLAG_CHUNKED    = 0x20, // solid block is split into chunks that are compressed independently (version 1+, only encrypted with LVPAFLAG_CHACHA)
+    LVPAFLAG_CHACHA     = 0x40, // if ENCRYPTED or SCRAMBLED, ChaCha20 is used instead of the RC4-like cipher (version 2+).
+                                // Any part of the file can be decrypted on its own, so chunked solid blocks can be encrypted, too.
+    LVPAFLAG_ALIAS      = 0x80, // file has no data of its own, but the same content as the file aliasId (version 3+).
+                                // Only the name, size and CRC are stored. Both share the same memory once loaded.
 };
 
 enum LVPALoadFlags
 {
     LVPALOAD_NONE     = 0x00, // load only headers
     LVPALOAD_SOLID    = 0x01, // load all solid blocks and all files within
-    LVPALOAD_ALL      = 0xFF  // load all files
+    LVPALOAD_ALL      = 0xFF, // load all files
+    LVPALOAD_ASYNC    = 0x100 // combined with one of the above: unpack on the thread pool (see SetThreadPool()) instead of right away
+};
+
+// when the CRCs of a file are checked. Get() with checkCRC = false never checks.
+enum LVPACRCPolicy
+{
+    LVPACRC_ALWAYS,     // each time a file is loaded from the container, also after Free() or Drop()
+    LVPACRC_FIRST_LOAD, // until a check passed, then the file is trusted for as long as the container is loaded
+    LVPACRC_NEVER,      // not at all; corrupt data or a wrong key go unnoticed. only for trusted containers
+    LVPACRC_BACKGROUND  // the stored data are checked on the thread pool after LoadFrom(), loading does not wait for that.
+                        // once a file is found to be corrupt, it fails to load. Encrypted files, and all files if there is
+                        // no thread pool, are checked like LVPACRC_FIRST_LOAD.
 };
 
 enum LVPAAlgorithms
@@ -55,13 +91,20 @@ enum LVPAAlgorithms
     LVPAPACK_LZO1X,
     LVPAPACK_DEFLATE,
 
+    // SaveAs() picks one of the above and a level for each file or solid block, after looking at samples of the data.
+    // Already compressed data are stored. Otherwise, the level chosen together with this says what matters more:
+    // 1-2: decoding speed (LZO), 3-5: a balance (Deflate, or LZO for very redundant data), 6-9: size (LZMA).
+    // The level is then used for the chosen algorithm as well. Never stored in a file.
+    LVPAPACK_AUTO = 0xFE,
+
     LVPAPACK_INHERIT = 0xFF // select the one used by parent
 };
 
 enum LVPAEncrpytions
 {
     LVPAENCR_NONE,
-    LVPAENCR_ENABLED, // currently, the code supports only on, off, and inherit
+    LVPAENCR_ENABLED, // the RC4-like cipher, which must always be decrypted from the start of a file
+    LVPAENCR_CHACHA, // ChaCha20 in counter mode, see LVPAFLAG_CHACHA
 
     LVPAENCR_INHERIT = 0xFF // select the one used by parent
 };
@@ -96,12 +139,19 @@ struct LVPAMasterHeader
     // level is not explicitly stored
 };
 
+struct LVPAChunk
+{
+    LVPAChunk() : packedSize(0), offset(0) {}
+    uint32 packedSize; // stored in the file. if this is equal to the unpacked size, the chunk is not compressed.
+    uint32 offset; // calculated during load, relative to the start of the solid block in the file
+};
+
 struct LVPAFileHeader
 {
     LVPAFileHeader()
-        : packedSize(0), realSize(0), crcPacked(0), crcReal(0), blockId(0), cipherWarmup(0),
+        : packedSize(0), realSize(0), crcPacked(0), crcReal(0), blockId(0), aliasId(0), chunkSize(0), cipherWarmup(0), cipherNonce(0),
           flags(LVPAFLAG_NONE), algo(LVPAPACK_NONE), level(LVPACOMP_NONE),
-          id(-1), offset(-1), encryption(LVPAENCR_NONE), good(true), otherMem(false)
+          id(-1), offset(-1), encryption(LVPAENCR_NONE), good(true), verified(false), otherMem(false), mapped(false), dirty(true)
     {}
 
     // these are stored in the file
@@ -111,7 +161,11 @@ struct LVPAFileHeader
     uint32 crcPacked; // checksum for the packed data block
     uint32 crcReal; // checksum for the unpacked data block
     uint32 blockId; // solid block ID, this is the header index of the file that serves as solid block
+    uint32 aliasId; // if LVPAFLAG_ALIAS is set, the header index of the file that has the data. always lower than the own index.
+    uint32 chunkSize; // if LVPAFLAG_CHUNKED is set, the unpacked size of each chunk (except the last one)
+    std::vector<LVPAChunk> chunks; // if LVPAFLAG_CHUNKED is set
     uint16 cipherWarmup; // if LVPAFLAG_ENCRYPTED is set, this many bytes were drawn from the cipher before starting the actual encryption
+    uint64 cipherNonce; // stored instead of cipherWarmup if LVPAFLAG_CHACHA is set
     uint8 flags; // see LVPAFileFlags
     uint8 algo; // algorithm used to compress this file
     uint8 level; // compression level used. default: LVPACOMP_INHERIT
@@ -123,23 +177,49 @@ struct LVPAFileHeader
     memblock data;
     uint8 encryption;
     bool good;
+    bool verified; // a CRC check of the unpacked data passed, see LVPACRCPolicy
 
     // this is always true for solid files that are inside of a solid block (means if LVPAFileHeader.data.ptr points into another file's data.ptr
-    // if so, we can't just delete[] the memory associated with this file.
+    // if so, we can't just delete[] the memory associated with this file. Also for aliases, which share the memory of their file.
+    // also true if the data point into the file mapping.
     bool otherMem;
+
+    // data.ptr points into the file mapping (directly, or via its solid block). implies otherMem.
+    bool mapped;
+
+    // added or changed since the container file was loaded or saved. files that are not are copied as they are stored when saving.
+    bool dirty;
 };
 
 typedef std::map<std::string, uint32> LVPAIndexMap; // maps a file name to its internal file number (which is the index of _headers vector)
 
+class ICompressor;
+class ThreadPool;
+class LVPALoadTask;
+class LVPAVerifyTask;
+class LVPAStream;
+class LVPAFileCipher;
+struct SDL_mutex;
+
 
 class LVPAFile
 {
+    friend class LVPAPackTask;
+    friend class LVPALoadTask;
+    friend class LVPAVerifyTask;
+    friend class LVPAStream;
+
 public:
     LVPAFile();
     ~LVPAFile();
     bool LoadFrom(const char *fn, LVPALoadFlags loadFlags = LVPALOAD_NONE);
     virtual bool Save(uint8 compression = LVPA_DEFAULT_LEVEL, uint8 algo = LVPAPACK_INHERIT, bool encrypt = false);
+    // files from the loaded container that were not changed are copied as they are stored, without applying the settings again, see Repack()
     virtual bool SaveAs(const char *fn, uint8 compression = LVPA_DEFAULT_LEVEL, uint8 algo = LVPAPACK_INHERIT, bool encrypt = false);
+    // Like Save(), but only files that were added or changed are written, after the existing data, followed by new headers.
+    // Space taken by replaced files is not reused, SaveAs() to the own file compacts it, see GetUnusedSize().
+    // Saves the whole file if nothing in it can be kept.
+    virtual bool Update(uint8 compression = LVPA_DEFAULT_LEVEL, uint8 algo = LVPAPACK_INHERIT, bool encrypt = false);
 
     virtual void Add(const char *fn, memblock mb, const char *solidBlockName = NULL, uint8 algo = LVPAPACK_INHERIT,
         uint8 level = LVPACOMP_INHERIT, uint8 encrypt = LVPAENCR_INHERIT, bool scramble = false); // adds a file, overwriting if exists
@@ -170,12 +250,53 @@ public:
     bool AllGood(void) const;
     const LVPAFileHeader& GetFileInfo(uint32 i) const;
 
+    // files from the loaded container are written again by the next save, instead of being copied as they are stored.
+    // settings other than LVPA*_INHERIT replace the ones they were stored with. returns false if a file could not be loaded.
+    bool Repack(uint8 compression = LVPACOMP_INHERIT, uint8 algo = LVPAPACK_INHERIT, uint8 encrypt = LVPAENCR_INHERIT);
+
     // encryption related
+    // encrypted and scrambled files from the loaded container are loaded with the old key, to be written again with the new one.
+    // scrambled files whose name was not looked up yet keep the old key.
     void SetMasterKey(const uint8 *key, uint32 size);
 
+    // If enabled, the container file is memory-mapped when loaded, and files that are stored uncompressed and unencrypted
+    // are not copied, but accessed directly in the mapping (copy-on-write, so writing to the memory is safe).
+    // Memory of these files can not be freed or dropped, see Free() and Drop().
+    // Must be set before LoadFrom() to have an effect.
+    inline void SetUseMapping(bool b) { _useMapping = b; }
+    inline bool IsMapped(void) const { return _mapPtr != NULL; }
+
+    // Default is LVPACRC_FIRST_LOAD. Must be set before LoadFrom() for LVPACRC_BACKGROUND to have an effect.
+    inline void SetCRCPolicy(LVPACRCPolicy p) { _crcPolicy = p; }
+    inline LVPACRCPolicy GetCRCPolicy(void) const { return _crcPolicy; }
+    bool IsVerifying(void) const; // true while the files are checked in the background
+
+    // If set, SaveAs() compresses files and solid blocks in parallel. The output is the same as without.
+    // Each thread in use needs as much memory as compressing a single file, keep that in mind for LZMA.
+    // Also required for LVPALOAD_ASYNC and Prefetch(). Files still being unpacked are waited for before the pool is changed,
+    // so call SetThreadPool(NULL) before deleting the pool.
+    void SetThreadPool(ThreadPool *pool);
+
+    // Starts unpacking a file (or the solid block it is in) on the thread pool.
+    // Get() will wait for it if it is not done yet. Returns false if there is no thread pool, or the file can't be prefetched.
+    bool Prefetch(const char *fn);
+    bool Prefetch(uint32 id);
+    bool IsReady(uint32 id) const; // true if Get() would neither have to wait nor read from disk
+
+    // For SaveAs(): solid blocks larger than this are compressed in chunks, so that a single file can be unpacked
+    // without unpacking the whole block. 0 disables this. Encrypted solid blocks are never chunked.
+    inline void SetChunkSize(uint32 size) { _chunkSize = size; }
+
+    // For SaveAs(): files with identical content (compared by hash) are stored only once, see LVPAFLAG_ALIAS.
+    // Files are only merged if they are encrypted alike. Scrambled files are never merged. Default is on.
+    inline void SetDeduplicate(bool b) { _dedup = b; }
+
+    inline bool HasEncryptedHeaders(void) const { return _hdrEncrypted; } // of the loaded file
+
     // for stats. note: only call these directly after load/save, and NOT after files were added/removed!
     inline uint32 GetRealSize(void) const { return _realSize; }
     uint32 GetPackedSize(void) const { return _packedSize; }
+    inline uint32 GetUnusedSize(void) const { return _unusedSize; } // bytes in the file that belong to no file anymore, after Update()
 
 
 private:
@@ -183,8 +304,27 @@ private:
     LVPAIndexMap _indexes;
     std::vector<LVPAFileHeader> _headers;
     FILE *_handle;
-    uint32 _realSize, _packedSize; // for stats
-
+    uint32 _realSize, _packedSize, _unusedSize; // for stats
+    bool _hdrEncrypted;
+
+    // file mapping, if used
+    bool _useMapping;
+    uint8 *_mapPtr;
+    uint32 _mapSize;
+
+    ThreadPool *_threadPool; // not owned
+    std::vector<LVPALoadTask*> _loadTasks; // indexed like _headers, non-NULL while a file is being prefetched
+    SDL_mutex *_fileMtx; // for reading via _handle from multiple threads, and to check if prefetching is done
+
+    LVPACRCPolicy _crcPolicy;
+    LVPAVerifyTask *_verifyTask; // for LVPACRC_BACKGROUND, kept until Clear() for its results
+
+    uint32 _chunkSize;
+    bool _dedup;
+    // the last unpacked chunk, files in a chunked solid block are likely read in order
+    uint32 _cachedBlock;
+    uint32 _cachedChunk;
+    std::vector<uint8> _chunkCache;
     std::vector<uint8> _masterKey; // used as global encryption key for each file
     uint8 _masterSalt[LVPAHash_Size]; // derived from master key, used for filename salting
     
@@ -192,18 +332,49 @@ private:
     // [HDD] -> _LoadFile() -> _DecryptFile() -> _UnpackFile() -> _PrepareFile() -> Get() -> [memblock]
     bool _LoadFile(memblock& target, LVPAFileHeader& h); // load from disk
     bool _DecryptFile(memblock &target, LVPAFileHeader& h); // _LoadFile() and decrypt
-    memblock _UnpackFile(LVPAFileHeader& h); // _DecryptFile(), and unpack
-    memblock _PrepareFile(LVPAFileHeader& h, bool checkCRC = true); // _UnpackFile(), and check CRC
-
+    memblock _UnpackFile(LVPAFileHeader& h, bool checkCRC); // _DecryptFile(), and unpack
+    memblock _PrepareFile(LVPAFileHeader& h, bool checkCRC); // _UnpackFile(), and check CRC
+    // for files in chunked solid blocks that are not loaded: unpacks only the required chunks, instead of _PrepareFile() on the block
+    memblock _UnpackSolidFile(LVPAFileHeader& h, LVPAFileHeader& block);
+    const uint8 *_GetChunk(LVPAFileHeader& block, uint32 idx);
+    uint32 _ReadRaw(uint8 *dst, uint32 offset, uint32 size); // returns bytes read
+
+    void _WaitLoaded(uint32 id); // if the file is being prefetched, wait until it is done
+    void _WaitAllLoaded(void);
+    bool _IsLoaded(const LVPALoadTask *t) const;
+    bool _NeedCRC(uint32 id) const; // if the CRCs of a file must be checked when loading it, according to the policy
+    void _StartVerify(void); // for LVPACRC_BACKGROUND
+    void _StopVerify(bool del = false); // cancels verifying and waits for the task. files not yet verified are checked when loaded.
+    void _UnlinkAliases(uint32 id); // before the memory of a file goes away, so that its aliases do not point to it anymore
+    void _DetachAliases(uint32 id); // before a file is changed: its aliases get their own copy of the data and become regular files
+    void _SetDirty(LVPAFileHeader& h); // and its solid block
+    // loads a file (all files of a solid block) while the stored settings and the current key still apply, and marks it dirty
+    bool _LoadToRewrite(uint32 id);
+    // save helper, turns files into aliases. kept files may be referred to, but are not changed.
+    void _FindDuplicates(std::vector<LVPAFileHeader>& hdrs, bool encrypt, const std::vector<uint8>& keep);
+    bool _FindUnchanged(std::vector<uint8>& keep); // save helper, which files can be copied as stored. loads those that can't.
+    bool _Write(const char *fn, uint8 compression, uint8 algo, bool encrypt, bool append); // SaveAs() and Update()
+    // after the own file was written, the headers in memory describe what is in it
+    void _AdoptHeaders(const std::vector<LVPAFileHeader>& hdrs, const std::vector<uint8>& keep);
+    bool _CopyRaw(FILE *dst, uint32 offset, uint32 size); // copies stored data to another file
     bool _OpenFile(void);
     void _CloseFile(void);
+    bool _MapFile(void);
+    void _UnmapFile(void);
+    void _ReleaseMapping(void); // copies all mapped files into regular memory
+    bool _IsMappable(const LVPAFileHeader& h) const;
     void _CreateIndexes(void); // load helper
-    void _CalcOffsets(uint32 startOffset); // load helper
+    void _CalcOffsets(uint32 startOffset, bool stored); // load helper. if stored, files and solid blocks already have their offsets
     void _MakeSolid(LVPAFileHeader& h, const char *solidBlockName); // put file into solid block
     void _CalcSaltedFilenameHash(uint8 *dst, const std::string& fn);
     // encrypt or decrypt block of data; it is assumed that hdr.filename already holds the correct file name in case the file is scrambled
     // writeMode should be true when the block is supposed to be encrypted/scrambled, false otherwise
     bool _CryptBlock(uint8 *buf, LVPAFileHeader& hdr, bool writeMode); 
+    bool _InitCipher(LVPAFileCipher& ciph, LVPAFileHeader& hdr, bool writeMode); // _CryptBlock() helper, sets up the key and warms up
+    // save helper: CRC, compress and encrypt one file or solid block. returns the amount of bytes it will take up in the container.
+    uint32 _PackFile(LVPAFileHeader& h, ICompressor *& block, bool progress);
+    void _PackChunks(LVPAFileHeader& h, ICompressor *block, bool progress); // _PackFile() helper for LVPAFLAG_CHUNKED
+    bool _CalcChunkOffsets(LVPAFileHeader& h); // load helper, also checks the chunk index
     // these return true and set *id to the internal file number (= _headers[] array position) if found
     bool _FindHeaderByName(const char *fn, uint32 *id);
     bool _FindHeaderByHash(uint8 *hash, uint32 *id);
@@ -212,7 +383,10 @@ private:
 
 class LVPAFileReadOnly : public LVPAFile
 {
+public:
+    LVPAFileReadOnly() { SetUseMapping(true); }
     virtual bool SaveAs(const char *fn, uint8 compression = LVPA_DEFAULT_LEVEL, uint8 algo = LVPAPACK_INHERIT, bool encrypt = false) { return false; }
+    virtual bool Update(uint8 compression = LVPA_DEFAULT_LEVEL, uint8 algo = LVPAPACK_INHERIT, bool encrypt = false) { return false; }
 };
 
 
@@ -0,0 +1,450 @@
+#include "lzma/LzmaDec.h"
+#include "lzo/lzo1x.h"
+#include "common.h"
+#include "zlib.h"
+#include "LVPAStream.h"
+
+
+static void *myLzmaAlloc(void *, size_t size)
+{
+    return malloc(size);
+}
+
+static void myLzmaFree(void *, void *ptr)
+{
+    if(ptr)
+        free(ptr);
+}
+
+static ISzAlloc s_lzmaAlloc = { myLzmaAlloc, myLzmaFree };
+
+
+// unpacks one segment incrementally
+class LVPAStreamDecoder
+{
+public:
+    virtual ~LVPAStreamDecoder() {}
+    // *srcLen and *dstLen hold the available sizes, and are set to the amounts used.
+    // last is true if src holds all remaining packed data. returns false on error.
+    virtual bool Decode(const uint8 *src, uint32 *srcLen, uint8 *dst, uint32 *dstLen, bool last) = 0;
+};
+
+class StoredStreamDecoder : public LVPAStreamDecoder
+{
+public:
+    virtual bool Decode(const uint8 *src, uint32 *srcLen, uint8 *dst, uint32 *dstLen, bool last)
+    {
+        uint32 n = std::min(*srcLen, *dstLen);
+        memcpy(dst, src, n);
+        *srcLen = *dstLen = n;
+        return true;
+    }
+};
+
+class LZMAStreamDecoder : public LVPAStreamDecoder
+{
+public:
+    LZMAStreamDecoder(uint32 realSize) : _realSize(realSize), _propsLen(0), _ready(false)
+    {
+        LzmaDec_Construct(&_dec);
+    }
+    virtual ~LZMAStreamDecoder()
+    {
+        LzmaDec_Free(&_dec, &s_lzmaAlloc);
+    }
+    virtual bool Decode(const uint8 *src, uint32 *srcLen, uint8 *dst, uint32 *dstLen, bool last)
+    {
+        // LZMACompressor stores the encoded props in front of the data
+        uint32 used = 0;
+        if(!_ready)
+        {
+            used = std::min(*srcLen, uint32(LZMA_PROPS_SIZE) - _propsLen);
+            memcpy(&_props[_propsLen], src, used);
+            _propsLen += used;
+            if(_propsLen < LZMA_PROPS_SIZE)
+            {
+                *srcLen = used;
+                *dstLen = 0;
+                return true;
+            }
+
+            // the dictionary never needs to be larger than the data, this saves a lot of memory for small files
+            uint32 dictSize = _props[1] | (_props[2] << 8) | (_props[3] << 16) | (uint32(_props[4]) << 24);
+            if(dictSize > _realSize)
+            {
+                dictSize = _realSize;
+                for(uint32 i = 0; i < 4; ++i)
+                    _props[i + 1] = uint8(dictSize >> (i * 8));
+            }
+            if(LzmaDec_Allocate(&_dec, &_props[0], LZMA_PROPS_SIZE, &s_lzmaAlloc) != SZ_OK)
+                return false;
+            LzmaDec_Init(&_dec);
+            _ready = true;
+        }
+
+        SizeT inLen = *srcLen - used;
+        SizeT outLen = *dstLen;
+        ELzmaStatus status;
+        SRes res = LzmaDec_DecodeToBuf(&_dec, dst, &outLen, src + used, &inLen, LZMA_FINISH_ANY, &status);
+        *srcLen = used + uint32(inLen);
+        *dstLen = uint32(outLen);
+        return res == SZ_OK;
+    }
+
+private:
+    CLzmaDec _dec;
+    uint32 _realSize;
+    uint32 _propsLen;
+    uint8 _props[LZMA_PROPS_SIZE];
+    bool _ready;
+};
+
+class DeflateStreamDecoder : public LVPAStreamDecoder
+{
+public:
+    DeflateStreamDecoder() : _ok(false)
+    {
+        memset(&_z, 0, sizeof(_z));
+        _ok = inflateInit2(&_z, -MAX_WBITS) == Z_OK; // raw deflate stream, like DeflateCompressor
+    }
+    virtual ~DeflateStreamDecoder()
+    {
+        if(_ok)
+            inflateEnd(&_z);
+    }
+    virtual bool Decode(const uint8 *src, uint32 *srcLen, uint8 *dst, uint32 *dstLen, bool last)
+    {
+        if(!_ok)
+            return false;
+        _z.next_in = (Bytef*)src;
+        _z.avail_in = *srcLen;
+        _z.next_out = (Bytef*)dst;
+        _z.avail_out = *dstLen;
+        int err = inflate(&_z, Z_NO_FLUSH);
+        *srcLen -= _z.avail_in;
+        *dstLen -= _z.avail_out;
+        return err == Z_OK || err == Z_STREAM_END || err == Z_BUF_ERROR; // Z_BUF_ERROR just means no progress
+    }
+
+private:
+    z_stream _z;
+    bool _ok;
+};
+
+// LZO has no streaming interface, the segment is collected and unpacked as a whole.
+// With chunked solid blocks, that's one chunk at a time.
+class LZOStreamDecoder : public LVPAStreamDecoder
+{
+public:
+    LZOStreamDecoder(uint32 realSize) : _realSize(realSize), _outPos(0), _done(false) {}
+    virtual bool Decode(const uint8 *src, uint32 *srcLen, uint8 *dst, uint32 *dstLen, bool last)
+    {
+        if(!_done)
+        {
+            _in.insert(_in.end(), src, src + *srcLen);
+            if(!last)
+            {
+                *dstLen = 0;
+                return true;
+            }
+            _out.resize(_realSize);
+            lzo_uint outLen = _realSize;
+            int r = lzo1x_decompress_safe(_in.empty() ? NULL : &_in[0], _in.size(), _out.empty() ? NULL : &_out[0], &outLen, NULL);
+            if(r != LZO_E_OK || outLen != _realSize)
+                return false;
+            std::vector<uint8>().swap(_in);
+            _done = true;
+        }
+        else
+            *srcLen = 0;
+
+        uint32 n = std::min(*dstLen, _realSize - _outPos);
+        memcpy(dst, &_out[0] + _outPos, n);
+        _outPos += n;
+        *dstLen = n;
+        return true;
+    }
+
+private:
+    std::vector<uint8> _in;
+    std::vector<uint8> _out;
+    uint32 _realSize;
+    uint32 _outPos;
+    bool _done;
+};
+
+
+LVPAStream::LVPAStream()
+: _lvpa(NULL), _chunkSize(0), _algo(LVPAPACK_NONE), _encrypted(false), _good(false),
+  _dataOffset(0), _base(0), _size(0), _pos(0), _dec(NULL), _seg(0), _segIn(0), _streamPos(0), _inPos(0), _inLen(0),
+  _crcPos(0), _crcReal(0)
+{
+}
+
+LVPAStream::~LVPAStream()
+{
+    Close();
+}
+
+bool LVPAStream::Open(LVPAFile *lvpa, uint32 id)
+{
+    Close();
+    if(id >= lvpa->HeaderCount())
+        return false;
+
+    if(lvpa->_headers[id].flags & LVPAFLAG_ALIAS)
+    {
+        if(!lvpa->_headers[id].good)
+            return false;
+        id = lvpa->_headers[id].aliasId; // has the same content
+        if(id >= lvpa->HeaderCount())
+            return false;
+    }
+
+    LVPAFileHeader& h = lvpa->_headers[id];
+    if(!h.good || (h.flags & (LVPAFLAG_SOLIDBLOCK | LVPAFLAG_ALIAS)))
+        return false;
+
+    LVPAFileHeader *b = &h;
+    _base = 0;
+    if(h.flags & LVPAFLAG_SOLID)
+    {
+        if(h.blockId >= lvpa->HeaderCount())
+            return false;
+        b = &lvpa->_headers[h.blockId];
+        _base = h.offset;
+    }
+    if(!b->good || b->offset == uint32(-1) || _base + h.realSize > b->realSize || _base + h.realSize < _base)
+        return false; // not (yet) in the container file, or broken
+
+    _encrypted = (b->flags & (LVPAFLAG_ENCRYPTED | LVPAFLAG_SCRAMBLED)) != 0;
+    if(_encrypted)
+    {
+        _cipherStart = LVPAFileCipher();
+        if(!lvpa->_InitCipher(_cipherStart, *b, false))
+            return false;
+    }
+
+    bool packed = (b->flags & LVPAFLAG_PACKED) != 0;
+    if(packed)
+    {
+        switch(b->algo)
+        {
+            case LVPAPACK_NONE:
+            case LVPAPACK_LZMA:
+            case LVPAPACK_DEFLATE:
+            case LVPAPACK_LZO1X:
+                break;
+            default:
+                return false;
+        }
+    }
+    _algo = b->algo;
+
+    if(b->flags & LVPAFLAG_CHUNKED)
+    {
+        _chunkSize = b->chunkSize;
+        _segs.resize(b->chunks.size());
+        for(uint32 i = 0; i < _segs.size(); ++i)
+        {
+            Segment& s = _segs[i];
+            s.offset = b->offset + b->chunks[i].offset;
+            s.packedSize = b->chunks[i].packedSize;
+            s.start = i * _chunkSize;
+            s.realSize = std::min(_chunkSize, b->realSize - s.start);
+            s.raw = s.packedSize == s.realSize;
+        }
+    }
+    else
+    {
+        _chunkSize = 0;
+        _segs.resize(1);
+        Segment& s = _segs[0];
+        s.offset = b->offset;
+        s.packedSize = b->packedSize;
+        s.realSize = b->realSize;
+        s.start = 0;
+        s.raw = !packed;
+    }
+
+    _lvpa = lvpa;
+    _dataOffset = b->offset;
+    _size = h.realSize;
+    _pos = 0;
+    _crcPos = 0;
+    _crcReal = h.crcReal;
+    _crc = CRC32();
+    _in.resize(LVPA_STREAM_BUFSIZE);
+    _good = true; // the decoder is set up on the first read
+    return true;
+}
+
+void LVPAStream::Close(void)
+{
+    delete _dec;
+    _dec = NULL;
+    _lvpa = NULL;
+    _good = false;
+    _segs.clear();
+    std::vector<uint8>().swap(_in);
+}
+
+bool LVPAStream::Seek(uint32 pos)
+{
+    if(!_lvpa || pos > _size)
+        return false;
+    _pos = pos; // the decoder catches up on the next read
+    return true;
+}
+
+uint32 LVPAStream::Read(uint8 *dst, uint32 bytes)
+{
+    if(!_good || _pos >= _size)
+        return 0;
+    bytes = std::min(bytes, _size - _pos);
+    if(!_SkipTo(_base + _pos))
+        return 0;
+
+    uint32 done = 0;
+    while(done < bytes)
+    {
+        uint32 n = _Decode(dst + done, bytes - done);
+        if(!n)
+            break;
+        done += n;
+    }
+
+    if(_crcPos == _pos)
+    {
+        _crc.Update(dst, done);
+        _crcPos += done;
+        if(_crcPos == _size)
+        {
+            _crc.Finalize();
+            if(_crc.Result() != _crcReal)
+            {
+                logerror("LVPAStream: CRC mismatch, file is corrupt, or decrypt fail");
+                _good = false;
+            }
+        }
+    }
+    _pos += done;
+    return done;
+}
+
+bool LVPAStream::_StartSegment(uint32 idx)
+{
+    delete _dec;
+    _dec = NULL;
+    if(idx >= _segs.size())
+        return false;
+
+    const Segment& s = _segs[idx];
+    _seg = idx;
+    _segIn = 0;
+    _streamPos = s.start;
+    _inPos = _inLen = 0;
+    if(_encrypted)
+    {
+        _cipher = _cipherStart;
+        _cipher.Seek(s.offset - _dataOffset); // not 0 only for chunked blocks, which are always seekable
+    }
+
+    if(s.raw)
+        _dec = new StoredStreamDecoder;
+    else switch(_algo)
+    {
+        case LVPAPACK_LZMA:    _dec = new LZMAStreamDecoder(s.realSize); break;
+        case LVPAPACK_DEFLATE: _dec = new DeflateStreamDecoder; break;
+        case LVPAPACK_LZO1X:   _dec = new LZOStreamDecoder(s.realSize); break;
+        default:               _dec = new StoredStreamDecoder;
+    }
+    return true;
+}
+
+bool LVPAStream::_SkipTo(uint32 pos)
+{
+    uint32 idx = _chunkSize ? std::min(pos / _chunkSize, uint32(_segs.size() - 1)) : 0;
+    if(idx != _seg || !_dec || (pos < _streamPos && !_CanJump()))
+        if(!_StartSegment(idx))
+            return false;
+
+    if(pos != _streamPos && _CanJump())
+    {
+        const Segment& s = _segs[_seg];
+        _segIn = pos - s.start;
+        _streamPos = pos;
+        _inPos = _inLen = 0;
+        if(_encrypted)
+            _cipher.Seek(s.offset + _segIn - _dataOffset);
+        return true;
+    }
+
+    uint8 tmp[4096];
+    while(_streamPos < pos)
+        if(!_Decode(&tmp[0], std::min(uint32(sizeof(tmp)), pos - _streamPos)))
+            return false;
+    return true;
+}
+
+bool LVPAStream::_CanJump(void) const
+{
+    return _segs[_seg].raw && (!_encrypted || _cipher.IsSeekable());
+}
+
+bool LVPAStream::_Fill(void)
+{
+    const Segment& s = _segs[_seg];
+    uint32 n = std::min(uint32(_in.size()), s.packedSize - _segIn);
+    if(_lvpa->_ReadRaw(&_in[0], s.offset + _segIn, n) != n)
+        return false;
+    if(_encrypted)
+        _cipher.Apply(&_in[0], n);
+    _segIn += n;
+    _inPos = 0;
+    _inLen = n;
+    return true;
+}
+
+uint32 LVPAStream::_Decode(uint8 *dst, uint32 size)
+{
+    while(_good)
+    {
+        const Segment& s = _segs[_seg];
+        uint32 segEnd = s.start + s.realSize;
+        if(_streamPos >= segEnd)
+        {
+            if(!_StartSegment(_seg + 1))
+                break;
+            continue;
+        }
+
+        // the decoders consume all input as long as there is room for output, so the window is only refilled when empty
+        if(_inPos == _inLen && _segIn < s.packedSize && !_Fill())
+        {
+            logerror("LVPAStream: Unable to read packed data");
+            _good = false;
+            break;
+        }
+
+        uint32 inLen = _inLen - _inPos;
+        uint32 outLen = std::min(size, segEnd - _streamPos);
+        if(!_dec->Decode(&_in[0] + _inPos, &inLen, dst, &outLen, _segIn == s.packedSize))
+        {
+            logerror("LVPAStream: Failed to unpack, file is corrupt, or decrypt fail");
+            _good = false;
+            break;
+        }
+        _inPos += inLen;
+        _streamPos += outLen;
+        if(outLen)
+            return outLen;
+        if(!inLen)
+        {
+            logerror("LVPAStream: Packed data end too early");
+            _good = false;
+            break;
+        }
+    }
+    return 0;
+}
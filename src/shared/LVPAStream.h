@@ -0,0 +1,84 @@
+#ifndef LVPA_STREAM_H
+#define LVPA_STREAM_H
+
+#include "LVPAFile.h"
+#include "LVPAStreamCipher.h"
+#include "MyCrc32.h"
+
+// size of the window packed data are read into
+#define LVPA_STREAM_BUFSIZE (16 * 1024)
+
+class LVPAStreamDecoder;
+
+// Reads a single file from an LVPA container piece by piece, decrypting and unpacking on the fly,
+// instead of unpacking the whole file into memory like LVPAFile::Get() does.
+// Seeking forward decodes and skips data; seeking backward starts over from the beginning of the file,
+// or from the beginning of the chunk, for files in chunked solid blocks.
+// Files stored uncompressed, and either not encrypted or encrypted with ChaCha20, are seeked directly.
+// Works only for files as they are stored in the container, not for files added after loading.
+// After Open(), the stream only reads the container file, and may be used by another thread than the LVPAFile.
+class LVPAStream
+{
+public:
+    LVPAStream();
+    ~LVPAStream();
+    bool Open(LVPAFile *lvpa, uint32 id); // returns false if the file can't be streamed
+    void Close(void);
+    uint32 Read(uint8 *dst, uint32 bytes); // returns less than requested at the end of the file, or on error
+    bool Seek(uint32 pos);
+    inline uint32 Tell(void) const { return _pos; }
+    inline uint32 Size(void) const { return _size; }
+    inline bool IsOpen(void) const { return _lvpa != NULL; }
+    // false if reading failed. The CRC can only be checked after the file was read from start to end,
+    // so a mismatch is detected after the data were already returned.
+    inline bool IsGood(void) const { return _good; }
+
+private:
+    LVPAStream(const LVPAStream&); // forbid copy
+    LVPAStream& operator=(const LVPAStream&);
+
+    // a piece of the packed data that is unpacked independently: the whole file or solid block, or one chunk
+    struct Segment
+    {
+        uint32 offset; // of the packed data in the container file
+        uint32 packedSize;
+        uint32 realSize;
+        uint32 start; // position of the unpacked data in the stream
+        bool raw; // stored as-is
+    };
+
+    bool _StartSegment(uint32 idx);
+    bool _SkipTo(uint32 pos);
+    bool _CanJump(void) const; // true if the current segment can be read from any position without decoding what is before
+    bool _Fill(void);
+    uint32 _Decode(uint8 *dst, uint32 size);
+
+    LVPAFile *_lvpa;
+    std::vector<Segment> _segs;
+    uint32 _chunkSize; // 0 if there is only one segment
+    uint8 _algo;
+    bool _encrypted;
+    bool _good;
+    LVPAFileCipher _cipherStart; // set up and warmed up, copied to _cipher for each restart
+    LVPAFileCipher _cipher;
+    uint32 _dataOffset; // of the file or solid block in the container file, where the encryption starts
+
+    uint32 _base; // position of the file in the unpacked stream, not 0 for files in a solid block
+    uint32 _size;
+    uint32 _pos;
+
+    // decoder state
+    LVPAStreamDecoder *_dec;
+    uint32 _seg; // current segment
+    uint32 _segIn; // packed bytes of the current segment read so far
+    uint32 _streamPos; // the next byte _Decode() returns
+    std::vector<uint8> _in;
+    uint32 _inPos;
+    uint32 _inLen;
+
+    CRC32 _crc; // of the data returned so far, if read in order
+    uint32 _crcPos;
+    uint32 _crcReal;
+};
+
+#endif
@@ -3,6 +3,11 @@
 #include "LVPAStreamCipher.h"
 #include "MersenneTwister.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define CHACHA_SSE2
+#  include <emmintrin.h>
+#endif
+
 template <typename T> inline static void iswap(T& a, T& b)
 {
     /*
@@ -71,15 +76,15 @@ HPRC4LikeCipher::HPRC4LikeCipher()
 
 void HPRC4LikeCipher::Init(const uint8 *key, uint32 size)
 {
-    MTRand mt;
+    // seed directly, the default constructor would seed from time and a static counter, which is not thread safe
 #ifdef IS_LITTLE_ENDIAN
-    mt.seed((uint32*)key, size / sizeof(uint32));
+    MTRand mt((uint32*)key, size / sizeof(uint32));
 #else
     std::vector<uint32> keycopy(size);
     memcpy(&keycopy[0], key, size);
     for(uint32 i = 0; i < (size / sizeof(uint32)); ++i)
         ToLittleEndian(*((uint32*)&keycopy[0]));
-    mt.seed((uint32*)&keycopy[0], size / sizeof(uint32));
+    MTRand mt((uint32*)&keycopy[0], size / sizeof(uint32));
 #endif
 
     for(uint32 i = 0; i < 256; ++i)
@@ -202,4 +207,191 @@ void HPRC4LikeCipher::_DoRemainingBytes(uint8 *buf, uint8 bytes)
 }
 
 
+#define CHACHA_ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define CHACHA_QR(a, b, c, d) \
+    a += b; d ^= a; d = CHACHA_ROTL(d, 16); \
+    c += d; b ^= c; b = CHACHA_ROTL(b, 12); \
+    a += b; d ^= a; d = CHACHA_ROTL(d, 8); \
+    c += d; b ^= c; b = CHACHA_ROTL(b, 7);
+
+// one block of keystream, as little endian words
+static void chacha20_block(const uint32 *in, uint64 counter, uint32 *out)
+{
+    uint32 x[16];
+    memcpy(x, in, sizeof(x));
+    x[12] = uint32(counter);
+    x[13] = uint32(counter >> 32);
+    uint32 c12 = x[12], c13 = x[13];
+    for(uint32 i = 0; i < 10; ++i)
+    {
+        CHACHA_QR(x[0], x[4], x[8],  x[12]);
+        CHACHA_QR(x[1], x[5], x[9],  x[13]);
+        CHACHA_QR(x[2], x[6], x[10], x[14]);
+        CHACHA_QR(x[3], x[7], x[11], x[15]);
+        CHACHA_QR(x[0], x[5], x[10], x[15]);
+        CHACHA_QR(x[1], x[6], x[11], x[12]);
+        CHACHA_QR(x[2], x[7], x[8],  x[13]);
+        CHACHA_QR(x[3], x[4], x[9],  x[14]);
+    }
+    for(uint32 i = 0; i < 16; ++i)
+    {
+        uint32 v = x[i] + (i == 12 ? c12 : i == 13 ? c13 : in[i]);
+        ToLittleEndian(v);
+        out[i] = v;
+    }
+}
+
+#ifdef CHACHA_SSE2
+
+#define CHACHA_ROTL4(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define CHACHA_QR4(a, b, c, d) \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = CHACHA_ROTL4(d, 16); \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = CHACHA_ROTL4(b, 12); \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = CHACHA_ROTL4(d, 8); \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = CHACHA_ROTL4(b, 7);
+
+// 4 consecutive blocks at once, each vector holds the same word of all 4 blocks
+static void chacha20_xor4(const uint32 *in, uint64 counter, uint8 *buf)
+{
+    __m128i x[16], o[16];
+    for(uint32 i = 0; i < 16; ++i)
+        o[i] = _mm_set1_epi32(in[i]);
+    uint64 c1 = counter + 1, c2 = counter + 2, c3 = counter + 3;
+    o[12] = _mm_set_epi32(uint32(c3), uint32(c2), uint32(c1), uint32(counter));
+    o[13] = _mm_set_epi32(uint32(c3 >> 32), uint32(c2 >> 32), uint32(c1 >> 32), uint32(counter >> 32));
+    for(uint32 i = 0; i < 16; ++i)
+        x[i] = o[i];
+
+    for(uint32 i = 0; i < 10; ++i)
+    {
+        CHACHA_QR4(x[0], x[4], x[8],  x[12]);
+        CHACHA_QR4(x[1], x[5], x[9],  x[13]);
+        CHACHA_QR4(x[2], x[6], x[10], x[14]);
+        CHACHA_QR4(x[3], x[7], x[11], x[15]);
+        CHACHA_QR4(x[0], x[5], x[10], x[15]);
+        CHACHA_QR4(x[1], x[6], x[11], x[12]);
+        CHACHA_QR4(x[2], x[7], x[8],  x[13]);
+        CHACHA_QR4(x[3], x[4], x[9],  x[14]);
+    }
+
+    // transpose each group of 4 words, so that each vector holds 16 consecutive bytes of one block
+    for(uint32 g = 0; g < 16; g += 4)
+    {
+        __m128i a = _mm_add_epi32(x[g], o[g]);
+        __m128i b = _mm_add_epi32(x[g + 1], o[g + 1]);
+        __m128i c = _mm_add_epi32(x[g + 2], o[g + 2]);
+        __m128i d = _mm_add_epi32(x[g + 3], o[g + 3]);
+        __m128i ab0 = _mm_unpacklo_epi32(a, b); // a0 b0 a1 b1
+        __m128i ab1 = _mm_unpackhi_epi32(a, b); // a2 b2 a3 b3
+        __m128i cd0 = _mm_unpacklo_epi32(c, d);
+        __m128i cd1 = _mm_unpackhi_epi32(c, d);
+        __m128i k[4];
+        k[0] = _mm_unpacklo_epi64(ab0, cd0); // a0 b0 c0 d0: block 0
+        k[1] = _mm_unpackhi_epi64(ab0, cd0);
+        k[2] = _mm_unpacklo_epi64(ab1, cd1);
+        k[3] = _mm_unpackhi_epi64(ab1, cd1);
+        for(uint32 blk = 0; blk < 4; ++blk)
+        {
+            __m128i *p = (__m128i*)(buf + blk * 64 + g * 4);
+            _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), k[blk]));
+        }
+    }
+}
+
+#endif
+
+ChaCha20Cipher::ChaCha20Cipher()
+: _pos(0)
+{
+    // "expand 32-byte k"
+    _state[0] = 0x61707865;
+    _state[1] = 0x3320646e;
+    _state[2] = 0x79622d32;
+    _state[3] = 0x6b206574;
+    memset(&_state[4], 0, 12 * sizeof(uint32));
+}
+
+void ChaCha20Cipher::Init(const uint8 *key, uint32 size)
+{
+    uint8 k[32];
+    for(uint32 i = 0; i < 32; ++i)
+        k[i] = size ? key[i % size] : 0;
+    for(uint32 i = 0; i < 8; ++i)
+        _state[4 + i] = k[i * 4] | (k[i * 4 + 1] << 8) | (k[i * 4 + 2] << 16) | (uint32(k[i * 4 + 3]) << 24);
+    _pos = 0;
+}
+
+void ChaCha20Cipher::SetNonce(uint64 nonce)
+{
+    _state[14] = uint32(nonce);
+    _state[15] = uint32(nonce >> 32);
+}
+
+void ChaCha20Cipher::_XorBlocks(uint8 *buf, uint32 blocks, uint64 counter)
+{
+#ifdef CHACHA_SSE2
+    for( ; blocks >= 4; blocks -= 4, counter += 4, buf += 4 * 64)
+        chacha20_xor4(&_state[0], counter, buf);
+#endif
+    uint32 ks[16];
+    for( ; blocks; --blocks, ++counter, buf += 64)
+    {
+        chacha20_block(&_state[0], counter, &ks[0]);
+        const uint8 *k = (const uint8*)&ks[0];
+        for(uint32 i = 0; i < 64; ++i)
+            buf[i] ^= k[i];
+    }
+}
+
+void ChaCha20Cipher::Apply(uint8 *buf, uint32 size)
+{
+    uint32 ks[16];
+    const uint8 *k = (const uint8*)&ks[0];
+
+    // finish the block started last time
+    uint32 offs = uint32(_pos & 63);
+    if(offs && size)
+    {
+        uint32 n = std::min(64 - offs, size);
+        chacha20_block(&_state[0], _pos >> 6, &ks[0]);
+        for(uint32 i = 0; i < n; ++i)
+            buf[i] ^= k[offs + i];
+        buf += n;
+        size -= n;
+        _pos += n;
+    }
 
+    uint32 blocks = size / 64;
+    if(blocks)
+    {
+        _XorBlocks(buf, blocks, _pos >> 6);
+        buf += blocks * 64;
+        size -= blocks * 64;
+        _pos += blocks * 64;
+    }
+
+    // start the next one
+    if(size)
+    {
+        chacha20_block(&_state[0], _pos >> 6, &ks[0]);
+        for(uint32 i = 0; i < size; ++i)
+            buf[i] ^= k[i];
+        _pos += size;
+    }
+}
+
+
+void LVPAFileCipher::InitRC4Like(const uint8 *key, uint32 size, uint32 warmup)
+{
+    _chacha = false;
+    _rc = HPRC4LikeCipher();
+    _rc.Init(key, size);
+    _rc.WarmUp(warmup);
+}
+
+void LVPAFileCipher::InitChaCha(const uint8 *key, uint32 size, uint64 nonce)
+{
+    _chacha = true;
+    _cc.Init(key, size);
+    _cc.SetNonce(nonce);
+}
@@ -42,4 +42,43 @@ private:
     uint8 _x, _y, _rb;
 };
 
+// ChaCha20 (20 rounds, 64 bit nonce, 64 bit block counter) used as a counter-mode stream cipher.
+// Each 64-byte block of the keystream depends only on the key, nonce and block number,
+// so Seek() is cheap, and separate parts of a buffer can be processed by separate instances.
+// Uses SSE2 to generate 4 blocks at once where available.
+class ChaCha20Cipher : public ISymmetricCipher
+{
+public:
+    ChaCha20Cipher();
+    virtual ~ChaCha20Cipher() {}
+    virtual void Init(const uint8 *key, uint32 size); // the key is repeated or cut to 32 bytes
+    virtual void Apply(uint8 *buf, uint32 size);
+    virtual void WarmUp(uint32 size) { _pos += size; }
+    void SetNonce(uint64 nonce);
+    inline void Seek(uint64 pos) { _pos = pos; }
+    inline uint64 Tell(void) const { return _pos; }
+
+private:
+    void _XorBlocks(uint8 *buf, uint32 blocks, uint64 counter); // full blocks only
+    uint32 _state[16]; // constants, key, counter (unused, passed separately), nonce
+    uint64 _pos;
+};
+
+// The cipher of a single file in an LVPA container, which is one of the above, see LVPAFLAG_CHACHA.
+class LVPAFileCipher
+{
+public:
+    LVPAFileCipher() : _chacha(false) {}
+    void InitRC4Like(const uint8 *key, uint32 size, uint32 warmup);
+    void InitChaCha(const uint8 *key, uint32 size, uint64 nonce);
+    inline void Apply(uint8 *buf, uint32 size) { if(_chacha) _cc.Apply(buf, size); else _rc.Apply(buf, size); }
+    inline bool IsSeekable(void) const { return _chacha; }
+    inline void Seek(uint64 pos) { DEBUG(ASSERT(_chacha || !pos)); _cc.Seek(pos); } // only if IsSeekable(), or to position 0 right after Init*()
+
+private:
+    HPRC4LikeCipher _rc;
+    ChaCha20Cipher _cc;
+    bool _chacha;
+};
+
 #endif
@@ -13,7 +13,7 @@
 
 
 LayerMgr::LayerMgr(Engine *e)
-: _engine(e), _maxdim(0), _collisionMap(LCF_WALL)
+: _engine(e), _collisionMap(LCF_WALL, LCF_NONE), _width(0), _height(0), _streamed(false)
 {
     for(uint32 i = 0; i < LAYER_MAX; ++i)
         _layers[i] = NULL;
@@ -22,17 +22,20 @@ LayerMgr::LayerMgr(Engine *e)
 
 TileLayer *LayerMgr::CreateLayer(bool collision /* = false */, uint32 xoffs /* = 0 */, uint32 yoffs /* = 0 */)
 {
-    ASSERT(_maxdim); // sanity check
+    ASSERT(_width && _height); // sanity check
 
     TileLayer *layer = new TileLayer();
-    layer->Resize(_maxdim);
+    layer->Resize(_width, _height);
     layer->collision = collision;
-    layer->target = _engine->GetSurface();
-    layer->visible_area = _engine->GetVisibleBlockRect();
-    layer->visible = true;
+    if(_engine) // without one, the layers can't be rendered, but everything else works
+    {
+        layer->target = _engine->GetSurface();
+        layer->visible_area = _engine->GetVisibleBlockRect();
+        layer->camera = _engine->GetCameraPtr();
+        layer->visible = true;
+    }
     layer->xoffs = xoffs;
     layer->yoffs = yoffs;
-    layer->camera = _engine->GetCameraPtr();
     layer->mgr = this;
 
     return layer;
@@ -57,13 +60,19 @@ void LayerMgr::Clear(void)
     _collisionMap.free();
 }
 
-void LayerMgr::SetMaxDim(uint32 dim)
+void LayerMgr::SetSize(uint32 w, uint32 h)
 {
-    _maxdim = dim;
+    _width = w;
+    _height = h;
     for(uint32 i = 0; i < LAYER_MAX; i++)
         if(TileLayer *layer = GetLayer(i))
-            layer->Resize(dim);
-    _collisionMap.resize(dim, false);
+            layer->Resize(w, h);
+    if(HasCollisionMap())
+        _collisionMap.resize(GetPixelWidth(), GetPixelHeight());
+    if(GetInfoLayer())
+        _infoLayer.resize(w, h, TILEFLAG_DEFAULT);
+    if(_streamed)
+        SetStreamed(true); // chunks are loaded again
 }
 
 void LayerMgr::SetRenderOffset(int32 x, int32 y)
@@ -102,13 +111,13 @@ void LayerMgr::Render(void)
     // DEBUG: render collision map
     if(_engine->HasDebugFlag(EDBG_COLLISION_MAP_OVERLAY))
     {
-        uint32 xmax = std::min(_collisionMap.size1d(), _engine->GetResX());
-        uint32 ymax = std::min(_collisionMap.size1d(), _engine->GetResY());
+        uint32 xmax = std::min(_collisionMap.width(), _engine->GetResX());
+        uint32 ymax = std::min(_collisionMap.height(), _engine->GetResY());
         for(uint32 y = 0; y < ymax; y++)
         {
             for(uint32 x = 0; x < xmax; x++)
             {
-                uint8 f = _collisionMap(x,y);
+                uint8 f = _collisionMap.get(x,y);
                 uint32 c = 0;
                 if(f & 1)
                     c |= 0xFF0000FF;
@@ -132,27 +141,44 @@ void LayerMgr::Update(uint32 curtime)
             _layers[i]->Update(curtime);
 }
 
+// the chunks are allocated as soon as something solid is put there
 void LayerMgr::CreateCollisionMap(void)
 {
     _collisionMap.free();
-    _collisionMap.resize(_maxdim * 16, LCF_NONE);
+    _collisionMap.setFillValue(_streamed ? LCF_WALL : LCF_NONE);
+    _collisionMap.resize(GetPixelWidth(), GetPixelHeight());
 }
 
 void LayerMgr::CreateInfoLayer(void)
 {
-    DEBUG(ASSERT(_maxdim));
-    _infoLayer.resize(_maxdim, TILEFLAG_DEFAULT);
+    DEBUG(ASSERT(_width && _height));
+    _infoLayer.resize(_width, _height, TILEFLAG_DEFAULT);
 }
 
 // intended for initial collision map generation, NOT for regular updates! (its just too slow)
 void LayerMgr::UpdateCollisionMap(void)
 {
-    DEBUG(ASSERT(_maxdim));
+    DEBUG(ASSERT(_width && _height));
+    if(!_streamed)
+    {
+        UpdateCollisionMap(0, 0, _width, _height);
+        return;
+    }
+    for(uint32 cy = 0; cy < GetChunksY(); ++cy)
+        for(uint32 cx = 0; cx < GetChunksX(); ++cx)
+            if(IsChunkLoaded(cx, cy))
+                UpdateCollisionChunk(cx, cy);
+}
+
+void LayerMgr::UpdateCollisionMap(uint32 x, uint32 y, uint32 w, uint32 h)
+{
     if(!HasCollisionMap())
         return;
-    for(uint32 y = 0; y < _maxdim; ++y)
-        for(uint32 x = 0; x < _maxdim; ++x)
-            UpdateCollisionMap(x,y);
+    uint32 x2 = std::min(x + w, _width);
+    uint32 y2 = std::min(y + h, _height);
+    for(uint32 iy = y; iy < y2; ++iy)
+        for(uint32 ix = x; ix < x2; ++ix)
+            UpdateCollisionMap(ix, iy);
 }
 
 // TODO: this can maybe be a lot more optimized...
@@ -177,10 +203,12 @@ void LayerMgr::UpdateCollisionMap(uint32 x, uint32 y) // this x and y are tile p
     bool uselayer[LAYER_MAX];
     bool counter = 0;
     for(uint32 i = 0; i < LAYER_MAX; ++i)
-        if(uselayer[i] = _layers[i] && _layers[i]->used && _layers[i]->collision && _layers[i]->tilearray(x,y))
+        if(uselayer[i] = _layers[i] && _layers[i]->used && _layers[i]->collision && _layers[i]->GetTile(x,y))
             ++counter;
     if(!counter) // no layers to be used, means there is no tile here on any layer -> tile is fully passable. update all 16x16 pixels.
     {
+        if(!_collisionMap.hasChunkAt(x16, y16)) // nothing solid here yet
+            return;
         for(uint32 py = 0; py < 16; ++py)
             for(uint32 px = 0; px < 16; ++px)
                 _collisionMap(x16 + px, y16 + py) &= ~LCF_WALL;
@@ -192,7 +220,7 @@ void LayerMgr::UpdateCollisionMap(uint32 x, uint32 y) // this x and y are tile p
     {
         if(uselayer[i])
         {
-            SDL_Surface *surface = _layers[i]->tilearray(x,y)->GetSurface();
+            SDL_Surface *surface = _layers[i]->GetTile(x,y)->GetSurface();
             if(SDL_MUSTLOCK(surface))
                 SDL_LockSurface(surface);
         }
@@ -209,7 +237,7 @@ void LayerMgr::UpdateCollisionMap(uint32 x, uint32 y) // this x and y are tile p
             {
                 if(uselayer[i])
                 {
-                    BasicTile *tile = _layers[i]->tilearray(x,y);
+                    BasicTile *tile = _layers[i]->GetTile(x,y);
                     pix = SDLfunc_getpixel(tile->GetSurface(), px, py);
                     SDL_GetRGBA(pix, tile->GetSurface()->format, &r, &g, &b, &a);
                     // if not fully transparent, this pixel is solid and cannot be passed
@@ -232,13 +260,70 @@ void LayerMgr::UpdateCollisionMap(uint32 x, uint32 y) // this x and y are tile p
     {
         if(uselayer[i])
         {
-            SDL_Surface *surface = _layers[i]->tilearray(x,y)->GetSurface();
+            SDL_Surface *surface = _layers[i]->GetTile(x,y)->GetSurface();
             if(SDL_MUSTLOCK(surface))
                 SDL_UnlockSurface(surface);
         }
     }
 }
 
+void LayerMgr::UpdateCollisionChunk(uint32 cx, uint32 cy)
+{
+    // if streamed, the chunk must exist for the empty tiles in it to be passable
+    if(_streamed && cx < _collisionMap.chunksX() && cy < _collisionMap.chunksY())
+        _collisionMap.createChunk(cx, cy, LCF_NONE);
+    UpdateCollisionMap(cx << TILECHUNK_SHIFT, cy << TILECHUNK_SHIFT, TILECHUNK_DIM, TILECHUNK_DIM);
+}
+
+// objects in there are marked again as soon as they move
+void LayerMgr::DropChunk(uint32 cx, uint32 cy)
+{
+    for(uint32 i = 0; i < LAYER_MAX; ++i)
+        if(_layers[i])
+            _layers[i]->DropChunk(cx, cy);
+    if(cx < _collisionMap.chunksX() && cy < _collisionMap.chunksY())
+        _collisionMap.freeChunk(cx, cy);
+    if(_streamed && cx < GetChunksX() && cy < GetChunksY())
+        _loadedChunks[cy * GetChunksX() + cx] = false;
+}
+
+bool LayerMgr::IsChunkModified(uint32 cx, uint32 cy) const
+{
+    for(uint32 i = 0; i < LAYER_MAX; ++i)
+        if(_layers[i] && _layers[i]->IsChunkModified(cx, cy))
+            return true;
+    return false;
+}
+
+void LayerMgr::SetChunkModified(uint32 cx, uint32 cy, bool m)
+{
+    for(uint32 i = 0; i < LAYER_MAX; ++i)
+        if(_layers[i])
+            _layers[i]->SetChunkModified(cx, cy, m);
+}
+
+void LayerMgr::SetStreamed(bool streamed)
+{
+    _streamed = streamed;
+    _collisionMap.setFillValue(streamed ? LCF_WALL : LCF_NONE);
+    _loadedChunks.assign(streamed ? GetChunksX() * GetChunksY() : 0, false);
+}
+
+bool LayerMgr::IsChunkLoaded(uint32 cx, uint32 cy) const
+{
+    if(!_streamed)
+        return true;
+    return cx < GetChunksX() && cy < GetChunksY() && _loadedChunks[cy * GetChunksX() + cx];
+}
+
+void LayerMgr::OnChunkLoaded(uint32 cx, uint32 cy)
+{
+    if(_streamed && cx < GetChunksX() && cy < GetChunksY())
+        _loadedChunks[cy * GetChunksX() + cx] = true;
+    if(HasCollisionMap())
+        UpdateCollisionChunk(cx, cy);
+}
+
 // TODO: this will ASSERT fail if an object moves out of the screen, fix this
 void LayerMgr::RemoveFromCollisionMap(Object *obj)
 {
@@ -387,7 +472,7 @@ Point LayerMgr::GetNonCollidingPoint(const BaseRect *rect, uint8 direction, uint
     BaseRect r = rect->cloneRect();
     int32 moveable;
     if(maxdist == uint32(-1)) // by default, dont try to go further then the total layer size
-        maxdist = GetMaxPixelDim();
+        maxdist = std::max(GetPixelWidth(), GetPixelHeight());
     if(moveable = (int32)CanMoveToDirection(&r, mdi, maxdist)) // try to move as far as possible
     {
         r.MoveRelative(mdi.xstep * moveable, mdi.ystep * moveable);
@@ -398,7 +483,7 @@ Point LayerMgr::GetNonCollidingPoint(const BaseRect *rect, uint8 direction, uint
 void LayerMgr::LoadAsciiLevel(AsciiLevel *level)
 {
     // reserve space
-    SetMaxDim(level->tiles.size1d());
+    SetSize(level->tiles.width(), level->tiles.height());
 
     // create the layers
     TileLayer *layers[LAYER_MAX];
@@ -414,9 +499,9 @@ void LayerMgr::LoadAsciiLevel(AsciiLevel *level)
     std::string realFileName, startAnim;
     uint32 startIdx = 0;
     std::string startIdxStr;
-    for(uint32 y = 0; y < level->tiles.size1d(); ++y)
+    for(uint32 y = 0; y < level->tiles.height(); ++y)
     {
-        for(uint32 x = 0; x < level->tiles.size1d(); ++x)
+        for(uint32 x = 0; x < level->tiles.width(); ++x)
         {
             std::vector<std::string>& filevect = level->tiledata[level->tiles(x,y)];
             for(uint32 i = 0; i < filevect.size(); ++i)
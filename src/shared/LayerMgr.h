@@ -31,7 +31,7 @@ enum LayerCollisionFlag
 };
 
 typedef array2d<uint16> TileInfoLayer;
-typedef array2d<uint8, true> CollisionMap;
+typedef chunkarray2d<uint8, TILECHUNK_SHIFT + 4> CollisionMap; // one chunk per tile chunk, 16x16 pixels per tile
 
 
 class LayerMgr
@@ -50,10 +50,15 @@ public:
     void Render(void);
     void Clear(void);
 
-    void SetMaxDim(uint32 dim); // set x and y size of all layers & collision map + resize if necessary
+    void SetSize(uint32 w, uint32 h); // set size of all layers, info layer & collision map in tiles + resize if necessary
     void SetRenderOffset(int32 x, int32 y);
-    inline uint32 GetMaxDim(void) const { return _maxdim; }
-    inline uint32 GetMaxPixelDim(void)  const { return _maxdim * 16; } // TODO: FIXME for tile sizes != 16
+    inline uint32 GetWidth(void) const { return _width; }
+    inline uint32 GetHeight(void) const { return _height; }
+    inline uint32 GetPixelWidth(void) const { return _width * 16; } // TODO: FIXME for tile sizes != 16
+    inline uint32 GetPixelHeight(void) const { return _height * 16; }
+    inline uint32 GetMaxDim(void) const { return std::max(_width, _height); }
+    inline uint32 GetChunksX(void) const { return (_width + TILECHUNK_DIM - 1) >> TILECHUNK_SHIFT; } // see TileLayer
+    inline uint32 GetChunksY(void) const { return (_height + TILECHUNK_DIM - 1) >> TILECHUNK_SHIFT; }
 
     // TODO: is the info layer really needed?
     void CreateInfoLayer(void);
@@ -62,13 +67,25 @@ public:
     inline uint16 GetTileInfo(uint32 x, uint32 y) { return _infoLayer(x,y); }
     inline void SetTileInfo(uint32 x, uint32 y, uint16 info) { _infoLayer(x,y) = info; }
 
-    inline bool HasCollisionMap(void) const { return _collisionMap.size1d(); }
+    inline bool HasCollisionMap(void) const { return _collisionMap.width(); }
     inline const CollisionMap& GetCollisionMap(void) const { return _collisionMap; }
     void CreateCollisionMap(void); // create new collision map (and delete old if exists)
     void UpdateCollisionMap(uint32 x, uint32 y); // recalculates the collision map at a specific tile
     void UpdateCollisionMap(void); // recalculates the *whole* collision map - use rarely!
+    void UpdateCollisionMap(uint32 x, uint32 y, uint32 w, uint32 h); // recalculates a rectangle of tiles
     void UpdateCollisionMap(Object *obj); // uses LCF_BLOCKING_OBJECT to mark the collision map
     void RemoveFromCollisionMap(Object *obj);
+    void UpdateCollisionChunk(uint32 cx, uint32 cy); // recalculates the tiles of one chunk, see TileLayer
+    void DropChunk(uint32 cx, uint32 cy); // removes the tiles of all layers and the collision data in a chunk, and frees them
+    bool IsChunkModified(uint32 cx, uint32 cy) const; // true if a tile of the chunk was changed on any layer
+    void SetChunkModified(uint32 cx, uint32 cy, bool m); // on all layers
+
+    // while a map is streamed by MapStreamer, only some of its chunks are loaded. the collision map reads as LCF_WALL
+    // outside of them then, so that nothing moves through the parts of the map that are not there.
+    void SetStreamed(bool streamed); // no chunk is loaded after this
+    inline bool IsStreamed(void) const { return _streamed; }
+    bool IsChunkLoaded(uint32 cx, uint32 cy) const; // always true if not streamed
+    void OnChunkLoaded(uint32 cx, uint32 cy); // after its tiles were set. calculates the collision data, if there is a collision map.
     bool CollisionWith(const BaseRect *rect, int32 skip = 4, uint8 flags = LCF_ALL) const; // check if a rectangle overlaps with at least one solid pixel in our collision map.
     // when calling this function, we assume there is NO collision yet (check new position with CollisionWith() before!)
     Point GetNonCollidingPoint(const BaseRect *rect, uint8 direction, uint32 maxdist = -1) const;
@@ -83,7 +100,9 @@ private:
     TileLayer *_layers[LAYER_MAX];
     TileInfoLayer _infoLayer;
     CollisionMap _collisionMap;
-    uint32 _maxdim; // max dimension for all created layers
+    uint32 _width, _height; // size of all created layers
+    bool _streamed;
+    std::vector<bool> _loadedChunks; // per chunk, row by row, while streamed. DropChunk() unloads a chunk.
 
 };
 
@@ -21,14 +21,184 @@ bool MapFile::SaveAsFileDirect(const char *fn, LayerMgr *mgr)
     return bytes == bb.wpos(); // write successful?
 }
 
+// reads from memory without copying it, throws ByteBufferException like ByteBuffer does
+class MapReader
+{
+public:
+    MapReader(const uint8 *ptr, uint32 size) : _ptr(ptr), _size(size), _rpos(0) {}
+
+    template <typename T> T read(void)
+    {
+        T val;
+        memcpy(&val, Skip(sizeof(T)), sizeof(T));
+        ToLittleEndian(val);
+        return val;
+    }
+
+    MapReader& operator>>(uint32& val) { val = read<uint32>(); return *this; }
+
+    MapReader& operator>>(std::string& val)
+    {
+        const uint8 *end = _rpos < _size ? (const uint8*)memchr(_ptr + _rpos, 0, _size - _rpos) : NULL;
+        if(!end)
+            throw ByteBufferException("read-string", _rpos, _size, 1, _size);
+        val.assign((const char*)_ptr + _rpos, end - (_ptr + _rpos));
+        _rpos += (end - (_ptr + _rpos)) + 1;
+        return *this;
+    }
+
+    const uint8 *Skip(uint32 bytes) // returns where the skipped bytes start
+    {
+        if(bytes > _size - std::min(_rpos, _size))
+            throw ByteBufferException("read", _rpos, _size, bytes, _size);
+        const uint8 *p = _ptr + _rpos;
+        _rpos += bytes;
+        return p;
+    }
+
+    inline void rpos(uint32 pos) { _rpos = pos; }
+    inline uint32 rpos(void) const { return _rpos; }
+    inline uint32 size(void) const { return _size; }
+
+private:
+    const uint8 *_ptr;
+    uint32 _size;
+    uint32 _rpos;
+};
+
+// holds a reference to each tile of a map while its layers are filled
+struct MapTileTable
+{
+    ~MapTileTable()
+    {
+        for(uint32 i = 0; i < tiles.size(); ++i)
+            if(tiles[i])
+                tiles[i]->ref--;
+    }
+    std::vector<BasicTile*> tiles;
+};
+
+// writes the tile indexes of a layer in whichever MapLayerEncoding is smaller
+static void encodeLayer(ByteBuffer& outbuf, const std::vector<uint16>& ids)
+{
+    ByteBuffer rle, sparse;
+    for(uint32 i = 0; i < ids.size(); )
+    {
+        uint32 n = 1;
+        while(i + n < ids.size() && n < 0xFFFF && ids[i + n] == ids[i])
+            ++n;
+        rle << ids[i] << uint16(n);
+        i += n;
+    }
+
+    uint32 used = 0;
+    sparse << uint32(0); // count, fixed below
+    for(uint32 i = 0; i < ids.size(); ++i)
+        if(ids[i])
+        {
+            sparse << uint32(i) << ids[i];
+            ++used;
+        }
+    sparse.put<uint32>(0, used);
+
+    ByteBuffer& best = sparse.size() < rle.size() ? sparse : rle;
+    outbuf << uint8(&best == &sparse ? MAPLAYER_SPARSE : MAPLAYER_RLE);
+    outbuf << uint32(best.size());
+    outbuf.append(best.contents(), best.size());
+}
+
+// reads the tile indexes of a layer stored by encodeLayer(). false if the encoding is unknown.
+static bool decodeLayer(MapReader& buf, std::vector<uint16>& ids)
+{
+    uint8 encoding = buf.read<uint8>();
+    uint32 bytes = buf.read<uint32>();
+    MapReader data(buf.Skip(bytes), bytes);
+    std::fill(ids.begin(), ids.end(), 0);
+    switch(encoding)
+    {
+        case MAPLAYER_RLE:
+            for(uint32 pos = 0; pos < ids.size(); )
+            {
+                uint16 id = data.read<uint16>();
+                uint32 n = std::min<uint32>(data.read<uint16>(), ids.size() - pos);
+                std::fill(ids.begin() + pos, ids.begin() + pos + n, id);
+                pos += n;
+            }
+            return true;
+
+        case MAPLAYER_SPARSE:
+            for(uint32 count = data.read<uint32>(); count; --count)
+            {
+                uint32 pos = data.read<uint32>();
+                uint16 id = data.read<uint16>();
+                if(pos < ids.size())
+                    ids[pos] = id;
+            }
+            return true;
+    }
+    logerror("MapFile: Unknown layer encoding %u", encoding);
+    return false;
+}
+
+// version 3: chunk size and index, followed by the data of all chunks that have tiles
+static void writeChunks(ByteBuffer& outbuf, std::map<uint32, std::vector<uint16> >& layers, uint32 width, uint32 height,
+                        uint32 chunkDataOffsPos)
+{
+    uint32 cw = (width + TILECHUNK_DIM - 1) / TILECHUNK_DIM;
+    uint32 ch = (height + TILECHUNK_DIM - 1) / TILECHUNK_DIM;
+    outbuf << uint32(TILECHUNK_DIM);
+    uint32 indexPos = outbuf.wpos();
+    for(uint32 i = 0; i < cw * ch; i++)
+        outbuf << uint32(0) << uint32(0); // offset, size
+    outbuf.put<uint32>(chunkDataOffsPos, outbuf.wpos()); // fix offset
+
+    std::vector<uint16> ids(TILECHUNK_DIM * TILECHUNK_DIM);
+    ByteBuffer chunkbuf;
+    for(uint32 cy = 0; cy < ch; cy++)
+        for(uint32 cx = 0; cx < cw; cx++)
+        {
+            uint8 count = 0;
+            chunkbuf.clear();
+            chunkbuf << uint8(0); // layer count, fixed below
+            for(std::map<uint32, std::vector<uint16> >::iterator it = layers.begin(); it != layers.end(); it++)
+            {
+                bool any = false;
+                for(uint32 y = 0; y < TILECHUNK_DIM; y++)
+                    for(uint32 x = 0; x < TILECHUNK_DIM; x++)
+                    {
+                        uint32 mx = cx * TILECHUNK_DIM + x;
+                        uint32 my = cy * TILECHUNK_DIM + y;
+                        uint16 id = (mx < width && my < height) ? it->second[my * width + mx] : 0;
+                        ids[y * TILECHUNK_DIM + x] = id;
+                        any = any || id;
+                    }
+                if(!any)
+                    continue;
+                chunkbuf << uint8(it->first);
+                encodeLayer(chunkbuf, ids);
+                ++count;
+            }
+            if(!count)
+                continue;
+
+            chunkbuf.put<uint8>(0, count);
+            uint32 entryPos = indexPos + (cy * cw + cx) * 2 * sizeof(uint32);
+            outbuf.put<uint32>(entryPos, outbuf.wpos());
+            outbuf.put<uint32>(entryPos + sizeof(uint32), chunkbuf.size());
+            outbuf.append(chunkbuf.contents(), chunkbuf.size());
+        }
+}
+
 void MapFile::Save(ByteBuffer *bufptr, LayerMgr *mgr)
 {
     ByteBuffer& outbuf = *bufptr;
 
-    uint32 entriesPerLayer = mgr->GetMaxDim() * mgr->GetMaxDim();
-    uint32 bytesPerLayer = entriesPerLayer * sizeof(uint32);
+    uint32 width = mgr->GetWidth();
+    uint32 height = mgr->GetHeight();
+    bool chunked = std::max(width, height) >= MAPFILE_CHUNKED_MIN_DIM;
     std::map<std::string, uint32> usedGfx;
-    std::map<uint32, ByteBuffer> usedLayers;
+    std::map<BasicTile*, uint32> tileIds; // tiles are shared between cells, most lookups end here
+    std::map<uint32, std::vector<uint16> > usedLayers;
     ByteBuffer gfxBuf;
     ByteBuffer strdataBuf;
     uint32 gfxIndex;
@@ -46,50 +216,48 @@ void MapFile::Save(ByteBuffer *bufptr, LayerMgr *mgr)
         TileLayer *layer = mgr->GetLayer(i);
         if(layer && layer->IsUsed())
         {
-            ByteBuffer& layerbuf = usedLayers[i];
-            layerbuf.reserve(bytesPerLayer);
-
-            for(uint32 y = 0; y < layer->GetArraySize(); y++)
-                for(uint32 x = 0; x < layer->GetArraySize(); x++)
+            std::vector<uint16>& ids = usedLayers[i];
+            ids.resize(width * height);
+            for(uint32 y = 0; y < height; y++)
+                for(uint32 x = 0; x < width; x++)
+                {
+                    uint32 usedId = 0; // no tile there
                     if(BasicTile *tile = layer->GetTile(x,y))
                     {
-                        std::string gfx = tile->GetFilename();
-                        std::map<std::string, uint32>::iterator it = usedGfx.find(gfx);
-                        uint32 usedId;
-                        if(it == usedGfx.end()) // gfx not found
+                        std::map<BasicTile*, uint32>::iterator tt = tileIds.find(tile);
+                        if(tt != tileIds.end())
+                            usedId = tt->second;
+                        else
                         {
-                            usedGfx[gfx] = gfxIndex;
-                            gfxBuf << gfx;
-                            usedId = gfxIndex;
-                            ++gfxIndex;
+                            std::string gfx = tile->GetFilename();
+                            std::map<std::string, uint32>::iterator it = usedGfx.find(gfx);
+                            if(it == usedGfx.end()) // gfx not found
+                            {
+                                usedGfx[gfx] = gfxIndex;
+                                gfxBuf << gfx;
+                                usedId = gfxIndex;
+                                ++gfxIndex;
+                            }
+                            else
+                                usedId = it->second;
+                            tileIds[tile] = usedId;
                         }
-                        else
-                            usedId = it->second;
-
-                        layerbuf << uint16(usedId);
                     }
-                    else // no tile there
-                    {
-                        layerbuf << uint16(0);
-                    }
-
-
-
+                    ids[y * width + x] = uint16(usedId);
+                }
         }
     }
 
     uint32 prealloc = 100; // for headers and different stuff. TODO: predict better.
     prealloc += gfxBuf.size();
     prealloc += strdataBuf.size();
-    prealloc += (usedLayers.size() * bytesPerLayer);
-
 
     // we have all layers now, prepare output buffer
     outbuf.resize(prealloc);
     outbuf.wpos(0);
 
     outbuf.append("LVPM", 4); // magic
-    outbuf << uint32(1); // version
+    outbuf << uint32(chunked ? MAPFILE_VERSION_CHUNKED : 2);
     outbuf << uint32(0) << uint32(0) << uint32(0) << uint32(0); // reserved (header + flags)
 
     // #1 -- string data offset (can be 0)
@@ -104,10 +272,13 @@ void MapFile::Save(ByteBuffer *bufptr, LayerMgr *mgr)
     uint32 dataHdrOffsPos = outbuf.wpos();
     outbuf << uint32(0); // map data header start offset
 
-    // #4 - #12 -- reserved
+    // #4 -- chunk data offset (version 3), everything before is read at once when streaming
+    uint32 chunkDataOffsPos = outbuf.wpos();
+    outbuf << uint32(0);
+
+    // #5 - #12 -- reserved
     outbuf << uint32(0) << uint32(0) << uint32(0) << uint32(0); // reserved (other offsets)
     outbuf << uint32(0) << uint32(0) << uint32(0) << uint32(0); // makes total 12 offset uint32s
-    outbuf << uint32(0);
 
     // TODO: more header data here?
 
@@ -126,8 +297,8 @@ void MapFile::Save(ByteBuffer *bufptr, LayerMgr *mgr)
 
     // add map data header
     outbuf.put<uint32>(dataHdrOffsPos, outbuf.wpos()); // fix offset
-    outbuf << uint32(mgr->GetMaxDim()); // x width
-    outbuf << uint32(mgr->GetMaxDim()); // y height
+    outbuf << uint32(width); // x width
+    outbuf << uint32(height); // y height
     outbuf << uint32(LAYER_MAX);
     outbuf << uint32(usedLayers.size());
     outbuf << uint32(16); // tile size x // TODO: implement for other sizes
@@ -140,28 +311,25 @@ void MapFile::Save(ByteBuffer *bufptr, LayerMgr *mgr)
         outbuf << (layer ? layer->name : "");
     }
 
+    if(chunked)
+    {
+        writeChunks(outbuf, usedLayers, width, height, chunkDataOffsPos);
+        return;
+    }
+
     // add individual layers
-    for(std::map<uint32, ByteBuffer>::iterator it = usedLayers.begin(); it != usedLayers.end(); it++)
+    for(std::map<uint32, std::vector<uint16> >::iterator it = usedLayers.begin(); it != usedLayers.end(); it++)
     {
         outbuf << uint32(it->first);
-        ByteBuffer& layerbuf = it->second;
-        outbuf.append(layerbuf.contents(), layerbuf.size());
+        encodeLayer(outbuf, it->second);
     }
 }
 
 LayerMgr *MapFile::Load(memblock *mem, Engine *engine, LayerMgr *mgr /* = NULL */)
-{
-    // TODO: make this more efficient
-    ByteBuffer bb(mem->size);
-    bb.append(mem->ptr, mem->size);
-    return Load(&bb, engine, mgr);
-}
-
-LayerMgr *MapFile::Load(ByteBuffer *bufptr, Engine *engine, LayerMgr *mgr /* = NULL */)
 {
     try
     {
-        return LoadUnsafe(bufptr, engine, mgr);
+        return _LoadUnsafe(mem->ptr, mem->size, engine, mgr);
     }
     catch(ByteBufferException ex)
     {
@@ -172,23 +340,59 @@ LayerMgr *MapFile::Load(ByteBuffer *bufptr, Engine *engine, LayerMgr *mgr /* = N
     return NULL;
 }
 
+LayerMgr *MapFile::Load(ByteBuffer *bufptr, Engine *engine, LayerMgr *mgr /* = NULL */)
+{
+    memblock mb((uint8*)bufptr->contents(), bufptr->size());
+    return Load(&mb, engine, mgr);
+}
 
 LayerMgr *MapFile::LoadUnsafe(ByteBuffer *bufptr, Engine *engine, LayerMgr *mgr)
 {
-    ByteBuffer& buf = *bufptr;
+    return _LoadUnsafe(bufptr->contents(), bufptr->size(), engine, mgr);
+}
 
-    char magic[4];
-    buf.read((uint8*)(&magic[0]), 4);
-    if(memcmp(magic, "LVPM", 4))
-        return NULL;
 
-    uint32 version;
-    buf >> version;
-    if(version != 1)
-        return NULL;
+bool MapFile::GetTileNames(memblock *mem, std::vector<std::string>& names)
+{
+    MapFileHeader hdr;
+    try
+    {
+        if(!ReadHeader(mem->ptr, mem->size, hdr))
+            return false;
+    }
+    catch(ByteBufferException ex)
+    {
+        logerror("MapFile::GetTileNames: Exception when reading file!");
+        return false;
+    }
+    names.insert(names.end(), hdr.tiles.begin() + 1, hdr.tiles.end());
+    return true;
+}
 
-    uint32 pad;
-    buf >> pad >> pad >> pad >> pad; // reserved (other header fields + flags)
+uint32 MapFile::GetChunkedHeaderSize(const uint8 *ptr, uint32 size)
+{
+    MapReader buf(ptr, size);
+    if(size < MAPFILE_FIXED_HEADER_SIZE || memcmp(buf.Skip(4), "LVPM", 4))
+        return 0;
+    uint32 version = buf.read<uint32>();
+    if(version < MAPFILE_VERSION_CHUNKED || version > MAPFILE_VERSION)
+        return 0;
+    buf.Skip((4 + 3) * sizeof(uint32)); // reserved, offsets #1 - #3
+    return buf.read<uint32>(); // #4 -- chunk data offset
+}
+
+bool MapFile::ReadHeader(const uint8 *ptr, uint32 size, MapFileHeader& hdr)
+{
+    MapReader buf(ptr, size);
+
+    if(memcmp(buf.Skip(4), "LVPM", 4))
+        return false;
+
+    buf >> hdr.version;
+    if(!hdr.version || hdr.version > MAPFILE_VERSION)
+        return false;
+
+    buf.Skip(4 * sizeof(uint32)); // reserved (other header fields + flags)
 
     // #1 -- string data offset (can be 0)
     uint32 strdataOffs;
@@ -198,21 +402,19 @@ LayerMgr *MapFile::LoadUnsafe(ByteBuffer *bufptr, Engine *engine, LayerMgr *mgr)
     uint32 tileOffs;
     buf >> tileOffs;
     if(!tileOffs) // must have tiles
-        return NULL;
+        return false;
 
     // #3 -- map/layer data offset (must exist)
     uint32 dataHdrOffs;
     buf >> dataHdrOffs;
     if(!dataHdrOffs)
-        return NULL; // must have a data hdr
+        return false; // must have a data hdr
 
-    // #4 - #12 -- reserved
-    buf >> pad >> pad >> pad >> pad; // reserved (other header fields + flags)
-    buf >> pad >> pad >> pad >> pad; // total 12 offset uint32
-    buf >> pad;
+    // #4 - #12 -- chunk data offset, not needed here; reserved
+    buf.Skip(9 * sizeof(uint32));
 
-    // read stringdata (use extra map instead of writing into the mgr directly - loading may still fail below)
-    std::map<std::string, std::string> stringdata;
+    // read stringdata
+    hdr.stringdata.clear();
     if(strdataOffs)
     {
         buf.rpos(strdataOffs);
@@ -223,7 +425,7 @@ LayerMgr *MapFile::LoadUnsafe(ByteBuffer *bufptr, Engine *engine, LayerMgr *mgr)
         {
             buf >> key;
             buf >> val;
-            stringdata.insert(std::make_pair(key,val));
+            hdr.stringdata.insert(std::make_pair(key,val));
         }
     }
 
@@ -232,50 +434,77 @@ LayerMgr *MapFile::LoadUnsafe(ByteBuffer *bufptr, Engine *engine, LayerMgr *mgr)
     uint32 strCount;
     buf >> strCount;
     if(!strCount)
-        return NULL;
-    std::vector<std::string> gfxStore(strCount + 1); // +1 because of the initial empty string at position 0
-    for(uint32 i = 0; i < gfxStore.size(); i++)
+        return false;
+    hdr.tiles.clear();
+    hdr.tiles.resize(strCount + 1); // +1 because of the initial empty string at position 0
+    for(uint32 i = 0; i < hdr.tiles.size(); i++)
     {
-        buf >> gfxStore[i];
+        buf >> hdr.tiles[i];
     }
 
     // read layers header
     buf.rpos(dataHdrOffs);
-    uint32 width, height, layersTotal, layersUsed, tileSizeX, tileSizeY;
-    buf >> width;
-    buf >> height;
-    buf >> layersTotal;
-    buf >> layersUsed;
+    uint32 tileSizeX, tileSizeY;
+    buf >> hdr.width;
+    buf >> hdr.height;
+    buf >> hdr.layersTotal;
+    buf >> hdr.layersUsed;
     buf >> tileSizeX;
     buf >> tileSizeY;
 
     // unsupported
-    if(layersTotal > LAYER_MAX)
-        return NULL;
+    if(hdr.layersTotal > LAYER_MAX)
+        return false;
 
     // no layers?!
-    if(!layersUsed)
-        return NULL;
+    if(!hdr.layersUsed)
+        return false;
 
     // bullshit data
-    if(layersTotal < layersUsed)
-        return NULL;
+    if(hdr.layersTotal < hdr.layersUsed || !hdr.width || !hdr.height || uint64(hdr.width) * hdr.height > 0xFFFFFFFF)
+        return false;
 
+    hdr.layerNames.resize(hdr.layersTotal);
+    for(uint32 i = 0; i < hdr.layersTotal; i++)
+        buf >> hdr.layerNames[i];
+    hdr.layerDataOffs = buf.rpos();
+
+    hdr.chunkDim = 0;
+    hdr.chunks.clear();
+    if(hdr.version >= MAPFILE_VERSION_CHUNKED)
+    {
+        buf >> hdr.chunkDim;
+        if(!hdr.chunkDim || hdr.chunkDim > 1024)
+            return false;
+        uint32 cw = (hdr.width + hdr.chunkDim - 1) / hdr.chunkDim;
+        uint32 ch = (hdr.height + hdr.chunkDim - 1) / hdr.chunkDim;
+        if(uint64(cw) * ch * 2 * sizeof(uint32) > size)
+            return false;
+        hdr.chunks.resize(cw * ch);
+        for(uint32 i = 0; i < hdr.chunks.size(); i++)
+        {
+            buf >> hdr.chunks[i].offset;
+            buf >> hdr.chunks[i].size;
+        }
+    }
+
+    return true;
+}
+
+LayerMgr *MapFile::PrepareLayers(const MapFileHeader& hdr, Engine *engine, LayerMgr *mgr)
+{
     if(mgr)
     {
-        // mgr already in use, just clear existing layers
+        // mgr already in use, just clear existing layers. the collision map is rebuilt by the caller.
         for(uint32 i = 0; i < LAYER_MAX; ++i)
             if(TileLayer *ly = mgr->GetLayer(i))
-                ly->Clear();                
+                ly->Clear(false);
     }
     else
     {
         mgr = new LayerMgr(engine);
     }
-    mgr->SetMaxDim(std::max(width, height));
-
-    uint32 layerIndex;
-    uint32 tileIdx;
+    mgr->SetSize(hdr.width, hdr.height);
 
     // read names and create layers
     for(uint32 i = 0; i < LAYER_MAX; i++) // create as many layers as the engine supports
@@ -283,42 +512,109 @@ LayerMgr *MapFile::LoadUnsafe(ByteBuffer *bufptr, Engine *engine, LayerMgr *mgr)
         TileLayer *layer = mgr->GetLayer(i);
         if(!layer)
             layer = mgr->CreateLayer();
-        if(i < layersTotal) // and fill the names of as many as the file has
+        if(i < hdr.layerNames.size()) // and fill the names of as many as the file has
+            layer->name = hdr.layerNames[i];
+        mgr->SetLayer(layer, i);
+    }
+    return mgr;
+}
+
+void MapFile::LoadTileTable(const MapFileHeader& hdr, std::vector<BasicTile*>& tiles)
+{
+    tiles.resize(hdr.tiles.size(), NULL);
+    for(uint32 i = 1; i < hdr.tiles.size(); i++)
+        tiles[i] = AnimatedTile::New(hdr.tiles[i].c_str());
+}
+
+bool MapFile::LoadChunk(const uint8 *ptr, uint32 size, LayerMgr *mgr, uint32 cx, uint32 cy, uint32 chunkDim,
+                        BasicTile *const *table, uint32 tableSize)
+{
+    MapReader buf(ptr, size);
+    std::vector<uint16> ids(chunkDim * chunkDim);
+    for(uint8 layers = buf.read<uint8>(); layers; --layers)
+    {
+        uint8 layerIndex = buf.read<uint8>();
+        if(layerIndex >= LAYER_MAX || !decodeLayer(buf, ids))
+            return false;
+        mgr->GetLayer(layerIndex)->Fill(cx * chunkDim, cy * chunkDim, chunkDim, chunkDim, &ids[0], table, tableSize, false);
+    }
+    return true;
+}
+
+bool MapFile::LoadLayers(const uint8 *ptr, uint32 size, const MapFileHeader& hdr, LayerMgr *mgr,
+                         BasicTile *const *table, uint32 tableSize)
+{
+    if(hdr.version >= MAPFILE_VERSION_CHUNKED)
+    {
+        uint32 cw = (hdr.width + hdr.chunkDim - 1) / hdr.chunkDim;
+        for(uint32 i = 0; i < hdr.chunks.size(); i++)
         {
-            std::string name;
-            buf >> name;
-            layer->name = name;
+            const MapChunkEntry& e = hdr.chunks[i];
+            if(!e.offset)
+                continue;
+            if(e.offset > size || e.size > size - e.offset)
+                return false;
+            if(!LoadChunk(ptr + e.offset, e.size, mgr, i % cw, i / cw, hdr.chunkDim, table, tableSize))
+                return false;
         }
-        mgr->SetLayer(layer, i);
+        return true;
     }
-    
-    // read individual layer data
-    for(uint32 i = 0; i < layersUsed; i++)
+
+    // version 1 stores all cells, they must be in the file
+    if(hdr.version < 2 && uint64(hdr.width) * hdr.height * sizeof(uint16) * hdr.layersUsed > size)
+        return false;
+
+    MapReader buf(ptr, size);
+    buf.rpos(hdr.layerDataOffs);
+    std::vector<uint16> ids(hdr.width * hdr.height);
+    for(uint32 i = 0; i < hdr.layersUsed; i++)
     {
+        uint32 layerIndex;
         buf >> layerIndex;
+        if(layerIndex >= LAYER_MAX)
+            return false;
 
-        TileLayer *layer = mgr->GetLayer(layerIndex);
+        if(hdr.version < 2)
+        {
+            for(uint32 j = 0; j < ids.size(); j++)
+                ids[j] = buf.read<uint16>();
+        }
+        else if(!decodeLayer(buf, ids))
+            return false;
 
-        // read tiles on layer
-        for(uint32 y = 0; y < height; y++)
-            for(uint32 x = 0; x < width; x++)
-            {
-                tileIdx = buf.read<uint16>();
-                if(!tileIdx || tileIdx >= gfxStore.size())
-                    continue;
+        mgr->GetLayer(layerIndex)->Fill(0, 0, hdr.width, hdr.height, &ids[0], table, tableSize, false);
+    }
+    return true;
+}
+
+LayerMgr *MapFile::_LoadUnsafe(const uint8 *ptr, uint32 size, Engine *engine, LayerMgr *mgr)
+{
+    MapFileHeader hdr;
+    if(!ReadHeader(ptr, size, hdr))
+        return NULL;
 
-                std::string& gfxName = gfxStore[tileIdx];
+    bool created = !mgr;
+    mgr = PrepareLayers(hdr, engine, mgr);
 
-                if(BasicTile *tile = AnimatedTile::New(gfxName.c_str()))
-                {
-                    layer->SetTile(x, y, tile, false);
-                    tile->ref--;
-                }
-            }
+    // load each tile once, all cells using it share it
+    MapTileTable table;
+    LoadTileTable(hdr, table.tiles);
+    if(!LoadLayers(ptr, size, hdr, mgr, table.tiles.empty() ? NULL : &table.tiles[0], table.tiles.size()))
+    {
+        if(created)
+            delete mgr;
+        return NULL;
+    }
+
+    // the layers were filled without touching the collision map, do it in one go
+    if(mgr->HasCollisionMap())
+    {
+        mgr->CreateCollisionMap();
+        mgr->UpdateCollisionMap();
     }
 
     // assign stringdata
-    mgr->stringdata = stringdata;
+    mgr->stringdata = hdr.stringdata;
 
     return mgr;
 }
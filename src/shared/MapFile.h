@@ -1,10 +1,50 @@
 #ifndef MAPFILE_H
 #define MAPFILE_H
 
+#include <map>
+#include <vector>
+
 class LayerMgr;
 class ByteBuffer;
 class Engine;
 class VFSFile;
+class BasicTile;
+
+// file format versions. 1 stored one uint16 per cell for each layer, 2 added MapLayerEncoding,
+// 3 stores the layers in square chunks, so that they can be streamed by MapStreamer.
+#define MAPFILE_VERSION_CHUNKED 3
+#define MAPFILE_VERSION 3 // newest version that can be read
+#define MAPFILE_CHUNKED_MIN_DIM 256 // Save() writes maps at least this many tiles wide or high as version 3, others as version 2
+#define MAPFILE_FIXED_HEADER_SIZE (4 + 5 * 4 + 12 * 4) // magic, version, reserved, offsets
+
+// how the tile indexes of a layer are stored (version 2+)
+enum MapLayerEncoding
+{
+    MAPLAYER_RLE    = 0, // runs of (uint16 tile index, uint16 count), row by row, until all cells are covered
+    MAPLAYER_SPARSE = 1, // uint32 count, then for each used cell: uint32 position (y * width + x), uint16 tile index
+};
+
+struct MapChunkEntry
+{
+    uint32 offset; // in the file, 0 if there are no tiles in this chunk
+    uint32 size;
+};
+
+// everything in a map file before the layer data
+struct MapFileHeader
+{
+    uint32 version;
+    uint32 width;
+    uint32 height;
+    uint32 layersTotal;
+    uint32 layersUsed;
+    uint32 layerDataOffs; // version 1 and 2
+    uint32 chunkDim; // tiles per chunk side, version 3+
+    std::vector<MapChunkEntry> chunks; // row by row, version 3+
+    std::map<std::string, std::string> stringdata;
+    std::vector<std::string> tiles; // [0] is the empty string, for no tile
+    std::vector<std::string> layerNames;
+};
 
 class MapFile
 {
@@ -13,9 +53,25 @@ public:
     static bool SaveAsFileDirect(const char *fn, LayerMgr *mgr);
     static LayerMgr *LoadUnsafe(ByteBuffer *bufptr, Engine *engine, LayerMgr *target); // may throw ByteBufferException if file corrupt
     static LayerMgr *Load(ByteBuffer *bufptr, Engine *engine, LayerMgr *target = NULL);
-    static LayerMgr *Load(memblock* mem,  Engine *engine, LayerMgr *target = NULL);
+    static LayerMgr *Load(memblock* mem,  Engine *engine, LayerMgr *target = NULL); // reads directly from the memory, no copy
+
+    // the names of all tiles used in the map, without loading anything. false if the map is not valid.
+    static bool GetTileNames(memblock *mem, std::vector<std::string>& names);
 
+    // used by MapStreamer to load chunked maps piece by piece. all of these may throw ByteBufferException.
+    // from the first MAPFILE_FIXED_HEADER_SIZE bytes of a chunked map, the size of everything before the chunk data. 0 if not a chunked map.
+    static uint32 GetChunkedHeaderSize(const uint8 *ptr, uint32 size);
+    static bool ReadHeader(const uint8 *ptr, uint32 size, MapFileHeader& hdr); // false if not a map, or a version that is not supported
+    static LayerMgr *PrepareLayers(const MapFileHeader& hdr, Engine *engine, LayerMgr *target); // clears or creates the layers, sets the size
+    static void LoadTileTable(const MapFileHeader& hdr, std::vector<BasicTile*>& tiles); // holds a reference to each tile, [0] is NULL
+    static bool LoadChunk(const uint8 *ptr, uint32 size, LayerMgr *mgr, uint32 cx, uint32 cy, uint32 chunkDim,
+        BasicTile *const *table, uint32 tableSize); // does not touch the collision map
+    // all layers of the file, with the tiles in table, as indexed by hdr.tiles. does not touch the collision map.
+    static bool LoadLayers(const uint8 *ptr, uint32 size, const MapFileHeader& hdr, LayerMgr *mgr,
+        BasicTile *const *table, uint32 tableSize);
 
+private:
+    static LayerMgr *_LoadUnsafe(const uint8 *ptr, uint32 size, Engine *engine, LayerMgr *target); // may throw ByteBufferException
 };
 
 
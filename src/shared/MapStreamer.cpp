@@ -0,0 +1,151 @@
+#include "common.h"
+#include "ByteBuffer.h"
+#include "VFSFile.h"
+#include "TileLayer.h"
+#include "LayerMgr.h"
+#include "MapStreamer.h"
+
+
+MapStreamer::MapStreamer(LayerMgr *mgr)
+: _mgr(mgr), _vf(NULL), _chunksX(0), _chunksY(0)
+{
+}
+
+MapStreamer::~MapStreamer()
+{
+    Close();
+}
+
+bool MapStreamer::Open(VFSFile *vf)
+{
+    Close();
+    if(!vf || !vf->open(NULL, (char*)"rb"))
+        return false;
+
+    // the headers and chunk index are read at once, the chunks later as they are needed
+    uint8 fixedHdr[MAPFILE_FIXED_HEADER_SIZE];
+    uint32 hdrSize = 0;
+    try
+    {
+        if(vf->read((char*)&fixedHdr[0], sizeof(fixedHdr)) == sizeof(fixedHdr))
+            hdrSize = MapFile::GetChunkedHeaderSize(&fixedHdr[0], sizeof(fixedHdr));
+        if(hdrSize >= sizeof(fixedHdr) && hdrSize <= vf->size())
+        {
+            _buf.resize(hdrSize);
+            memcpy(&_buf[0], &fixedHdr[0], sizeof(fixedHdr));
+            uint32 rest = hdrSize - sizeof(fixedHdr);
+            if((rest && vf->read((char*)&_buf[sizeof(fixedHdr)], rest) != rest)
+                || !MapFile::ReadHeader(&_buf[0], hdrSize, _hdr) || _hdr.chunkDim != TILECHUNK_DIM)
+                hdrSize = 0;
+        }
+        else
+            hdrSize = 0;
+    }
+    catch(ByteBufferException ex)
+    {
+        logerror("MapStreamer::Open: Exception when reading file '%s'", vf->name());
+        hdrSize = 0;
+    }
+    if(!hdrSize)
+    {
+        vf->close();
+        return false;
+    }
+
+    _vf = vf;
+    _vf->ref++;
+
+    MapFile::PrepareLayers(_hdr, NULL, _mgr);
+    _mgr->SetStreamed(true);
+    if(_mgr->HasCollisionMap())
+        _mgr->CreateCollisionMap(); // filled per chunk, solid until then
+    _mgr->stringdata = _hdr.stringdata;
+    MapFile::LoadTileTable(_hdr, _tiles);
+
+    _chunksX = (_hdr.width + TILECHUNK_DIM - 1) / TILECHUNK_DIM;
+    _chunksY = (_hdr.height + TILECHUNK_DIM - 1) / TILECHUNK_DIM;
+
+    logdetail("MapStreamer: Opened '%s', %ux%u tiles in %ux%u chunks", vf->name(), _hdr.width, _hdr.height, _chunksX, _chunksY);
+    return true;
+}
+
+void MapStreamer::Close(void)
+{
+    for(uint32 i = 0; i < _tiles.size(); ++i)
+        if(_tiles[i])
+            _tiles[i]->ref--;
+    _tiles.clear();
+    _buf.clear();
+    _chunksX = _chunksY = 0;
+    if(_vf)
+    {
+        _mgr->SetStreamed(false);
+        _vf->close();
+        _vf->ref--;
+        _vf = NULL;
+    }
+}
+
+void MapStreamer::Update(int32 x, int32 y, uint32 w, uint32 h)
+{
+    if(!_vf)
+        return;
+
+    // visible chunks, clipped to the map
+    const int32 chunkPixels = TILECHUNK_DIM * 16;
+    int32 cx1 = (std::max(x, 0)) / chunkPixels;
+    int32 cy1 = (std::max(y, 0)) / chunkPixels;
+    int32 cx2 = (std::max(x + int32(w), 1) - 1) / chunkPixels;
+    int32 cy2 = (std::max(y + int32(h), 1) - 1) / chunkPixels;
+
+    for(uint32 cy = 0; cy < _chunksY; ++cy)
+        for(uint32 cx = 0; cx < _chunksX; ++cx)
+        {
+            int32 icx = int32(cx), icy = int32(cy);
+            bool keep = icx >= cx1 - MAPSTREAM_KEEP_MARGIN && icx <= cx2 + MAPSTREAM_KEEP_MARGIN
+                     && icy >= cy1 - MAPSTREAM_KEEP_MARGIN && icy <= cy2 + MAPSTREAM_KEEP_MARGIN;
+            bool load = icx >= cx1 - MAPSTREAM_LOAD_MARGIN && icx <= cx2 + MAPSTREAM_LOAD_MARGIN
+                     && icy >= cy1 - MAPSTREAM_LOAD_MARGIN && icy <= cy2 + MAPSTREAM_LOAD_MARGIN;
+            bool loaded = _mgr->IsChunkLoaded(cx, cy);
+            if(loaded && !keep && !_mgr->IsChunkModified(cx, cy)) // changed chunks stay, to not lose the changes
+                _mgr->DropChunk(cx, cy);
+            else if(!loaded && load)
+                _LoadChunk(cx, cy);
+        }
+}
+
+uint32 MapStreamer::GetLoadedCount(void) const
+{
+    uint32 n = 0;
+    for(uint32 cy = 0; cy < _chunksY; ++cy)
+        for(uint32 cx = 0; cx < _chunksX; ++cx)
+            if(_mgr->IsChunkLoaded(cx, cy))
+                ++n;
+    return n;
+}
+
+void MapStreamer::_LoadChunk(uint32 cx, uint32 cy)
+{
+    // if it fails, the chunk is marked as loaded anyway, to not try again each frame
+    const MapChunkEntry& e = _hdr.chunks[cy * _chunksX + cx];
+    if(e.offset) // not empty
+    {
+        _buf.resize(std::max<uint32>(e.size, 1));
+        if(!_vf->seek(e.offset) || _vf->read((char*)&_buf[0], e.size) != e.size)
+            logerror("MapStreamer: Failed to read chunk (%u, %u) of '%s'", cx, cy, _vf->name());
+        else
+        {
+            try
+            {
+                if(!MapFile::LoadChunk(&_buf[0], e.size, _mgr, cx, cy, TILECHUNK_DIM, _tiles.empty() ? NULL : &_tiles[0], _tiles.size()))
+                    logerror("MapStreamer: Chunk (%u, %u) of '%s' is invalid", cx, cy, _vf->name());
+            }
+            catch(ByteBufferException ex)
+            {
+                logerror("MapStreamer: Exception when loading chunk (%u, %u) of '%s'", cx, cy, _vf->name());
+            }
+        }
+    }
+    _mgr->SetChunkModified(cx, cy, false); // as in the file
+    _mgr->OnChunkLoaded(cx, cy);
+}
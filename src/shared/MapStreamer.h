@@ -0,0 +1,43 @@
+#ifndef MAPSTREAMER_H
+#define MAPSTREAMER_H
+
+#include "MapFile.h"
+
+class LayerMgr;
+class VFSFile;
+
+// how many chunks around the visible area are loaded, and how far away they have to be to be dropped again
+#define MAPSTREAM_LOAD_MARGIN 1
+#define MAPSTREAM_KEEP_MARGIN 2
+
+// Pages the chunks of a chunked map (version 3, see MapFile) in and out of a LayerMgr around the camera,
+// so that only the part of a large map near the camera is in memory. The file stays open while streaming.
+// Collision data are generated per chunk as it is loaded, if the LayerMgr has a collision map.
+// The parts of the map that are not loaded are solid (see LayerMgr::SetStreamed()), so that objects there stay where they are.
+// Chunks with changed tiles are kept until the map is closed. Tiles set in a chunk before it was loaded are overwritten.
+class MapStreamer
+{
+public:
+    MapStreamer(LayerMgr *mgr);
+    ~MapStreamer();
+    bool Open(VFSFile *vf); // sets up the layers. false if vf is not a chunked map, the layers are not touched then.
+    void Close(void); // does not remove loaded chunks from the layers, the LayerMgr is no longer streamed then
+    void Update(int32 x, int32 y, uint32 w, uint32 h); // area in pixels to keep loaded, usually the screen
+    inline bool IsOpen(void) const { return _vf != NULL; }
+    uint32 GetLoadedCount(void) const;
+
+private:
+    MapStreamer(const MapStreamer&); // forbid copy
+    MapStreamer& operator=(const MapStreamer&);
+
+    void _LoadChunk(uint32 cx, uint32 cy);
+
+    LayerMgr *_mgr;
+    VFSFile *_vf;
+    MapFileHeader _hdr;
+    std::vector<BasicTile*> _tiles; // referenced as long as the map is open, so that chunks loaded again find them
+    std::vector<uint8> _buf; // for reading chunks
+    uint32 _chunksX, _chunksY;
+};
+
+#endif
@@ -1,17 +1,41 @@
 #include "common.h"
 #include "MyCrc32.h"
 
-uint32 CRC32::_tab[256];
+// carry-less multiplication is used if the compiler knows the intrinsics.
+// the CPU is checked at runtime, the code is never run on CPUs without support.
+#if COMPILER == COMPILER_GNU && (defined(__x86_64__) || defined(__i386__)) \
+    && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#  define CRC32_PCLMUL
+#  define CRC32_PCLMUL_FUNC __attribute__((target("pclmul,sse2")))
+#  include <cpuid.h>
+#  include <wmmintrin.h>
+#elif COMPILER == COMPILER_MICROSOFT && (defined(_M_IX86) || defined(_M_X64)) && _MSC_VER >= 1500
+#  define CRC32_PCLMUL
+#  define CRC32_PCLMUL_FUNC
+#  include <intrin.h>
+#  include <wmmintrin.h>
+#endif
+
+// the PCLMUL path needs at least this many bytes, and works on multiples of 16
+#define CRC32_PCLMUL_MIN_SIZE 64
+
+uint32 CRC32::_tab[8][256];
 bool CRC32::_notab = true;
+CRC32::Mode CRC32::_mode = CRC32::MODE_SLICE8;
 
 CRC32::CRC32()
 : _crc(0xFFFFFFFF)
 {
     if(_notab)
-    {
-        GenTab();
-        _notab = false;
-    }
+        _Init();
+}
+
+void CRC32::_Init(void)
+{
+    GenTab();
+    if(HasPCLMUL())
+        _mode = MODE_PCLMUL;
+    _notab = false;
 }
 
 void CRC32::GenTab(void)
@@ -27,17 +51,178 @@ void CRC32::GenTab(void)
             else
                 crc >>= 1;
         }
-        _tab[i] = crc;
+        _tab[0][i] = crc;
+    }
+
+    // _tab[k][i] is the CRC of byte i followed by k zero bytes
+    for (uint16 i = 0; i < 256; i++)
+    {
+        crc = _tab[0][i];
+        for (uint8 k = 1; k < 8; k++)
+        {
+            crc = (crc >> 8) ^ _tab[0][crc & 0xFF];
+            _tab[k][i] = crc;
+        }
     }
 }
 
+bool CRC32::HasPCLMUL(void)
+{
+#if defined(CRC32_PCLMUL) && COMPILER == COMPILER_GNU
+    unsigned int a, b, c, d;
+    if(!__get_cpuid(1, &a, &b, &c, &d))
+        return false;
+    return (c & bit_PCLMUL) && (d & bit_SSE2);
+#elif defined(CRC32_PCLMUL)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 1)) && (info[3] & (1 << 26)); // PCLMULQDQ, SSE2
+#else
+    return false;
+#endif
+}
+
+bool CRC32::SetMode(Mode m)
+{
+    if(_notab)
+        _Init(); // so that the default mode does not override this later
+    if(m == MODE_PCLMUL && !HasPCLMUL())
+        return false;
+    _mode = m;
+    return true;
+}
+
+CRC32::Mode CRC32::GetMode(void)
+{
+    if(_notab)
+        _Init();
+    return _mode;
+}
+
 void CRC32::Finalize(void)
 {
     _crc ^= 0xFFFFFFFF;
 }
 
+#ifdef CRC32_PCLMUL
+
+// Folds 64 bytes at a time, then reduces to 32 bits. buf must be at least 64 bytes, size a multiple of 16.
+// From "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction", V. Gopal, E. Ozturk et al., Intel 2009,
+// with the bit-reflected constants for polynomial 0x04C11DB7 given at the end of the paper.
+CRC32_PCLMUL_FUNC static uint32 crc32_pclmul(const uint8 *buf, uint32 size, uint32 crc)
+{
+    // k1..k5 and the Barrett constants
+    const __m128i k1k2 = _mm_set_epi32(0x00000001, 0xc6e41596, 0x00000001, 0x54442bd4);
+    const __m128i k3k4 = _mm_set_epi32(0x00000000, 0xccaa009e, 0x00000001, 0x751997d0);
+    const __m128i k5k0 = _mm_set_epi32(0, 0, 0x00000001, 0x63cd6124);
+    const __m128i poly = _mm_set_epi32(0x00000001, 0xf7011641, 0x00000001, 0xdb710641);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    buf += 64;
+    size -= 64;
+
+    // fold 4 x 128 bits in parallel
+    x0 = k1k2;
+    while(size >= 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(buf + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(buf + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(buf + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(buf + 0x30)));
+        buf += 64;
+        size -= 64;
+    }
+
+    // fold into 128 bits
+    x0 = k3k4;
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // remaining blocks of 16 bytes
+    while(size >= 16)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i*)buf)), x5);
+        buf += 16;
+        size -= 16;
+    }
+
+    // fold 128 bits to 64 bits
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+
+#endif
+
 void CRC32::Update(const uint8 *buf, uint32 size)
 {
-    for (uint32 i = 0; i < size; i++)
-        _crc = ((_crc >> 8) & 0x00FFFFFF) ^ _tab[(_crc ^ *buf++) & 0xFF];
+    register uint32 crc = _crc;
+
+    if(_mode == MODE_BYTEWISE)
+    {
+        for (uint32 i = 0; i < size; i++)
+            crc = (crc >> 8) ^ _tab[0][(crc ^ *buf++) & 0xFF];
+        _crc = crc;
+        return;
+    }
+
+#ifdef CRC32_PCLMUL
+    if(_mode == MODE_PCLMUL && size >= CRC32_PCLMUL_MIN_SIZE)
+    {
+        uint32 blocks = size & ~15u;
+        crc = crc32_pclmul(buf, blocks, crc);
+        buf += blocks;
+        size -= blocks;
+    }
+#endif
+
+    // slice-by-8. bytes are combined explicitly, so this works on any endianness and alignment.
+    while(size >= 8)
+    {
+        uint32 one = crc ^ (uint32(buf[0]) | (uint32(buf[1]) << 8) | (uint32(buf[2]) << 16) | (uint32(buf[3]) << 24));
+        uint32 two = uint32(buf[4]) | (uint32(buf[5]) << 8) | (uint32(buf[6]) << 16) | (uint32(buf[7]) << 24);
+        crc = _tab[7][one & 0xFF] ^ _tab[6][(one >> 8) & 0xFF] ^ _tab[5][(one >> 16) & 0xFF] ^ _tab[4][one >> 24]
+            ^ _tab[3][two & 0xFF] ^ _tab[2][(two >> 8) & 0xFF] ^ _tab[1][(two >> 16) & 0xFF] ^ _tab[0][two >> 24];
+        buf += 8;
+        size -= 8;
+    }
+    while(size--)
+        crc = (crc >> 8) ^ _tab[0][(crc ^ *buf++) & 0xFF];
+
+    _crc = crc;
 }
@@ -5,6 +5,14 @@
 class CRC32
 {
 public:
+    // ways to calculate the same CRC, the fastest one available is used by default
+    enum Mode
+    {
+        MODE_BYTEWISE, // one table lookup per byte
+        MODE_SLICE8, // 8 bytes at a time, with 8 tables
+        MODE_PCLMUL // carry-less multiplication (x86 with PCLMULQDQ), slice-by-8 for the rest
+    };
+
     CRC32();
     void Update(const uint8 *buf, uint32 size);
     void Finalize(void);
@@ -18,11 +26,17 @@ public:
         return crc.Result();
     }
 
+    static bool SetMode(Mode m); // returns false if the mode is not supported by the CPU, and leaves it unchanged
+    static Mode GetMode(void);
+    static bool HasPCLMUL(void);
+
 private:
+    static void _Init(void);
     static void GenTab(void);
     uint32 _crc;
-    static uint32 _tab[256];
+    static uint32 _tab[8][256];
     static bool _notab;
+    static Mode _mode;
 };
 
 #endif
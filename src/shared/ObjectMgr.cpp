@@ -6,8 +6,19 @@
 #include "Tile.h"
 #include "SDL_func.h"
 
+#include <algorithm>
+
+// a low priority object that had to wait this many frames is ranked like one with the next higher priority
+#define UPDATE_AGING_FRAMES 8
+
+// min. amount of work per worker thread; below that, the overhead of using more threads is not worth it
+#define PARALLEL_MIN_PHYSICS 32
+#define PARALLEL_MIN_ANIMS 64
+#define PARALLEL_MIN_COLLISION 16
+
 ObjectMgr::ObjectMgr(Engine *e)
-: _curId(0)
+: _curId(0), _updateBudget(0), _updatesRun(0), _updatesDeferred(0), _frame(0), _workers(NULL),
+  _parallelPhysicsIdx(0), _eventIdx(0)
 {
     _engine = e;
 }
@@ -29,6 +40,7 @@ void ObjectMgr::RemoveAll(void)
         _renderLayers[i].clear();
 
     _store.clear();
+    _contacts.clear(); // ids will be reused
     _curId = 0;
 }
 
@@ -39,6 +51,7 @@ uint32 ObjectMgr::Add(BaseObject *obj)
     if(obj->GetType() >= OBJTYPE_OBJECT)
     {
         _renderLayers[((Object*)obj)->GetLayer()].insert((Object*)obj);
+        ((Object*)obj)->_SetLastUpdateTime(Engine::GetCurFrameTime());
     }
     return _curId;
 }
@@ -81,7 +94,12 @@ void ObjectMgr::Update(uint32 diff, float frac, uint32 frametime)
     if(!frac)
         return;
 
-    // first, update all objects, handle physics, movement, etc.
+    ++_frame;
+
+    // native work that does not call into scripts and does not depend on other objects, spread over worker threads
+    _UpdateNative(frac, frametime);
+
+    // now update all objects in order, handle the remaining physics, movement, script calls, etc.
     for(ObjectMap::iterator it = _store.begin(); it != _store.end(); it++)
     {
         ActiveRect *base = (ActiveRect*)it->second;
@@ -91,12 +109,19 @@ void ObjectMgr::Update(uint32 diff, float frac, uint32 frametime)
             Object *obj = (Object*)base;
             _layerMgr->RemoveFromCollisionMap(obj);
 
+            // was the physics update already done in _UpdateNative()?
+            bool physicsDone = false;
+            while(_parallelPhysicsIdx < _parallelPhysics.size() && _parallelPhysics[_parallelPhysicsIdx]->GetId() <= obj->GetId())
+                physicsDone = _parallelPhysics[_parallelPhysicsIdx++] == obj;
+
             // do not touch objects flagged for deletion
             if(base->CanBeDeleted())
                 continue;
 
             // physics
-            if(obj->IsAffectedByPhysics())        // the collision with walls is handled in here. also sets HasMoved() to true if required.
+            if(physicsDone)
+                _DispatchEvents(obj->GetId());
+            else if(obj->IsAffectedByPhysics())    // the collision with walls is handled in here. also sets HasMoved() to true if required.
                 _physMgr->UpdatePhysics(obj, frac); // also takes care of triggering OnTouch() for solid objects vs Players and other specific things
             // update layer sets if changed
             if(obj->_NeedsLayerUpdate())
@@ -105,34 +130,34 @@ void ObjectMgr::Update(uint32 diff, float frac, uint32 frametime)
                 _renderLayers[obj->GetLayer()].insert(obj);
                 obj->_SetLayerUpdated();
             }
-            // update gfx if required
-            if(obj->GetSprite() && obj->GetSprite()->GetType() == TILETYPE_ANIMATED)
-                ((AnimatedTile*)(obj->GetSprite()))->Update(frametime);
 
-            if(obj->IsUpdate())
-                obj->OnUpdate(diff);
+            if(obj->IsUpdate() && obj->IsUpdateDue(frametime))
+            {
+                if(obj->IsUpdateBudgeted())
+                    _pendingUpdates.push_back(obj);
+                else
+                    obj->_DoUpdate(frametime, diff);
+            }
 
             _layerMgr->UpdateCollisionMap(obj);
         }
     }
 
-    // now that every object that should have moved has done so, we can check what collided with what
-    for(ObjectMap::iterator it = _store.begin(); it != _store.end(); it++)
-    {
-        ActiveRect *base = (ActiveRect*)it->second;
+    _RunBudgetedUpdates(diff, frametime);
 
-        // collision detection (object vs object)
-        if(base->CanBeDeleted() || !base->IsCollisionEnabled() || !base->HasMoved())
-            continue;
-
-        // i guess this will be very slow for MANY objects in the game... have to see how this works out
-        for(ObjectMap::iterator jt = _store.begin(); jt != _store.end(); jt++)
+    // now that every object that should have moved has done so, we can check what collided with what.
+    // the pairs are found in parallel, and handled here in the same order as if it was done serially.
+    // as the handlers may move or disable objects, every pair is checked again before.
+    _FindCollisionPairs();
+    for(uint32 p = 0; p < _pairBuffers.size(); ++p)
+    {
+        CollisionPairVector& pairs = _pairBuffers[p];
+        for(uint32 i = 0; i < pairs.size(); ++i)
         {
-            ActiveRect *other = (ActiveRect*)jt->second;
-            // never calculate collision with self, invalid, or non-colliding objects
-            if(base == other || other->CanBeDeleted() || !other->IsCollisionEnabled())
+            ActiveRect *base = pairs[i].first;
+            ActiveRect *other = pairs[i].second;
+            if(base->CanBeDeleted() || !base->IsCollisionEnabled() || other->CanBeDeleted() || !other->IsCollisionEnabled())
                 continue;
-            // skip solid objects, as these are handled in the physics system.
             if(other->GetType() >= OBJTYPE_OBJECT && ((Object*)other)->IsBlocking())
                 continue;
 
@@ -144,6 +169,9 @@ void ObjectMgr::Update(uint32 diff, float frac, uint32 frametime)
         }
     }
 
+    // check the overlaps that were not confirmed above, and end those that are gone
+    _UpdateContacts();
+
     for(ObjectMap::iterator it = _store.begin(); it != _store.end(); )
     {
         BaseObject *obj = it->second;
@@ -162,6 +190,235 @@ void ObjectMgr::Update(uint32 diff, float frac, uint32 frametime)
     }
 }
 
+struct PhysicsJob : public ParallelRange
+{
+    PhysicsJob(PhysicsMgr *pm, ObjectVector& objs, std::vector<ObjectEventBuffer>& bufs, float frac)
+        : physMgr(pm), objs(objs), bufs(bufs), frac(frac) {}
+
+    virtual void Run(uint32 begin, uint32 end, uint32 part)
+    {
+        ObjectEventBuffer& buf = bufs[part];
+        for(uint32 i = begin; i < end; ++i)
+            physMgr->UpdatePhysics(objs[i], frac, &buf);
+    }
+
+    PhysicsMgr *physMgr;
+    ObjectVector& objs;
+    std::vector<ObjectEventBuffer>& bufs;
+    float frac;
+};
+
+struct AnimJob : public ParallelRange
+{
+    AnimJob(std::vector<AnimatedTile*>& tiles, uint32 frametime) : tiles(tiles), frametime(frametime) {}
+
+    virtual void Run(uint32 begin, uint32 end, uint32 part)
+    {
+        for(uint32 i = begin; i < end; ++i)
+            tiles[i]->Update(frametime);
+    }
+
+    std::vector<AnimatedTile*>& tiles;
+    uint32 frametime;
+};
+
+struct CollisionPairJob : public ParallelRange
+{
+    CollisionPairJob(ActiveRectVector& movers, ActiveRectVector& all, std::vector<CollisionPairVector>& bufs)
+        : movers(movers), all(all), bufs(bufs) {}
+
+    virtual void Run(uint32 begin, uint32 end, uint32 part)
+    {
+        CollisionPairVector& buf = bufs[part];
+        for(uint32 i = begin; i < end; ++i)
+        {
+            ActiveRect *base = movers[i];
+            for(uint32 j = 0; j < all.size(); ++j)
+            {
+                ActiveRect *other = all[j];
+                // never calculate collision with self
+                if(base != other && base->CollisionWith(other))
+                    buf.push_back(std::make_pair(base, other));
+            }
+        }
+    }
+
+    ActiveRectVector& movers;
+    ActiveRectVector& all;
+    std::vector<CollisionPairVector>& bufs;
+};
+
+uint32 ObjectMgr::_GetPartCount(uint32 count, uint32 minPerPart) const
+{
+    if(!_workers)
+        return count ? 1 : 0;
+    return _workers->GetPartCount(count, minPerPart);
+}
+
+void ObjectMgr::_RunParallel(ParallelRange& job, uint32 count, uint32 minPerPart)
+{
+    if(_workers)
+        _workers->ParallelFor(job, count, minPerPart);
+    else if(count)
+        job.Run(0, count, 0);
+}
+
+// Physics of objects that can not push other objects (and therefore do not need to know where other objects are)
+// and animations are updated here. Script callbacks are not called directly, but stored per worker and called
+// later via _DispatchEvents(), in order of object ids.
+// The collision map is not changed while this runs, blocking objects are handled later in the serial update.
+void ObjectMgr::_UpdateNative(float frac, uint32 frametime)
+{
+    _parallelPhysics.clear();
+    _animTiles.clear();
+    for(ObjectMap::iterator it = _store.begin(); it != _store.end(); it++)
+    {
+        BaseObject *base = it->second;
+        if(base->GetType() < OBJTYPE_OBJECT || ((ActiveRect*)base)->CanBeDeleted())
+            continue;
+        Object *obj = (Object*)base;
+
+        // must match 'selectNearby' in PhysicsMgr::UpdatePhysics()
+        if(obj->IsAffectedByPhysics() && obj->GetType() < OBJTYPE_PLAYER && !obj->IsBlocking())
+            _parallelPhysics.push_back(obj);
+
+        if(obj->GetSprite() && obj->GetSprite()->GetType() == TILETYPE_ANIMATED)
+            _animTiles.push_back((AnimatedTile*)obj->GetSprite());
+    }
+
+    // sprites can be shared, update each only once
+    std::sort(_animTiles.begin(), _animTiles.end());
+    _animTiles.erase(std::unique(_animTiles.begin(), _animTiles.end()), _animTiles.end());
+    AnimJob anims(_animTiles, frametime);
+    _RunParallel(anims, _animTiles.size(), PARALLEL_MIN_ANIMS);
+
+    uint32 parts = _GetPartCount(_parallelPhysics.size(), PARALLEL_MIN_PHYSICS);
+    if(_eventBuffers.size() < parts)
+        _eventBuffers.resize(parts);
+    for(uint32 i = 0; i < _eventBuffers.size(); ++i)
+        _eventBuffers[i].clear();
+    PhysicsJob physics(_physMgr, _parallelPhysics, _eventBuffers, frac);
+    _RunParallel(physics, _parallelPhysics.size(), PARALLEL_MIN_PHYSICS);
+
+    // the parts are ordered, so this is ordered by object id
+    _events.clear();
+    for(uint32 i = 0; i < parts; ++i)
+        _events.insert(_events.end(), _eventBuffers[i].begin(), _eventBuffers[i].end());
+    _eventIdx = 0;
+    _parallelPhysicsIdx = 0;
+}
+
+// calls the script callbacks stored for object <id> in _UpdateNative()
+void ObjectMgr::_DispatchEvents(uint32 id)
+{
+    for( ; _eventIdx < _events.size() && _events[_eventIdx].objId <= id; ++_eventIdx)
+    {
+        const ObjectEvent& evt = _events[_eventIdx];
+        if(evt.objId != id)
+            continue; // object was skipped
+        Object *obj = (Object*)Get(id);
+        if(!obj || obj->CanBeDeleted())
+            continue;
+        switch(evt.type)
+        {
+            case OBJEVENT_TOUCH:
+            {
+                ActiveRect *target = (ActiveRect*)Get(evt.otherId);
+                if(target && !target->CanBeDeleted())
+                {
+                    obj->OnTouch(evt.side, target);
+                    target->OnTouchedBy(InvertSide(evt.side), obj);
+                }
+                break;
+            }
+
+            case OBJEVENT_TOUCH_WALL:
+                obj->OnTouchWall(evt.side, evt.xspeed, evt.yspeed);
+                if(!obj->CanBeDeleted())
+                    _physMgr->Bounce(obj, evt.moveDir); // as in the serial update, the callback sees the speed before it
+                break;
+        }
+    }
+}
+
+// collects the pairs of objects that overlap, where the first one has moved.
+void ObjectMgr::_FindCollisionPairs(void)
+{
+    _collidables.clear();
+    _movers.clear();
+    for(ObjectMap::iterator it = _store.begin(); it != _store.end(); it++)
+    {
+        ActiveRect *obj = (ActiveRect*)it->second;
+        if(obj->CanBeDeleted() || !obj->IsCollisionEnabled())
+            continue;
+        if(obj->HasMoved())
+            _movers.push_back(obj);
+        // skip solid objects, as these are handled in the physics system.
+        if(obj->GetType() < OBJTYPE_OBJECT || !((Object*)obj)->IsBlocking())
+            _collidables.push_back(obj);
+    }
+
+    uint32 parts = _GetPartCount(_movers.size(), PARALLEL_MIN_COLLISION);
+    _pairBuffers.resize(parts);
+    for(uint32 i = 0; i < parts; ++i)
+        _pairBuffers[i].clear();
+    CollisionPairJob job(_movers, _collidables, _pairBuffers);
+    _RunParallel(job, _movers.size(), PARALLEL_MIN_COLLISION);
+}
+
+struct BudgetedUpdateOrder
+{
+    inline static int32 rank(const Object *obj)
+    {
+        return int32(obj->GetUpdatePriority() * UPDATE_AGING_FRAMES) - int32(obj->GetUpdateDeferCount());
+    }
+    inline bool operator()(const Object *a, const Object *b) const
+    {
+        int32 ra = rank(a), rb = rank(b);
+        if(ra != rb)
+            return ra < rb;
+        return a->GetId() < b->GetId(); // keep the order stable between frames
+    }
+};
+
+// Calls OnUpdate() on all due objects that have a priority other than UPDATE_PRIO_ALWAYS,
+// most important first, until the time budget for this frame is used up.
+// Objects that did not get their turn stay due, and rank higher in the next frame.
+void ObjectMgr::_RunBudgetedUpdates(uint32 diff, uint32 frametime)
+{
+    _updatesRun = 0;
+    _updatesDeferred = 0;
+    if(_pendingUpdates.empty())
+        return;
+
+    std::sort(_pendingUpdates.begin(), _pendingUpdates.end(), BudgetedUpdateOrder());
+
+    uint32 start = SDL_GetTicks();
+    uint32 i = 0;
+    for( ; i < _pendingUpdates.size(); ++i)
+    {
+        // always process at least one object per frame, so that everything makes progress eventually
+        if(_updateBudget && i && SDL_GetTicks() - start >= _updateBudget)
+            break;
+
+        Object *obj = _pendingUpdates[i];
+        if(obj->CanBeDeleted())
+            continue;
+
+        // the object may move in OnUpdate(), but its collision map entry was already written
+        _layerMgr->RemoveFromCollisionMap(obj);
+        obj->_DoUpdate(frametime, diff);
+        _layerMgr->UpdateCollisionMap(obj);
+    }
+    _updatesRun = i;
+    _updatesDeferred = _pendingUpdates.size() - i;
+
+    for( ; i < _pendingUpdates.size(); ++i)
+        _pendingUpdates[i]->_DeferUpdate();
+
+    _pendingUpdates.clear();
+}
+
 // <base> is the object that has moved, usually; <side> is <base's> side where <other> collided with it
 void ObjectMgr::HandleObjectCollision(ActiveRect *base, ActiveRect *other, uint8 side)
 {
@@ -184,18 +441,87 @@ void ObjectMgr::HandleObjectCollision(ActiveRect *base, ActiveRect *other, uint8
                 //       (but this can be done in falcon too.. i think)
                 base->x = xold;
                 base->y = yold;
-                base->OnEnter(side, other);
-                other->OnEnteredBy(InvertSide(side), base);
+                if(_BeginContact(base, other, side))
+                {
+                    base->OnEnter(side, other);
+                    other->OnEnteredBy(InvertSide(side), base);
+                }
             }
         }
     }
-    else
+    else if(_BeginContact(base, other, side))
     {
         base->OnEnter(side, other);
         other->OnEnteredBy(InvertSide(side), base);
     }
 }
 
+inline static uint64 ContactKey(uint32 a, uint32 b)
+{
+    return a < b ? (uint64(a) << 32) | b : (uint64(b) << 32) | a;
+}
+
+// returns true if the objects did not overlap before, i.e. OnEnter() should be called
+bool ObjectMgr::_BeginContact(ActiveRect *enterer, ActiveRect *other, uint8 side)
+{
+    uint64 key = ContactKey(enterer->GetId(), other->GetId());
+    if(ObjectContact *c = _contacts.find(key))
+    {
+        c->lastSeen = _frame;
+        return false;
+    }
+    ObjectContact c;
+    c.enterer = enterer->GetId();
+    c.lastSeen = _frame;
+    c.side = side;
+    _contacts.insert(key, c);
+    return true;
+}
+
+// Overlaps that were not seen by the collision detection this frame (it only checks objects that moved)
+// are tested again here. Ended contacts trigger OnLeave() and OnLeftBy().
+void ObjectMgr::_UpdateContacts(void)
+{
+    if(_contacts.empty())
+        return;
+
+    std::vector<uint64> ended;
+    for(ContactMap::iterator it = _contacts.begin(); it != _contacts.end(); ++it)
+    {
+        ObjectContact& c = it.value();
+        if(c.lastSeen == _frame)
+            continue;
+
+        uint32 id1 = uint32(it.key() >> 32), id2 = uint32(it.key());
+        ActiveRect *a = (ActiveRect*)Get(id1);
+        ActiveRect *b = (ActiveRect*)Get(id2);
+        if(a && b && !a->CanBeDeleted() && !b->CanBeDeleted()
+            && a->IsCollisionEnabled() && b->IsCollisionEnabled() && a->CollisionWith(b))
+        {
+            c.lastSeen = _frame;
+            continue;
+        }
+        ended.push_back(it.key());
+    }
+
+    // the callbacks may add or remove objects, so the contacts are not iterated anymore here
+    for(uint32 i = 0; i < ended.size(); ++i)
+    {
+        ObjectContact c = *_contacts.find(ended[i]);
+        _contacts.erase(ended[i]);
+
+        uint32 otherId = c.enterer == uint32(ended[i]) ? uint32(ended[i] >> 32) : uint32(ended[i]);
+        ActiveRect *enterer = (ActiveRect*)Get(c.enterer);
+        ActiveRect *other = (ActiveRect*)Get(otherId);
+        if(!(enterer && other))
+            continue; // already removed, and unbound from scripts
+        if(!enterer->CanBeDeleted())
+            enterer->OnLeave(c.side, other);
+        if(!other->CanBeDeleted())
+            other->OnLeftBy(InvertSide(c.side), enterer);
+    }
+}
+
 
 // this renders the objects.
 // it is called from LayerMgr::Render(), so that objects on higher layers are drawn over objects on lower layers
@@ -6,14 +6,31 @@
 #include <list>
 
 #include "LayerMgr.h"
+#include "FlatHashMap.h"
+#include "ThreadPool.h"
+#include "PhysicsSystem.h"
 
 class BaseObject;
 class PhysicsMgr;
 class AppFalconGame;
+class ThreadPool;
 
 typedef std::map<uint32, BaseObject*> ObjectMap;
 typedef std::set<Object*> ObjectSet;
 typedef std::set<std::pair<BaseObject*,uint8> > ObjectWithSideSet;
+typedef std::vector<Object*> ObjectVector;
+
+// two overlapping objects. the ids of both are encoded in the key of the ContactMap.
+struct ObjectContact
+{
+    uint32 enterer; // id of the object that moved into the other one
+    uint32 lastSeen; // frame in which the overlap was last confirmed
+    uint8 side; // enterer's side where the other object is
+};
+typedef FlatHashMap<uint64, ObjectContact> ContactMap;
+
+typedef std::vector<ActiveRect*> ActiveRectVector;
+typedef std::vector<std::pair<ActiveRect*, ActiveRect*> > CollisionPairVector;
 
 
 class ObjectMgr
@@ -38,11 +55,27 @@ public:
 
     inline void SetPhysicsMgr(PhysicsMgr *pm) { _physMgr = pm; }
     inline void SetLayerMgr(LayerMgr *layers) {_layerMgr = layers; }
+    inline void SetThreadPool(ThreadPool *pool) { _workers = pool; } // NULL to do everything in the calling thread
+
+    // max. time in ms per frame spent in OnUpdate() calls of objects with a priority other than UPDATE_PRIO_ALWAYS, 0 = no limit
+    inline void SetUpdateBudget(uint32 ms) { _updateBudget = ms; }
+    inline uint32 GetUpdateBudget(void) const { return _updateBudget; }
+    inline uint32 GetLastUpdatesRun(void) const { return _updatesRun; }
+    inline uint32 GetLastUpdatesDeferred(void) const { return _updatesDeferred; }
+    inline uint32 GetContactCount(void) const { return _contacts.size(); }
 
     void dbg_setcoll(bool b);
 
 protected:
     ObjectMap::iterator _Remove(uint32 id);
+    void _RunBudgetedUpdates(uint32 diff, uint32 frametime);
+    bool _BeginContact(ActiveRect *enterer, ActiveRect *other, uint8 side);
+    void _UpdateContacts(void);
+    void _UpdateNative(float frac, uint32 frametime);
+    void _FindCollisionPairs(void);
+    void _DispatchEvents(uint32 id);
+    void _RunParallel(ParallelRange& job, uint32 count, uint32 minPerPart);
+    uint32 _GetPartCount(uint32 count, uint32 minPerPart) const;
 
     uint32 _curId;
     ObjectMap _store;
@@ -50,6 +83,24 @@ protected:
     LayerMgr *_layerMgr;
     Engine *_engine;
     ObjectSet _renderLayers[LAYER_MAX];
+    ObjectVector _pendingUpdates; // due objects that are subject to the update budget, valid only during Update()
+    uint32 _updateBudget;
+    uint32 _updatesRun; // stats of the last frame, budgeted objects only
+    uint32 _updatesDeferred;
+    ContactMap _contacts; // pairs of objects that currently overlap
+    uint32 _frame;
+
+    // state of the parallel parts of Update(). kept here to re-use the memory every frame.
+    ThreadPool *_workers;
+    ObjectVector _parallelPhysics; // objects whose physics can be done in worker threads, ordered by id
+    uint32 _parallelPhysicsIdx;
+    std::vector<AnimatedTile*> _animTiles;
+    std::vector<ObjectEventBuffer> _eventBuffers; // one per part of the parallel physics update
+    ObjectEventBuffer _events; // all of the above, ordered by object id
+    uint32 _eventIdx; // next event to dispatch
+    ActiveRectVector _collidables;
+    ActiveRectVector _movers;
+    std::vector<CollisionPairVector> _pairBuffers;
 
 };
 
@@ -7,6 +7,12 @@
 
 #include "UndefUselessCrap.h"
 
+// projectiles and the like are spawned and removed frequently, keep their memory around
+IMPLEMENT_POOLED_ALLOC(ActiveRect, 64)
+IMPLEMENT_POOLED_ALLOC(Object, 64)
+IMPLEMENT_POOLED_ALLOC(Unit, 32)
+IMPLEMENT_POOLED_ALLOC(Player, 8)
+
 BaseObject::BaseObject()
 {
     _falObj = NULL;
@@ -17,6 +23,10 @@ BaseObject::BaseObject()
 BaseObject::~BaseObject()
 {
     DEBUG(logdebug("~BaseObject "PTRFMT, this));
+
+    // the memory of this object will be reused, others must not keep pointers to it
+    DetachFromAll();
+    DetachAllFromThis();
 }
 
 // single-directional non-recursive DFS graph search
@@ -32,7 +42,7 @@ void BaseObject::GetAttached(std::set<BaseObject*>& found) const
         pending.pop();
         found.insert(const_cast<BaseObject*>(obj));
 
-        for(std::set<BaseObject*>::const_iterator it = obj->_children.begin(); it != obj->_children.end(); ++it)
+        for(AttachedObjects::const_iterator it = obj->_children.begin(); it != obj->_children.end(); ++it)
         {
             if(found.find(*it) == found.end())
                 pending.push(*it);
@@ -244,6 +254,20 @@ void Object::_GenericInit(void)
     _blocking = false;
     _update = true;
     _visible = true;
+    _updatePrio = UPDATE_PRIO_ALWAYS;
+    _updateInterval = 0;
+    _lastUpdate = 0;
+    _updateDeferred = 0;
+}
+
+void Object::_DoUpdate(uint32 now, uint32 diff)
+{
+    // objects updated every frame get the plain frame time diff.
+    // the game time can be reset by scripts, in this case the last frame's time diff is the best guess, too.
+    uint32 elapsed = (_updateInterval || _updateDeferred) && now >= _lastUpdate ? now - _lastUpdate : diff;
+    _lastUpdate = now;
+    _updateDeferred = 0;
+    OnUpdate(elapsed);
 }
 
 void Object::SetSprite(BasicTile *tile)
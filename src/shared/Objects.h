@@ -5,6 +5,8 @@
 #include "SharedStructs.h"
 #include "PhysicsSystem.h"
 #include "DelayedDeletable.h"
+#include "BlockPool.h"
+#include "SmallVector.h"
 
 /*
  * NOTE: The OnEnter(), OnLeave(), OnWhatever() functions are defined in FalconObjectModule.cpp !!
@@ -24,6 +26,19 @@ enum ObjectType
     OBJTYPE_PLAYER  = 3
 };
 
+// controls how ObjectMgr::Update() schedules OnUpdate() calls
+enum UpdatePriority
+{
+    UPDATE_PRIO_ALWAYS = 0, // called whenever due, not subject to the frame budget (default)
+    UPDATE_PRIO_HIGH   = 1, // lower priorities are deferred to later frames first if the budget is exceeded
+    UPDATE_PRIO_NORMAL = 2,
+    UPDATE_PRIO_LOW    = 3,
+
+    UPDATE_PRIO_MAX
+};
+
+typedef SmallVector<BaseObject*, 4> AttachedObjects; // most objects have none or very few attachments
+
 // basic object class, defines shared properties but can't be instantiated
 class BaseObject : public DelayedDeletable
 {
@@ -34,8 +49,8 @@ public:
     virtual ~BaseObject();
     virtual void Init(void) = 0;
 
-    inline uint32 GetId(void) { return _id; }
-    inline uint8 GetType(void) { return type; }
+    inline uint32 GetId(void) const { return _id; }
+    inline uint8 GetType(void) const { return type; }
     inline void SetLayerMgr(LayerMgr *mgr) { _layermgr = mgr; }
 
     void unbind(void); // clears bindings from falcon, should be called before deletion
@@ -45,26 +60,26 @@ public:
     void GetAttached(std::set<BaseObject*>& found) const;
 
     // attach this object to another
-    inline void AttachTo(BaseObject *other){ _parents.insert(other); other->_children.insert(this); }
+    inline void AttachTo(BaseObject *other){ _parents.insert_unique(other); other->_children.insert_unique(this); }
 
     // attach another object to this
-    inline void AttachToThis(BaseObject *who) { _children.insert(who); who->_parents.insert(this); }
+    inline void AttachToThis(BaseObject *who) { _children.insert_unique(who); who->_parents.insert_unique(this); }
 
     // detach this object from others
-    inline void DetachFrom(BaseObject *other) { _parents.erase(other); other->_children.erase(this); }
+    inline void DetachFrom(BaseObject *other) { _parents.erase_value(other); other->_children.erase_value(this); }
     inline void DetachFromAll(void)
     {
-        for(std::set<BaseObject*>::iterator it = _parents.begin(); it != _parents.end(); ++it)
-            (*it)->_children.erase(this);
+        for(AttachedObjects::iterator it = _parents.begin(); it != _parents.end(); ++it)
+            (*it)->_children.erase_value(this);
         _parents.clear();
     }
 
     // detach other objects from this
-    inline void DetachFromThis(BaseObject *who) { _children.erase(who); who->_parents.erase(this); }
+    inline void DetachFromThis(BaseObject *who) { _children.erase_value(who); who->_parents.erase_value(this); }
     inline void DetachAllFromThis(void)
     {
-        for(std::set<BaseObject*>::iterator it = _children.begin(); it != _children.end(); ++it)
-            (*it)->_parents.erase(this);
+        for(AttachedObjects::iterator it = _children.begin(); it != _children.end(); ++it)
+            (*it)->_parents.erase_value(this);
         _children.clear();
     }
     
@@ -72,8 +87,8 @@ public:
     FalconProxyObject *_falObj;
 
 protected:
-    std::set<BaseObject*> _children; // objects that are attached to this one
-    std::set<BaseObject*> _parents;  // objects this object is attached to
+    AttachedObjects _children; // objects that are attached to this one
+    AttachedObjects _parents;  // objects this object is attached to
     LayerMgr *_layermgr; // required for collision checks
     uint32 _id;
     uint8 type;
@@ -86,16 +101,18 @@ protected:
 class ActiveRect : public BaseObject, public BaseRect
 {
 public:
+    DECLARE_POOLED_ALLOC
+
     virtual void Init(void);
 
     // see SharedDefines.h for the sides enum
     // TODO: use vector physics here
     virtual void OnEnter(uint8 side, ActiveRect *who);
-    virtual void OnLeave(uint8 side, ActiveRect *who); // TODO: NYI
+    virtual void OnLeave(uint8 side, ActiveRect *who);
     virtual bool OnTouch(uint8 side, ActiveRect *who);
 
     virtual void OnEnteredBy(uint8 side, ActiveRect *who);
-    virtual void OnLeftBy(uint8 side, ActiveRect *who); // TODO: NYI
+    virtual void OnLeftBy(uint8 side, ActiveRect *who);
     virtual bool OnTouchedBy(uint8 side, ActiveRect *who);
 
     // These take care of moving all objects that are attached to this as well.
@@ -139,6 +156,8 @@ protected:
 class Object : public ActiveRect
 {
 public:
+    DECLARE_POOLED_ALLOC
+
     virtual ~Object();
     virtual void Init(void);
 
@@ -157,6 +176,18 @@ public:
     inline void SetVisible(bool b) { _visible = b; }
     inline bool IsVisible(void) const { return _visible; }
 
+    // update scheduling, see ObjectMgr::Update()
+    inline void SetUpdateInterval(uint32 ms) { _updateInterval = ms; }
+    inline uint32 GetUpdateInterval(void) const { return _updateInterval; }
+    inline void SetUpdatePriority(uint8 prio) { _updatePrio = prio; }
+    inline uint8 GetUpdatePriority(void) const { return _updatePrio; }
+    inline bool IsUpdateBudgeted(void) const { return _updatePrio != UPDATE_PRIO_ALWAYS; }
+    inline bool IsUpdateDue(uint32 now) const { return now < _lastUpdate || now - _lastUpdate >= _updateInterval; }
+    inline uint32 GetUpdateDeferCount(void) const { return _updateDeferred; }
+    inline void _SetLastUpdateTime(uint32 t) { _lastUpdate = t; }
+    inline void _DeferUpdate(void) { ++_updateDeferred; }
+    void _DoUpdate(uint32 now, uint32 diff); // calls OnUpdate() with the time passed since the last call
+
     void SetSprite(BasicTile *tile);
     inline BasicTile *GetSprite(void) { return _gfx; }
 
@@ -177,12 +208,18 @@ protected:
     bool _physicsAffected;
     bool _blocking; // true if this object affects the LayerMgr's CollisionMap
     bool _visible;
+    uint8 _updatePrio; // UpdatePriority
+    uint32 _updateInterval; // min. time between 2 OnUpdate() calls, 0 = every frame
+    uint32 _lastUpdate; // game time of the last OnUpdate() call
+    uint32 _updateDeferred; // frames this object was due for an update, but had to wait because of the budget
 };
 
 // unit, most likely some NPC, enemy, or player
 class Unit : public Object
 {
 public:
+    DECLARE_POOLED_ALLOC
+
     virtual void Init(void);
 };
 
@@ -190,6 +227,8 @@ public:
 class Player : public Unit
 {
 public:
+    DECLARE_POOLED_ALLOC
+
     virtual void Init(void);
 
 };
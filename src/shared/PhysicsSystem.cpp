@@ -18,7 +18,7 @@ void PhysicsMgr::SetDefaults(void)
     envPhys.gravity = 0.0f;
 }
 
-void PhysicsMgr::UpdatePhysics(Object *obj, float tf)
+void PhysicsMgr::UpdatePhysics(Object *obj, float tf, ObjectEventBuffer *events /* = NULL */)
 {
     // affected by physics already checked in ObjectMgr::Update
 
@@ -187,6 +187,18 @@ void PhysicsMgr::UpdatePhysics(Object *obj, float tf)
                     continue;
                 if(target->IsBlocking() && target->IsCollisionEnabled())
                 {
+                    if(events)
+                    {
+                        ObjectEvent evt;
+                        evt.type = OBJEVENT_TOUCH;
+                        evt.objId = obj->GetId();
+                        evt.otherId = target->GetId();
+                        evt.side = it->second | SIDE_FLAG_SOLID;
+                        evt.xspeed = evt.yspeed = 0.0f;
+                        evt.moveDir = DIRECTION_NONE;
+                        events->push_back(evt);
+                        continue;
+                    }
                     obj->OnTouch(it->second | SIDE_FLAG_SOLID, target);
                     target->OnTouchedBy(InvertSide(it->second) | SIDE_FLAG_SOLID, obj); // TODO: return value?
                 }
@@ -212,6 +224,7 @@ void PhysicsMgr::UpdatePhysics(Object *obj, float tf)
             float disty = abs(newRect.y - obj->y);
             uint8 actualDir = DIRECTION_NONE;
             bool definiteWallCollision = false;
+            uint8 bounceDir = direction;
 
             if(dirx && diry)
                 pdia = _layerMgr->GetNonCollidingPoint(obj, direction, 1 + (uint32)std::max(distx, disty));
@@ -275,21 +288,27 @@ void PhysicsMgr::UpdatePhysics(Object *obj, float tf)
 
             if(definiteWallCollision || (actualDir /*&& Point((uint32)obj->x, (uint32)obj->y) != pcur*/ && !_layerMgr->CanMoveToDirection(obj, actualDir)))
             {
-                obj->OnTouchWall(actualDir, phys.xspeed, phys.yspeed); // if we are going right, the wall hits us right...
+                if(events)
+                {
+                    ObjectEvent evt;
+                    evt.type = OBJEVENT_TOUCH_WALL;
+                    evt.objId = obj->GetId();
+                    evt.otherId = 0;
+                    evt.side = actualDir;
+                    evt.xspeed = phys.xspeed;
+                    evt.yspeed = phys.yspeed;
+                    evt.moveDir = direction;
+                    events->push_back(evt);
+                    bounceDir = DIRECTION_NONE; // in ObjectMgr::_DispatchEvents(), after the callback, as below
+                }
+                else
+                    obj->OnTouchWall(actualDir, phys.xspeed, phys.yspeed); // if we are going right, the wall hits us right...
                 phys._wallTouched = true;
             }
 
             // -- end of messy part --
 
-            // now check where we can move from this position
-            if(dirx && !_layerMgr->CanMoveToDirection(obj, dirx))
-            {
-                phys.xspeed *= -(dirx & DIRECTION_LEFT ? phys.lbounce : phys.rbounce);
-            }
-            if(diry && !_layerMgr->CanMoveToDirection(obj, diry))
-            {
-                phys.yspeed *= -(diry & DIRECTION_UP ? phys.ubounce : phys.dbounce);
-            }
+            Bounce(obj, bounceDir);
         }
     }
 
@@ -302,3 +321,20 @@ void PhysicsMgr::UpdatePhysics(Object *obj, float tf)
     phys._lastx = begin_x;
     phys._lasty = begin_y;
 }
+
+void PhysicsMgr::Bounce(Object *obj, uint8 moveDir)
+{
+    PhysProps& phys = obj->phys;
+    uint8 dirx = moveDir & (DIRECTION_LEFT | DIRECTION_RIGHT);
+    uint8 diry = moveDir & (DIRECTION_UP | DIRECTION_DOWN);
+
+    // check where we can move from this position
+    if(dirx && !_layerMgr->CanMoveToDirection(obj, dirx))
+    {
+        phys.xspeed *= -(dirx & DIRECTION_LEFT ? phys.lbounce : phys.rbounce);
+    }
+    if(diry && !_layerMgr->CanMoveToDirection(obj, diry))
+    {
+        phys.yspeed *= -(diry & DIRECTION_UP ? phys.ubounce : phys.dbounce);
+    }
+}
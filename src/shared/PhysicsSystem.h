@@ -1,6 +1,8 @@
 #ifndef PHYSICSSYSTEM_H
 #define PHYSICSSYSTEM_H
 
+#include <vector>
+
 class LayerMgr;
 class Object;
 class ObjectMgr;
@@ -41,12 +43,33 @@ struct EnvPhysProps
     float gravity;
 };
 
+enum ObjectEventType
+{
+    OBJEVENT_TOUCH, // OnTouch() + OnTouchedBy()
+    OBJEVENT_TOUCH_WALL // OnTouchWall()
+};
+
+// script callback that was not called directly, because the physics of the object were calculated in a worker thread
+struct ObjectEvent
+{
+    uint32 objId;
+    uint32 otherId;
+    float xspeed;
+    float yspeed;
+    uint8 type;
+    uint8 side;
+    uint8 moveDir; // OBJEVENT_TOUCH_WALL: directions the object moved in, it bounces off walls there after the callback
+};
+typedef std::vector<ObjectEvent> ObjectEventBuffer;
+
 class PhysicsMgr
 {
 public:
     PhysicsMgr();
     void SetDefaults(void);
-    void UpdatePhysics(Object *obj, float frac);
+    // if events is not NULL, callbacks are stored there instead of being called
+    void UpdatePhysics(Object *obj, float frac, ObjectEventBuffer *events = NULL);
+    void Bounce(Object *obj, uint8 moveDir); // inverts the speed towards walls the object moved against
 
     EnvPhysProps envPhys;
     
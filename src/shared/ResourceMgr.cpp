@@ -10,6 +10,8 @@
 
 #include "VFSHelper.h"
 #include "VFSFile.h"
+#include "VFSFileLVPA.h"
+#include "LVPAStream.h"
 
 // internally referenced files get this postfix to make the file ref map happy
 #define FILENAME_TMP_INDIC "|tmp"
@@ -18,7 +20,8 @@
 static uint8 g_emptyData[] = {0, 0, 0, 0}; // this is never freed. must be >= 4 bytes.
 
 ResourceMgr::ResourceMgr()
-: _usedMem(0)
+: _unusedHead(NULL), _unusedTail(NULL), _unusedMem(0), _memBudget(0), _hits(0), _misses(0), _evictions(0),
+  _usedMem(0), _workers(NULL)
 {
 }
 
@@ -30,11 +33,11 @@ void ResourceMgr::DbgCheckEmpty(void)
 {
     for(FileRefMap::iterator it = _frmap.begin(); it != _frmap.end(); ++it)
     {
-        DEBUG(logerror("ResourceMgr: File not unloaded: '%s' ptr "PTRFMT, it->first.c_str(), it->second));
+        DEBUG(logerror("ResourceMgr: File not unloaded: '%s' ptr "PTRFMT, it.key().c_str(), it.value()->ptr));
     }
     for(PtrCountMap::iterator it = _ptrmap.begin(); it != _ptrmap.end(); ++it)
     {
-        DEBUG(logerror("ResourceMgr: Ptr not unloaded: "PTRFMT" count %u", it->first, it->second.count));
+        DEBUG(logerror("ResourceMgr: Ptr not unloaded: "PTRFMT" count %u", it.key(), it.value()->count));
     }
 
     if(*((uint32*)&g_emptyData[0])) // its exactly 4 bytes wide
@@ -43,26 +46,52 @@ void ResourceMgr::DbgCheckEmpty(void)
     }
 }
 
-void ResourceMgr::DropUnused(void)
+void ResourceMgr::DropUnused(bool keepWarm /* = false */)
 {
     pool.Cleanup();
 
-    uint32 c;
-    do // Anims contain references to SDL_Surfaces, which may be skipped if the Anim is deleted after the
-    {  // Surface's count is checked. iterate over tiles again in case we deleted something in the previous loop.
-        c = _ptrmap.size();
-        for(PtrCountMap::iterator it = _ptrmap.begin(); it != _ptrmap.end(); )
-        {
-            if(!it->second.count)
-            {
-                _Delete(it->first, it->second);
-                _ptrmap.erase(it++);
-            }
-            else
-                ++it;
-        }
+    if(keepWarm && _memBudget)
+    {
+        _Trim();
+        return;
+    }
+
+    // Anims contain references to SDL_Surfaces, and music to its file data. deleting those drops
+    // the last reference to what they depend on, which is then appended to the list and deleted in the same loop.
+    while(_unusedHead)
+        _Delete(_unusedHead);
+}
+
+void ResourceMgr::SetMemBudget(uint32 bytes)
+{
+    _memBudget = bytes;
+    _Trim();
+}
+
+// evicts unused resources, least recently used first, until the budget is met
+void ResourceMgr::_Trim(void)
+{
+    while(_memBudget && _usedMem > _memBudget && _unusedHead)
+    {
+        ++_evictions;
+        _Delete(_unusedHead);
     }
-    while(_ptrmap.size() != c);
+}
+
+void *ResourceMgr::_GetPtr(const std::string& fn)
+{
+    ResStruct **resp = _frmap.find(fn);
+    if(!resp)
+        return NULL;
+    ResStruct *res = *resp;
+    // an unused resource may be outdated, if the VFS now has another file under its name
+    if(!res->count && vfs.GetFile(res->file.c_str()) != res->vf)
+    {
+        logdebug("ResourceMgr: '%s' has changed, dropping old "PTRFMT, fn.c_str(), res->ptr);
+        _Delete(res);
+        return NULL;
+    }
+    return res->ptr;
 }
 
 uint32 ResourceMgr::GetUsedCount(void)
@@ -92,22 +121,52 @@ void ResourceMgr::_unaccountMem(uint32 bytes)
     //_memMutex.unlock();
 }
 
-void ResourceMgr::_InitRef(void *ptr, ResourceType rt, void *depdata /* = NULL */, SDL_RWops *rwop /* = NULL */)
+void ResourceMgr::_InitRef(const std::string& fn, void *ptr, ResourceType rt, void *depdata /* = NULL */, SDL_RWops *rwop /* = NULL */)
 {
     DEBUG(ASSERT(ptr != NULL));
     if(!ptr)
         return;
 
-    _ptrmap[ptr] = ResStruct(rt, depdata, rwop);
+    ResStruct *res = new ResStruct(fn, ptr, rt, depdata, rwop);
+    if(!_ptrmap.insert(ptr, res))
+    {
+        logerror("ResourceMgr::_InitRef("PTRFMT") - already reference counted ('%s')", ptr, fn.c_str());
+        delete res;
+        return;
+    }
+    _frmap[fn] = res; // a resource replaced this way is still deleted properly, but can't be found by name anymore
+
+    // remember where it came from, to detect changes while it is unused. props and postfixes are not part of the file name.
+    res->file = fn.substr(0, fn.find_first_of(":|"));
+    res->vf = vfs.GetFile(res->file.c_str());
+    if(res->vf)
+        res->vf->ref++;
+
+    switch(rt)
+    {
+        case RESTYPE_MEMBLOCK:    res->mem = ((memblock*)ptr)->size; break;
+        case RESTYPE_SDL_SURFACE: res->mem = SDLfunc_GetSurfaceBytes((SDL_Surface*)ptr); break;
+        case RESTYPE_MIX_CHUNK:   res->mem = ((Mix_Chunk*)ptr)->alen; break;
+        default:                  res->mem = 0; // what they use is accounted for with the resources they depend on
+    }
+    _accountMem(res->mem);
+    ++_misses;
+    _Trim();
 }
 
 void ResourceMgr::_IncRef(void *ptr)
 {
     DEBUG(ASSERT(ptr != NULL));
 
-    PtrCountMap::iterator it = _ptrmap.find(ptr);
-    if(it != _ptrmap.end())
-        Falcon::atomicInc(it->second.count);
+    ResStruct **res = _ptrmap.find(ptr);
+    if(res)
+    {
+        if(Falcon::atomicInc((*res)->count) == 1)
+        {
+            _UnlinkUnused(*res); // used again
+            ++_hits;
+        }
+    }
     else
         logerror("IncRef: "PTRFMT" not reference counted!", ptr);
 }
@@ -116,26 +175,29 @@ void ResourceMgr::_DecRef(void *ptr, bool del /* = false */)
 {
     DEBUG(ASSERT(ptr != NULL));
 
-    PtrCountMap::iterator it = _ptrmap.find(ptr);
-    if(it != _ptrmap.end())
+    ResStruct **resp = _ptrmap.find(ptr);
+    if(resp)
     {
-        if(!it->second.count) // if we do proper refcounting, we should never try to _DecRef a ptr with refcount 0
+        ResStruct *res = *resp;
+        if(!res->count) // if we do proper refcounting, we should never try to _DecRef a ptr with refcount 0
         {
-            DEBUG(logerror("ResourceMgr::_DecRef("PTRFMT") - already 0 (type %u)", ptr, it->second.count, it->second.rt));
+            DEBUG(logerror("ResourceMgr::_DecRef("PTRFMT") - already 0 (type %u)", ptr, res->rt));
         }
-        if( !Falcon::atomicDec(it->second.count) )
+        if( !Falcon::atomicDec(res->count) )
         {
-            DEBUG(logdebug("ResourceMgr::_DecRef("PTRFMT") - now UNUSED (type %u)", ptr, it->second.count, it->second.rt));
+            DEBUG(logdebug("ResourceMgr::_DecRef("PTRFMT") - now UNUSED (type %u)", ptr, res->rt));
             if(del)
+                _Delete(res);
+            else
             {
-                _Delete(ptr, it->second);
-                _ptrmap.erase(it);
+                _LinkUnused(res);
+                _Trim();
             }
             return;
         }
         else
         {
-            //DEBUG(logdebug("ResourceMgr::_DecRef("PTRFMT") - now %u (type %u)", ptr, it->second.count, it->second.rt));
+            //DEBUG(logdebug("ResourceMgr::_DecRef("PTRFMT") - now %u (type %u)", ptr, res->count, res->rt));
         }
     }
     else
@@ -144,31 +206,54 @@ void ResourceMgr::_DecRef(void *ptr, bool del /* = false */)
     }
 }
 
-void ResourceMgr::_Delete(void *ptr, ResStruct& res)
+void ResourceMgr::_LinkUnused(ResStruct *res)
 {
-    bool found = false;
-    for(FileRefMap::iterator it = _frmap.begin(); it != _frmap.end(); ++it)
-    {
-        if(it->second == ptr)
-        {
-            found = true;
-            _frmap.erase(it);
-            break;
-        }
-    }
-    if(!found)
+    _unusedMem += res->mem;
+    res->prevUnused = _unusedTail;
+    res->nextUnused = NULL;
+    if(_unusedTail)
+        _unusedTail->nextUnused = res;
+    else
+        _unusedHead = res;
+    _unusedTail = res;
+}
+
+void ResourceMgr::_UnlinkUnused(ResStruct *res)
+{
+    if(res->prevUnused)
+        res->prevUnused->nextUnused = res->nextUnused;
+    else if(_unusedHead == res)
+        _unusedHead = res->nextUnused;
+    else
+        return; // not in the list
+    _unusedMem -= res->mem;
+    if(res->nextUnused)
+        res->nextUnused->prevUnused = res->prevUnused;
+    else
+        _unusedTail = res->prevUnused;
+    res->prevUnused = res->nextUnused = NULL;
+}
+
+// removes the resource from all lists, frees it and deletes res
+void ResourceMgr::_Delete(ResStruct *res)
+{
+    _UnlinkUnused(res);
+    _ptrmap.erase(res->ptr);
+    ResStruct **named = _frmap.find(res->name);
+    if(named && *named == res)
+        _frmap.erase(res->name);
+    else
     {
-        DEBUG(logerror("ResourceMgr::_Delete("PTRFMT") - not found in FileRefMap (type %u)", ptr, res.rt));
+        DEBUG(logerror("ResourceMgr::_Delete("PTRFMT") - not found in FileRefMap (type %u)", res->ptr, res->rt));
     }
 
-    switch(res.rt)
+    switch(res->rt)
     {
         case RESTYPE_MEMBLOCK:
         {
-            memblock *mblock = (memblock*)ptr;
+            memblock *mblock = (memblock*)res->ptr;
             DEBUG(logdebug("ResourceMgr:: Deleting memblock "PTRFMT" with ptr "PTRFMT", size %u",
-                ptr, mblock->ptr, mblock->size));
-            _unaccountMem(mblock->size);
+                res->ptr, mblock->ptr, mblock->size));
             if(mblock->ptr != &g_emptyData[0])
                 delete [] mblock->ptr; // the memblock ptr stores an array! (special exception if it held an empty string or other empty data)
             delete mblock;
@@ -176,32 +261,30 @@ void ResourceMgr::_Delete(void *ptr, ResStruct& res)
         }
 
         case RESTYPE_ANIM:
-            DEBUG(logdebug("ResourceMgr:: Deleting Anim "PTRFMT" (%s)", ptr, ((Anim*)ptr)->filename.c_str()));
-            delete (Anim*)ptr;
+            DEBUG(logdebug("ResourceMgr:: Deleting Anim "PTRFMT" (%s)", res->ptr, ((Anim*)res->ptr)->filename.c_str()));
+            delete (Anim*)res->ptr;
             break;
 
         case RESTYPE_SDL_SURFACE:
-            DEBUG(logdebug("ResourceMgr:: Deleting SDL_Surface "PTRFMT" (%ux%u)", ptr, ((SDL_Surface*)ptr)->w, ((SDL_Surface*)ptr)->h));
-            _unaccountMem(SDLfunc_GetSurfaceBytes((SDL_Surface*)ptr));
-            SDL_FreeSurface((SDL_Surface*)ptr);
+            DEBUG(logdebug("ResourceMgr:: Deleting SDL_Surface "PTRFMT" (%ux%u)", res->ptr, ((SDL_Surface*)res->ptr)->w, ((SDL_Surface*)res->ptr)->h));
+            SDL_FreeSurface((SDL_Surface*)res->ptr);
             break;
 
         case RESTYPE_MIX_CHUNK:
-            DEBUG(logdebug("ResourceMgr:: Deleting Mix_Chunk "PTRFMT, ptr));
-            _unaccountMem(((Mix_Chunk*)ptr)->alen);
-            Mix_FreeChunk((Mix_Chunk*)ptr);
+            DEBUG(logdebug("ResourceMgr:: Deleting Mix_Chunk "PTRFMT, res->ptr));
+            Mix_FreeChunk((Mix_Chunk*)res->ptr);
             break;
 
         case RESTYPE_MIX_MUSIC:
         {
-            Mix_MusicType musType = Mix_GetMusicType((Mix_Music*)ptr);
-            DEBUG(logdebug("ResourceMgr:: Deleting Mix_Music "PTRFMT" (music type %u)", ptr, musType));
-            Mix_FreeMusic((Mix_Music*)ptr);
+            Mix_MusicType musType = Mix_GetMusicType((Mix_Music*)res->ptr);
+            DEBUG(logdebug("ResourceMgr:: Deleting Mix_Music "PTRFMT" (music type %u)", res->ptr, musType));
+            Mix_FreeMusic((Mix_Music*)res->ptr);
             // For unknown reason, OGG frees the RWop, but MikMod and WAV do not (not sure about the rest).
             // We have to check for that to prevent double-free,
             // Setting it to NULL here will prevent a second deletion & crash further down.
             if(musType == MUS_OGG)
-                res.rwop = NULL;
+                res->rwop = NULL;
             break;
         }
 
@@ -210,18 +293,23 @@ void ResourceMgr::_Delete(void *ptr, ResStruct& res)
     }
 
     // if there is another resource the now deleted resource depends on, decref that
-    if(res.depdata)
+    if(res->depdata)
     {
-        logdebug("ResMgr: Dropping depdata "PTRFMT" for resource "PTRFMT, res.depdata, ptr);
-        Drop(res.depdata);
+        logdebug("ResMgr: Dropping depdata "PTRFMT" for resource "PTRFMT, res->depdata, res->ptr);
+        Drop(res->depdata);
     }
 
     // same for SDL RWops still used to access the data (Mix_LoadMUS_RW() does that)
-    if(res.rwop)
+    if(res->rwop)
     {
-        logdebug("ResMgr: Dropping RWop "PTRFMT" for resource "PTRFMT, res.rwop, ptr);
-        SDL_RWclose(res.rwop);
+        logdebug("ResMgr: Dropping RWop "PTRFMT" for resource "PTRFMT, res->rwop, res->ptr);
+        SDL_RWclose(res->rwop);
     }
+
+    _unaccountMem(res->mem);
+    if(res->vf)
+        res->vf->ref--;
+    delete res;
 }
 
 SDL_Surface *ResourceMgr::LoadImg(const char *name)
@@ -244,7 +332,6 @@ SDL_Surface *ResourceMgr::LoadImg(const char *name)
     else
     {
         VFSFile *vf = NULL;
-        SDL_RWops *rwop = NULL;
 
         // we got additional properties
         if(fn != origfn)
@@ -302,12 +389,7 @@ SDL_Surface *ResourceMgr::LoadImg(const char *name)
             vf = vfs.GetFile(fn.c_str());
             if(vf && vf->size())
             {
-                rwop = SDL_RWFromMem((void*)vf->getBuf(), vf->size());
-                if(rwop)
-                {
-                    img = IMG_Load_RW(rwop, 0);
-                    SDL_RWclose(rwop);
-                }
+                img = _DecodeImg(vf->getBuf(), vf->size());
                 vf->dropBuf(true); // delete original buf -- even if it could not load an image from it - its useless to keep this memory
             }
         }
@@ -316,30 +398,49 @@ SDL_Surface *ResourceMgr::LoadImg(const char *name)
             logerror("LoadImg failed: '%s'", origfn.c_str());
             return NULL;
         }
-        // convert loaded images into currently used color format.
-        // this allows faster blitting because the color formats dont have to be converted
-        SDL_Surface *newimg = SDL_DisplayFormatAlpha(img);
-        if(newimg && img != newimg)
-        {
-            SDL_FreeSurface(img);
-            img = newimg;
-        }
+        img = _ConvertImg(img);
 
         logdebug("LoadImg: '%s' [%s] -> "PTRFMT , origfn.c_str(), vf ? vf->getSource() : "*", img);
 
-        _accountMem(SDLfunc_GetSurfaceBytes(img));
-        _SetPtr(origfn, (void*)img);
-        _InitRef((void*)img, RESTYPE_SDL_SURFACE);
+        _AddImg(origfn, img);
     }
 
     return img;
 }
 
+SDL_Surface *ResourceMgr::_DecodeImg(const uint8 *buf, uint32 size)
+{
+    SDL_Surface *img = NULL;
+    SDL_RWops *rwop = SDL_RWFromConstMem((const void*)buf, size);
+    if(rwop)
+    {
+        img = IMG_Load_RW(rwop, 0);
+        SDL_RWclose(rwop);
+    }
+    return img;
+}
+
+// convert loaded images into currently used color format.
+// this allows faster blitting because the color formats dont have to be converted
+SDL_Surface *ResourceMgr::_ConvertImg(SDL_Surface *img)
+{
+    SDL_Surface *newimg = SDL_DisplayFormatAlpha(img);
+    if(newimg && img != newimg)
+    {
+        SDL_FreeSurface(img);
+        img = newimg;
+    }
+    return img;
+}
+
+void ResourceMgr::_AddImg(const std::string& fn, SDL_Surface *img)
+{
+    _InitRef(fn, (void*)img, RESTYPE_SDL_SURFACE);
+}
+
 Anim *ResourceMgr::LoadAnim(const char *name)
 {
     std::string fn("gfx/");
-    std::string relpath(_PathStripLast(name));
-    std::string loadpath;
     fn += name;
 
     Anim *ani = (Anim*)_GetPtr(fn);
@@ -349,46 +450,56 @@ Anim *ResourceMgr::LoadAnim(const char *name)
     }
     else
     {
-        // a .anim file is just a text file, so we use the internal text file loader
-        memblock *mb = _LoadTextFileInternal((char*)fn.c_str(), FILENAME_TMP_INDIC);
-        if(!mb)
-        {
-            logerror("LoadAnim: Failed to open '%s'", fn.c_str());
-            return NULL;
-        }
+        ani = _ParseAnimFile(fn);
+        if(ani)
+            _AddAnim(fn, ani);
+    }
+
+    return ani;
+}
 
-        ani = ParseAnimData((char*)mb->ptr, (char*)fn.c_str());
-        Drop(mb); // text data are no longer needed
+Anim *ResourceMgr::_ParseAnimFile(const std::string& fn)
+{
+    // a .anim file is just a text file, so we use the internal text file loader
+    memblock *mb = _LoadTextFileInternal((char*)fn.c_str(), FILENAME_TMP_INDIC);
+    if(!mb)
+    {
+        logerror("LoadAnim: Failed to open '%s'", fn.c_str());
+        return NULL;
+    }
 
-        if(!ani)
-        {
-            logerror("LoadAnim: Failed to parse '%s'", fn.c_str());
-            return NULL;
-        }
+    Anim *ani = ParseAnimData((char*)mb->ptr, (char*)fn.c_str());
+    Drop(mb); // text data are no longer needed
 
-        // load all additional files referenced in this .anim file
-        // pay attention to relative paths in the file, respect the .anim file's directory for this
-        for(AnimMap::iterator am = ani->anims.begin(); am != ani->anims.end(); am++)
-            for(AnimFrameVector::iterator af = am->second.store.begin(); af != am->second.store.end(); af++)
+    if(!ani)
+        logerror("LoadAnim: Failed to parse '%s'", fn.c_str());
+    return ani;
+}
+
+void ResourceMgr::_AddAnim(const std::string& fn, Anim *ani)
+{
+    std::string relpath(_PathStripLast(fn.substr(4))); // without "gfx/"
+    std::string loadpath;
+
+    // load all additional files referenced in this .anim file
+    // pay attention to relative paths in the file, respect the .anim file's directory for this
+    for(AnimMap::iterator am = ani->anims.begin(); am != ani->anims.end(); am++)
+        for(AnimFrameVector::iterator af = am->second.store.begin(); af != am->second.store.end(); af++)
+        {
+            loadpath = AddPathIfNecessary(af->filename,relpath);
+            af->surface = LoadImg(loadpath.c_str()); // get all images referenced
+            if(af->surface)
+                af->callback.ptr(af->surface); // register callback for auto-deletion
+            else
             {
-                loadpath = AddPathIfNecessary(af->filename,relpath);
-                af->surface = LoadImg(loadpath.c_str()); // get all images referenced
-                if(af->surface)
-                    af->callback.ptr(af->surface); // register callback for auto-deletion
-                else
-                {
-                    logerror("LoadAnim: '%s': Failed to open referenced image '%s'", fn.c_str(), loadpath.c_str());
-                    // we keep the NULL-ptr anyways
-                }
+                logerror("LoadAnim: '%s': Failed to open referenced image '%s'", fn.c_str(), loadpath.c_str());
+                // we keep the NULL-ptr anyways
             }
+        }
 
-         logdebug("LoadAnim: '%s' [%s] -> "PTRFMT , fn.c_str(), vfs.GetFile(fn.c_str())->getSource(), ani); // the file must exist
-
-         _SetPtr(fn, (void*)ani);
-         _InitRef((void*)ani, RESTYPE_ANIM);
-    }
+     logdebug("LoadAnim: '%s' [%s] -> "PTRFMT , fn.c_str(), vfs.GetFile(fn.c_str())->getSource(), ani); // the file must exist
 
-    return ani;
+     _InitRef(fn, (void*)ani, RESTYPE_ANIM);
 }
 
 Mix_Music *ResourceMgr::LoadMusic(const char *name)
@@ -407,30 +518,55 @@ Mix_Music *ResourceMgr::LoadMusic(const char *name)
     }
     else
     {
-        memblock *mb = _LoadFileInternal(fn.c_str(), NULL);
+        memblock *mb = NULL;
         SDL_RWops *rwop = NULL;
-        if(mb && mb->size)
-        {
-            rwop = SDL_RWFromConstMem((const void*)mb->ptr, mb->size);
-            music = Mix_LoadMUS_RW(rwop);
-            // We can NOT free the RWop here, it is still used by SDL_Mixer to access the music data.
-            // Instead, is is saved with the other pointers and freed along with the music later.
-        }
 
-        if(!music)
-        {
-            Drop(mb);
-            if(rwop)
-                SDL_RWclose(rwop);
-            return NULL;
-        }
-        
-        logdebug("LoadMusic: '%s' [%s] -> "PTRFMT , name, vfs.GetFile(fn.c_str())->getSource(), music);
+        VFSFile *vf = vfs.GetFile(fn.c_str());
+        if(_CanStreamMusic(vf))
+            rwop = ((VFSFileLVPA*)vf)->openRWops();
+
+        if(!rwop)
+            mb = _LoadFileInternal(fn.c_str(), NULL);
+
+        music = _OpenMusic(fn, mb, rwop);
+    }
+
+    return music;
+}
+
+// music in the base archive is streamed, instead of keeping the whole unpacked file in memory.
+// other containers can be unmounted and deleted while the music is still playing.
+bool ResourceMgr::_CanStreamMusic(VFSFile *vf)
+{
+    return vf && !strcmp(vf->getSource(), "LVPA") && ((VFSFileLVPA*)vf)->getLVPA() == vfs.GetBase();
+}
+
+Mix_Music *ResourceMgr::_OpenMusic(const std::string& fn, memblock *mb, SDL_RWops *rwop)
+{
+    Mix_Music *music = NULL;
+    if(!rwop && mb && mb->size)
+        rwop = SDL_RWFromConstMem((const void*)mb->ptr, mb->size);
+
+    if(rwop)
+    {
+        music = Mix_LoadMUS_RW(rwop);
+        // We can NOT free the RWop here, it is still used by SDL_Mixer to access the music data.
+        // Instead, is is saved with the other pointers and freed along with the music later.
+    }
 
-        _SetPtr(fn + FILENAME_MUSIC_INDIC, (void*)music);
-        _InitRef((void*)music, RESTYPE_MIX_MUSIC, mb, rwop); // note that this music depends on mb and the rwop, save for later deletion
+    if(!music)
+    {
+        if(mb)
+            Drop(mb);
+        if(rwop)
+            SDL_RWclose(rwop);
+        return NULL;
     }
 
+    VFSFile *vf = vfs.GetFile(fn.c_str());
+    logdebug("LoadMusic: '%s' [%s] -> "PTRFMT , fn.c_str(), vf ? vf->getSource() : "*", music);
+
+    _InitRef(fn + FILENAME_MUSIC_INDIC, (void*)music, RESTYPE_MIX_MUSIC, mb, rwop); // note that this music depends on mb and the rwop, save for later deletion
     return music;
 }
 
@@ -447,15 +583,9 @@ Mix_Chunk *ResourceMgr::LoadSound(const char *name)
     else
     {
         VFSFile *vf = vfs.GetFile(fn.c_str());
-        SDL_RWops *rwop = NULL;
         if(vf)
         {
-            rwop = SDL_RWFromMem((void*)vf->getBuf(), vf->size());
-            if(rwop)
-            {
-                sound = Mix_LoadWAV_RW(rwop, 0);
-                SDL_RWclose(rwop);
-            }
+            sound = _DecodeSound(vf->getBuf(), vf->size());
             vf->dropBuf(true);
         }
 
@@ -467,14 +597,29 @@ Mix_Chunk *ResourceMgr::LoadSound(const char *name)
 
         logdebug("LoadSound: '%s' [%s] -> "PTRFMT , name, vf->getSource(), sound);
 
-        _accountMem(sound->alen);
-        _SetPtr(fn, (void*)sound);
-        _InitRef((void*)sound, RESTYPE_MIX_CHUNK);
+        _AddSound(fn, sound);
     }
 
     return sound;
 }
 
+Mix_Chunk *ResourceMgr::_DecodeSound(const uint8 *buf, uint32 size)
+{
+    Mix_Chunk *sound = NULL;
+    SDL_RWops *rwop = SDL_RWFromConstMem((const void*)buf, size);
+    if(rwop)
+    {
+        sound = Mix_LoadWAV_RW(rwop, 0);
+        SDL_RWclose(rwop);
+    }
+    return sound;
+}
+
+void ResourceMgr::_AddSound(const std::string& fn, Mix_Chunk *sound)
+{
+    _InitRef(fn, (void*)sound, RESTYPE_MIX_CHUNK);
+}
+
 memblock *ResourceMgr::LoadFile(const char *name)
 {
     std::string t(name); // copying the string is necessary if <name> is hardcoded in the program, and thus really const
@@ -534,14 +679,17 @@ memblock *ResourceMgr::_LoadFileInternal(const char *name, const char *indic)
 
         logdebug("LoadFile: '%s' [%s], %u bytes -> "PTRFMT" ["PTRFMT"]" , name, vf->getSource(), mb->size, mb, mb->ptr);
 
-        _accountMem(size);
-        _SetPtr(fn, (void*)mb);
-        _InitRef((void*)mb, RESTYPE_MEMBLOCK);
+        _AddFile(fn, mb);
     }
 
     return mb;
 }
 
+void ResourceMgr::_AddFile(const std::string& fn, memblock *mb)
+{
+    _InitRef(fn, (void*)mb, RESTYPE_MEMBLOCK);
+}
+
 memblock *ResourceMgr::LoadTextFile(const char *name)
 {
     std::string t(name); // copying the string is necessary if <name> is hardcoded in the program, and thus really const
@@ -596,9 +744,7 @@ memblock *ResourceMgr::_LoadTextFileInternal(const char *name, const char *indic
 
         logdebug("LoadTextFile: '%s' [%s] -> "PTRFMT" ["PTRFMT"]" , name, vf->getSource(), mb, mb->ptr);
 
-        _accountMem(mb->size);
-        _SetPtr(fn, (void*)mb);
-        _InitRef((void*)mb, RESTYPE_MEMBLOCK);
+        _AddFile(fn, mb);
     }
 
     return mb;
@@ -627,6 +773,323 @@ void ResourceMgr::SetPropForFile(const char *fn, const char *prop, const char *w
 }
 
 
+AsyncLoad::AsyncLoad(AsyncType type, const std::string& name, AsyncLoadListener *listener)
+: ref(this), _type(type), _name(name), _listener(listener), _stream(NULL), _data(NULL), _size(0),
+  _decoded(NULL), _res(NULL), _pooled(false), _finished(false), _taken(false)
+{
+}
+
+AsyncLoad::~AsyncLoad()
+{
+    delete _listener;
+    delete _stream;
+    delete [] _data;
+    if(_decoded) // cancelled
+    {
+        if(_type == ASYNC_IMG)
+            SDL_FreeSurface((SDL_Surface*)_decoded);
+        else if(_type == ASYNC_SOUND)
+            Mix_FreeChunk((Mix_Chunk*)_decoded);
+    }
+    if(_res && !_taken)
+        resMgr.Drop(_res);
+}
+
+void *AsyncLoad::TakeResource(void)
+{
+    DEBUG(ASSERT(_finished && !_taken));
+    _taken = true;
+    return _res;
+}
+
+// runs on a worker thread. touches only this object, never the VFS or the ResourceMgr.
+void AsyncLoad::Run(void)
+{
+    if(_stream)
+    {
+        if((_size = _stream->Size()))
+        {
+            _data = new uint8[_size];
+            if(_stream->Read(_data, _size) != _size || !_stream->IsGood())
+                _DropData();
+        }
+        delete _stream;
+        _stream = NULL;
+    }
+    else if(_path.length())
+    {
+        if(FILE *fh = fopen(_path.c_str(), "rb"))
+        {
+            fseek(fh, 0, SEEK_END);
+            long size = ftell(fh);
+            fseek(fh, 0, SEEK_SET);
+            if(size > 0)
+            {
+                _size = (uint32)size;
+                _data = new uint8[_size];
+                if(fread(_data, 1, _size, fh) != _size)
+                    _DropData();
+            }
+            fclose(fh);
+        }
+    }
+
+    if(!_data)
+        return;
+
+    switch(_type)
+    {
+        case ASYNC_IMG:
+            _decoded = ResourceMgr::_DecodeImg(_data, _size);
+            break;
+
+        case ASYNC_SOUND:
+            _decoded = ResourceMgr::_DecodeSound(_data, _size);
+            break;
+
+        default:
+            return; // music and files keep the data
+    }
+    _DropData();
+}
+
+void AsyncLoad::_DropData(void)
+{
+    delete [] _data;
+    _data = NULL;
+    _size = 0;
+}
+
+// the data become a memblock, ownership goes with them
+memblock *AsyncLoad::_TakeData(void)
+{
+    memblock *mb = new memblock(_data, _size);
+    _data = NULL;
+    _size = 0;
+    return mb;
+}
+
+AsyncLoad *ResourceMgr::LoadImgAsync(const char *name, AsyncLoadListener *listener /* = NULL */)
+{
+    std::string origfn(name + (name[0] == '/')); // like LoadImg()
+    if(origfn.substr(0,4) != "gfx/")
+        origfn = "gfx/" + origfn;
+    std::string fn;
+    SplitFilenameToProps(origfn.c_str(), &fn); // the file the image is taken from
+    return _StartAsync(AsyncLoad::ASYNC_IMG, name, fn, !_GetPtr(origfn) && !_GetPtr(fn), listener);
+}
+
+AsyncLoad *ResourceMgr::LoadSoundAsync(const char *name, AsyncLoadListener *listener /* = NULL */)
+{
+    std::string fn("sfx/");
+    fn += name;
+    return _StartAsync(AsyncLoad::ASYNC_SOUND, name, fn, !_GetPtr(fn), listener);
+}
+
+AsyncLoad *ResourceMgr::LoadMusicAsync(const char *name, AsyncLoadListener *listener /* = NULL */)
+{
+    std::string fn("music/");
+    fn += name;
+    bool read = !_GetPtr(fn + FILENAME_MUSIC_INDIC) && !_GetPtr(fn) && !_CanStreamMusic(vfs.GetFile(fn.c_str()));
+    return _StartAsync(AsyncLoad::ASYNC_MUSIC, name, fn, read, listener);
+}
+
+AsyncLoad *ResourceMgr::LoadFileAsync(const char *name, AsyncLoadListener *listener /* = NULL */)
+{
+    std::string fn(name);
+    return _StartAsync(AsyncLoad::ASYNC_FILE, name, fn, !_GetPtr(fn), listener);
+}
+
+// if there is nothing to read, the request is finished by the synchronous Load*() in UpdateAsync()
+AsyncLoad *ResourceMgr::_StartAsync(AsyncLoad::AsyncType type, const char *name, const std::string& fn, bool read, AsyncLoadListener *listener)
+{
+    AsyncLoad *req = new AsyncLoad(type, name, listener);
+    req->ref++; // ours, until it is finished
+    _async.push_back(req);
+
+    if(!read)
+        return req;
+
+    VFSFile *vf = vfs.GetFile(fn.c_str());
+    if(!vf)
+        return req;
+
+    const char *src = vf->getSource();
+    if(!strcmp(src, "LVPA"))
+        req->_stream = ((VFSFileLVPA*)vf)->openStream();
+    else if(!strcmp(src, "disk") && !vf->isopen())
+        req->_path = vf->fullname();
+
+    if(!req->_stream && req->_path.empty()) // already in memory
+    {
+        const uint8 *buf = vf->getBuf();
+        uint32 size = (uint32)vf->size();
+        if(buf && size)
+        {
+            req->_data = new uint8[size];
+            req->_size = size;
+            memcpy(req->_data, buf, size);
+        }
+        vf->dropBuf(true);
+    }
+
+    // a pool without threads runs a task only when it is waited for, requests are polled in UpdateAsync()
+    if(_workers && _workers->GetThreadCount())
+    {
+        req->_pooled = true;
+        _workers->Add(req);
+    }
+    else
+        req->Run();
+
+    return req;
+}
+
+void ResourceMgr::UpdateAsync(uint32 maxms /* = 0 */)
+{
+    uint32 start = getMSTime();
+    for(uint32 i = 0; i < _async.size(); )
+    {
+        AsyncLoad *req = _async[i];
+        if(req->_pooled && !req->IsDone())
+        {
+            ++i;
+            continue;
+        }
+        _async.erase(_async.begin() + i);
+        _FinishAsync(req); // listeners may start or finish other requests, i is still good enough
+        req->ref--;
+
+        if(maxms && getMSTimeDiff(start, getMSTime()) >= maxms)
+            break;
+    }
+}
+
+void ResourceMgr::WaitAsync(AsyncLoad *req /* = NULL */)
+{
+    if(req)
+    {
+        if(req->_pooled)
+            _workers->Wait(req);
+        return;
+    }
+    for(uint32 i = 0; i < _async.size(); ++i)
+        if(_async[i]->_pooled)
+            _workers->Wait(_async[i]);
+}
+
+void ResourceMgr::CancelAsync(void)
+{
+    WaitAsync();
+    std::deque<AsyncLoad*> reqs;
+    reqs.swap(_async);
+    for(uint32 i = 0; i < reqs.size(); ++i)
+    {
+        AsyncLoad *req = reqs[i];
+        delete req->_listener;
+        req->_listener = NULL;
+        req->_finished = true;
+        req->ref--;
+    }
+}
+
+void ResourceMgr::_FinishAsync(AsyncLoad *req)
+{
+    void *res = NULL;
+    switch(req->_type)
+    {
+        case AsyncLoad::ASYNC_IMG:
+        {
+            if(SDL_Surface *img = (SDL_Surface*)req->_decoded)
+            {
+                req->_decoded = NULL;
+                std::string fn(req->_name.c_str() + (req->_name[0] == '/'));
+                if(fn.substr(0,4) != "gfx/")
+                    fn = "gfx/" + fn;
+                SplitFilenameToProps(fn.c_str(), &fn);
+                if(_GetPtr(fn))
+                    SDL_FreeSurface(img); // was loaded by someone else in the meantime
+                else
+                {
+                    img = _ConvertImg(img); // must be done by the main thread, the display format may change
+                    logdebug("LoadImgAsync: '%s' -> "PTRFMT , fn.c_str(), img);
+                    _AddImg(fn, img);
+                    res = LoadImg(req->_name.c_str()); // cut out the part of the image, if required
+                    Drop(img); // the reference from _AddImg()
+                    break;
+                }
+            }
+            res = LoadImg(req->_name.c_str());
+            break;
+        }
+
+        case AsyncLoad::ASYNC_SOUND:
+        {
+            std::string fn("sfx/");
+            fn += req->_name;
+            Mix_Chunk *sound = (Mix_Chunk*)req->_decoded;
+            req->_decoded = NULL;
+            if(sound && !_GetPtr(fn))
+            {
+                logdebug("LoadSoundAsync: '%s' -> "PTRFMT , fn.c_str(), sound);
+                _AddSound(fn, sound);
+                res = sound;
+            }
+            else
+            {
+                if(sound)
+                    Mix_FreeChunk(sound);
+                res = LoadSound(req->_name.c_str());
+            }
+            break;
+        }
+
+        case AsyncLoad::ASYNC_MUSIC:
+        {
+            std::string fn("music/");
+            fn += req->_name;
+            if(req->_data && !_GetPtr(fn + FILENAME_MUSIC_INDIC))
+            {
+                memblock *mb = (memblock*)_GetPtr(fn);
+                if(mb)
+                    _IncRef((void*)mb);
+                else
+                {
+                    mb = req->_TakeData();
+                    _AddFile(fn, mb);
+                }
+                res = _OpenMusic(fn, mb, NULL);
+            }
+            else
+                res = LoadMusic(req->_name.c_str());
+            break;
+        }
+
+        case AsyncLoad::ASYNC_FILE:
+        {
+            if(req->_data && !_GetPtr(req->_name))
+            {
+                memblock *mb = req->_TakeData();
+                logdebug("LoadFileAsync: '%s', %u bytes -> "PTRFMT" ["PTRFMT"]" , req->_name.c_str(), mb->size, mb, mb->ptr);
+                _AddFile(req->_name, mb);
+                res = mb;
+            }
+            else
+                res = LoadFile(req->_name.c_str());
+            break;
+        }
+    }
+    req->_DropData();
+
+    req->_res = res;
+    req->_finished = true;
+    if(AsyncLoadListener *listener = req->_listener)
+    {
+        req->_listener = NULL;
+        listener->OnLoaded(req);
+        delete listener;
+    }
+}
 
 
 // extern, global (since we aren't using singletons here)
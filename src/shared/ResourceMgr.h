@@ -2,6 +2,7 @@
 #define RESOURCEMGR_H
 
 #include <map>
+#include <deque>
 #include <SDL/SDL.h>
 #include <SDL/SDL_mixer.h>
 #include <falcon/mt.h>
@@ -9,14 +10,82 @@
 
 #include "VFSHelper.h"
 #include "DelayedDeletable.h"
+#include "SelfRefCounter.h"
+#include "ThreadPool.h"
+#include "FlatHashMap.h"
 
 struct Anim;
+class LVPAStream;
+class AsyncLoad;
+
+// Gets notified when an asynchronous load is finished.
+// Owned by the request, which deletes it afterwards, or when the request is cancelled.
+class AsyncLoadListener
+{
+public:
+    virtual ~AsyncLoadListener() {}
+    virtual void OnLoaded(AsyncLoad *req) = 0; // called on the main thread, from ResourceMgr::UpdateAsync()
+};
+
+// A resource being loaded in the background, returned by ResourceMgr::Load*Async().
+// The file is read, unpacked and decoded by a worker thread,
+// the rest is done on the main thread in ResourceMgr::UpdateAsync().
+class AsyncLoad : public ThreadPoolTask
+{
+    friend class ResourceMgr;
+
+public:
+    enum AsyncType
+    {
+        ASYNC_IMG,
+        ASYNC_SOUND,
+        ASYNC_MUSIC,
+        ASYNC_FILE
+    };
+
+    virtual ~AsyncLoad();
+
+    inline AsyncType GetType(void) const { return _type; }
+    inline const std::string& GetName(void) const { return _name; }
+    inline bool IsFinished(void) const { return _finished; }
+
+    // the resource as the matching ResourceMgr::Load*() would return it, or NULL if loading failed.
+    // the request holds a reference to it until it is deleted; TakeResource() passes that reference to the caller.
+    inline void *GetResource(void) const { return _res; }
+    void *TakeResource(void);
+
+    SelfRefCounter<AsyncLoad> ref;
+
+private:
+    AsyncLoad(AsyncType type, const std::string& name, AsyncLoadListener *listener);
+    AsyncLoad(const AsyncLoad&); // forbid copy
+    AsyncLoad& operator=(const AsyncLoad&);
+    virtual void Run(void);
+    void _DropData(void);
+    memblock *_TakeData(void);
+
+    AsyncType _type;
+    std::string _name; // as passed to Load*Async()
+    AsyncLoadListener *_listener;
+    LVPAStream *_stream; // the file is read from a container,
+    std::string _path; // or from disk,
+    uint8 *_data; // or was copied by the main thread. the data read end up here.
+    uint32 _size;
+    void *_decoded; // not yet known to the ResourceMgr
+    void *_res;
+    bool _pooled; // queued in the thread pool, instead of being done right away
+    bool _finished;
+    bool _taken;
+};
 
 
 typedef std::map<std::string, std::map<std::string, std::string> > PropMap;
 
 class ResourceMgr
 {
+    friend class ResourcePreloader;
+    friend class AsyncLoad;
+
     enum ResourceType
     {
         RESTYPE_MEMBLOCK,
@@ -28,16 +97,23 @@ class ResourceMgr
 
     struct ResStruct
     {
-        ResStruct() : rt(RESTYPE_MEMBLOCK), count(1), depdata(NULL) {}
-        ResStruct(ResourceType r, void *dep = NULL, SDL_RWops *rw = NULL) : rt(r), count(1), depdata(dep), rwop(rw) {}
+        ResStruct(const std::string& fn, void *p, ResourceType r, void *dep, SDL_RWops *rw)
+            : name(fn), ptr(p), count(1), rt(r), depdata(dep), rwop(rw), vf(NULL), mem(0), prevUnused(NULL), nextUnused(NULL) {}
+        std::string name; // key in the FileRefMap
+        std::string file; // the name in the VFS it was loaded from
+        void *ptr;
         volatile Falcon::int32 count;
         ResourceType rt;
         void *depdata;
         SDL_RWops *rwop;
+        VFSFile *vf; // the file it was loaded from, referenced
+        uint32 mem; // accounted bytes
+        ResStruct *prevUnused; // in the list of resources with count 0, oldest first
+        ResStruct *nextUnused;
     };
 
-    typedef std::map<void*, ResStruct> PtrCountMap;
-    typedef std::map<std::string, void*> FileRefMap;
+    typedef FlatHashMap<void*, ResStruct*> PtrCountMap;
+    typedef FlatHashMap<std::string, ResStruct*> FileRefMap;
 
 public:
     ResourceMgr();
@@ -45,7 +121,7 @@ public:
     void DbgCheckEmpty(void);
 
     template <class T> inline void Drop(T *ptr, bool del = false) { _DecRef((void*)ptr, del); }
-    void DropUnused(void);
+    void DropUnused(bool keepWarm = false); // keepWarm: drop only as much as needed to meet the memory budget
 
     SDL_Surface *LoadImg(const char *name);
     Anim *LoadAnim(const char *name);
@@ -59,6 +135,28 @@ public:
     uint32 GetUsedCount(void); // amount of resources
     uint32 GetUsedMem(void); // estimated total resource memory consumption
 
+    // Unused resources stay in memory (the "warm" tier), in case they are needed again.
+    // With a budget set, the least recently used ones are deleted when the used memory exceeds it.
+    // Without (0, the default), they are kept until DropUnused().
+    void SetMemBudget(uint32 bytes);
+    inline uint32 GetMemBudget(void) const { return _memBudget; }
+    inline uint32 GetWarmMem(void) const { return _unusedMem; }
+    inline uint32 GetCacheHits(void) const { return _hits; } // unused resources that were used again
+    inline uint32 GetCacheMisses(void) const { return _misses; } // resources that had to be loaded
+    inline uint32 GetEvictions(void) const { return _evictions; } // unused resources deleted because of the budget
+
+    // Asynchronous loading. Always returns a request, the caller holds one reference to it.
+    // The listener (may be NULL) is called when the request is finished, even if loading failed.
+    AsyncLoad *LoadImgAsync(const char *name, AsyncLoadListener *listener = NULL);
+    AsyncLoad *LoadSoundAsync(const char *name, AsyncLoadListener *listener = NULL);
+    AsyncLoad *LoadMusicAsync(const char *name, AsyncLoadListener *listener = NULL);
+    AsyncLoad *LoadFileAsync(const char *name, AsyncLoadListener *listener = NULL);
+    void UpdateAsync(uint32 maxms = 0); // finishes decoded requests for up to maxms ms (0 = no limit)
+    void WaitAsync(AsyncLoad *req = NULL); // returns when req (or every request) is decoded. call this before removing files from the VFS.
+    void CancelAsync(void); // drops all unfinished requests, without notifying their listeners
+    inline uint32 GetAsyncCount(void) const { return _async.size(); }
+    inline void SetThreadPool(ThreadPool *pool) { _workers = pool; } // without pool or threads, requests are decoded right away
+
     VFSHelper vfs;
     DeletablePool pool;
 
@@ -66,26 +164,45 @@ private:
     memblock *_LoadFileInternal(const char *name, const char *indic);
     memblock *_LoadTextFileInternal(const char *name, const char *indic);
 
-    inline void *_GetPtr(const std::string& fn)
-    {
-        FileRefMap::iterator it = _frmap.find(fn);
-        return (it == _frmap.end() ? NULL : it->second);
-    }
-    inline void _SetPtr(const std::string& fn, void *ptr)
-    {
-        _frmap[fn] = ptr;
-    }
-    void _InitRef(void *ptr, ResourceType rt, void *depdata = NULL, SDL_RWops *rwop = NULL);
+    // decoding is done separately from adding the result, because it can be done by any thread
+    static SDL_Surface *_DecodeImg(const uint8 *buf, uint32 size);
+    static SDL_Surface *_ConvertImg(SDL_Surface *img); // to display format; frees img if converted
+    static Mix_Chunk *_DecodeSound(const uint8 *buf, uint32 size);
+    void _AddImg(const std::string& fn, SDL_Surface *img);
+    void _AddSound(const std::string& fn, Mix_Chunk *sound);
+    void _AddFile(const std::string& fn, memblock *mb);
+    bool _CanStreamMusic(VFSFile *vf);
+    Mix_Music *_OpenMusic(const std::string& fn, memblock *mb, SDL_RWops *rwop); // takes over mb's reference and the rwop
+    Anim *_ParseAnimFile(const std::string& fn); // without loading the images
+    void _AddAnim(const std::string& fn, Anim *ani); // loads the images
+
+    void *_GetPtr(const std::string& fn);
+    void _InitRef(const std::string& fn, void *ptr, ResourceType rt, void *depdata = NULL, SDL_RWops *rwop = NULL);
     void _IncRef(void *ptr);
     void _DecRef(void *ptr, bool del = false);
-    void _Delete(void *ptr, ResStruct& rt);
+    void _Delete(ResStruct *res);
+    void _LinkUnused(ResStruct *res);
+    void _UnlinkUnused(ResStruct *res);
+    void _Trim(void);
     PtrCountMap _ptrmap;
     FileRefMap _frmap;
+    ResStruct *_unusedHead;
+    ResStruct *_unusedTail;
+    uint32 _unusedMem;
+    uint32 _memBudget;
+    uint32 _hits;
+    uint32 _misses;
+    uint32 _evictions;
     PropMap _fprops;
 
     void _accountMem(uint32 bytes);
     void _unaccountMem(uint32 bytes);
     uint32 _usedMem;
+
+    AsyncLoad *_StartAsync(AsyncLoad::AsyncType type, const char *name, const std::string& fn, bool read, AsyncLoadListener *listener);
+    void _FinishAsync(AsyncLoad *req);
+    ThreadPool *_workers;
+    std::deque<AsyncLoad*> _async; // unfinished requests, in the order they were started
 };
 
 
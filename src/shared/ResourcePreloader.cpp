@@ -0,0 +1,233 @@
+#include "common.h"
+#include "ResourceMgr.h"
+#include "ResourcePreloader.h"
+#include "ThreadPool.h"
+#include "MapFile.h"
+#include "Anim.h"
+
+// requests being loaded at the same time, per thread
+#define PRELOAD_QUEUE_PER_THREAD 4
+
+
+ResourcePreloader::ResourcePreloader(ThreadPool *pool)
+: _pool(pool), _next(0), _done(0)
+{
+}
+
+ResourcePreloader::~ResourcePreloader()
+{
+    for(uint32 i = 0; i < _items.size(); ++i)
+    {
+        Item& item = _items[i];
+        if(item.req)
+            item.req->ref--; // the ResourceMgr finishes it, then drops what was loaded
+        else if(item.state == ITEM_WAITING)
+            delete (Anim*)item.res; // parsed, but not yet known to the ResourceMgr
+        else if(item.res)
+            resMgr.Drop(item.res);
+    }
+}
+
+void ResourcePreloader::Add(PreloadType type, const char *name)
+{
+    std::string key(1, char('0' + type));
+    key += name;
+    if(!_added.insert(key).second)
+        return;
+
+    Item item;
+    item.type = type;
+    item.name = name;
+    _items.push_back(item);
+}
+
+void ResourcePreloader::AddFile(const char *fn)
+{
+    while(*fn == '/')
+        ++fn;
+    std::string s(fn);
+    if(s.substr(0, 4) == "gfx/")
+        Add(FileGetExtension(s) == ".anim" ? PRELOAD_ANIM : PRELOAD_IMG, s.c_str() + 4);
+    else if(s.substr(0, 4) == "sfx/")
+        Add(PRELOAD_SOUND, s.c_str() + 4);
+    else if(s.substr(0, 6) == "music/")
+        Add(PRELOAD_MUSIC, s.c_str() + 6);
+    else
+        Add(PRELOAD_FILE, fn);
+}
+
+void ResourcePreloader::AddManifest(const char *text)
+{
+    std::vector<std::string> lines;
+    StrSplit(text, "\n\x0a\x0d", lines);
+    for(uint32 i = 0; i < lines.size(); ++i)
+    {
+        std::string& lin = lines[i];
+        size_t cpos = lin.find('#'); // strip comments if there are any
+        if(cpos != std::string::npos)
+            lin.erase(cpos);
+        size_t start = lin.find_first_not_of(" \t");
+        if(start == std::string::npos)
+            continue;
+        size_t end = lin.find_last_not_of(" \t");
+        AddFile(lin.substr(start, end - start + 1).c_str());
+    }
+}
+
+bool ResourcePreloader::AddMap(const char *fn)
+{
+    memblock *mb = resMgr.LoadFile(fn);
+    if(!mb)
+        return false;
+    std::vector<std::string> tiles;
+    bool ok = MapFile::GetTileNames(mb, tiles);
+    resMgr.Drop(mb, true);
+    if(!ok)
+        return false;
+
+    // same as AnimatedTile::New()
+    for(uint32 i = 0; i < tiles.size(); ++i)
+        Add(FileGetExtension(tiles[i]) == ".anim" ? PRELOAD_ANIM : PRELOAD_IMG, tiles[i].c_str());
+
+    std::string sidecar(fn);
+    sidecar += ".preload";
+    if(resMgr.vfs.GetFile(sidecar.c_str()))
+    {
+        if(memblock *mb = resMgr.LoadTextFile(sidecar.c_str()))
+        {
+            AddManifest((const char*)mb->ptr);
+            resMgr.Drop(mb, true);
+        }
+    }
+    return true;
+}
+
+float ResourcePreloader::GetProgress(void) const
+{
+    return _items.empty() ? 1.0f : float(_done) / float(_items.size());
+}
+
+bool ResourcePreloader::Update(uint32 maxms)
+{
+    uint32 start = getMSTime();
+    uint32 maxQueued = (_pool->GetThreadCount() + 1) * PRELOAD_QUEUE_PER_THREAD;
+
+    while(true)
+    {
+        // in start order, which is about the order they are finished
+        while(!_loading.empty() && _items[_loading.front()].req->IsFinished())
+        {
+            uint32 idx = _loading.front();
+            _loading.pop_front();
+            AsyncLoad *req = _items[idx].req;
+            _items[idx].req = NULL;
+            _Done(idx, req->TakeResource());
+            req->ref--;
+        }
+
+        if(maxms && getMSTimeDiff(start, getMSTime()) >= maxms)
+            break;
+        if(_next >= _items.size() || _loading.size() >= maxQueued)
+            break;
+        _Start(_next++);
+    }
+
+    // anims last, they use the images loaded above
+    if(_next >= _items.size() && _loading.empty() && !_anims.empty())
+    {
+        for(uint32 i = 0; i < _anims.size(); ++i)
+            _FinishAnim(_anims[i]);
+        _anims.clear();
+    }
+
+    return IsDone();
+}
+
+void ResourcePreloader::Finish(void)
+{
+    while(!Update(0))
+    {
+        if(!_loading.empty())
+            resMgr.WaitAsync(_items[_loading.front()].req);
+        resMgr.UpdateAsync();
+    }
+}
+
+// this may add more items, so references into _items are not kept across calls to Add()
+void ResourcePreloader::_Start(uint32 idx)
+{
+    Item& item = _items[idx];
+    AsyncLoad *req = NULL;
+    switch(item.type)
+    {
+        case PRELOAD_IMG:
+            req = resMgr.LoadImgAsync(item.name.c_str());
+            break;
+
+        case PRELOAD_SOUND:
+            req = resMgr.LoadSoundAsync(item.name.c_str());
+            break;
+
+        case PRELOAD_MUSIC:
+            req = resMgr.LoadMusicAsync(item.name.c_str());
+            break;
+
+        case PRELOAD_FILE:
+            req = resMgr.LoadFileAsync(item.name.c_str());
+            break;
+
+        case PRELOAD_ANIM:
+        {
+            std::string fn("gfx/" + item.name);
+            if(resMgr._GetPtr(fn))
+            {
+                _Done(idx, resMgr.LoadAnim(item.name.c_str()));
+                return;
+            }
+            Anim *ani = resMgr._ParseAnimFile(fn);
+            if(!ani)
+            {
+                _Done(idx, NULL);
+                return;
+            }
+            item.res = ani;
+            item.state = ITEM_WAITING;
+            _anims.push_back(idx);
+
+            // same as ResourceMgr::_AddAnim()
+            std::string relpath(_PathStripLast(item.name));
+            for(AnimMap::iterator am = ani->anims.begin(); am != ani->anims.end(); am++)
+                for(AnimFrameVector::iterator af = am->second.store.begin(); af != am->second.store.end(); af++)
+                    Add(PRELOAD_IMG, AddPathIfNecessary(af->GetFilename(), relpath).c_str());
+            return;
+        }
+    }
+
+    item.req = req;
+    item.state = ITEM_LOADING;
+    _loading.push_back(idx);
+}
+
+void ResourcePreloader::_FinishAnim(uint32 idx)
+{
+    Item& item = _items[idx];
+    std::string fn("gfx/" + item.name);
+    Anim *ani = (Anim*)item.res;
+    item.res = NULL;
+    if(ani && !resMgr._GetPtr(fn))
+        resMgr._AddAnim(fn, ani);
+    else
+    {
+        delete ani;
+        ani = resMgr.LoadAnim(item.name.c_str());
+    }
+    _Done(idx, ani);
+}
+
+void ResourcePreloader::_Done(uint32 idx, void *res)
+{
+    Item& item = _items[idx];
+    item.res = res;
+    item.state = ITEM_DONE;
+    ++_done;
+}
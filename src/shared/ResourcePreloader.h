@@ -0,0 +1,76 @@
+#ifndef RESOURCEPRELOADER_H
+#define RESOURCEPRELOADER_H
+
+#include <vector>
+#include <deque>
+#include <set>
+
+class ThreadPool;
+class AsyncLoad;
+
+// Loads a list of resources into the ResourceMgr ahead of time, so that they are there when a map needs them.
+// Uses the asynchronous loaders of the ResourceMgr, which are finished by ResourceMgr::UpdateAsync().
+// Holds a reference to everything it loaded until it is deleted.
+class ResourcePreloader
+{
+public:
+    enum PreloadType
+    {
+        PRELOAD_IMG,
+        PRELOAD_ANIM,
+        PRELOAD_SOUND,
+        PRELOAD_MUSIC,
+        PRELOAD_FILE
+    };
+
+    ResourcePreloader(ThreadPool *pool);
+    ~ResourcePreloader();
+
+    void Add(PreloadType type, const char *name); // name as it would be passed to ResourceMgr::Load*()
+    void AddFile(const char *fn); // full VFS path, the type is chosen by the top directory and file extension
+    bool AddMap(const char *fn); // all tiles used by a map, and what its sidecar file "<fn>.preload" lists
+    void AddManifest(const char *text); // one full VFS path per line, '#' starts a comment
+
+    bool Update(uint32 maxms); // starts loading for up to maxms ms (0 = no limit) and collects finished resources. true when done.
+    void Finish(void); // returns when everything is loaded
+    inline bool IsDone(void) const { return _done == _items.size(); }
+    inline uint32 GetDoneCount(void) const { return _done; }
+    inline uint32 GetTotalCount(void) const { return _items.size(); }
+    float GetProgress(void) const; // 0 .. 1
+    inline const std::string& GetName(void) const { return _name; }
+    inline void SetName(const std::string& name) { _name = name; }
+
+private:
+    enum ItemState
+    {
+        ITEM_NEW,
+        ITEM_LOADING,
+        ITEM_WAITING, // anims, until their images are loaded
+        ITEM_DONE
+    };
+
+    struct Item
+    {
+        Item() : type(PRELOAD_FILE), state(ITEM_NEW), req(NULL), res(NULL) {}
+        PreloadType type;
+        ItemState state;
+        std::string name;
+        AsyncLoad *req;
+        void *res; // what we hold a reference to
+    };
+
+    void _Start(uint32 idx); // starts loading, or parses an anim
+    void _FinishAnim(uint32 idx); // adds the parsed anim to the ResourceMgr
+    void _Done(uint32 idx, void *res);
+
+    ThreadPool *_pool;
+    std::vector<Item> _items;
+    std::set<std::string> _added; // type + name, to add everything only once
+    std::deque<uint32> _loading; // indexes into _items, in the order they were started
+    std::vector<uint32> _anims; // waiting
+    uint32 _next; // first item not yet started
+    uint32 _done;
+    std::string _name;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef SMALLVECTOR_H
+#define SMALLVECTOR_H
+
+// vector that stores up to N elements inline, and only allocates heap memory if it has to grow beyond that.
+// intended for POD types (pointers, mostly): elements are copied with memcpy and never constructed/destructed.
+// order of elements is not preserved on erase.
+template <typename T, uint32 N> class SmallVector
+{
+public:
+    typedef T* iterator;
+    typedef const T* const_iterator;
+
+    SmallVector() : _data(&_local[0]), _size(0), _cap(N) {}
+    ~SmallVector() { _FreeHeap(); }
+
+    inline iterator begin(void) { return _data; }
+    inline iterator end(void) { return _data + _size; }
+    inline const_iterator begin(void) const { return _data; }
+    inline const_iterator end(void) const { return _data + _size; }
+    inline uint32 size(void) const { return _size; }
+    inline bool empty(void) const { return !_size; }
+    inline T& operator[](uint32 i) { return _data[i]; }
+    inline const T& operator[](uint32 i) const { return _data[i]; }
+
+    inline void push_back(const T& v)
+    {
+        if(_size == _cap)
+            _Grow();
+        _data[_size++] = v;
+    }
+
+    inline iterator find(const T& v)
+    {
+        for(uint32 i = 0; i < _size; ++i)
+            if(_data[i] == v)
+                return _data + i;
+        return end();
+    }
+
+    inline const_iterator find(const T& v) const
+    {
+        for(uint32 i = 0; i < _size; ++i)
+            if(_data[i] == v)
+                return _data + i;
+        return end();
+    }
+
+    // replaces the erased element with the last one
+    inline void erase(iterator it)
+    {
+        *it = _data[--_size];
+    }
+
+    // set-like helpers
+    inline bool insert_unique(const T& v)
+    {
+        if(find(v) != end())
+            return false;
+        push_back(v);
+        return true;
+    }
+
+    inline bool erase_value(const T& v)
+    {
+        iterator it = find(v);
+        if(it == end())
+            return false;
+        erase(it);
+        return true;
+    }
+
+    // keeps heap memory, if any
+    inline void clear(void) { _size = 0; }
+
+private:
+    SmallVector(const SmallVector&); // forbid copy
+    SmallVector& operator=(const SmallVector&);
+
+    void _Grow(void)
+    {
+        uint32 newcap = _cap * 2;
+        T *newdata = new T[newcap];
+        memcpy(newdata, _data, _size * sizeof(T));
+        _FreeHeap();
+        _data = newdata;
+        _cap = newcap;
+    }
+
+    inline void _FreeHeap(void)
+    {
+        if(_data != &_local[0])
+            delete [] _data;
+    }
+
+    T *_data;
+    uint32 _size;
+    uint32 _cap;
+    T _local[N];
+};
+
+#endif
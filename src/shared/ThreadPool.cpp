@@ -0,0 +1,201 @@
+#include "common.h"
+#include "ThreadPool.h"
+
+#include <SDL/SDL.h>
+#include <SDL/SDL_thread.h>
+#include <algorithm>
+
+#ifdef _WIN32
+#  define WIN32_LEAN_AND_MEAN
+#  include <windows.h>
+#else
+#  include <unistd.h>
+#endif
+
+#include "UndefUselessCrap.h"
+
+
+ThreadPool::ThreadPool(uint32 threads /* = uint32(-1) */)
+: _running(0), _quit(false)
+{
+    _mtx = SDL_CreateMutex();
+    _workCond = SDL_CreateCond();
+    _doneCond = SDL_CreateCond();
+
+    if(threads == uint32(-1))
+        threads = GetCPUCount() - 1;
+
+    for(uint32 i = 0; i < threads; ++i)
+    {
+        SDL_Thread *th = SDL_CreateThread(&_ThreadFunc, this);
+        if(!th)
+        {
+            logerror("ThreadPool: Failed to create thread #%u, using %u threads", i, i);
+            break;
+        }
+        _threads.push_back(th);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    WaitAll();
+
+    SDL_mutexP(_mtx);
+    _quit = true;
+    SDL_CondBroadcast(_workCond);
+    SDL_mutexV(_mtx);
+
+    for(uint32 i = 0; i < _threads.size(); ++i)
+        SDL_WaitThread(_threads[i], NULL);
+
+    SDL_DestroyCond(_doneCond);
+    SDL_DestroyCond(_workCond);
+    SDL_DestroyMutex(_mtx);
+}
+
+uint32 ThreadPool::GetCPUCount(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    long n = info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+    long n = 1;
+#endif
+    return n > 0 ? uint32(n) : 1;
+}
+
+void ThreadPool::Add(ThreadPoolTask *task, bool urgent /* = false */)
+{
+    SDL_mutexP(_mtx);
+    task->_done = false;
+    if(urgent)
+        _queue.push_front(task);
+    else
+        _queue.push_back(task);
+    SDL_CondSignal(_workCond);
+    SDL_mutexV(_mtx);
+}
+
+void ThreadPool::Wait(ThreadPoolTask *task)
+{
+    SDL_mutexP(_mtx);
+    // other tasks are not touched, they may take much longer than the caller wants to wait
+    std::deque<ThreadPoolTask*>::iterator it = std::find(_queue.begin(), _queue.end(), task);
+    if(it != _queue.end())
+    {
+        _queue.erase(it);
+        _RunLocked(task);
+    }
+    while(!task->_done) // the task is being run by another thread
+        SDL_CondWait(_doneCond, _mtx);
+    SDL_mutexV(_mtx);
+}
+
+void ThreadPool::WaitAll(void)
+{
+    SDL_mutexP(_mtx);
+    while(_running || !_queue.empty())
+    {
+        if(_queue.empty())
+            SDL_CondWait(_doneCond, _mtx);
+        else
+        {
+            ThreadPoolTask *t = _queue.front();
+            _queue.pop_front();
+            _RunLocked(t);
+        }
+    }
+    SDL_mutexV(_mtx);
+}
+
+// unlocks the mutex while the task runs
+void ThreadPool::_RunLocked(ThreadPoolTask *task)
+{
+    ++_running;
+    SDL_mutexV(_mtx);
+    task->Run();
+    SDL_mutexP(_mtx);
+    --_running;
+    task->_done = true;
+    SDL_CondBroadcast(_doneCond);
+}
+
+int ThreadPool::_ThreadFunc(void *p)
+{
+    ((ThreadPool*)p)->_WorkerLoop();
+    return 0;
+}
+
+void ThreadPool::_WorkerLoop(void)
+{
+    SDL_mutexP(_mtx);
+    while(true)
+    {
+        while(_queue.empty() && !_quit)
+            SDL_CondWait(_workCond, _mtx);
+        if(_quit)
+            break;
+        ThreadPoolTask *t = _queue.front();
+        _queue.pop_front();
+        _RunLocked(t);
+    }
+    SDL_mutexV(_mtx);
+}
+
+uint32 ThreadPool::GetPartCount(uint32 count, uint32 minPerPart /* = 1 */) const
+{
+    if(!count)
+        return 0;
+    if(!minPerPart)
+        minPerPart = 1;
+    uint32 parts = (count + minPerPart - 1) / minPerPart;
+    uint32 maxparts = _threads.size() + 1;
+    return parts < maxparts ? parts : maxparts;
+}
+
+class ParallelRangeTask : public ThreadPoolTask
+{
+public:
+    ParallelRangeTask() : job(NULL), begin(0), end(0), part(0) {}
+    virtual void Run(void) { job->Run(begin, end, part); }
+
+    ParallelRange *job;
+    uint32 begin;
+    uint32 end;
+    uint32 part;
+};
+
+void ThreadPool::ParallelFor(ParallelRange& job, uint32 count, uint32 minPerPart /* = 1 */)
+{
+    uint32 parts = GetPartCount(count, minPerPart);
+    if(parts <= 1)
+    {
+        if(count)
+            job.Run(0, count, 0);
+        return;
+    }
+
+    std::vector<ParallelRangeTask> tasks(parts);
+    uint32 per = count / parts, rest = count % parts, pos = 0;
+    for(uint32 i = 0; i < parts; ++i)
+    {
+        ParallelRangeTask& t = tasks[i];
+        t.job = &job;
+        t.part = i;
+        t.begin = pos;
+        pos += per + (i < rest ? 1 : 0);
+        t.end = pos;
+    }
+
+    // the first part is done by this thread, after the others are queued.
+    // they go before queued loading work, parts not taken by then are run here in Wait().
+    for(uint32 i = parts - 1; i >= 1; --i)
+        Add(&tasks[i], true);
+    tasks[0].Run();
+    for(uint32 i = 1; i < parts; ++i)
+        Wait(&tasks[i]);
+}
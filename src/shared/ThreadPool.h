@@ -0,0 +1,72 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <deque>
+#include <vector>
+
+struct SDL_mutex;
+struct SDL_cond;
+struct SDL_Thread;
+
+// Work item for a ThreadPool. The pool does not take ownership.
+class ThreadPoolTask
+{
+    friend class ThreadPool;
+
+public:
+    ThreadPoolTask() : _done(false) {}
+    virtual ~ThreadPoolTask() {}
+    virtual void Run(void) = 0;
+    inline bool IsDone(void) const { return _done; }
+
+private:
+    volatile bool _done;
+};
+
+// Work that can be split into independent index ranges, see ThreadPool::ParallelFor()
+class ParallelRange
+{
+public:
+    virtual ~ParallelRange() {}
+    virtual void Run(uint32 begin, uint32 end, uint32 part) = 0;
+};
+
+// Fixed set of worker threads processing queued tasks in FIFO order, urgent tasks first.
+// A thread waiting for a task that was not started yet runs it itself, so a pool without threads
+// (single core machine) runs tasks in the thread that waits for them. Other tasks are left to the workers.
+class ThreadPool
+{
+public:
+    ThreadPool(uint32 threads = uint32(-1)); // default: one thread less than there are CPUs, the calling thread helps out
+    ~ThreadPool();
+
+    void Add(ThreadPoolTask *task, bool urgent = false); // urgent tasks are run before all others, for work that is waited for right away
+    void Wait(ThreadPoolTask *task); // returns when the task was run
+    void WaitAll(void); // returns when the queue is empty and all tasks were run
+
+    // calls job.Run() for consecutive ranges of [0, count), each at least minPerPart long, and returns when all are done.
+    // the ranges are numbered in ascending order, starting with 0. they are queued as urgent.
+    void ParallelFor(ParallelRange& job, uint32 count, uint32 minPerPart = 1);
+    uint32 GetPartCount(uint32 count, uint32 minPerPart = 1) const; // how many parts ParallelFor() will use
+
+    inline uint32 GetThreadCount(void) const { return _threads.size(); }
+    static uint32 GetCPUCount(void);
+
+private:
+    ThreadPool(const ThreadPool&); // forbid copy
+    ThreadPool& operator=(const ThreadPool&);
+
+    static int _ThreadFunc(void *);
+    void _WorkerLoop(void);
+    void _RunLocked(ThreadPoolTask *task); // mutex must be locked
+
+    std::vector<SDL_Thread*> _threads;
+    std::deque<ThreadPoolTask*> _queue;
+    SDL_mutex *_mtx;
+    SDL_cond *_workCond; // signalled when tasks were added
+    SDL_cond *_doneCond; // signalled when a task is done
+    uint32 _running; // tasks taken from the queue, but not done yet
+    bool _quit;
+};
+
+#endif
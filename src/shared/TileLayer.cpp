@@ -7,31 +7,73 @@
 
 TileLayer::TileLayer()
 : used(false), collision(false), visible(false), xoffs(0), yoffs(0), camera(NULL), target(NULL),
-visible_area(NULL), mgr(NULL), parallaxMulti(1.0f)
+visible_area(NULL), mgr(NULL), parallaxMulti(1.0f), tilearray(NULL, NULL)
 {
 }
 
+static void derefChunk(BasicTile **chunk)
+{
+    for(uint32 i = 0; i < TileArray::CHUNK_SIZE; ++i)
+        if(chunk[i])
+            chunk[i]->ref--;
+}
 
 // upon deletion, update refcount of all tiles, this ensures proper resource cleanup.
 TileLayer::~TileLayer()
 {
-    for(uint32 y = 0; y < tilearray.size1d(); ++y)
-        for(uint32 x = 0; x < tilearray.size1d(); ++x)
-            if(BasicTile *tile = tilearray(x,y))
-                tile->ref--;
+    for(uint32 cy = 0; cy < tilearray.chunksY(); ++cy)
+        for(uint32 cx = 0; cx < tilearray.chunksX(); ++cx)
+            if(BasicTile **chunk = tilearray.chunk(cx, cy))
+                derefChunk(chunk);
 }
 
-void TileLayer::Clear(void)
+void TileLayer::Clear(bool updateCollision /* = true */)
 {
-    for(uint32 y = 0; y < tilearray.size1d(); ++y)
-        for(uint32 x = 0; x < tilearray.size1d(); ++x)
-            SetTile(x, y, NULL, true);
+    // area that had tiles, for the collision map
+    uint32 x1 = tilearray.width(), y1 = tilearray.height(), x2 = 0, y2 = 0;
+    for(uint32 cy = 0; cy < tilearray.chunksY(); ++cy)
+        for(uint32 cx = 0; cx < tilearray.chunksX(); ++cx)
+        {
+            BasicTile **chunk = tilearray.chunk(cx, cy);
+            if(!chunk)
+                continue;
+            derefChunk(chunk);
+            tilearray.freeChunk(cx, cy);
+            modified[cy * tilearray.chunksX() + cx] = true;
+            x1 = std::min(x1, cx << TILECHUNK_SHIFT);
+            y1 = std::min(y1, cy << TILECHUNK_SHIFT);
+            x2 = std::max(x2, (cx + 1) << TILECHUNK_SHIFT);
+            y2 = std::max(y2, (cy + 1) << TILECHUNK_SHIFT);
+        }
+    tilemap.clear();
+    used = 0;
+
+    if(updateCollision && x2 && collision && mgr && mgr->HasCollisionMap())
+        mgr->UpdateCollisionMap(x1, y1, x2 - x1, y2 - y1);
+}
+
+void TileLayer::Fill(uint32 x, uint32 y, uint32 w, uint32 h, const uint16 *ids, BasicTile *const *table, uint32 tableSize,
+                     bool updateCollision /* = true */)
+{
+    uint32 maxw = x < tilearray.width() ? std::min(w, tilearray.width() - x) : 0;
+    uint32 maxh = y < tilearray.height() ? std::min(h, tilearray.height() - y) : 0;
+    for(uint32 iy = 0; iy < maxh; ++iy)
+    {
+        const uint16 *row = ids + iy * w;
+        for(uint32 ix = 0; ix < maxw; ++ix)
+            SetTile(x + ix, y + iy, row[ix] < tableSize ? table[row[ix]] : NULL, false);
+    }
+
+    if(updateCollision && maxw && maxh && collision && mgr && mgr->HasCollisionMap())
+        mgr->UpdateCollisionMap(x, y, maxw, maxh);
 }
 
 // Puts a tile to location (x,y). Set tile to NULL to remove current tile. Does ref-counting.
 void TileLayer::SetTile(uint32 x, uint32 y, BasicTile *tile, bool updateCollision /* = true */)
 {
-    if(x >= tilearray.size1d() || y >= tilearray.size1d())
+    if(x >= tilearray.width() || y >= tilearray.height())
+        return;
+    if(!tile && !tilearray.hasChunkAt(x,y)) // nothing there, and no need to allocate a chunk to store nothing
         return;
 
     BasicTile *& tileref = tilearray(x,y);
@@ -76,6 +118,7 @@ void TileLayer::SetTile(uint32 x, uint32 y, BasicTile *tile, bool updateCollisio
         tile->ref++;
 
     tileref = tile;
+    modified[(y >> TILECHUNK_SHIFT) * tilearray.chunksX() + (x >> TILECHUNK_SHIFT)] = true;
 
     // if this tile is relevant for collision detection, update collision map at this pos
     if(updateCollision && collision && mgr && mgr->HasCollisionMap())
@@ -101,13 +144,14 @@ void TileLayer::Render(void)
     if(visible_area)
     {
         blockrect = *visible_area;
-        blockrect.w = std::min(uint32(blockrect.w + blockrect.x), tilearray.size1d()); // use absolute values, this is right x point now
-        blockrect.h = std::min(uint32(blockrect.h + blockrect.y), tilearray.size1d()); // now bottom y point
+        blockrect.w = std::min(uint32(blockrect.w + blockrect.x), tilearray.width()); // use absolute values, this is right x point now
+        blockrect.h = std::min(uint32(blockrect.h + blockrect.y), tilearray.height()); // now bottom y point
     }
     else
     {
         blockrect.x = blockrect.y = 0;
-        blockrect.w = blockrect.h = tilearray.size1d();
+        blockrect.w = tilearray.width();
+        blockrect.h = tilearray.height();
     }
 
     if(camera)
@@ -122,7 +166,7 @@ void TileLayer::Render(void)
         for(uint32 y = blockrect.y; y < blockrect.h; ++y)
             for(uint32 x = blockrect.x; x < blockrect.w; ++x)
             {
-                BasicTile *& tile = tilearray(x,y);
+                BasicTile *tile = tilearray.get(x,y);
                 if(!tile)
                     continue;
 
@@ -138,7 +182,7 @@ void TileLayer::Render(void)
         {
             for(uint32 x = blockrect.x; x < blockrect.w; ++x)
             {
-                BasicTile *& tile = tilearray(x,y);
+                BasicTile *tile = tilearray.get(x,y);
                 if(!tile)
                     continue;
 
@@ -152,43 +196,52 @@ void TileLayer::Render(void)
 }
 
 // this should be called by LayerMgr only, unless the layer has no mgr
-void TileLayer::Resize(uint32 dim)
+void TileLayer::Resize(uint32 w, uint32 h)
 {
-    // enlarging is easy as no tiles will disappear
-    uint32 newsize = clp2(dim); // always n^2
-    if(newsize >= tilearray.size1d())
-    {
-        tilearray.resize(dim, NULL);
-        return;
-    }
-
     // if shrinking the map, the tiles that are going to disappear have to be reference counted down properly
-    // example: (not powers of 2 but who cares)
-    /* XXXX.....
-    *  XXXX.....
-    *  XXXX.....
-    *  .........
-    *  .........*/
-    uint32 y = 0, x;
-    while(y < newsize)
+    for(uint32 cy = 0; cy < tilearray.chunksY(); ++cy)
+        for(uint32 cx = 0; cx < tilearray.chunksX(); ++cx)
+        {
+            uint32 x1 = cx << TILECHUNK_SHIFT, y1 = cy << TILECHUNK_SHIFT;
+            if(!tilearray.chunk(cx, cy) || (x1 + TILECHUNK_DIM <= w && y1 + TILECHUNK_DIM <= h))
+                continue;
+            for(uint32 y = y1; y < y1 + TILECHUNK_DIM; ++y)
+                for(uint32 x = x1; x < x1 + TILECHUNK_DIM; ++x)
+                    if(x >= w || y >= h)
+                        SetTile(x, y, NULL, false); // drop tile
+        }
+    uint32 oldcw = tilearray.chunksX(), oldch = tilearray.chunksY();
+    tilearray.resize(w, h);
+
+    // keep the flags of the chunks that are still there
+    uint32 cw = tilearray.chunksX(), ch = tilearray.chunksY();
+    std::vector<bool> oldmod;
+    oldmod.swap(modified);
+    modified.resize(cw * ch, false);
+    for(uint32 cy = 0; cy < std::min(ch, oldch); ++cy)
+        for(uint32 cx = 0; cx < std::min(cw, oldcw); ++cx)
+            modified[cy * cw + cx] = oldmod[cy * oldcw + cx];
+}
+
+void TileLayer::DropChunk(uint32 cx, uint32 cy)
+{
+    if(HasChunk(cx, cy))
     {
-        for(x = tilearray.size1d(); x < newsize; x++)
-            if(BasicTile *tile = GetTile(x,y))
-                SetTile(x, y, NULL, false); // drop tile
-        y++;
+        uint32 x1 = cx << TILECHUNK_SHIFT, y1 = cy << TILECHUNK_SHIFT;
+        for(uint32 y = y1; y < y1 + TILECHUNK_DIM; ++y)
+            for(uint32 x = x1; x < x1 + TILECHUNK_DIM; ++x)
+                SetTile(x, y, NULL, false);
+        tilearray.freeChunk(cx, cy);
     }
-    for(y = tilearray.size1d(); y < newsize; y++)
-        for(x = 0; x < newsize; x++)
-            if(BasicTile *tile = GetTile(x,y))
-                SetTile(x, y, NULL, false); // drop tile
+    SetChunkModified(cx, cy, false);
 }
 
 void TileLayer::CopyTo(uint32 startx, uint32 starty, TileLayer *dest, uint32 destx, uint32 desty, uint32 w, uint32 h)
 {
-    uint32 copyable_src_x = GetArraySize() - startx;
-    uint32 copyable_src_y = GetArraySize() - starty;
-    uint32 copyable_dest_x = dest->GetArraySize() - destx;
-    uint32 copyable_dest_y = dest->GetArraySize() - desty;
+    uint32 copyable_src_x = GetWidth() - startx;
+    uint32 copyable_src_y = GetHeight() - starty;
+    uint32 copyable_dest_x = dest->GetWidth() - destx;
+    uint32 copyable_dest_y = dest->GetHeight() - desty;
     w = std::min(w, std::min(copyable_src_x, copyable_dest_x));
     h = std::min(h, std::min(copyable_src_y, copyable_dest_y));
 
@@ -2,7 +2,8 @@
 #define TILELAYER_H
 
 #include <map>
-#include "array2d.h"
+#include <vector>
+#include "chunkarray2d.h"
 
 struct SDL_Surface;
 struct SDL_Rect;
@@ -13,6 +14,13 @@ struct Camera;
 
 typedef std::map<AnimatedTile*, uint32> AnimTileMap;
 
+// tiles are stored in square chunks of this many tiles per side, which are only allocated where tiles are set.
+// this is also the unit in which chunked maps are streamed, see MapStreamer.
+#define TILECHUNK_SHIFT 5
+#define TILECHUNK_DIM (1 << TILECHUNK_SHIFT)
+
+typedef chunkarray2d<BasicTile*, TILECHUNK_SHIFT> TileArray;
+
 
 class TileLayer
 {
@@ -21,16 +29,30 @@ class TileLayer
 public:
     TileLayer();
     ~TileLayer();
-    void Clear(void);
+    void Clear(bool updateCollision = true); // the collision map is updated once at the end, not for each tile
     void Update(uint32 curtime);
     void Render(void);
     void SetTile(uint32 x, uint32 y, BasicTile *tile, bool updateCollision = true);
-    inline BasicTile *GetTile(uint32 x, uint32 y) { return tilearray(x,y); }
-    inline uint32 GetArraySize(void) { return tilearray.size1d(); }
-    inline uint32 GetPixelSize(void) { return GetArraySize() * 16; }
+    // Sets a w*h rectangle of tiles at (x,y). ids are indexes into table, row by row; 0 or an index past the table clears the cell.
+    // Like SetTile(), but if requested, the collision map is updated once at the end.
+    void Fill(uint32 x, uint32 y, uint32 w, uint32 h, const uint16 *ids, BasicTile *const *table, uint32 tableSize,
+        bool updateCollision = true);
+    inline BasicTile *GetTile(uint32 x, uint32 y) const { return tilearray.get(x,y); }
+    inline uint32 GetWidth(void) const { return tilearray.width(); }
+    inline uint32 GetHeight(void) const { return tilearray.height(); }
+    inline uint32 GetArraySize(void) const { return std::max(GetWidth(), GetHeight()); } // the larger side
     inline bool IsUsed(void) { return used; }
     inline uint32 UsedTiles(void) { return used; }
-    void Resize(uint32 dim); // do not use this for layers stored in the LayerMgr!
+    inline uint32 UsedChunks(void) const { return tilearray.usedChunks(); }
+    inline uint32 GetChunksX(void) const { return tilearray.chunksX(); }
+    inline uint32 GetChunksY(void) const { return tilearray.chunksY(); }
+    // chunk coordinates, TILECHUNK_DIM tiles per chunk
+    inline bool HasChunk(uint32 cx, uint32 cy) const { return cx < GetChunksX() && cy < GetChunksY() && tilearray.chunk(cx, cy); }
+    void DropChunk(uint32 cx, uint32 cy); // removes all tiles of the chunk and frees it. does not touch the collision map.
+    // a chunk is marked as modified when one of its tiles is changed. MapStreamer does not drop modified chunks.
+    inline bool IsChunkModified(uint32 cx, uint32 cy) const { return cx < GetChunksX() && cy < GetChunksY() && modified[cy * GetChunksX() + cx]; }
+    inline void SetChunkModified(uint32 cx, uint32 cy, bool m) { if(cx < GetChunksX() && cy < GetChunksY()) modified[cy * GetChunksX() + cx] = m; }
+    void Resize(uint32 w, uint32 h); // do not use this for layers stored in the LayerMgr!
     void CopyTo(uint32 startx, uint32 starty, TileLayer *dest, uint32 destx, uint32 desty, uint32 w, uint32 h);
 
     std::string name;
@@ -44,9 +66,10 @@ public:
     bool collision; // do collision checking against this layer for non-transparent areas
 
 protected:
-    array2d<BasicTile*> tilearray;
+    TileArray tilearray;
     AnimTileMap tilemap;
     uint32 used; // amount of used tiles - if 0 Update() and Render() are skipped. Counted in SetTile()
+    std::vector<bool> modified; // per chunk, row by row
     LayerMgr *mgr; // ptr to layer mgr - this is needed for collision map (re-)calculation
 };
 
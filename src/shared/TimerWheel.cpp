@@ -0,0 +1,181 @@
+#include "common.h"
+#include "TimerWheel.h"
+
+
+TimerWheel::TimerWheel()
+: _pool("Timer", sizeof(Timer), 64), _cur(0), _nextId(0)
+{
+    for(uint32 i = 0; i < ROOT_SIZE; ++i)
+        _InitList(&_root[i]);
+    for(uint32 l = 0; l < LEVELS; ++l)
+        for(uint32 i = 0; i < LEVEL_SIZE; ++i)
+            _InitList(&_levels[l][i]);
+    _InitList(&_due);
+}
+
+TimerWheel::~TimerWheel()
+{
+    Clear();
+}
+
+uint32 TimerWheel::Schedule(uint32 when, TimerCallback *cb)
+{
+    do
+        ++_nextId;
+    while(!_nextId || _timers.find(_nextId) != _timers.end()); // skip 0, and ids still in use after wrapping around
+
+    Timer *t = (Timer*)_pool.Alloc();
+    t->cb = cb;
+    t->id = _nextId;
+    t->expires = when;
+    _timers[t->id] = t;
+    _Insert(t);
+    return t->id;
+}
+
+bool TimerWheel::Cancel(uint32 id)
+{
+    TimerMap::iterator it = _timers.find(id);
+    if(it == _timers.end())
+        return false;
+    Timer *t = it->second;
+    _timers.erase(it);
+    _Unlink(t);
+    _Destroy(t);
+    return true;
+}
+
+bool TimerWheel::Reschedule(uint32 id, uint32 when)
+{
+    TimerMap::iterator it = _timers.find(id);
+    if(it == _timers.end())
+        return false;
+    Timer *t = it->second;
+    _Unlink(t);
+    t->expires = when;
+    _Insert(t);
+    return true;
+}
+
+void TimerWheel::Clear(void)
+{
+    for(TimerMap::iterator it = _timers.begin(); it != _timers.end(); ++it)
+    {
+        _Unlink(it->second);
+        _Destroy(it->second);
+    }
+    _timers.clear();
+}
+
+void TimerWheel::Update(uint32 now)
+{
+    // the time base was reset, keep the remaining time of all timers
+    if(int32(now - _cur) < -1)
+        _Rebase(now);
+
+    while(int32(now - _cur) >= 0)
+    {
+        if(_timers.empty())
+        {
+            _cur = now + 1;
+            break;
+        }
+
+        // when the root wheel turned over, move the timers of the next coarser bucket down
+        uint32 idx = _cur & ROOT_MASK;
+        if(!idx)
+        {
+            for(uint32 l = 0; l < LEVELS; ++l)
+            {
+                uint32 lidx = (_cur >> (ROOT_BITS + l * LEVEL_BITS)) & LEVEL_MASK;
+                _Cascade(l, lidx);
+                if(lidx)
+                    break;
+            }
+        }
+
+        // everything in this bucket expires now.
+        // timers scheduled from within a callback go at least into the next tick.
+        _Splice(&_root[idx], &_due);
+        ++_cur;
+
+        while(!_IsEmpty(&_due))
+        {
+            Timer *t = (Timer*)_due.next;
+            _Unlink(t);
+            _timers.erase(t->id);
+            // the callback may add, cancel or reschedule timers, including the ones still in _due
+            t->cb->Call(t->id);
+            _Destroy(t);
+        }
+    }
+}
+
+void TimerWheel::_Insert(Timer *t)
+{
+    if(int32(t->expires - _cur) < 0)
+        t->expires = _cur; // already expired, call in the next update
+    uint32 delta = t->expires - _cur;
+    if(delta > MAX_DELAY)
+        delta = MAX_DELAY; // will be sorted in again when its bucket is cascaded
+    uint32 when = _cur + delta;
+
+    TimerNode *head;
+    if(delta < ROOT_SIZE)
+        head = &_root[when & ROOT_MASK];
+    else
+    {
+        uint32 l = 0;
+        while(l < LEVELS - 1 && delta >= (1u << (ROOT_BITS + (l + 1) * LEVEL_BITS)))
+            ++l;
+        head = &_levels[l][(when >> (ROOT_BITS + l * LEVEL_BITS)) & LEVEL_MASK];
+    }
+    _Append(head, t);
+}
+
+void TimerWheel::_Cascade(uint32 level, uint32 idx)
+{
+    TimerNode tmp;
+    _InitList(&tmp);
+    _Splice(&_levels[level][idx], &tmp);
+    while(!_IsEmpty(&tmp))
+    {
+        Timer *t = (Timer*)tmp.next;
+        _Unlink(t);
+        _Insert(t);
+    }
+}
+
+void TimerWheel::_Rebase(uint32 now)
+{
+    for(TimerMap::iterator it = _timers.begin(); it != _timers.end(); ++it)
+    {
+        Timer *t = it->second;
+        _Unlink(t);
+        int32 remain = int32(t->expires - (_cur - 1)); // relative to the last processed tick
+        t->expires = remain > 0 ? now + remain : now;
+    }
+    _cur = now + 1; // 'now' takes the place of the last processed tick
+    for(TimerMap::iterator it = _timers.begin(); it != _timers.end(); ++it)
+        _Insert(it->second);
+}
+
+void TimerWheel::_Destroy(Timer *t)
+{
+    delete t->cb;
+    _pool.Free(t);
+}
+
+// moves all entries of list 'from' to the end of list 'to'
+void TimerWheel::_Splice(TimerNode *from, TimerNode *to)
+{
+    if(_IsEmpty(from))
+        return;
+    TimerNode *first = from->next;
+    TimerNode *last = from->prev;
+    first->prev = to->prev;
+    to->prev->next = first;
+    last->next = to;
+    to->prev = last;
+    _InitList(from);
+}
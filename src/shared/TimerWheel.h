@@ -0,0 +1,94 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <map>
+#include "BlockPool.h"
+
+class TimerCallback
+{
+public:
+    virtual ~TimerCallback() {}
+    virtual void Call(uint32 id) = 0;
+};
+
+// Hierarchical timer wheel with 1 ms resolution.
+// Timers are sorted into buckets by their expiry time; Update() only touches the bucket(s) of the
+// time span that passed, so timers that are not yet due cost nothing per frame.
+// Timers further away wait in coarser buckets, and are moved down when their time comes closer.
+class TimerWheel
+{
+public:
+    TimerWheel();
+    ~TimerWheel();
+
+    // calls cb at time 'when' (absolute, same time base as passed to Update()).
+    // takes ownership of cb. returns the timer id (never 0).
+    uint32 Schedule(uint32 when, TimerCallback *cb);
+    bool Cancel(uint32 id);
+    bool Reschedule(uint32 id, uint32 when);
+    void Update(uint32 now);
+    void Clear(void);
+    inline uint32 GetCount(void) const { return _timers.size(); }
+
+private:
+    enum
+    {
+        ROOT_BITS = 8,
+        ROOT_SIZE = 1 << ROOT_BITS,
+        ROOT_MASK = ROOT_SIZE - 1,
+        LEVEL_BITS = 6,
+        LEVEL_SIZE = 1 << LEVEL_BITS,
+        LEVEL_MASK = LEVEL_SIZE - 1,
+        LEVELS = 3, // + root; covers (1 << 26) ms ~ 18.6 hours, timers beyond that are re-sorted when the last level turns over
+        MAX_DELAY = (1 << (ROOT_BITS + LEVELS * LEVEL_BITS)) - 1
+    };
+
+    struct TimerNode
+    {
+        TimerNode *next;
+        TimerNode *prev;
+    };
+
+    struct Timer : public TimerNode
+    {
+        TimerCallback *cb;
+        uint32 id;
+        uint32 expires;
+    };
+
+    typedef std::map<uint32, Timer*> TimerMap;
+
+    TimerWheel(const TimerWheel&); // forbid copy
+    TimerWheel& operator=(const TimerWheel&);
+
+    void _Insert(Timer *t);
+    void _Cascade(uint32 level, uint32 idx);
+    void _Rebase(uint32 now);
+    void _Destroy(Timer *t);
+
+    inline static void _InitList(TimerNode *head) { head->next = head->prev = head; }
+    inline static bool _IsEmpty(const TimerNode *head) { return head->next == head; }
+    inline static void _Unlink(TimerNode *n)
+    {
+        n->prev->next = n->next;
+        n->next->prev = n->prev;
+    }
+    inline static void _Append(TimerNode *head, TimerNode *n)
+    {
+        n->next = head;
+        n->prev = head->prev;
+        head->prev->next = n;
+        head->prev = n;
+    }
+    static void _Splice(TimerNode *from, TimerNode *to);
+
+    TimerNode _root[ROOT_SIZE];
+    TimerNode _levels[LEVELS][LEVEL_SIZE];
+    TimerNode _due; // timers taken out of their bucket in the current Update(), but not yet called
+    TimerMap _timers;
+    BlockPool _pool;
+    uint32 _cur; // next tick to process
+    uint32 _nextId;
+};
+
+#endif
@@ -2,6 +2,9 @@
 #include "VFSFile.h"
 #include "VFSDir.h"
 
+#include <set>
+#include <time.h>
+
 VFSDir::~VFSDir()
 {
     for(VFSFileMap::iterator it = _files.begin(); it != _files.end(); it++)
@@ -52,6 +55,24 @@ bool VFSDir::addRecursive(VFSFile *f, bool overwrite /* = true */)
     return vdir->add(f, true);
 }
 
+bool VFSDir::remove(const char *fn)
+{
+    VFSFileMap::iterator it = _files.find(fn);
+    if(it == _files.end())
+        return false;
+    it->second->ref--;
+    _files.erase(it);
+    return true;
+}
+
+void VFSDir::listFiles(std::vector<std::string>& files, const std::string& prefix /* = "" */)
+{
+    for(VFSFileMap::iterator it = _files.begin(); it != _files.end(); it++)
+        files.push_back(prefix + it->first);
+    for(VFSDirMap::iterator it = _subdirs.begin(); it != _subdirs.end(); it++)
+        it->second->listFiles(files, prefix + it->first + '/');
+}
+
 bool VFSDir::merge(VFSDir *dir, bool overwrite /* = true */)
 {
     bool result = false;
@@ -150,7 +171,7 @@ VFSDir *VFSDir::getDir(const char *subdir, bool forceCreate /* = false */)
 // ----- VFSDirReal start here -----
 
 
-VFSDirReal::VFSDirReal() : VFSDir()
+VFSDirReal::VFSDirReal() : VFSDir(), _mtime(0), _scanTime(0)
 {
 }
 
@@ -158,6 +179,8 @@ uint32 VFSDirReal::load(const char *dir /* = NULL */)
 {
     _abspath = dir;
     _name = _PathToFileName(dir); // path must not end with '/'
+    _mtime = GetModifiedTime(dir); // before reading, so that changes made while reading are seen by refresh()
+    _scanTime = time(NULL);
     std::deque<std::string> fl = GetFileList(dir);
 
     for(std::deque<std::string>::iterator it = fl.begin(); it != fl.end(); it++)
@@ -180,3 +203,67 @@ uint32 VFSDirReal::load(const char *dir /* = NULL */)
     }
     return sum;
 }
+
+// a directory's mtime changes when entries are added, removed or renamed, but not when a file's content changes,
+// or when something changes further down the tree. so every directory is stat()ed, but only changed ones are read.
+void VFSDirReal::refresh(std::vector<std::string>& changed, const std::string& prefix /* = "" */)
+{
+    uint64 mt = GetModifiedTime(_abspath.c_str());
+
+    // the mtime has only a resolution of 1 second, so a change right after the last scan might have gone unnoticed
+    if(mt != _mtime || mt >= _scanTime)
+    {
+        _mtime = mt;
+        _scanTime = time(NULL);
+
+        std::deque<std::string> fl = GetFileList(_abspath);
+        std::set<std::string> present(fl.begin(), fl.end());
+        for(VFSFileMap::iterator it = _files.begin(); it != _files.end(); )
+        {
+            if(present.find(it->first) == present.end())
+            {
+                changed.push_back(prefix + it->first);
+                it->second->ref--;
+                _files.erase(it++);
+            }
+            else
+                ++it;
+        }
+        for(std::deque<std::string>::iterator it = fl.begin(); it != fl.end(); it++)
+        {
+            if(_files.find(*it) != _files.end())
+                continue;
+            VFSFileReal *f = new VFSFileReal((_abspath + '/'  + *it).c_str());
+            _files[f->name()] = f;
+            changed.push_back(prefix + f->name());
+        }
+
+        std::deque<std::string> dl = GetDirList(_abspath, false);
+        present.clear();
+        present.insert(dl.begin(), dl.end());
+        for(VFSDirMap::iterator it = _subdirs.begin(); it != _subdirs.end(); )
+        {
+            if(present.find(it->first) == present.end())
+            {
+                it->second->listFiles(changed, prefix + it->first + '/');
+                it->second->ref--;
+                _subdirs.erase(it++);
+            }
+            else
+                ++it;
+        }
+        for(std::deque<std::string>::iterator it = dl.begin(); it != dl.end(); it++)
+        {
+            if(_subdirs.find(*it) != _subdirs.end())
+                continue;
+            VFSDirReal *d = new VFSDirReal;
+            d->load((_abspath + '/' + *it).c_str());
+            _subdirs[d->name()] = d;
+            d->listFiles(changed, prefix + d->name() + '/');
+        }
+    }
+
+    // subdirs that were just loaded are up to date, checking them again is cheap
+    for(VFSDirMap::iterator it = _subdirs.begin(); it != _subdirs.end(); it++)
+        ((VFSDirReal*)it->second)->refresh(changed, prefix + it->first + '/');
+}
@@ -2,6 +2,7 @@
 #define VFSDIR_H
 
 #include <map>
+#include <vector>
 #include "SelfRefCounter.h"
 
 class VFSDir;
@@ -18,11 +19,16 @@ public:
     virtual uint32 load(const char *dir = NULL) { return 0; } // dir must be absolute path
     virtual VFSFile *getFile(const char *fn);
     virtual VFSDir *getDir(const char *subdir, bool forceCreate = false);
+    // checks the underlying storage for changes and updates the tree.
+    // the paths of added and removed files are appended to changed, prepended by prefix.
+    virtual void refresh(std::vector<std::string>& changed, const std::string& prefix = "") {}
 
     bool insert(VFSDir *subdir, bool overwrite = true);
     bool merge(VFSDir *dir, bool overwrite = true);
     bool add(VFSFile *f, bool overwrite = true); // add file directly in this dir
     bool addRecursive(VFSFile *f, bool overwrite = true); // traverse subdir tree to find correct subdir; create if not existing
+    bool remove(const char *fn); // remove file directly in this dir
+    void listFiles(std::vector<std::string>& files, const std::string& prefix = ""); // appends the paths of all files below this dir
 
 
     const char *name() { return _name.c_str(); }
@@ -43,9 +49,12 @@ public:
     VFSDirReal();
     virtual ~VFSDirReal() {};
     virtual uint32 load(const char *dir = NULL);
+    virtual void refresh(std::vector<std::string>& changed, const std::string& prefix = ""); // rescans only directories whose mtime changed
 
 protected:
     std::string _abspath;
+    uint64 _mtime; // of the directory when it was last scanned
+    uint64 _scanTime; // when it was last scanned
 };
 
 #endif
@@ -217,6 +217,7 @@ uint32 VFSFileMem::read(char *dst, uint32 bytes)
     uint32 rem = std::min(_size - _pos, bytes);
 
     memcpy(dst, _buf + _pos, rem);
+    _pos += rem;
     return rem;
 }
 
@@ -227,5 +228,6 @@ uint32 VFSFileMem::write(char *src, uint32 bytes)
     uint32 rem = std::min(_size - _pos, bytes);
 
     memcpy(_buf + _pos, src, rem);
+    _pos += rem;
     return rem;
 }
@@ -1,9 +1,12 @@
 #include "common.h"
 #include "LVPAFile.h"
+#include "LVPAStream.h"
 #include "VFSFileLVPA.h"
 
+#include <SDL/SDL_rwops.h>
+
 VFSFileLVPA::VFSFileLVPA(LVPAFile *src, uint32 headerId) : VFSFile(),
-_fixedStr(NULL)
+_fixedStr(NULL), _stream(NULL)
 {
     _mode = "b"; // binary mode by default
     _lvpa = src;
@@ -21,11 +24,22 @@ VFSFileLVPA::~VFSFileLVPA()
 {
     if(_fixedStr)
         delete [] _fixedStr;
+    _dropStream();
+}
+
+void VFSFileLVPA::_dropStream(void)
+{
+    if(_stream)
+    {
+        delete _stream;
+        _stream = NULL;
+    }
 }
 
 bool VFSFileLVPA::open(const char *fn /* = NULL */, char *mode /* = NULL */)
 {
     _pos = 0;
+    _dropStream();
     if(mode)
     {
         if(_fixedStr && mode != _mode)
@@ -85,12 +99,27 @@ uint64 VFSFileLVPA::getpos(void)
 
 uint32 VFSFileLVPA::read(char *dst, uint32 bytes)
 {
+    // binary reads of a file that is not in memory are streamed, instead of unpacking the whole file
+    if(!_stream && _mode.find('b') != std::string::npos && !_lvpa->IsReady(_headerId))
+    {
+        _stream = new LVPAStream;
+        if(!_stream->Open(_lvpa, _headerId))
+            _dropStream();
+    }
+    if(_stream)
+    {
+        _stream->Seek(_pos);
+        bytes = _stream->Read((uint8*)dst, bytes);
+        _pos += bytes;
+        return bytes;
+    }
+
     memblock data = _lvpa->Get(_headerId);
     uint8 *startptr = data.ptr + _pos;
     uint8 *endptr = data.ptr + data.size;
     bytes = std::min(uint32(endptr - startptr), bytes); // limit in case reading over buffer size
     if(_mode.find('b') == std::string::npos)
-        strnNLcpy(dst, (const char*)startptr, bytes); // non-binary == text mode
+        strnNLcpy(dst, (const char*)startptr, bytes, bytes); // non-binary == text mode
     else
         memcpy(dst, startptr, bytes); //  binary copy
     _pos += bytes;
@@ -99,6 +128,7 @@ uint32 VFSFileLVPA::read(char *dst, uint32 bytes)
 
 uint32 VFSFileLVPA::write(char *src, uint32 bytes)
 {
+    _dropStream(); // the data in memory are changed, the stream would read the old data
     if(getpos() + bytes >= size())
         size(getpos() + bytes); // enlarge if necessary
 
@@ -118,6 +148,8 @@ uint64 VFSFileLVPA::size(uint64 newsize)
     if(newsize == size())
         return newsize;
 
+    _dropStream();
+
     memblock data = _lvpa->Get(_headerId);
     const LVPAFileHeader& hdr = _lvpa->GetFileInfo(_headerId);
     uint32 n = uint32(newsize);
@@ -154,7 +186,7 @@ const uint8 *VFSFileLVPA::getBuf(void)
     if(buf && _mode.find("b") == std::string::npos) // text mode?
     {
         _fixedStr = new char[mb.size + 4];
-        strnNLcpy(_fixedStr, (const char*)buf);
+        strnNLcpy(_fixedStr, (const char*)buf, mb.size + 1, mb.size); // the data are not necessarily \0-terminated if mapped
         buf = (const uint8*)_fixedStr;
     }
     return buf;
@@ -177,3 +209,85 @@ void VFSFileLVPA::dropBuf(bool del)
         _lvpa->Drop(_headerId);
     }
 }
+
+// ------------- SDL_RWops for streaming -----------------------
+
+struct LVPARWData
+{
+    LVPAStream stream;
+    VFSFile *file; // referenced while the RWops exists
+};
+
+static int SDLCALL lvpaRW_seek(SDL_RWops *rw, int offset, int whence)
+{
+    LVPAStream *s = &((LVPARWData*)rw->hidden.unknown.data1)->stream;
+    int64 pos;
+    switch(whence)
+    {
+        case RW_SEEK_SET: pos = offset; break;
+        case RW_SEEK_CUR: pos = int64(s->Tell()) + offset; break;
+        case RW_SEEK_END: pos = int64(s->Size()) + offset; break;
+        default: return -1;
+    }
+    if(pos < 0 || !s->Seek(uint32(pos)))
+        return -1;
+    return int(s->Tell());
+}
+
+static int SDLCALL lvpaRW_read(SDL_RWops *rw, void *ptr, int size, int maxnum)
+{
+    LVPAStream *s = &((LVPARWData*)rw->hidden.unknown.data1)->stream;
+    if(size <= 0 || maxnum <= 0)
+        return 0;
+    // only whole objects are read
+    uint32 n = std::min(uint32(maxnum), (s->Size() - s->Tell()) / uint32(size));
+    uint32 bytes = s->Read((uint8*)ptr, n * uint32(size));
+    return int(bytes / uint32(size));
+}
+
+static int SDLCALL lvpaRW_write(SDL_RWops *, const void *, int, int)
+{
+    return -1; // read only
+}
+
+static int SDLCALL lvpaRW_close(SDL_RWops *rw)
+{
+    LVPARWData *d = (LVPARWData*)rw->hidden.unknown.data1;
+    VFSFile *vf = d->file;
+    delete d;
+    SDL_FreeRW(rw);
+    vf->ref--;
+    return 0;
+}
+
+SDL_RWops *VFSFileLVPA::openRWops(void)
+{
+    LVPARWData *d = new LVPARWData;
+    SDL_RWops *rw = NULL;
+    if(!d->stream.Open(_lvpa, _headerId) || !(rw = SDL_AllocRW()))
+    {
+        delete d;
+        return NULL;
+    }
+    d->file = this;
+    rw->seek = lvpaRW_seek;
+    rw->read = lvpaRW_read;
+    rw->write = lvpaRW_write;
+    rw->close = lvpaRW_close;
+    rw->hidden.unknown.data1 = d;
+    ref++; // keep this file around as long as the RWops is in use
+    return rw;
+}
+
+LVPAStream *VFSFileLVPA::openStream(void)
+{
+    if(_lvpa->IsReady(_headerId))
+        return NULL;
+    LVPAStream *stream = new LVPAStream;
+    if(!stream->Open(_lvpa, _headerId))
+    {
+        delete stream;
+        return NULL;
+    }
+    return stream;
+}
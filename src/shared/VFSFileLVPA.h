@@ -4,6 +4,8 @@
 #include "VFSFile.h"
 
 class LVPAFile;
+class LVPAStream;
+struct SDL_RWops;
 
 class VFSFileLVPA : public VFSFile
 {
@@ -29,7 +31,17 @@ public:
 
     inline LVPAFile *getLVPA(void) { return _lvpa; }
 
+    // creates a new SDL_RWops that streams this file from the archive, independent of this object's read position.
+    // safe to use from another thread (SDL_mixer does that for music). returns NULL if the file can't be streamed.
+    SDL_RWops *openRWops(void);
+
+    // a stream reading this file from the archive, to be deleted by the caller. may be used by another thread.
+    // returns NULL if the file is in memory already, or can't be streamed.
+    LVPAStream *openStream(void);
+
 protected:
+    void _dropStream(void);
+
     uint32 _pos;
     uint32 _size;
     uint32 _headerId;
@@ -38,6 +50,7 @@ protected:
     std::string _mode;
     LVPAFile *_lvpa;
     char *_fixedStr; // for \n fixed string in text mode
+    LVPAStream *_stream; // for binary reads while the file is not in memory
 };
 
 #endif
@@ -11,8 +11,52 @@
 #define LDR_DISK 0
 #define LDR_LVPABASE 1
 
+// makes paths comparable: backslashes become slashes, no leading "./" or '/', no duplicate or trailing '/'
+static std::string normalizePath(const char *p)
+{
+    std::string s;
+    s.reserve(strlen(p));
+    for( ; *p; ++p)
+    {
+        char c = *p == '\\' ? '/' : *p;
+        if(c == '/' && (s.empty() || s[s.length() - 1] == '/'))
+            continue;
+        if(c == '.' && s.empty() && (p[1] == '/' || p[1] == '\\'))
+            continue;
+        s += c;
+    }
+    if(s.length() && s[s.length() - 1] == '/')
+        s.erase(s.length() - 1);
+    return s;
+}
+
+static std::string makePrefix(const std::string& mountPoint)
+{
+    return mountPoint.empty() ? mountPoint : mountPoint + '/';
+}
+
+// removes the file at path below d, and directories that become empty. returns true if d is empty afterwards.
+static bool removeFileAndPrune(VFSDir *d, const char *path)
+{
+    const char *slash = strchr(path, '/');
+    if(slash)
+    {
+        VFSDirMap::iterator it = d->_subdirs.find(std::string(path, slash - path));
+        if(it == d->_subdirs.end())
+            return false;
+        if(removeFileAndPrune(it->second, slash + 1))
+        {
+            it->second->ref--;
+            d->_subdirs.erase(it);
+        }
+    }
+    else
+        d->remove(path);
+    return d->_files.empty() && d->_subdirs.empty();
+}
+
 VFSHelper::VFSHelper()
-: vRoot(NULL), filesysRoot(NULL), merged(NULL), lvpabase(NULL)
+: vRoot(NULL), filesysRoot(NULL), overrides(NULL), loaded(NULL), lvpabase(NULL), merged(NULL)
 {
     loaders.resize(OMNIPRESENT_LOADERS);
     loaders[LDR_DISK    ] = NULL; // reserved for VFSLoaderReal
@@ -22,51 +66,53 @@ VFSHelper::VFSHelper()
 
 VFSHelper::~VFSHelper()
 {
-    _delete();
-    if(vRoot)
-        vRoot->ref--;
-    if(filesysRoot)
-        filesysRoot->ref--;
-    if(lvpabase)
-        delete lvpabase;
-}
-
-void VFSHelper::_delete(void)
-{
+    _clearIndex();
     if(merged)
-    {
         merged->ref--;
-        merged = NULL;
-    }
+    if(overrides)
+        overrides->ref--;
+    if(loaded)
+        loaded->ref--;
     for(VFSMountList::iterator it = vlist.begin(); it != vlist.end(); it++)
         it->vdir->ref--;
     for(std::set<LVPAFile*>::iterator it = lvpalist.begin(); it != lvpalist.end(); it++)
         delete *it;
-    vlist.clear();
-    lvpalist.clear();
-    for(uint32 i = OMNIPRESENT_LOADERS; i < loaders.size(); ++i)
+    for(uint32 i = 0; i < loaders.size(); ++i)
         delete loaders[i];
-    loaders.resize(OMNIPRESENT_LOADERS); // drop all except first 2
-}
-
-void VFSHelper::LoadBase(LVPAFile *f, bool deleteLater)
-{
     if(vRoot)
         vRoot->ref--;
+    if(filesysRoot)
+        filesysRoot->ref--;
     if(lvpabase)
-    {
         delete lvpabase;
-        lvpabase = NULL;
-    }
+}
 
+void VFSHelper::LoadBase(LVPAFile *f, bool deleteLater)
+{
+    VFSDirLVPA *oldroot = vRoot;
     vRoot = new VFSDirLVPA(f);
     vRoot->load();
 
-    if(deleteLater)
-        lvpabase = f;
+    // the base is below everything else, so its files must be resolved instead of just overwritten
+    if(merged)
+    {
+        if(oldroot)
+            _updateDir(oldroot, "", true);
+        _updateDir(vRoot, "", false);
+    }
+    if(oldroot)
+        oldroot->ref--;
+    _clearLayer(loaded); // may contain files found by the old loader
+
+    if(lvpabase && lvpabase != f)
+        delete lvpabase;
+    lvpabase = deleteLater ? f : NULL;
 
     if(loaders[LDR_LVPABASE])
+    {
         delete loaders[LDR_LVPABASE];
+        loaders[LDR_LVPABASE] = NULL;
+    }
 
     // if the container has scrambled files, register a loader.
     // we can't add scrambled files to the tree, because their names are probably unknown at this point
@@ -82,21 +128,29 @@ void VFSHelper::LoadBase(LVPAFile *f, bool deleteLater)
 
 bool VFSHelper::LoadFileSysRoot(void)
 {
-    VFSDirReal *oldroot = filesysRoot;
+    if(!loaders[LDR_DISK])
+        loaders[LDR_DISK] = new VFSLoaderDisk;
+
+    // already loaded, only pick up what changed since then
+    if(filesysRoot)
+    {
+        std::vector<std::string> changed;
+        filesysRoot->refresh(changed);
+        if(merged)
+            for(uint32 i = 0; i < changed.size(); ++i)
+                _update(changed[i]);
+        return true;
+    }
 
     filesysRoot = new VFSDirReal;
     if(!filesysRoot->load("."))
     {
         filesysRoot->ref--;
-        filesysRoot = oldroot;
+        filesysRoot = NULL;
         return false;
     }
-
-    if(oldroot)
-        oldroot->ref--;
-
-    if(!loaders[LDR_DISK])
-        loaders[LDR_DISK] = new VFSLoaderDisk;
+    if(merged)
+        _updateDir(filesysRoot, "", false);
 
     return true;
 }
@@ -104,23 +158,43 @@ bool VFSHelper::LoadFileSysRoot(void)
 void VFSHelper::Prepare(bool clear /* = true */)
 {
     if(clear)
-        _delete();
+    {
+        // unmount from the top, so that the remaining mounts need to be searched as little as possible
+        while(!vlist.empty())
+            _removeEntry(--vlist.end());
+        _clearLayer(overrides);
+        _clearLayer(loaded);
+        for(std::set<LVPAFile*>::iterator it = lvpalist.begin(); it != lvpalist.end(); it++)
+            delete *it; // containers whose mounting failed
+        lvpalist.clear();
+    }
+
     if(!merged)
+    {
         merged = new VFSDir;
-    
-    if(vRoot)
-        merged->merge(vRoot);
-    if(filesysRoot)
-        merged->merge(filesysRoot);
+        if(vRoot)
+            _mountDir(vRoot, "", true);
+        if(filesysRoot)
+            _mountDir(filesysRoot, "", true);
+        for(VFSMountList::iterator it = vlist.begin(); it != vlist.end(); it++)
+            _mountDir(it->vdir, makePrefix(it->mountPoint), it->overwrite);
+    }
 }
 
+// every mount operation updates the tree right away, so only the disk needs to be checked for changes
 void VFSHelper::Reload(bool fromDisk /* = false */)
 {
-    if(fromDisk)
-        LoadFileSysRoot();
-    Prepare(false);
+    if(!fromDisk)
+        return;
+
+    LoadFileSysRoot();
+
+    std::vector<std::string> changed;
     for(VFSMountList::iterator it = vlist.begin(); it != vlist.end(); it++)
-        GetDir(it->mountPoint.c_str(), true)->merge(it->vdir, it->overwrite);
+        it->vdir->refresh(changed, makePrefix(it->mountPoint));
+    if(merged)
+        for(uint32 i = 0; i < changed.size(); ++i)
+            _update(changed[i]);
 }
 
 void VFSHelper::AddVFSDir(VFSDir *dir, const char *subdir /* = NULL */, bool overwrite /* = true */)
@@ -128,9 +202,14 @@ void VFSHelper::AddVFSDir(VFSDir *dir, const char *subdir /* = NULL */, bool ove
     if(!subdir)
         subdir = "";
     dir->ref++;
-    VDirEntry ve(dir, subdir, overwrite);
+    VDirEntry ve(dir, normalizePath(subdir), overwrite);
     vlist.push_back(ve);
-    GetDir(subdir, true)->merge(dir, overwrite); // merge into specified subdir. will be (virtually) created if not existing
+    if(merged)
+    {
+        if(ve.mountPoint.length())
+            GetDir(ve.mountPoint.c_str(), true); // will be (virtually) created if not existing
+        _mountDir(dir, makePrefix(ve.mountPoint), overwrite);
+    }
 }
 
 bool VFSHelper::AddContainer(LVPAFile *f, const char *path, bool deleteLater, bool overwrite /* = true */)
@@ -139,6 +218,8 @@ bool VFSHelper::AddContainer(LVPAFile *f, const char *path, bool deleteLater, bo
     if(vfs->load())
     {
         AddVFSDir(vfs, path, overwrite);
+        VDirEntry& ve = vlist.back();
+        ve.lvpa = f;
         if(deleteLater)
             lvpalist.insert(f);
 
@@ -148,7 +229,8 @@ bool VFSHelper::AddContainer(LVPAFile *f, const char *path, bool deleteLater, bo
         {
             if(f->GetFileInfo(i).flags & LVPAFLAG_SCRAMBLED)
             {
-                loaders.push_back(new VFSLoaderLVPA(f));
+                ve.loader = new VFSLoaderLVPA(f);
+                loaders.push_back(ve.loader);
                 break;
             }
         }
@@ -163,17 +245,108 @@ bool VFSHelper::AddPath(const char *path)
 {
     VFSDirReal *vfs = new VFSDirReal;
     if(vfs->load(path))
+    {
         AddVFSDir(vfs);
+        vlist.back().path = normalizePath(path);
+    }
     return --(vfs->ref); // 0 if deleted
 }
 
+bool VFSHelper::RemoveContainer(LVPAFile *f)
+{
+    bool found = false;
+    for(VFSMountList::iterator it = vlist.begin(); it != vlist.end(); )
+    {
+        if(it->lvpa == f)
+        {
+            _removeEntry(it++);
+            found = true;
+        }
+        else
+            ++it;
+    }
+    return found;
+}
+
+bool VFSHelper::RemovePath(const char *path)
+{
+    std::string p(normalizePath(path));
+    bool found = false;
+    for(VFSMountList::iterator it = vlist.begin(); it != vlist.end(); )
+    {
+        if(it->path.length() && it->path == p)
+        {
+            _removeEntry(it++);
+            found = true;
+        }
+        else
+            ++it;
+    }
+    return found;
+}
+
+bool VFSHelper::RemoveVFSDir(VFSDir *dir)
+{
+    bool found = false;
+    for(VFSMountList::iterator it = vlist.begin(); it != vlist.end(); )
+    {
+        if(it->vdir == dir)
+        {
+            _removeEntry(it++);
+            found = true;
+        }
+        else
+            ++it;
+    }
+    return found;
+}
+
+void VFSHelper::_removeEntry(VFSMountList::iterator it)
+{
+    VDirEntry ve = *it;
+    vlist.erase(it);
+
+    // the dir keeps its files alive until they are resolved again
+    if(merged)
+        _updateDir(ve.vdir, makePrefix(ve.mountPoint), true);
+    ve.vdir->ref--;
+
+    if(ve.loader)
+    {
+        for(uint32 i = OMNIPRESENT_LOADERS; i < loaders.size(); ++i)
+        {
+            if(loaders[i] == ve.loader)
+            {
+                loaders.erase(loaders.begin() + i);
+                break;
+            }
+        }
+        _clearLayer(loaded); // may contain files the loader found, they can be found again by the remaining loaders
+        delete ve.loader;
+    }
+
+    if(ve.lvpa)
+    {
+        for(VFSMountList::iterator mt = vlist.begin(); mt != vlist.end(); mt++)
+            if(mt->lvpa == ve.lvpa)
+                return; // still mounted elsewhere
+        std::set<LVPAFile*>::iterator lt = lvpalist.find(ve.lvpa);
+        if(lt != lvpalist.end())
+        {
+            lvpalist.erase(lt);
+            delete ve.lvpa;
+        }
+    }
+}
+
 VFSFile *VFSHelper::GetFile(const char *fn)
 {
-    VFSFile *vf = merged->getFile(fn);
+    VFSFile **found = fileIndex.find(normalizePath(fn));
+    VFSFile *vf = found ? *found : NULL;
 
     // nothing found? maybe a loader has something.
     // if so, add the newly created VFSFile to the tree
-    if(!vf)
+    if(!vf && merged)
     {
         for(uint32 i = 0; i < loaders.size(); ++i)
         {
@@ -182,7 +355,9 @@ VFSFile *VFSHelper::GetFile(const char *fn)
                 vf = loaders[i]->Load(fn);
                 if(vf)
                 {
-                    GetDirRoot()->addRecursive(vf, true);
+                    std::string path(normalizePath(vf->fullname()));
+                    _addToLayer(loaded, path, vf);
+                    _update(path);
                     --(vf->ref);
                     break;
                 }
@@ -195,10 +370,189 @@ VFSFile *VFSHelper::GetFile(const char *fn)
 
 VFSDir *VFSHelper::GetDir(const char* dn, bool create /* = false */)
 {
-    return *dn ? merged->getDir(dn, create) : merged;
+    if(!*dn)
+        return merged;
+    std::string s(dn); // VFSDir::getDir() temporarily modifies the string, which must not be a literal
+    return merged->getDir(s.c_str(), create);
 }
 
 VFSDir *VFSHelper::GetDirRoot(void)
 {
     return merged;
 }
+
+bool VFSHelper::AddFile(VFSFile *vf, bool overwrite /* = true */)
+{
+    std::string path(normalizePath(vf->fullname()));
+    if(!merged || path.empty())
+        return false;
+    VFSFile **old = fileIndex.find(path);
+    if(old && (!overwrite || *old == vf))
+        return false;
+    _addToLayer(overrides, path, vf);
+    _setFile(path, vf);
+    return true;
+}
+
+bool VFSHelper::Merge(const char *src, const char *target, bool createTarget /* = false */)
+{
+    VFSDir *targetdir = GetDir(target, createTarget);
+    VFSDir *srcdir = GetDir(src);
+    if(!(targetdir && srcdir))
+        return false;
+
+    std::vector<std::string> files;
+    srcdir->listFiles(files);
+    std::string prefix(makePrefix(normalizePath(target)));
+    for(uint32 i = 0; i < files.size(); ++i)
+    {
+        VFSFile *vf = srcdir->getFile(files[i].c_str());
+        _addToLayer(overrides, prefix + files[i], vf);
+        _setFile(prefix + files[i], vf);
+    }
+    return true;
+}
+
+void VFSHelper::_mountDir(VFSDir *dir, const std::string& prefix, bool overwrite)
+{
+    for(VFSFileMap::iterator it = dir->_files.begin(); it != dir->_files.end(); ++it)
+    {
+        std::string path(prefix + it->first);
+        VFSFile **cur = fileIndex.find(path);
+        if(cur)
+        {
+            if(*cur == it->second)
+                continue;
+            // files found by a loader are always replaced, files added by AddFile() never
+            bool fromLoader = loaded && loaded->getFile(path.c_str()) == *cur;
+            if(!fromLoader && (!overwrite || (overrides && overrides->getFile(path.c_str()) == *cur)))
+                continue;
+        }
+        _setFile(path, it->second);
+    }
+    for(VFSDirMap::iterator it = dir->_subdirs.begin(); it != dir->_subdirs.end(); ++it)
+        _mountDir(it->second, prefix + it->first + '/', overwrite);
+}
+
+void VFSHelper::_updateDir(VFSDir *dir, const std::string& prefix, bool onlyUsed)
+{
+    for(VFSFileMap::iterator it = dir->_files.begin(); it != dir->_files.end(); ++it)
+    {
+        std::string path(prefix + it->first);
+        if(onlyUsed)
+        {
+            VFSFile **cur = fileIndex.find(path);
+            if(!cur || *cur != it->second)
+                continue;
+        }
+        _update(path);
+    }
+    for(VFSDirMap::iterator it = dir->_subdirs.begin(); it != dir->_subdirs.end(); ++it)
+        _updateDir(it->second, prefix + it->first + '/', onlyUsed);
+}
+
+void VFSHelper::_update(const std::string& path)
+{
+    VFSFile *vf = _resolve(path);
+    VFSFile **cur = fileIndex.find(path);
+    if(vf)
+    {
+        if(!cur || *cur != vf)
+            _setFile(path, vf);
+    }
+    else if(cur)
+        _unsetFile(path);
+}
+
+VFSFile *VFSHelper::_resolve(const std::string& path)
+{
+    const char *p = path.c_str();
+    VFSFile *vf = overrides ? overrides->getFile(p) : NULL;
+    if(vf)
+        return vf;
+
+    if(vRoot)
+        vf = vRoot->getFile(p);
+    if(filesysRoot)
+        if(VFSFile *f = filesysRoot->getFile(p))
+            vf = f;
+    for(VFSMountList::iterator it = vlist.begin(); it != vlist.end(); it++)
+    {
+        uint32 mplen = it->mountPoint.length();
+        if(mplen && (path.length() <= mplen || path[mplen] != '/' || path.compare(0, mplen, it->mountPoint)))
+            continue;
+        VFSFile *f = it->vdir->getFile(mplen ? p + mplen + 1 : p);
+        if(f && (!vf || it->overwrite))
+            vf = f;
+    }
+
+    if(!vf && loaded)
+        vf = loaded->getFile(p);
+    return vf;
+}
+
+void VFSHelper::_setFile(const std::string& path, VFSFile *vf)
+{
+    _indexFile(path, vf, true);
+    size_t slash = path.find_last_of('/');
+    VFSDir *dir = slash == std::string::npos ? merged : GetDir(path.substr(0, slash).c_str(), true);
+    dir->add(vf, true);
+}
+
+void VFSHelper::_unsetFile(const std::string& path)
+{
+    VFSFile **cur = fileIndex.find(path);
+    if(cur)
+    {
+        (*cur)->ref--;
+        fileIndex.erase(path);
+    }
+    removeFileAndPrune(merged, path.c_str());
+}
+
+void VFSHelper::_addToLayer(VFSDir *& layer, const std::string& path, VFSFile *vf)
+{
+    if(!layer)
+        layer = new VFSDir;
+    size_t slash = path.find_last_of('/');
+    VFSDir *dir = layer;
+    if(slash != std::string::npos)
+    {
+        std::string d(path, 0, slash); // VFSDir::getDir() temporarily modifies the string
+        dir = layer->getDir(d.c_str(), true);
+    }
+    dir->add(vf, true);
+}
+
+void VFSHelper::_clearLayer(VFSDir *& layer)
+{
+    if(!layer)
+        return;
+    VFSDir *old = layer;
+    layer = NULL;
+    if(merged)
+        _updateDir(old, "", true); // its files are still alive here
+    old->ref--;
+}
+
+void VFSHelper::_clearIndex(void)
+{
+    for(VFSFileIndex::iterator it = fileIndex.begin(); it != fileIndex.end(); ++it)
+        it.value()->ref--;
+    fileIndex.clear();
+}
+
+void VFSHelper::_indexFile(const std::string& path, VFSFile *vf, bool overwrite)
+{
+    VFSFile **old = fileIndex.find(path);
+    if(old)
+    {
+        if(!overwrite || *old == vf)
+            return;
+        (*old)->ref--;
+        *old = vf;
+    }
+    else
+        fileIndex.insert(path, vf);
+    vf->ref++;
+}
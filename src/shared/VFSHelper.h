@@ -2,6 +2,7 @@
 #define VFSHELPER_H
 
 #include <set>
+#include "FlatHashMap.h"
 
 class VFSDir;
 class VFSDirReal;
@@ -20,36 +21,73 @@ public:
     bool AddContainer(LVPAFile *f, const char *subdir, bool deleteLater, bool overwrite = true);
     bool AddPath(const char *path);
     void AddVFSDir(VFSDir *dir, const char *subdir = NULL, bool overwrite = true);
-    void Prepare(bool clear = true);
-    void Reload(bool fromDisk = false);
+
+    // undo the corresponding Add*() call. only the files provided by the removed dir are updated,
+    // they fall back to what the remaining mounts provide. a container added with deleteLater is deleted.
+    bool RemoveContainer(LVPAFile *f);
+    bool RemovePath(const char *path);
+    bool RemoveVFSDir(VFSDir *dir);
+
+    void Prepare(bool clear = true); // clear: remove everything except the base container and the file system root
+    void Reload(bool fromDisk = false); // fromDisk: rescan changed directories on disk
     VFSFile *GetFile(const char *fn);
     VFSDir *GetDir(const char* dn, bool create = false);
     VFSDir *GetDirRoot(void);
 
+    // Use these instead of modifying the tree returned by GetDir() or GetDirRoot() directly,
+    // otherwise GetFile() will not know about the change.
+    bool AddFile(VFSFile *vf, bool overwrite = true); // adds a single file, its path is created if necessary
+    bool Merge(const char *src, const char *target, bool createTarget = false); // merges a directory into another one
+    inline LVPAFile *GetBase(void) { return lvpabase; }
+
 protected:
 
     struct VDirEntry
     {
-        VDirEntry() : vdir(NULL), overwrite(false) {}
-        VDirEntry(VFSDir *v, std::string mp, bool ow) : vdir(v), mountPoint(mp), overwrite(ow) {}
+        VDirEntry() : vdir(NULL), overwrite(false), lvpa(NULL), loader(NULL) {}
+        VDirEntry(VFSDir *v, std::string mp, bool ow) : vdir(v), mountPoint(mp), overwrite(ow), lvpa(NULL), loader(NULL) {}
         VFSDir *vdir;
-        std::string mountPoint;
+        std::string mountPoint; // normalized
         bool overwrite;
+        LVPAFile *lvpa; // set by AddContainer()
+        VFSLoader *loader; // registered by AddContainer() for scrambled files
+        std::string path; // set by AddPath()
     };
 
     typedef std::list<VDirEntry> VFSMountList;
 
-    void _delete(void);
-    // the VFSDirs are merged in their declaration order.
-    // when merging, files already contained can be overwritten by files merged in later.
+    void _clearIndex(void);
+    void _indexFile(const std::string& path, VFSFile *vf, bool overwrite);
+
+    // the merged tree and the index are only ever changed through these
+    void _mountDir(VFSDir *dir, const std::string& prefix, bool overwrite); // for a dir mounted on top of all others
+    void _updateDir(VFSDir *dir, const std::string& prefix, bool onlyUsed); // re-resolve all files of dir
+    void _update(const std::string& path); // re-resolve a single file
+    VFSFile *_resolve(const std::string& path); // what the mounts provide for path, in order
+    void _setFile(const std::string& path, VFSFile *vf);
+    void _unsetFile(const std::string& path);
+
+    void _removeEntry(VFSMountList::iterator it);
+    void _addToLayer(VFSDir *& layer, const std::string& path, VFSFile *vf);
+    void _clearLayer(VFSDir *& layer);
+
+    // the VFSDirs are mounted in their declaration order.
+    // when mounting, files already contained can be overwritten by files mounted later.
     VFSDirLVPA *vRoot; // contains all files from lvpabase
     VFSDirReal *filesysRoot; // local files on disk (root dir)
     VFSMountList vlist; // all other files added later, together with path to mount to
+    VFSDir *overrides; // files added with AddFile() or Merge(), these are always on top
+    VFSDir *loaded; // files found by a loader, used only as long as no mounted dir has them
     std::set<LVPAFile*> lvpalist; // LVPA files delayed for deletion, required here
     LVPAFile *lvpabase; // base LVPA file, to be checked if everything else fails
     std::vector<VFSLoader*> loaders; // if files are not in the tree, maybe one of these is able to find it
 
     VFSDir *merged; // contains the merged virtual/actual file system tree
+
+    // all files in the merged tree by their full path, for quick lookup without walking the tree.
+    // kept in sync with the tree, holds a reference to each file.
+    typedef FlatHashMap<std::string, VFSFile*> VFSFileIndex;
+    VFSFileIndex fileIndex;
 };
 
 #endif
@@ -2,14 +2,14 @@
 #define ARRAY2D_H
 
 
-// fast 2D array avoiding multiplication to access array indexes
-// the size has to be a power of 2, if not, it will automatically align
+// fast 2D array with any width and height, stored row by row.
+// if the width is a power of 2, indexes are calculated with a shift instead of a multiplication.
 template <class T, bool OOBCHECK = false> class array2d
 {
 public:
 
-    array2d() : _shift(0), _size(0), data(NULL) { ASSERT(!OOBCHECK); } // when checking for bounds, we NEED a default value to return
-    array2d(T defaultval): _shift(0), _size(0), data(NULL), _defaultval(defaultval) {}
+    array2d() : _w(0), _h(0), _pitch(0), _shift(0), data(NULL) { ASSERT(!OOBCHECK); } // when checking for bounds, we NEED a default value to return
+    array2d(T defaultval): _w(0), _h(0), _pitch(0), _shift(0), data(NULL), _defaultval(defaultval) {}
     ~array2d() { this->free(); }
 
     inline void fill(T val)
@@ -25,67 +25,55 @@ public:
         {
             delete [] data;
             data = NULL;
-            _shift = _size = 0;
+            _w = _h = _pitch = _shift = 0;
         }
     }
 
-    inline void resize(uint32 dim, T fillval, bool force = false)
+    inline void resize(uint32 w, uint32 h, T fillval, bool force = false)
     {
-        uint32 req = 0;
-        uint32 newsize = 1;
-
-        // find out how often we have to shift to reach the desired capacity
-        // this will set the size to the nearest power of 2 required (if dim is 50 the final size will be 64, for example)
-        while(newsize < dim)
-        {
-            newsize <<= 1;
-            ++req;
-        }
-
         // array does already have the desired size and data field, nothing to do
-        if(!force && newsize == _size && data)
+        if(!force && w == _w && h == _h && data)
             return;
 
         // save old size and data field for later copy
-        uint32 oldsize = _size;
+        uint32 oldw = _w, oldh = _h, oldpitch = _pitch, oldshift = _shift;
         T* olddata = data;
 
         // alloc new space
-        _size = newsize;
-        data = new T[_size * _size];
+        _setSize(w, h);
+        data = new T[size2d()];
 
         // fill it up to prevent uninitialized memory
         fill(fillval);
 
         // if there was content, copy it
-        if(olddata && oldsize)
+        if(olddata)
         {
-            uint32 copysize = oldsize < newsize ? oldsize : newsize;
-            for(uint32 x = 0; x < copysize; ++x)
-                for(uint32 y = 0; y < copysize; ++y)
-                    data[(y << req) | x] = olddata[(y << _shift) | x];
+            uint32 copyw = std::min(oldw, w);
+            uint32 copyh = std::min(oldh, h);
+            for(uint32 y = 0; y < copyh; ++y)
+                for(uint32 x = 0; x < copyw; ++x)
+                    data[_index(x,y)] = olddata[oldshift != NOSHIFT ? (y << oldshift) | x : y * oldpitch + x];
             delete [] olddata;
         }
-
-        _shift = req;
     }
 
     inline T& operator () (uint32 x, uint32 y)
     {
         // trust the compiler to optimize this out
         if(OOBCHECK)
-            if(x >= _size || y >= _size)
+            if(x >= _w || y >= _h)
                 return _defaultval;
-        return data[(y << _shift) | x];
+        return data[_index(x,y)];
     }
 
     inline const T& operator () (uint32 x, uint32 y) const
     {
         // trust the compiler to optimize this out
         if(OOBCHECK)
-            if(x >= _size || y >= _size)
+            if(x >= _w || y >= _h)
                 return _defaultval;
-        return data[(y << _shift) | x];
+        return data[_index(x,y)];
     }
 
     inline T& operator [] (uint16 pos)
@@ -108,29 +96,42 @@ public:
         return &data[0];
     }
 
-    inline uint32 size1d(void) const { return _size; }
-    inline uint32 size2d(void) const { return _size * _size; }
+    inline uint32 width(void) const { return _w; }
+    inline uint32 height(void) const { return _h; }
+    inline uint32 pitch(void) const { return _pitch; } // elements from the start of one row to the next
+    inline uint32 size2d(void) const { return _pitch * _h; }
 
     // use at your own risk
     inline T* getPtr(void) { return data; }
     inline const T* getPtr(void) const { return data; }
     inline void setPtr(T *p) { data = p; }
-    inline void resizeNoAlloc(uint32 s)
+    inline void resizeNoAlloc(uint32 w, uint32 h) { _setSize(w, h); }
+
+
+protected:
+
+    enum { NOSHIFT = 0xFFFFFFFF };
+
+    inline uint32 _index(uint32 x, uint32 y) const
     {
+        return _shift != NOSHIFT ? (y << _shift) | x : y * _pitch + x;
+    }
+
+    inline void _setSize(uint32 w, uint32 h)
+    {
+        _w = w;
+        _h = h;
+        _pitch = w;
         _shift = 0;
-        _size = 1;
-        while(_size < s)
-        {
-            _size <<= 1;
+        while(_shift < 31 && (1u << _shift) < w)
             ++_shift;
-        }
+        if((1u << _shift) != w)
+            _shift = NOSHIFT;
     }
 
-
-protected:
-
-    uint32 _size;
-    uint32 _shift;
+    uint32 _w, _h;
+    uint32 _pitch;
+    uint32 _shift; // NOSHIFT if the width is not a power of 2
 
     T _defaultval;
     T *data;
@@ -0,0 +1,142 @@
+#ifndef CHUNKARRAY2D_H
+#define CHUNKARRAY2D_H
+
+#include <vector>
+
+// 2D array of any width and height, split into square chunks of (1 << SHIFT) * (1 << SHIFT) elements.
+// a chunk is allocated on the first write access to it, until then all its elements read as the fill value.
+// reading outside of the array returns the out-of-bounds value, writes there go to a dummy.
+template <class T, uint32 SHIFT> class chunkarray2d
+{
+public:
+    enum
+    {
+        CHUNK_DIM = 1 << SHIFT,
+        CHUNK_MASK = CHUNK_DIM - 1,
+        CHUNK_SIZE = CHUNK_DIM * CHUNK_DIM
+    };
+
+    chunkarray2d(T oobval, T fillval) : _w(0), _h(0), _cw(0), _ch(0), _used(0), _oobval(oobval), _fillval(fillval) {}
+    ~chunkarray2d() { this->free(); }
+
+    inline void free(void)
+    {
+        for(uint32 i = 0; i < _chunks.size(); ++i)
+            delete [] _chunks[i];
+        _chunks.clear();
+        _w = _h = _cw = _ch = _used = 0;
+    }
+
+    // chunks that end up outside of the new size are deleted, drop what they contain before
+    void resize(uint32 w, uint32 h)
+    {
+        uint32 cw = (w + CHUNK_MASK) >> SHIFT;
+        uint32 ch = (h + CHUNK_MASK) >> SHIFT;
+        if(cw != _cw || ch != _ch)
+        {
+            std::vector<T*> old;
+            old.swap(_chunks);
+            _chunks.resize(cw * ch, NULL);
+            for(uint32 cy = 0; cy < _ch; ++cy)
+                for(uint32 cx = 0; cx < _cw; ++cx)
+                {
+                    T *c = old[cy * _cw + cx];
+                    if(!c)
+                        continue;
+                    if(cx < cw && cy < ch)
+                        _chunks[cy * cw + cx] = c;
+                    else
+                    {
+                        delete [] c;
+                        --_used;
+                    }
+                }
+            _cw = cw;
+            _ch = ch;
+        }
+        _w = w;
+        _h = h;
+    }
+
+    inline T get(uint32 x, uint32 y) const
+    {
+        if(x >= _w || y >= _h)
+            return _oobval;
+        const T *c = _chunks[(y >> SHIFT) * _cw + (x >> SHIFT)];
+        return c ? c[((y & CHUNK_MASK) << SHIFT) | (x & CHUNK_MASK)] : _fillval;
+    }
+
+    inline T operator () (uint32 x, uint32 y) const
+    {
+        return get(x,y);
+    }
+
+    // allocates the chunk if it is not there yet
+    inline T& operator () (uint32 x, uint32 y)
+    {
+        if(x >= _w || y >= _h)
+        {
+            _dummy = _oobval;
+            return _dummy;
+        }
+        return createChunk(x >> SHIFT, y >> SHIFT)[((y & CHUNK_MASK) << SHIFT) | (x & CHUNK_MASK)];
+    }
+
+    inline uint32 width(void) const { return _w; }
+    inline uint32 height(void) const { return _h; }
+    inline uint32 chunksX(void) const { return _cw; }
+    inline uint32 chunksY(void) const { return _ch; }
+    inline uint32 usedChunks(void) const { return _used; }
+    inline T fillValue(void) const { return _fillval; }
+    inline void setFillValue(T val) { _fillval = val; } // for chunks that are not allocated, and new ones
+
+    // chunk coordinates, NULL if not allocated. elements are stored row by row, CHUNK_DIM per row.
+    inline T *chunk(uint32 cx, uint32 cy) { return _chunks[cy * _cw + cx]; }
+    inline const T *chunk(uint32 cx, uint32 cy) const { return _chunks[cy * _cw + cx]; }
+    inline bool hasChunkAt(uint32 x, uint32 y) const { return x < _w && y < _h && _chunks[(y >> SHIFT) * _cw + (x >> SHIFT)]; }
+
+    inline T *createChunk(uint32 cx, uint32 cy)
+    {
+        return createChunk(cx, cy, _fillval);
+    }
+
+    // a new chunk is filled with val, an existing one is not touched
+    T *createChunk(uint32 cx, uint32 cy, T val)
+    {
+        T *& c = _chunks[cy * _cw + cx];
+        if(!c)
+        {
+            c = new T[CHUNK_SIZE];
+            for(uint32 i = 0; i < CHUNK_SIZE; ++i)
+                c[i] = val;
+            ++_used;
+        }
+        return c;
+    }
+
+    void freeChunk(uint32 cx, uint32 cy)
+    {
+        T *& c = _chunks[cy * _cw + cx];
+        if(c)
+        {
+            delete [] c;
+            c = NULL;
+            --_used;
+        }
+    }
+
+protected:
+    uint32 _w, _h; // in elements
+    uint32 _cw, _ch; // in chunks
+    uint32 _used;
+    T _oobval;
+    T _fillval;
+    T _dummy;
+    std::vector<T*> _chunks;
+
+private:
+    chunkarray2d(const chunkarray2d&); // forbid copy
+    chunkarray2d& operator=(const chunkarray2d&);
+};
+
+#endif
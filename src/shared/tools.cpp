@@ -642,6 +642,23 @@ bool IsDirectory(const char *s)
 #endif
 }
 
+// last modification time of a file or directory in seconds since the epoch, like time(), 0 on error
+uint64 GetModifiedTime(const char *s)
+{
+#if PLATFORM == PLATFORM_WIN32
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if(!GetFileAttributesEx(s, GetFileExInfoStandard, &attr))
+        return 0;
+    uint64 t = (uint64(attr.ftLastWriteTime.dwHighDateTime) << 32) | attr.ftLastWriteTime.dwLowDateTime;
+    return t / 10000000 - UI64LIT(11644473600); // 100ns intervals since 1601 -> seconds since 1970
+#else
+    struct stat status;
+    if(stat(s, &status))
+        return 0;
+    return uint64(status.st_mtime);
+#endif
+}
+
 void MakeSlashTerminated(std::string& s)
 {
     if(s.length() && s[s.length() - 1] != '/')
@@ -749,14 +766,16 @@ uint32 GetConsoleWidth(void)
 // copy strings, mangling newlines to system standard
 // windows has 13+10
 // *nix has 10
-size_t strnNLcpy(char *dst, const char *src, uint32 n /* = -1 */)
+// n is the size of dst, srclen the max. amount of chars read from src, for data that are not \0-terminated
+size_t strnNLcpy(char *dst, const char *src, uint32 n /* = -1 */, uint32 srclen /* = -1 */)
 {
     char *olddst = dst;
+    const char *srcend = srclen < uint32(-1) ? src + srclen : NULL;
     bool had10 = false, had13 = false;
 
     --n; // reserve 1 for \0 at end
 
-    while(*src && n)
+    while(src != srcend && *src && n)
     {
         if((had13 && *src == 10) || (had10 && *src == 13))
         {
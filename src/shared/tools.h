@@ -20,6 +20,7 @@ std::deque<std::string> GetFileList(std::string);
 std::deque<std::string> GetDirList(std::string, bool recursive = false);
 bool FileExists(std::string);
 bool IsDirectory(const char *);
+uint64 GetModifiedTime(const char *);
 bool CreateDir(const char*);
 bool CreateDirRec(const char*);
 uint32 getMSTime(void);
@@ -44,7 +45,7 @@ void MakeSlashTerminated(std::string& s);
 void GetFileListRecursive(const std::string dir, std::list<std::string>& files, bool withQueriedDir = false);
 bool WildcardMatch(const char *str, const char *pattern);
 uint32 GetConsoleWidth(void);
-size_t strnNLcpy(char *dst, const char *src, uint32 n = -1 );
+size_t strnNLcpy(char *dst, const char *src, uint32 n = -1, uint32 srclen = -1);
 int ParseCommandLine(char *cmdline, char **argv);
 void UnEscapeQuotes(char *arg);
 
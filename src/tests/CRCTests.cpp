@@ -0,0 +1,114 @@
+#include "common.h"
+#include "MersenneTwister.h"
+#include "CRCTests.h"
+#include "MyCrc32.h"
+
+static const CRC32::Mode s_modes[] = { CRC32::MODE_BYTEWISE, CRC32::MODE_SLICE8, CRC32::MODE_PCLMUL };
+static const char *s_modeNames[] = { "bytewise", "slice-by-8", "pclmul" };
+
+// known result for the standard check string
+int TestCRC32()
+{
+    const char *check = "123456789";
+    CRC32::Mode oldmode = CRC32::GetMode();
+    for(uint32 m = 0; m < 3; ++m)
+    {
+        if(!CRC32::SetMode(s_modes[m]))
+            continue;
+        uint32 crc = CRC32::Calc((const uint8*)check, 9);
+        if(crc != 0xCBF43926)
+        {
+            printf("CRC32 %s: %08X\n", s_modeNames[m], crc);
+            CRC32::SetMode(oldmode);
+            return 1;
+        }
+    }
+    CRC32::SetMode(oldmode);
+    return 0;
+}
+
+// all modes must give the same results as the bytewise one, for any size, alignment, and split into Update() calls
+int TestCRC32Modes()
+{
+    const uint32 size = 4096 + 64;
+    std::vector<uint8> buf(size);
+    MTRand rnd(42);
+    for(uint32 i = 0; i < size; ++i)
+        buf[i] = uint8(rnd.randInt());
+
+    CRC32::Mode oldmode = CRC32::GetMode();
+    int ret = 0;
+    for(uint32 len = 0; len <= 300 && !ret; ++len)
+        for(uint32 ofs = 0; ofs < 16 && !ret; ++ofs)
+        {
+            CRC32::SetMode(CRC32::MODE_BYTEWISE);
+            uint32 expect = CRC32::Calc(&buf[ofs], len);
+            for(uint32 m = 1; m < 3; ++m)
+            {
+                if(!CRC32::SetMode(s_modes[m]))
+                    continue;
+                CRC32 crc;
+                uint32 half = len / 3;
+                crc.Update(&buf[ofs], half);
+                crc.Update(&buf[ofs + half], len - half);
+                crc.Finalize();
+                if(crc.Result() != expect || CRC32::Calc(&buf[ofs], len) != expect)
+                {
+                    printf("CRC32 %s: len %u, offset %u: %08X, expected %08X\n", s_modeNames[m], len, ofs, crc.Result(), expect);
+                    ret = 1;
+                    break;
+                }
+            }
+        }
+
+    for(uint32 m = 1; m < 3 && !ret; ++m)
+    {
+        CRC32::SetMode(CRC32::MODE_BYTEWISE);
+        uint32 expect = CRC32::Calc(&buf[3], size - 3);
+        if(CRC32::SetMode(s_modes[m]) && CRC32::Calc(&buf[3], size - 3) != expect)
+        {
+            printf("CRC32 %s: full buffer mismatch\n", s_modeNames[m]);
+            ret = 2;
+        }
+    }
+
+    CRC32::SetMode(oldmode);
+    return ret;
+}
+
+// prints the throughput of each mode, fails only if the results differ
+int BenchCRC32()
+{
+    const uint32 size = 8 * 1024 * 1024;
+    const uint32 rounds = 8;
+    std::vector<uint8> buf(size);
+    for(uint32 i = 0; i < size; ++i)
+        buf[i] = uint8(i * 7 + (i >> 9));
+
+    CRC32::Mode oldmode = CRC32::GetMode();
+    uint32 first = 0;
+    for(uint32 m = 0; m < 3; ++m)
+    {
+        if(!CRC32::SetMode(s_modes[m]))
+        {
+            printf("CRC32 %s: not supported\n", s_modeNames[m]);
+            continue;
+        }
+        uint32 crc = 0;
+        uint32 start = getMSTime();
+        for(uint32 r = 0; r < rounds; ++r)
+            crc = CRC32::Calc(&buf[0], size);
+        uint32 ms = getMSTimeDiff(start, getMSTime());
+        printf("CRC32 %s: %u MB in %u ms, %.1f MB/s\n", s_modeNames[m], (size / (1024 * 1024)) * rounds, ms,
+            ms ? double(size / (1024 * 1024)) * rounds * 1000.0 / ms : 0.0);
+        if(!m)
+            first = crc;
+        else if(crc != first)
+        {
+            CRC32::SetMode(oldmode);
+            return 1;
+        }
+    }
+    CRC32::SetMode(oldmode);
+    return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef TESTS_CRC_H
+#define TESTS_CRC_H
+
+int TestCRC32();
+int TestCRC32Modes();
+int BenchCRC32();
+
+#endif
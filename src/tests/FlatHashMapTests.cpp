@@ -0,0 +1,210 @@
+#include <map>
+#include <set>
+#include "common.h"
+#include "FlatHashMap.h"
+#include "FlatHashMapTests.h"
+
+// puts key k into slot k, so that tests can build runs of entries where they want
+struct IdentityHash
+{
+    inline uint32 operator()(uint32 k) const { return k; }
+};
+
+typedef FlatHashMap<uint32, uint32> U32Map;
+typedef FlatHashMap<uint32, uint32, IdentityHash> SlotMap;
+
+// the map must contain exactly the keys in ref, with the same values
+template <typename M> static bool sameAs(M& m, const std::map<uint32, uint32>& ref)
+{
+    if(m.size() != ref.size())
+        return false;
+    for(std::map<uint32, uint32>::const_iterator it = ref.begin(); it != ref.end(); ++it)
+    {
+        uint32 *v = m.find(it->first);
+        if(!v || *v != it->second)
+            return false;
+    }
+    uint32 visited = 0;
+    for(typename M::iterator it = m.begin(); it != m.end(); ++it)
+    {
+        std::map<uint32, uint32>::const_iterator r = ref.find(it.key());
+        if(r == ref.end() || r->second != it.value())
+            return false;
+        ++visited;
+    }
+    return visited == ref.size();
+}
+
+int TestFlatHashMap()
+{
+    U32Map m;
+    if(!m.empty() || m.find(1) || m.begin() != m.end())
+        return 1;
+
+    std::map<uint32, uint32> ref;
+    // grows from 16 slots several times
+    for(uint32 i = 0; i < 1000; ++i)
+    {
+        uint32 k = i * 7919;
+        if(!m.insert(k, i))
+            return 2;
+        ref[k] = i;
+    }
+    if(!sameAs(m, ref))
+        return 3;
+
+    // existing keys are left alone
+    if(m.insert(7919, 12345) || m[7919] != 1)
+        return 4;
+
+    // operator[] adds default values
+    if(m.find(3) || m[3] != 0 || m.size() != 1001)
+        return 5;
+    m[3] = 42;
+    ref[3] = 42;
+    if(!sameAs(m, ref))
+        return 6;
+
+    // reserving fewer entries than there are does not lose any
+    m.reserve(10);
+    m.reserve(5000);
+    if(!sameAs(m, ref))
+        return 7;
+
+    m.clear();
+    if(!m.empty() || m.find(3) || m.begin() != m.end())
+        return 8;
+    m[1] = 2;
+    if(m.size() != 1 || *m.find(1) != 2)
+        return 9;
+
+    FlatHashMap<std::string, uint32> sm;
+    sm["foo"] = 1;
+    sm["bar"] = 2;
+    if(sm.insert("foo", 3) || !sm.insert("baz", 3))
+        return 10;
+    if(*sm.find("foo") != 1 || *sm.find("bar") != 2 || *sm.find("baz") != 3 || sm.find("qux"))
+        return 11;
+
+    uint32 objs[64];
+    FlatHashMap<uint32*, uint32> pm;
+    for(uint32 i = 0; i < 64; ++i)
+        pm[&objs[i]] = i;
+    for(uint32 i = 0; i < 64; ++i)
+        if(!pm.find(&objs[i]) || *pm.find(&objs[i]) != i)
+            return 12;
+    if(!pm.erase(&objs[5]) || pm.erase(&objs[5]) || pm.find(&objs[5]) || pm.size() != 63)
+        return 13;
+
+    return 0;
+}
+
+int TestFlatHashMapErase()
+{
+    // 16 slots; one run wraps around the end of the array: 14, 15, 0 (home 14), 1 (home 15), 2 (home 0)
+    SlotMap m;
+    std::map<uint32, uint32> ref;
+    const uint32 keys[] = { 14, 15, 30, 31, 16, 5, 21, 37 }; // 5, 21 (home 5), 37 (home 5) form a second run
+    for(uint32 i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i)
+    {
+        m[keys[i]] = i;
+        ref[keys[i]] = i;
+    }
+    if(!sameAs(m, ref))
+        return 1;
+
+    // erasing in the middle of the runs must keep all other entries reachable, without tombstones
+    const uint32 order[] = { 15, 5, 14, 37, 30, 16, 21, 31 };
+    for(uint32 i = 0; i < sizeof(order) / sizeof(order[0]); ++i)
+    {
+        if(m.erase(100) || !m.erase(order[i]) || m.erase(order[i]))
+            return 2;
+        ref.erase(order[i]);
+        if(!sameAs(m, ref))
+            return 3;
+    }
+    if(!m.empty())
+        return 4;
+
+    // many inserts and erases mixed, with rehashes in between
+    U32Map h;
+    uint32 x = 12345;
+    for(uint32 i = 0; i < 20000; ++i)
+    {
+        x = x * 1103515245 + 12345;
+        uint32 k = (x >> 16) % 600;
+        if(x & 0x100)
+        {
+            h[k] = i;
+            ref[k] = i;
+        }
+        else if(h.erase(k) != (ref.erase(k) != 0))
+            return 5;
+    }
+    if(!sameAs(h, ref))
+        return 6;
+
+    return 0;
+}
+
+// erase every entry for which pick() is true while iterating; each entry must be visited exactly once
+template <typename M, typename P> static int eraseWhileIterating(M& m, std::map<uint32, uint32>& ref, P pick)
+{
+    uint32 count = m.size();
+    std::set<uint32> visited;
+    for(typename M::iterator it = m.begin(); it != m.end(); )
+    {
+        if(!visited.insert(it.key()).second)
+            return 1;
+        if(pick(it.key()))
+        {
+            ref.erase(it.key());
+            it = m.erase(it);
+        }
+        else
+            ++it;
+    }
+    if(visited.size() != count)
+        return 2;
+    return sameAs(m, ref) ? 0 : 3;
+}
+
+static bool pickAll(uint32) { return true; }
+static bool pickOdd(uint32 k) { return k & 1; }
+static bool pickEveryThird(uint32 k) { return !(k % 3); }
+
+int TestFlatHashMapIterErase()
+{
+    // the run that wraps around the end of the array is where erasing moves entries backwards over index 0
+    const uint32 keys[] = { 13, 14, 15, 29, 30, 31, 45, 46, 3, 19 };
+    bool (*picks[])(uint32) = { pickAll, pickOdd, pickEveryThird };
+    for(uint32 p = 0; p < sizeof(picks) / sizeof(picks[0]); ++p)
+    {
+        SlotMap m;
+        std::map<uint32, uint32> ref;
+        for(uint32 i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i)
+        {
+            m[keys[i]] = i;
+            ref[keys[i]] = i;
+        }
+        if(int r = eraseWhileIterating(m, ref, picks[p]))
+            return r + p * 10;
+    }
+
+    // same with lots of entries, where most of the map is one long run
+    for(uint32 p = 0; p < sizeof(picks) / sizeof(picks[0]); ++p)
+    {
+        SlotMap m;
+        std::map<uint32, uint32> ref;
+        for(uint32 i = 0; i < 48; ++i) // 64 slots at the end
+        {
+            uint32 k = 60 + (i % 5) * 64 + i;
+            m[k] = i;
+            ref[k] = i;
+        }
+        if(int r = eraseWhileIterating(m, ref, picks[p]))
+            return r + p * 10 + 100;
+    }
+
+    return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef TESTS_FLATHASHMAP_H
+#define TESTS_FLATHASHMAP_H
+
+int TestFlatHashMap();
+int TestFlatHashMapErase();
+int TestFlatHashMapIterErase();
+
+#endif
@@ -174,3 +174,47 @@ int TestHPRC4LikeMassive()
 {
     return TestCipherMassive<HPRC4LikeCipher>();
 }
+
+int TestChaCha20()
+{
+    // same as: openssl enc -chacha20 -K 000102..1f -iv 0000000000000000 0001020304050607 (counter, nonce)
+    const uint8 r[] = { 0xf7, 0x98, 0xa1, 0x89, 0xf1, 0x95, 0xe6, 0x69, 0x82, 0x10, 0x5f, 0xfb, 0x64, 0x0b, 0xb7, 0x75 };
+    uint8 key[32];
+    for(uint32 i = 0; i < 32; ++i)
+        key[i] = i;
+    std::vector<uint8> ks(1000);
+    ChaCha20Cipher c;
+    c.Init(key, 32);
+    c.SetNonce(0x0706050403020100ULL);
+    c.Apply(&ks[0], ks.size()); // several blocks at once
+    if(memcmp(&ks[0], r, sizeof(r)))
+        return 1;
+
+    // any part of the keystream on its own, crossing block borders in odd places
+    const uint32 parts[][2] = { {0, 1}, {63, 2}, {64, 64}, {100, 300}, {255, 513}, {999, 1} };
+    for(uint32 i = 0; i < sizeof(parts) / sizeof(parts[0]); ++i)
+    {
+        std::vector<uint8> buf(parts[i][1]);
+        c.Seek(parts[i][0]);
+        for(uint32 j = 0; j < buf.size(); ++j)
+            c.Apply(&buf[j], 1); // byte by byte
+        if(memcmp(&buf[0], &ks[parts[i][0]], buf.size()))
+            return 2;
+        c.Seek(parts[i][0]);
+        std::fill(buf.begin(), buf.end(), 0);
+        c.Apply(&buf[0], buf.size());
+        if(memcmp(&buf[0], &ks[parts[i][0]], buf.size()))
+            return 3;
+    }
+    return 0;
+}
+
+int TestChaCha20Warm()
+{
+    STATIC_TEST_CIPHER_WARM(ChaCha20Cipher, k0, v0);
+}
+
+int TestChaCha20Massive()
+{
+    return TestCipherMassive<ChaCha20Cipher>();
+}
@@ -4,6 +4,9 @@
 #include "LZOCompressor.h"
 #include "DeflateCompressor.h"
 #include "LVPAFile.h"
+#include "LVPAStream.h"
+#include "VFSFileLVPA.h"
+#include "ThreadPool.h"
 
 
 const char v0[] = "";
@@ -14,6 +17,11 @@ const char v4[] = "Short test string.";
 const char v5[] = "Longer test string, longer because the string is longer, and the string is the test";
 const char v6[] = "Long test string with many repetitions many repetitions many repetitions many repetitions many repetitions until many repetitions do end.";
 
+// CRLF text, not \0-terminated when stored
+const char crlf[] = "line1\r\nline2\r\nline3\r\nEND";
+const char crlfAfter[] = "GARBAGE";
+const char crlfExpected[] = "line1\nline2\nline3\nEND";
+
 const uint8 b1[] = 
 {
     0,1,2,3,4,5,6,7,8,9,
@@ -262,6 +270,67 @@ int TestLVPA_MixedSolid()
     return 0;
 }
 
+int TestLVPA_Mapped()
+{
+    INIT_TEST();
+    {
+        LVPAFile lvpa;
+        g_blockName = NULL;
+        ADD_MEMBLOCK(v0);
+        ADD_MEMBLOCK(v1);
+        ADD_MEMBLOCK(v2);
+        g_blockName = "txt";
+        ADD_MEMBLOCK(v3);
+        ADD_MEMBLOCK(v4);
+        ADD_MEMBLOCK(v5);
+        ADD_MEMBLOCK(v6);
+        // stored as-is and not in a solid block, so that the next file follows directly
+        lvpa.Add("crlf.txt", memblock((uint8*)&crlf[0], sizeof(crlf) - 1), NULL, LVPAPACK_NONE, LVPACOMP_NONE);
+        lvpa.Add("crlf_after.txt", memblock((uint8*)&crlfAfter[0], sizeof(crlfAfter) - 1), NULL, LVPAPACK_NONE, LVPACOMP_NONE);
+        g_blockName = "bin";
+        ADD_MEMBLOCK(b1);
+        ADD_MEMBLOCK(i1);
+        ADD_MEMBLOCK(i2);
+        lvpa.SetSolidBlock("txt", LVPACOMP_NONE, LVPAPACK_NONE);
+        lvpa.SetSolidBlock("bin", LVPACOMP_FAST, LVPAPACK_LZO1X);
+        lvpa.SaveAs("~test.lvpa.tmp", 0);
+        lvpa.Clear(false); // otherwise we would attempt to delete const memory
+    }
+    {
+        LVPAFile lvpa;
+        lvpa.SetUseMapping(true);
+        if(!lvpa.LoadFrom("~test.lvpa.tmp")) return 1;
+        if(!lvpa.IsMapped()) return 2;
+        DO_CHECK_ALL();
+        // stored as-is, must be used from the mapping
+        if(!lvpa.GetFileInfo(lvpa.GetId("FILE_v2")).mapped) return 3;
+        if(!lvpa.GetFileInfo(lvpa.GetId("FILE_v5")).mapped) return 4;
+        // packed, must have been copied
+        if(lvpa.GetFileInfo(lvpa.GetId("FILE_b1")).mapped) return 5;
+
+        // text mode must not read over the end of mapped data, which are not \0-terminated
+        {
+            uint32 id = lvpa.GetId("crlf.txt");
+            VFSFileLVPA vf(&lvpa, id);
+            vf.open(NULL, (char*)"r");
+            if(strcmp((const char*)vf.getBuf(), crlfExpected)) return 7;
+            if(!lvpa.GetFileInfo(id).mapped) return 8;
+            char buf[64];
+            memset(buf, 'x', sizeof(buf));
+            vf.open(NULL, (char*)"r");
+            vf.read(buf, sizeof(buf));
+            if(strcmp(buf, crlfExpected)) return 9;
+        }
+
+        // overwriting the mapped file must not invalidate the data still in use
+        lvpa.SaveAs("~test.lvpa.tmp", 0);
+        if(lvpa.IsMapped()) return 6;
+        DO_CHECK_ALL();
+    }
+    DO_LOAD_AND_CHECK_ALL();
+    return 0;
+}
+
 int TestLVPAUncompressedEncrypted()
 {
     INIT_TEST();
@@ -360,6 +429,331 @@ int TestLVPA_Everything()
 
 #include "VFSHelper.h"
 #include "VFSFile.h"
+#include "VFSDir.h"
+
+static bool readWholeFile(const char *fn, std::vector<uint8>& buf)
+{
+    FILE *fh = fopen(fn, "rb");
+    if(!fh)
+        return false;
+    fseek(fh, 0, SEEK_END);
+    buf.resize(ftell(fh));
+    fseek(fh, 0, SEEK_SET);
+    bool ok = buf.empty() || fread(&buf[0], 1, buf.size(), fh) == buf.size();
+    fclose(fh);
+    return ok;
+}
+
+// saves the same set of files with and without threads, the results must be identical
+int TestLVPA_Threaded()
+{
+    std::vector<uint8> serial, threaded;
+    ThreadPool pool(3);
+    for(uint32 pass = 0; pass < 2; ++pass)
+    {
+        INIT_TEST();
+        LVPAFile lvpa;
+        lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+        if(pass)
+            lvpa.SetThreadPool(&pool);
+        g_blockName = NULL;
+        g_encrypt = LVPAENCR_ENABLED;
+        ADD_MEMBLOCK(v0);
+        ADD_MEMBLOCK(v1);
+        g_scramble = true;
+        ADD_MEMBLOCK(v2);
+        ADD_MEMBLOCK(v6);
+        g_scramble = false;
+        g_encrypt = LVPAENCR_NONE;
+        ADD_MEMBLOCK(b1);
+        g_blockName = "txt";
+        ADD_MEMBLOCK(v3);
+        ADD_MEMBLOCK(v4);
+        ADD_MEMBLOCK(v5);
+        g_blockName = "bin";
+        g_encrypt = LVPAENCR_ENABLED;
+        ADD_MEMBLOCK(i1);
+        ADD_MEMBLOCK(i2);
+        lvpa.SetSolidBlock("txt", LVPACOMP_FASTEST, LVPAPACK_LZMA);
+        lvpa.SetSolidBlock("bin", LVPACOMP_GOOD, LVPAPACK_DEFLATE);
+        mtRandSeed(12345); // cipher warmups are random
+        if(!lvpa.SaveAs("~test.lvpa.tmp", LVPACOMP_NORMAL, LVPAPACK_LZO1X, true)) return 1;
+        lvpa.Clear(false); // otherwise we would attempt to delete const memory
+        if(!readWholeFile("~test.lvpa.tmp", pass ? threaded : serial)) return 2;
+    }
+    if(serial.empty() || serial != threaded) return 3;
+
+    g_blockName = NULL; // for DO_CHECK_ALL
+    DO_LOAD_AND_CHECK_ALL();
+    return 0;
+}
+
+// unpacks in the background, with and without file mapping
+int TestLVPA_Async()
+{
+    INIT_TEST();
+    {
+        LVPAFile lvpa;
+        lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+        g_encrypt = LVPAENCR_ENABLED;
+        ADD_MEMBLOCK(v0);
+        ADD_MEMBLOCK(v1);
+        ADD_MEMBLOCK(v2);
+        g_blockName = "txt";
+        ADD_MEMBLOCK(v3);
+        ADD_MEMBLOCK(v4);
+        ADD_MEMBLOCK(v5);
+        ADD_MEMBLOCK(v6);
+        g_blockName = "bin";
+        g_encrypt = LVPAENCR_NONE;
+        ADD_MEMBLOCK(b1);
+        ADD_MEMBLOCK(i1);
+        ADD_MEMBLOCK(i2);
+        lvpa.SetSolidBlock("txt", LVPACOMP_FAST, LVPAPACK_LZMA);
+        lvpa.SetSolidBlock("bin", LVPACOMP_FAST, LVPAPACK_DEFLATE);
+        lvpa.SaveAs("~test.lvpa.tmp", LVPACOMP_FAST, LVPAPACK_LZO1X);
+        lvpa.Clear(false); // otherwise we would attempt to delete const memory
+    }
+    ThreadPool pool(2);
+    for(uint32 pass = 0; pass < 4; ++pass)
+    {
+        LVPAFile lvpa;
+        lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+        lvpa.SetThreadPool(&pool);
+        lvpa.SetUseMapping(pass & 1);
+        if(!lvpa.LoadFrom("~test.lvpa.tmp", LVPALoadFlags((pass & 2 ? LVPALOAD_ALL : LVPALOAD_SOLID) | LVPALOAD_ASYNC))) return 1;
+        DO_CHECK_ALL();
+        for(uint32 i = 0; i < lvpa.HeaderCount(); ++i)
+            if(!lvpa.IsReady(i)) return 3;
+        // prefetching on demand
+        if(!lvpa.Free("FILE_v1")) return 4;
+        if(lvpa.IsReady(lvpa.GetId("FILE_v1"))) return 5;
+        if(!lvpa.Prefetch("FILE_v1")) return 6;
+        DO_CHECK_SAME(v1);
+    }
+    return 0;
+}
+
+static bool checkBlocksUnpacked(LVPAFile& lvpa, bool want)
+{
+    for(uint32 i = 0; i < lvpa.HeaderCount(); ++i)
+    {
+        const LVPAFileHeader& h = lvpa.GetFileInfo(i);
+        if((h.flags & LVPAFLAG_CHUNKED) && (h.data.ptr != NULL) != want)
+            return false;
+    }
+    return true;
+}
+
+int TestLVPA_Chunked()
+{
+    INIT_TEST();
+    {
+        LVPAFile lvpa;
+        lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+        lvpa.SetChunkSize(64); // small enough to have files spanning several chunks
+        g_blockName = "txt";
+        ADD_MEMBLOCK(v0);
+        ADD_MEMBLOCK(v1);
+        ADD_MEMBLOCK(v2);
+        ADD_MEMBLOCK(v3);
+        ADD_MEMBLOCK(v4);
+        g_blockName = "bin";
+        ADD_MEMBLOCK(b1);
+        ADD_MEMBLOCK(i1);
+        ADD_MEMBLOCK(i2);
+        g_blockName = "enc"; // encrypted blocks are never chunked
+        g_encrypt = LVPAENCR_ENABLED;
+        ADD_MEMBLOCK(v5);
+        ADD_MEMBLOCK(v6);
+        lvpa.SetSolidBlock("txt", LVPACOMP_FAST, LVPAPACK_LZMA);
+        lvpa.SetSolidBlock("bin", LVPACOMP_FAST, LVPAPACK_DEFLATE);
+        lvpa.SetSolidBlock("enc", LVPACOMP_FAST, LVPAPACK_LZO1X);
+        lvpa.SaveAs("~test.lvpa.tmp", LVPACOMP_FAST, LVPAPACK_LZO1X);
+        lvpa.Clear(false); // otherwise we would attempt to delete const memory
+    }
+    {
+        // single files only unpack the chunks they need
+        LVPAFile lvpa;
+        lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+        if(!lvpa.LoadFrom("~test.lvpa.tmp", LVPALOAD_NONE)) return 1;
+        uint32 chunked = 0;
+        for(uint32 i = 0; i < lvpa.HeaderCount(); ++i)
+        {
+            const LVPAFileHeader& h = lvpa.GetFileInfo(i);
+            if(h.flags & LVPAFLAG_CHUNKED)
+            {
+                if(h.flags & LVPAFLAG_ENCRYPTED) return 2;
+                ++chunked;
+            }
+        }
+        if(chunked != 2) return 3;
+        DO_CHECK_ALL();
+        if(!checkBlocksUnpacked(lvpa, false)) return 4;
+    }
+    // loading solid blocks up front unpacks them as a whole
+    {
+        LVPAFile lvpa;
+        lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+        if(!lvpa.LoadFrom("~test.lvpa.tmp", LVPALOAD_SOLID)) return 7;
+        if(!checkBlocksUnpacked(lvpa, true)) return 8;
+        DO_CHECK_ALL();
+    }
+    ThreadPool pool(1);
+    {
+        LVPAFile lvpa;
+        lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+        lvpa.SetThreadPool(&pool);
+        if(!lvpa.LoadFrom("~test.lvpa.tmp", LVPALoadFlags(LVPALOAD_SOLID | LVPALOAD_ASYNC))) return 5;
+        DO_CHECK_ALL();
+        if(!checkBlocksUnpacked(lvpa, true)) return 6;
+    }
+    return 0;
+}
+
+// reads the file with LVPAStream in odd-sized pieces, so that window and chunk borders are crossed in between
+static int checkStream(LVPAFile& lvpa, const char *fn, const uint8 *mem, uint32 size)
+{
+    LVPAStream s;
+    if(!s.Open(&lvpa, lvpa.GetId(fn))) return 1;
+    if(s.Size() != size) return 2;
+    std::vector<uint8> buf(size + 1);
+    uint32 pos = 0, n;
+    while((n = s.Read(&buf[pos], 777)))
+        pos += n;
+    if(pos != size || memcmp(&buf[0], mem, size) || !s.IsGood()) return 3;
+
+    // seeking backwards restarts, seeking forwards skips
+    uint32 half = size / 2;
+    if(!s.Seek(half) || s.Read(&buf[0], size - half) != size - half || memcmp(&buf[0], mem + half, size - half)) return 4;
+    if(!s.Seek(0) || s.Read(&buf[0], size) != size || memcmp(&buf[0], mem, size) || !s.IsGood()) return 5;
+    return 0;
+}
+
+#define DO_CHECK_STREAM(fn, mem, size) { int _r = checkStream(lvpa, fn, (const uint8*)(mem), size); if(_r) return 10 * _r; }
+
+int TestLVPA_Stream()
+{
+    INIT_TEST();
+    // something large enough to need several windows
+    std::vector<uint8> big(100 * 1024);
+    for(uint32 i = 0; i < big.size(); ++i)
+        big[i] = uint8((i % 251) ^ (i / 1000));
+    memblock bigmb(&big[0], big.size());
+    {
+        LVPAFile lvpa;
+        lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+        lvpa.SetChunkSize(16 * 1024);
+        lvpa.Add("big_lzma", bigmb, NULL, LVPAPACK_LZMA, LVPACOMP_FAST);
+        lvpa.Add("big_deflate", bigmb, NULL, LVPAPACK_DEFLATE, LVPACOMP_FAST);
+        lvpa.Add("big_lzo", bigmb, NULL, LVPAPACK_LZO1X, LVPACOMP_FAST);
+        lvpa.Add("big_none", bigmb, NULL, LVPAPACK_NONE, LVPACOMP_NONE, LVPAENCR_ENABLED);
+        lvpa.Add("big_enc", bigmb, NULL, LVPAPACK_LZMA, LVPACOMP_FAST, LVPAENCR_ENABLED);
+        lvpa.Add("big_scrambled", bigmb, NULL, LVPAPACK_DEFLATE, LVPACOMP_FAST, LVPAENCR_ENABLED, true);
+        g_blockName = "chunked";
+        ADD_MEMBLOCK(v4);
+        lvpa.Add("big_s1", bigmb, g_blockName);
+        ADD_MEMBLOCK(b1);
+        lvpa.Add("big_s2", bigmb, g_blockName);
+        g_blockName = "enc";
+        g_encrypt = LVPAENCR_ENABLED;
+        ADD_MEMBLOCK(v0);
+        ADD_MEMBLOCK(v6);
+        lvpa.Add("big_s3", bigmb, g_blockName);
+        ADD_MEMBLOCK(i1);
+        lvpa.SetSolidBlock("chunked", LVPACOMP_FAST, LVPAPACK_DEFLATE);
+        lvpa.SetSolidBlock("enc", LVPACOMP_FAST, LVPAPACK_LZMA);
+        lvpa.SaveAs("~test.lvpa.tmp", LVPACOMP_FAST, LVPAPACK_LZO1X);
+        lvpa.Clear(false); // otherwise we would attempt to delete const memory
+    }
+    LVPAFile lvpa;
+    lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+    if(!lvpa.LoadFrom("~test.lvpa.tmp", LVPALOAD_NONE)) return 1;
+    DO_CHECK_STREAM("big_lzma", &big[0], big.size());
+    DO_CHECK_STREAM("big_deflate", &big[0], big.size());
+    DO_CHECK_STREAM("big_lzo", &big[0], big.size());
+    DO_CHECK_STREAM("big_none", &big[0], big.size());
+    DO_CHECK_STREAM("big_enc", &big[0], big.size());
+    DO_CHECK_STREAM("big_scrambled", &big[0], big.size());
+    DO_CHECK_STREAM("big_s1", &big[0], big.size());
+    DO_CHECK_STREAM("big_s2", &big[0], big.size());
+    DO_CHECK_STREAM("big_s3", &big[0], big.size());
+    DO_CHECK_STREAM("FILE_v4", v4, sizeof(v4));
+    DO_CHECK_STREAM("FILE_b1", b1, sizeof(b1));
+    DO_CHECK_STREAM("FILE_v0", v0, sizeof(v0));
+    DO_CHECK_STREAM("FILE_v6", v6, sizeof(v6));
+    DO_CHECK_STREAM("FILE_i1", i1, sizeof(i1));
+
+    // binary reads through the VFS stream too, without unpacking the file into memory
+    uint32 id = lvpa.GetId("big_s2");
+    VFSFileLVPA vf(&lvpa, id);
+    std::vector<uint8> buf(big.size());
+    uint32 pos = 0, n;
+    while((n = vf.read((char*)&buf[pos], 1000)))
+        pos += n;
+    if(pos != big.size() || memcmp(&buf[0], &big[0], pos)) return 2;
+    if(lvpa.IsReady(id)) return 3;
+    return 0;
+}
+
+#define DO_CHECK_BIG(fn) { memblock _m = lvpa.Get(fn); if(_m.size != big.size() || memcmp(_m.ptr, &big[0], _m.size)) return 5; }
+
+int TestLVPA_ChaCha()
+{
+    INIT_TEST();
+    // large enough to be encrypted in parallel
+    std::vector<uint8> big(LVPA_PARALLEL_CRYPT_SIZE + 12345);
+    for(uint32 i = 0; i < big.size(); ++i)
+        big[i] = uint8((i % 251) ^ (i / 1000));
+    memblock bigmb(&big[0], big.size());
+    ThreadPool pool(2);
+    {
+        LVPAFile lvpa;
+        lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+        lvpa.SetThreadPool(&pool);
+        lvpa.SetChunkSize(16 * 1024);
+        lvpa.SetDeduplicate(false); // the same data in each file, all of them must be stored
+        lvpa.Add("big_none", bigmb, NULL, LVPAPACK_NONE, LVPACOMP_NONE, LVPAENCR_CHACHA);
+        lvpa.Add("big_lzo", bigmb, NULL, LVPAPACK_LZO1X, LVPACOMP_FAST, LVPAENCR_CHACHA);
+        lvpa.Add("big_scrambled", bigmb, NULL, LVPAPACK_NONE, LVPACOMP_NONE, LVPAENCR_CHACHA, true);
+        g_blockName = "enc";
+        g_encrypt = LVPAENCR_CHACHA;
+        ADD_MEMBLOCK(v4);
+        lvpa.Add("big_s1", bigmb, g_blockName, LVPAPACK_INHERIT, LVPACOMP_INHERIT, g_encrypt);
+        ADD_MEMBLOCK(b1);
+        lvpa.SetSolidBlock("enc", LVPACOMP_FAST, LVPAPACK_DEFLATE);
+        g_blockName = NULL;
+        g_encrypt = LVPAENCR_ENABLED; // the old cipher, in the same container
+        ADD_MEMBLOCK(v6);
+        lvpa.SaveAs("~test.lvpa.tmp", LVPACOMP_FAST, LVPAPACK_LZO1X);
+        lvpa.Clear(false); // otherwise we would attempt to delete const memory
+    }
+    for(uint32 pass = 0; pass < 2; ++pass)
+    {
+        LVPAFile lvpa;
+        lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+        if(pass)
+            lvpa.SetThreadPool(&pool);
+        if(!lvpa.LoadFrom("~test.lvpa.tmp", LVPALOAD_NONE)) return 1;
+        // encrypted solid blocks can be chunked, single files only decrypt and unpack the chunks they need
+        const LVPAFileHeader& sh = lvpa.GetFileInfo(lvpa.GetId("enc*"));
+        if((sh.flags & (LVPAFLAG_CHUNKED | LVPAFLAG_ENCRYPTED | LVPAFLAG_CHACHA)) != (LVPAFLAG_CHUNKED | LVPAFLAG_ENCRYPTED | LVPAFLAG_CHACHA)) return 2;
+        DO_CHECK_SAME(v4);
+        DO_CHECK_SAME(b1);
+        DO_CHECK_BIG("big_s1");
+        if(!checkBlocksUnpacked(lvpa, false)) return 3;
+        if(lvpa.GetFileInfo(lvpa.GetId("FILE_v6")).flags & LVPAFLAG_CHACHA) return 4;
+        DO_CHECK_SAME(v6);
+        DO_CHECK_BIG("big_none");
+        DO_CHECK_BIG("big_lzo");
+        DO_CHECK_BIG("big_scrambled");
+        DO_CHECK_STREAM("big_none", &big[0], big.size());
+        DO_CHECK_STREAM("big_lzo", &big[0], big.size());
+        DO_CHECK_STREAM("big_s1", &big[0], big.size());
+        DO_CHECK_STREAM("FILE_b1", b1, sizeof(b1));
+    }
+    return 0;
+}
 
 #define DO_CHECK_VFS(mem) \
 { \
@@ -426,4 +820,535 @@ int TestLVPA_VFS_ScrambledLoaderEncrypted()
     DO_CHECK_VFS(i1);
     DO_CHECK_VFS(i2);
     return 0;
-}
\ No newline at end of file
+}
+static bool checkVFSFile(VFSHelper& vfs, const char *fn, const void *mem, uint32 size)
+{
+    VFSFile *vf = vfs.GetFile(fn);
+    return vf && vf->size() == size && !memcmp(vf->getBuf(), mem, size);
+}
+
+#define DO_CHECK_VFS_AS(fn, mem) { if(!checkVFSFile(vfs, fn, &mem[0], sizeof(mem))) return 1; }
+
+int TestLVPA_VFS_Index()
+{
+    INIT_TEST()
+    {
+        LVPAFile lvpa;
+        lvpa.Add("dir/a", MAKE_MEMBLOCK(v1));
+        lvpa.Add("dir/sub/b", MAKE_MEMBLOCK(v2));
+        lvpa.Add("c", MAKE_MEMBLOCK(v3));
+        lvpa.SaveAs("~test.lvpa.tmp", LVPACOMP_NONE, LVPAPACK_NONE, false);
+        lvpa.Clear(false); // otherwise we would attempt to delete const memory
+
+        lvpa.Add("a", MAKE_MEMBLOCK(v4));
+        lvpa.Add("sub/b", MAKE_MEMBLOCK(v5));
+        lvpa.Add("d", MAKE_MEMBLOCK(v6));
+        lvpa.SaveAs("~test2.lvpa.tmp", LVPACOMP_NONE, LVPAPACK_NONE, false);
+        lvpa.Clear(false);
+    }
+    LVPAFile lvpa, lvpa2;
+    lvpa.LoadFrom("~test.lvpa.tmp");
+    lvpa2.LoadFrom("~test2.lvpa.tmp");
+    VFSHelper vfs;
+    vfs.LoadBase(&lvpa, false);
+    vfs.Prepare();
+    DO_CHECK_VFS_AS("dir/a", v1);
+    DO_CHECK_VFS_AS("dir/sub/b", v2);
+    DO_CHECK_VFS_AS("c", v3);
+    if(vfs.GetFile("a") || vfs.GetFile("dir/sub")) return 2;
+
+    // mounting without overwriting only adds new files
+    if(!vfs.AddContainer(&lvpa2, "dir", false, false)) return 3;
+    DO_CHECK_VFS_AS("dir/a", v1);
+    DO_CHECK_VFS_AS("dir/d", v6);
+    if(!vfs.AddContainer(&lvpa2, "dir", false, true)) return 4;
+    DO_CHECK_VFS_AS("dir/a", v4);
+    DO_CHECK_VFS_AS("dir/sub/b", v5);
+
+    // paths are normalized
+    DO_CHECK_VFS_AS("./dir//sub\\b", v5);
+    DO_CHECK_VFS_AS("/c", v3);
+
+    VFSFileMem *vf = new VFSFileMem("c", (uint8*)&v6[0], sizeof(v6), true);
+    bool added = vfs.AddFile(vf);
+    --(vf->ref);
+    if(!added) return 5;
+    DO_CHECK_VFS_AS("c", v6);
+    if(!vfs.Merge("dir/sub", "e", true)) return 6;
+    DO_CHECK_VFS_AS("e/b", v5);
+
+    // the index must always agree with the tree
+    vfs.Reload();
+    const char *names[] = { "dir/a", "dir/d", "dir/sub/b", "c", "e/b" };
+    for(uint32 i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+        if(vfs.GetFile(names[i]) != vfs.GetDirRoot()->getFile(names[i])) return 7;
+    DO_CHECK_VFS_AS("dir/a", v4);
+    DO_CHECK_VFS_AS("c", v6); // added files stay on top
+    return 0;
+}
+
+static bool writeWholeFile(const char *fn, const void *mem, uint32 size)
+{
+    FILE *fh = fopen(fn, "wb");
+    if(!fh)
+        return false;
+    bool ok = fwrite(mem, 1, size, fh) == size;
+    fclose(fh);
+    return ok;
+}
+
+#define DO_CHECK_VFS_GONE(fn) { if(vfs.GetFile(fn) || vfs.GetDirRoot()->getFile(fn)) return 1; }
+
+int TestLVPA_VFS_Mount()
+{
+    INIT_TEST()
+    {
+        LVPAFile lvpa;
+        lvpa.Add("dir/a", MAKE_MEMBLOCK(v1));
+        lvpa.Add("dir/sub/b", MAKE_MEMBLOCK(v2));
+        lvpa.Add("c", MAKE_MEMBLOCK(v3));
+        lvpa.SaveAs("~test.lvpa.tmp", LVPACOMP_NONE, LVPAPACK_NONE, false);
+        lvpa.Clear(false); // otherwise we would attempt to delete const memory
+
+        lvpa.Add("a", MAKE_MEMBLOCK(v4));
+        lvpa.Add("sub/b", MAKE_MEMBLOCK(v5));
+        lvpa.Add("d", MAKE_MEMBLOCK(v6));
+        lvpa.SaveAs("~test2.lvpa.tmp", LVPACOMP_NONE, LVPAPACK_NONE, false);
+        lvpa.Clear(false);
+    }
+    LVPAFile lvpa, lvpa2;
+    lvpa.LoadFrom("~test.lvpa.tmp");
+    lvpa2.LoadFrom("~test2.lvpa.tmp");
+    VFSHelper vfs;
+    vfs.LoadBase(&lvpa, false);
+    vfs.Prepare();
+
+    // unmounting falls back to what was there before
+    if(!vfs.AddContainer(&lvpa2, "dir", false, true)) return 2;
+    VFSFileMem *vf = new VFSFileMem("c", (uint8*)&v6[0], sizeof(v6), true);
+    vfs.AddFile(vf);
+    --(vf->ref);
+    DO_CHECK_VFS_AS("dir/a", v4);
+    DO_CHECK_VFS_AS("dir/d", v6);
+    if(!vfs.RemoveContainer(&lvpa2)) return 3;
+    DO_CHECK_VFS_AS("dir/a", v1);
+    DO_CHECK_VFS_AS("dir/sub/b", v2);
+    DO_CHECK_VFS_GONE("dir/d");
+    DO_CHECK_VFS_AS("c", v6);
+    if(vfs.RemoveContainer(&lvpa2)) return 4;
+
+    // clearing drops everything except the base
+    if(!vfs.AddContainer(&lvpa2, "", false, false)) return 5;
+    DO_CHECK_VFS_AS("d", v6);
+    vfs.Prepare(true);
+    DO_CHECK_VFS_AS("c", v3);
+    DO_CHECK_VFS_GONE("d");
+    DO_CHECK_VFS_GONE("a");
+    if(vfs.GetDir("sub")) return 6; // empty dirs are removed
+
+    // changes on disk are picked up by Reload(true)
+    CreateDir("~vfs.tmp");
+    remove("~vfs.tmp/y");
+    if(!writeWholeFile("~vfs.tmp/x", &v1[0], sizeof(v1))) return 7;
+    if(!vfs.AddPath("~vfs.tmp")) return 8;
+    DO_CHECK_VFS_AS("x", v1);
+    DO_CHECK_VFS_GONE("y");
+    if(!writeWholeFile("~vfs.tmp/y", &v2[0], sizeof(v2))) return 9;
+    vfs.Reload(true);
+    DO_CHECK_VFS_AS("y", v2);
+    remove("~vfs.tmp/x");
+    vfs.Reload(true);
+    DO_CHECK_VFS_GONE("x");
+    DO_CHECK_VFS_AS("y", v2);
+    if(!vfs.RemovePath("~vfs.tmp")) return 10;
+    DO_CHECK_VFS_GONE("y");
+    remove("~vfs.tmp/y");
+    return 0;
+}
+
+int TestLVPA_CRCPolicy()
+{
+    INIT_TEST();
+    {
+        LVPAFile lvpa;
+        lvpa.Add("plain", MAKE_MEMBLOCK(v6), NULL, LVPAPACK_NONE, LVPACOMP_NONE);
+        lvpa.Add("packed", MAKE_MEMBLOCK(i1));
+        g_blockName = "blk";
+        ADD_MEMBLOCK(v5);
+        ADD_MEMBLOCK(b1);
+        lvpa.SaveAs("~test.lvpa.tmp", LVPACOMP_FAST, LVPAPACK_DEFLATE);
+        lvpa.Clear(false); // otherwise we would attempt to delete const memory
+    }
+    // a copy with one byte of "plain" flipped
+    std::vector<uint8> buf;
+    if(!readWholeFile("~test.lvpa.tmp", buf)) return 1;
+    {
+        LVPAFile lvpa;
+        if(!lvpa.LoadFrom("~test.lvpa.tmp")) return 2;
+        buf[lvpa.GetFileInfo(lvpa.GetId("plain")).offset] ^= 0x20;
+    }
+    if(!writeWholeFile("~test2.lvpa.tmp", &buf[0], buf.size())) return 3;
+
+    ThreadPool pool(2);
+    for(uint32 p = LVPACRC_ALWAYS; p <= LVPACRC_BACKGROUND; ++p)
+    {
+        LVPACRCPolicy policy = LVPACRCPolicy(p);
+        {
+            LVPAFile lvpa;
+            lvpa.SetThreadPool(&pool);
+            lvpa.SetCRCPolicy(policy);
+            if(!lvpa.LoadFrom("~test.lvpa.tmp")) return 4;
+            while(lvpa.IsVerifying()) {}
+            DO_CHECK_SAME(v5);
+            DO_CHECK_SAME(b1);
+            memblock mb = lvpa.Get("packed");
+            if(!mb.ptr || memcmp(mb.ptr, i1, sizeof(i1))) return 5;
+            mb = lvpa.Get("plain");
+            if(!mb.ptr || memcmp(mb.ptr, v6, sizeof(v6))) return 6;
+            bool verified = lvpa.GetFileInfo(lvpa.GetId("plain")).verified;
+            if(verified != (policy == LVPACRC_ALWAYS || policy == LVPACRC_FIRST_LOAD)) return 7;
+            // loaded again from disk
+            if(!lvpa.Free("plain")) return 8;
+            mb = lvpa.Get("plain");
+            if(!mb.ptr || memcmp(mb.ptr, v6, sizeof(v6))) return 9;
+        }
+        {
+            LVPAFile lvpa;
+            lvpa.SetThreadPool(&pool);
+            lvpa.SetCRCPolicy(policy);
+            if(!lvpa.LoadFrom("~test2.lvpa.tmp")) return 10;
+            while(lvpa.IsVerifying()) {}
+            memblock mb = lvpa.Get("plain");
+            if(!mb.ptr != (policy != LVPACRC_NEVER)) return 11;
+            DO_CHECK_SAME(v5); // the others are fine
+        }
+    }
+    remove("~test2.lvpa.tmp");
+    return 0;
+}
+
+int TestLVPA_Dedup()
+{
+    INIT_TEST();
+    uint32 sizes[2];
+    for(uint32 dedup = 0; dedup < 2; ++dedup)
+    {
+        LVPAFile lvpa;
+        lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+        lvpa.SetDeduplicate(dedup != 0);
+        lvpa.Add("a", MAKE_MEMBLOCK(v6), NULL, LVPAPACK_NONE, LVPACOMP_NONE);
+        lvpa.Add("b", MAKE_MEMBLOCK(v6));
+        lvpa.Add("c", MAKE_MEMBLOCK(v6), "blk");
+        lvpa.Add("d", MAKE_MEMBLOCK(v6), NULL, LVPAPACK_INHERIT, LVPACOMP_INHERIT, LVPAENCR_CHACHA); // not an alias of a plain file
+        lvpa.Add("e", MAKE_MEMBLOCK(v6), "blk", LVPAPACK_INHERIT, LVPACOMP_INHERIT, LVPAENCR_ENABLED);
+        lvpa.Add("s", MAKE_MEMBLOCK(v6), NULL, LVPAPACK_INHERIT, LVPACOMP_INHERIT, LVPAENCR_INHERIT, true); // never merged
+        lvpa.Add("v5", MAKE_MEMBLOCK(v5), "blk");
+        lvpa.Add("x", MAKE_MEMBLOCK(v5));
+        lvpa.SaveAs("~test.lvpa.tmp", LVPACOMP_FAST, LVPAPACK_DEFLATE);
+        lvpa.Clear(false); // otherwise we would attempt to delete const memory
+        std::vector<uint8> buf;
+        if(!readWholeFile("~test.lvpa.tmp", buf)) return 1;
+        sizes[dedup] = buf.size();
+    }
+    if(sizes[1] >= sizes[0]) return 2;
+
+    ThreadPool pool(2);
+    for(uint32 pass = 0; pass < 2; ++pass)
+    {
+        LVPAFile lvpa;
+        lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+        if(pass)
+            lvpa.SetThreadPool(&pool);
+        if(!lvpa.LoadFrom("~test.lvpa.tmp", pass ? LVPALoadFlags(LVPALOAD_ALL | LVPALOAD_ASYNC) : LVPALOAD_NONE)) return 3;
+        const char *aliases[] = { "b", "a", "c", "a", "e", "d", "x", "v5" };
+        for(uint32 i = 0; i < 8; i += 2)
+        {
+            const LVPAFileHeader& h = lvpa.GetFileInfo(lvpa.GetId(aliases[i]));
+            if(!(h.flags & LVPAFLAG_ALIAS) || h.aliasId != lvpa.GetId(aliases[i + 1])) return 4;
+        }
+        if(lvpa.GetFileInfo(lvpa.GetId("d")).flags & LVPAFLAG_ALIAS) return 5;
+        if(lvpa.GetFileInfo(lvpa.GetId("s")).flags & LVPAFLAG_ALIAS) return 6;
+
+        // all share one buffer
+        memblock mc = lvpa.Get("c");
+        memblock ma = lvpa.Get("a");
+        if(!ma.ptr || ma.ptr != mc.ptr || ma.ptr != lvpa.Get("b").ptr || ma.size != sizeof(v6) || memcmp(ma.ptr, v6, sizeof(v6))) return 7;
+        memblock me = lvpa.Get("e");
+        if(!me.ptr || me.ptr == ma.ptr || me.ptr != lvpa.Get("d").ptr || memcmp(me.ptr, v6, sizeof(v6))) return 8;
+        memblock mx = lvpa.Get("x");
+        if(!mx.ptr || mx.size != sizeof(v5) || memcmp(mx.ptr, v5, sizeof(v5))) return 9;
+        DO_CHECK_STREAM("b", v6, sizeof(v6));
+        DO_CHECK_STREAM("x", v5, sizeof(v5));
+
+        // the aliases must not keep pointing to freed memory
+        if(!lvpa.Free("a")) return 10;
+        if(lvpa.GetFileInfo(lvpa.GetId("b")).data.ptr) return 11;
+        memblock mb = lvpa.Get("b");
+        if(!mb.ptr || memcmp(mb.ptr, v6, sizeof(v6))) return 12;
+
+        // changing a file does not change its aliases
+        lvpa.Add("a", MAKE_MEMBLOCK(v4));
+        const LVPAFileHeader& hb = lvpa.GetFileInfo(lvpa.GetId("b"));
+        if((hb.flags & LVPAFLAG_ALIAS) || !hb.data.ptr || hb.data.ptr == lvpa.Get("a").ptr || memcmp(hb.data.ptr, v6, sizeof(v6))) return 13;
+        mc = lvpa.Get("c");
+        if(!mc.ptr || memcmp(mc.ptr, v6, sizeof(v6))) return 14;
+        if(memcmp(lvpa.Get("a").ptr, v4, sizeof(v4))) return 15;
+        lvpa.Drop("a"); // const memory
+    }
+    return 0;
+}
+
+int TestLVPA_AutoCompression()
+{
+    INIT_TEST();
+    std::vector<uint8> rnd(100000), rep, words;
+    uint32 seed = 12345;
+    for(uint32 i = 0; i < rnd.size(); ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        rnd[i] = uint8(seed >> 23);
+    }
+    while(rep.size() < 50000)
+        rep.insert(rep.end(), v6, v6 + sizeof(v6) - 1);
+    const char *dict[] = { "tile", "layer", "sound", "map", "the", "of", "sprite", "a", "engine", "collision", "object", "with" };
+    while(words.size() < 50000)
+    {
+        seed = seed * 1103515245 + 12345;
+        const char *w = dict[(seed >> 16) % 12];
+        words.insert(words.end(), w, w + strlen(w));
+        words.push_back((seed >> 8) & 1 ? ' ' : '\n');
+    }
+    struct { const char *name; std::vector<uint8> *data; uint8 level; uint8 expect; } files[] =
+    {
+        { "rnd",   &rnd,   7, LVPAPACK_NONE },
+        { "rep1",  &rep,   1, LVPAPACK_LZO1X },
+        { "rep4",  &rep,   4, LVPAPACK_LZO1X },
+        { "rep7",  &rep,   7, LVPAPACK_LZMA },
+        { "words", &words, 4, LVPAPACK_DEFLATE },
+    };
+    const uint32 count = sizeof(files) / sizeof(files[0]);
+    {
+        LVPAFile lvpa;
+        lvpa.SetDeduplicate(false);
+        for(uint32 i = 0; i < count; ++i)
+            lvpa.Add(files[i].name, memblock(&(*files[i].data)[0], files[i].data->size()), NULL, LVPAPACK_AUTO, files[i].level);
+        lvpa.SetSolidBlock("blk", 4, LVPAPACK_AUTO);
+        lvpa.Add("swords", memblock(&words[0], words.size()), "blk");
+        lvpa.SaveAs("~test.lvpa.tmp", LVPACOMP_FAST, LVPAPACK_AUTO);
+        lvpa.Clear(false); // otherwise we would attempt to delete const memory
+    }
+    LVPAFile lvpa;
+    if(!lvpa.LoadFrom("~test.lvpa.tmp")) return 1;
+    for(uint32 i = 0; i < count; ++i)
+    {
+        const LVPAFileHeader& h = lvpa.GetFileInfo(lvpa.GetId(files[i].name));
+        if(h.algo != files[i].expect || !(h.flags & LVPAFLAG_PACKED) != (files[i].expect == LVPAPACK_NONE)) return 2;
+        if(h.algo != LVPAPACK_NONE && h.level != files[i].level) return 3;
+        memblock mb = lvpa.Get(files[i].name);
+        if(mb.size != files[i].data->size() || memcmp(mb.ptr, &(*files[i].data)[0], mb.size)) return 4;
+    }
+    if(lvpa.GetFileInfo(lvpa.GetId("blk*")).algo != LVPAPACK_DEFLATE) return 5;
+    memblock mb = lvpa.Get("swords");
+    if(mb.size != words.size() || memcmp(mb.ptr, &words[0], mb.size)) return 6;
+    return 0;
+}
+
+static bool sameContent(LVPAFile& lvpa, const char *fn, const void *mem, uint32 size)
+{
+    memblock mb = lvpa.Get(fn);
+    return mb.ptr && mb.size == size && !memcmp(mb.ptr, mem, size);
+}
+
+#define DO_CHECK_UPDATED(r) \
+{ \
+    if(!sameContent(lvpa, "a", v6, sizeof(v6))) return r; \
+    if(!sameContent(lvpa, "b", v4, sizeof(v4))) return r + 1; \
+    if(!sameContent(lvpa, "c", v3, sizeof(v3))) return r + 2; \
+    if(!sameContent(lvpa, "d", v4, sizeof(v4))) return r + 3; \
+    if(!sameContent(lvpa, "e", v5, sizeof(v5))) return r + 4; \
+    if(!sameContent(lvpa, "f", v1, sizeof(v1))) return r + 5; \
+    if(!sameContent(lvpa, "g", v2, sizeof(v2))) return r + 6; \
+}
+
+int TestLVPA_Update()
+{
+    INIT_TEST();
+    std::vector<uint8> buf;
+    uint32 sizes[3];
+    {
+        LVPAFile lvpa;
+        lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+        lvpa.Add("a", MAKE_MEMBLOCK(v1));
+        lvpa.Add("b", MAKE_MEMBLOCK(v2), "blk");
+        lvpa.Add("c", MAKE_MEMBLOCK(v3), "blk");
+        lvpa.Add("d", MAKE_MEMBLOCK(v4), NULL, LVPAPACK_INHERIT, LVPACOMP_INHERIT, LVPAENCR_CHACHA);
+        lvpa.Add("e", MAKE_MEMBLOCK(v5), "blk2");
+        lvpa.Add("f", MAKE_MEMBLOCK(v1)); // alias of "a"
+        if(!lvpa.SaveAs("~test.lvpa.tmp", LVPACOMP_FAST)) return 1;
+        lvpa.Clear(false); // otherwise we would attempt to delete const memory
+        if(!readWholeFile("~test.lvpa.tmp", buf)) return 2;
+        sizes[0] = buf.size();
+    }
+    {
+        // change a file, a file in a solid block, and add one. the rest stays in the file as it is.
+        LVPAFile lvpa;
+        lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+        lvpa.SetUseMapping(true);
+        if(!lvpa.LoadFrom("~test.lvpa.tmp")) return 3;
+        if(lvpa.GetUnusedSize()) return 4;
+        if(!sameContent(lvpa, "c", v3, sizeof(v3))) return 5; // points into the block that is written again
+        lvpa.Add("a", MAKE_MEMBLOCK(v6));
+        lvpa.Add("b", MAKE_MEMBLOCK(v4), "blk");
+        lvpa.Add("g", MAKE_MEMBLOCK(v2));
+        if(!lvpa.Update(LVPACOMP_FAST)) return 6;
+        if(!lvpa.GetUnusedSize()) return 7;
+        if(lvpa.GetFileInfo(lvpa.GetId("f")).flags & LVPAFLAG_ALIAS) return 8; // got its own copy
+        DO_CHECK_UPDATED(10);
+        lvpa.Drop("a"); // const memory
+        lvpa.Drop("b");
+        lvpa.Drop("g");
+        if(!lvpa.Free("c") || !sameContent(lvpa, "c", v3, sizeof(v3))) return 20; // from the new block
+        if(!readWholeFile("~test.lvpa.tmp", buf)) return 21;
+        sizes[1] = buf.size();
+        if(sizes[1] <= sizes[0] || memcmp(&buf[0], "LVPA", 4)) return 22;
+    }
+    {
+        LVPAFile lvpa;
+        lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+        if(!lvpa.LoadFrom("~test.lvpa.tmp")) return 30;
+        if(!lvpa.GetUnusedSize()) return 31;
+        DO_CHECK_STREAM("d", v4, sizeof(v4));
+        DO_CHECK_UPDATED(40);
+
+        // compacting copies everything as it is stored
+        if(!lvpa.Free("d") || !lvpa.Free("a")) return 50;
+        if(!lvpa.SaveAs("~test.lvpa.tmp", LVPACOMP_FAST)) return 51;
+        if(lvpa.GetUnusedSize()) return 52;
+        DO_CHECK_UPDATED(60);
+        if(!readWholeFile("~test.lvpa.tmp", buf)) return 70;
+        sizes[2] = buf.size();
+        if(sizes[2] >= sizes[1]) return 71;
+    }
+    LVPAFile lvpa;
+    lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+    if(!lvpa.LoadFrom("~test.lvpa.tmp")) return 80;
+    if(lvpa.GetUnusedSize()) return 81;
+    DO_CHECK_STREAM("d", v4, sizeof(v4));
+    DO_CHECK_UPDATED(90);
+    return 0;
+}
+
+int TestLVPA_Rekey()
+{
+    INIT_TEST();
+    uint8 newKey[LVPAHash_Size];
+    const char *k = "Somebody set up us the bomb.";
+    SHA256Hash::Calc(&newKey[0], (uint8*)k, strlen(k));
+    {
+        LVPAFile lvpa;
+        lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+        lvpa.Add("a", MAKE_MEMBLOCK(v5), NULL, LVPAPACK_INHERIT, LVPACOMP_INHERIT, LVPAENCR_ENABLED);
+        lvpa.Add("b", MAKE_MEMBLOCK(v6), NULL, LVPAPACK_INHERIT, LVPACOMP_INHERIT, LVPAENCR_CHACHA);
+        lvpa.Add("c", MAKE_MEMBLOCK(v3), "blk", LVPAPACK_INHERIT, LVPACOMP_INHERIT, LVPAENCR_ENABLED);
+        lvpa.Add("d", MAKE_MEMBLOCK(v4), "blk");
+        lvpa.Add("e", MAKE_MEMBLOCK(v2), NULL, LVPAPACK_INHERIT, LVPACOMP_INHERIT, LVPAENCR_ENABLED, true);
+        lvpa.Add("f", MAKE_MEMBLOCK(b1), NULL, LVPAPACK_INHERIT, LVPACOMP_INHERIT, LVPAENCR_NONE, true);
+        lvpa.Add("g", MAKE_MEMBLOCK(v1));
+        // stored as is, so that reading with a wrong key fails at the CRC check
+        if(!lvpa.SaveAs("~test.lvpa.tmp", LVPACOMP_NONE)) return 1;
+        lvpa.Clear(false); // otherwise we would attempt to delete const memory
+    }
+    {
+        LVPAFile lvpa;
+        lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+        if(!lvpa.LoadFrom("~test.lvpa.tmp")) return 2;
+        if(!sameContent(lvpa, "e", v2, sizeof(v2)) || !sameContent(lvpa, "f", b1, sizeof(b1))) return 3; // names are known now
+        lvpa.Free("e");
+        lvpa.SetMasterKey(&newKey[0], LVPAHash_Size);
+        if(!lvpa.SaveAs("~test.lvpa.tmp", LVPACOMP_NONE)) return 4;
+        if(!sameContent(lvpa, "e", v2, sizeof(v2)) || !sameContent(lvpa, "c", v3, sizeof(v3))) return 5;
+    }
+    {
+        LVPAFile lvpa;
+        lvpa.SetMasterKey(&newKey[0], LVPAHash_Size);
+        if(!lvpa.LoadFrom("~test.lvpa.tmp")) return 10;
+        if(!sameContent(lvpa, "a", v5, sizeof(v5))) return 11;
+        if(!sameContent(lvpa, "b", v6, sizeof(v6))) return 12;
+        if(!sameContent(lvpa, "c", v3, sizeof(v3))) return 13;
+        if(!sameContent(lvpa, "d", v4, sizeof(v4))) return 14;
+        if(!sameContent(lvpa, "e", v2, sizeof(v2))) return 15;
+        if(!sameContent(lvpa, "f", b1, sizeof(b1))) return 16;
+        if(!sameContent(lvpa, "g", v1, sizeof(v1))) return 17;
+        // still encrypted as before
+        if(!(lvpa.GetFileInfo(lvpa.GetId("a")).flags & LVPAFLAG_ENCRYPTED)) return 18;
+        if(!(lvpa.GetFileInfo(lvpa.GetId("b")).flags & LVPAFLAG_CHACHA)) return 19;
+        if(!(lvpa.GetFileInfo(lvpa.GetFileInfo(lvpa.GetId("c")).blockId).flags & LVPAFLAG_ENCRYPTED)) return 20;
+    }
+    LVPAFile lvpa;
+    lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+    if(!lvpa.LoadFrom("~test.lvpa.tmp")) return 30;
+    if(lvpa.Get("a").ptr || lvpa.Get("b").ptr || lvpa.Get("c").ptr) return 31;
+    if(lvpa.GetId("e") != uint32(-1) || lvpa.GetId("f") != uint32(-1)) return 32; // hashed with the new key's salt
+    if(!sameContent(lvpa, "g", v1, sizeof(v1))) return 33;
+
+    // files that could not be read with the wrong key are left alone, and can be read with the right one
+    lvpa.SetMasterKey(&newKey[0], LVPAHash_Size);
+    if(!sameContent(lvpa, "a", v5, sizeof(v5))) return 34;
+    if(!sameContent(lvpa, "b", v6, sizeof(v6))) return 35;
+    if(!sameContent(lvpa, "c", v3, sizeof(v3))) return 36;
+    if(!sameContent(lvpa, "e", v2, sizeof(v2))) return 37;
+    return 0;
+}
+
+int TestLVPA_Repack()
+{
+    INIT_TEST();
+    {
+        LVPAFile lvpa;
+        lvpa.Add("a", MAKE_MEMBLOCK(v6));
+        lvpa.Add("b", MAKE_MEMBLOCK(v5), "blk");
+        lvpa.Add("c", MAKE_MEMBLOCK(v3), "blk");
+        if(!lvpa.SaveAs("~test.lvpa.tmp", LVPACOMP_NONE)) return 1;
+        lvpa.Clear(false); // otherwise we would attempt to delete const memory
+    }
+    {
+        // without repacking, other settings are not applied to stored files
+        LVPAFile lvpa;
+        if(!lvpa.LoadFrom("~test.lvpa.tmp")) return 2;
+        if(!lvpa.SaveAs("~test.lvpa.tmp", LVPACOMP_FAST, LVPAPACK_LZMA)) return 3;
+        if(lvpa.GetFileInfo(lvpa.GetId("a")).flags & LVPAFLAG_PACKED) return 4;
+    }
+    {
+        LVPAFile lvpa;
+        lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+        if(!lvpa.LoadFrom("~test.lvpa.tmp")) return 10;
+        if(!lvpa.Repack(LVPACOMP_FAST, LVPAPACK_LZMA, LVPAENCR_ENABLED)) return 11;
+        if(!lvpa.SaveAs("~test.lvpa.tmp")) return 12;
+    }
+    {
+        LVPAFile lvpa;
+        lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+        if(!lvpa.LoadFrom("~test.lvpa.tmp")) return 20;
+        const LVPAFileHeader& a = lvpa.GetFileInfo(lvpa.GetId("a"));
+        if(!(a.flags & LVPAFLAG_PACKED) || !(a.flags & LVPAFLAG_ENCRYPTED) || a.algo != LVPAPACK_LZMA) return 21;
+        const LVPAFileHeader& blk = lvpa.GetFileInfo(lvpa.GetFileInfo(lvpa.GetId("b")).blockId);
+        if(!(blk.flags & LVPAFLAG_PACKED) || !(blk.flags & LVPAFLAG_ENCRYPTED) || blk.algo != LVPAPACK_LZMA) return 22;
+        if(!sameContent(lvpa, "a", v6, sizeof(v6))) return 23;
+        if(!sameContent(lvpa, "b", v5, sizeof(v5))) return 24;
+        if(!sameContent(lvpa, "c", v3, sizeof(v3))) return 25;
+
+        // changing a stored solid block's settings unpacks it with the old ones first
+        lvpa.Free("b");
+        lvpa.Free("c");
+        lvpa.SetSolidBlock("blk", LVPACOMP_FAST, LVPAPACK_DEFLATE);
+        if(!lvpa.SaveAs("~test.lvpa.tmp")) return 26;
+    }
+    LVPAFile lvpa;
+    lvpa.SetMasterKey(&g_masterKey[0], LVPAHash_Size);
+    if(!lvpa.LoadFrom("~test.lvpa.tmp")) return 30;
+    if(lvpa.GetFileInfo(lvpa.GetFileInfo(lvpa.GetId("b")).blockId).algo != LVPAPACK_DEFLATE) return 31;
+    if(!sameContent(lvpa, "b", v5, sizeof(v5))) return 32;
+    if(!sameContent(lvpa, "c", v3, sizeof(v3))) return 33;
+    if(!sameContent(lvpa, "a", v6, sizeof(v6))) return 34;
+    return 0;
+}
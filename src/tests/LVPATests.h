@@ -14,12 +14,26 @@ int TestLVPA_LZO();
 int TestLVPA_Deflate();
 int TestLVPA_Gzip();
 int TestLVPA_MixedSolid();
+int TestLVPA_Mapped();
 int TestLVPAUncompressedEncrypted();
 int TestLVPAUncompressedScrambled();
 int TestLVPAUncompressedEncrScram();
 int TestLVPA_LZMA_EncrScram();
 int TestLVPA_Everything();
+int TestLVPA_Threaded();
+int TestLVPA_Async();
+int TestLVPA_Chunked();
+int TestLVPA_Stream();
+int TestLVPA_ChaCha();
 int TestLVPA_VFS_ScrambledLoader();
 int TestLVPA_VFS_ScrambledLoaderEncrypted();
+int TestLVPA_VFS_Index();
+int TestLVPA_VFS_Mount();
+int TestLVPA_CRCPolicy();
+int TestLVPA_Dedup();
+int TestLVPA_AutoCompression();
+int TestLVPA_Update();
+int TestLVPA_Rekey();
+int TestLVPA_Repack();
 
 #endif
@@ -0,0 +1,371 @@
+#include "common.h"
+#include "ByteBuffer.h"
+#include "Tile.h"
+#include "TileLayer.h"
+#include "LayerMgr.h"
+#include "MapFile.h"
+#include "MapStreamer.h"
+#include "VFSFile.h"
+#include "MapTests.h"
+
+// tiles without images, only their names go into map files.
+// the initial reference is kept, deleting them would drop the missing image at the ResourceMgr.
+static BasicTile *g_tiles[4]; // [0] stays NULL, means no tile
+static const char *g_tileNames[4] = { "", "tiles/a.png", "tiles/b.png", "tiles/c.png" };
+
+typedef std::vector<uint8> MapData;
+
+int MapTestsInit()
+{
+    for(uint32 i = 1; i < 4; ++i)
+        g_tiles[i] = new BasicTile(NULL, g_tileNames[i]);
+    return 0;
+}
+
+// layer 0 has long runs (stored as RLE), layer 3 a few tiles (stored sparse), layer 7 a pattern without runs.
+// there are tiles in the last row and column, and around chunk borders.
+static LayerMgr *makeMap(uint32 w, uint32 h)
+{
+    LayerMgr *mgr = new LayerMgr(NULL);
+    mgr->SetSize(w, h);
+    uint32 depths[3] = { 0, 3, 7 };
+    for(uint32 i = 0; i < 3; ++i)
+    {
+        TileLayer *layer = mgr->CreateLayer();
+        layer->name = "layer";
+        layer->name += char('0' + depths[i]);
+        mgr->SetLayer(layer, depths[i]);
+    }
+    TileLayer *runs = mgr->GetLayer(0), *sparse = mgr->GetLayer(3), *pattern = mgr->GetLayer(7);
+    for(uint32 y = 0; y < h; ++y)
+        for(uint32 x = 0; x < w; ++x)
+        {
+            if(y != h / 2)
+                runs->SetTile(x, y, g_tiles[x < w / 3 ? 1 : 2]);
+            if((x * 7 + y * 13) % 97 == 0)
+                sparse->SetTile(x, y, g_tiles[3]);
+            pattern->SetTile(x, y, g_tiles[(x ^ (y * 3)) & 3]);
+        }
+    sparse->SetTile(w - 1, h - 1, g_tiles[1]);
+    sparse->SetTile(w - 1, 0, g_tiles[2]);
+    sparse->SetTile(0, h - 1, g_tiles[2]);
+    if(w > TILECHUNK_DIM && h > TILECHUNK_DIM)
+    {
+        sparse->SetTile(TILECHUNK_DIM - 1, TILECHUNK_DIM, g_tiles[1]);
+        sparse->SetTile(TILECHUNK_DIM, TILECHUNK_DIM - 1, g_tiles[1]);
+    }
+    mgr->stringdata["name"] = "test map";
+    mgr->stringdata["empty"] = "";
+    return mgr;
+}
+
+static MapData saveMap(LayerMgr *mgr)
+{
+    ByteBuffer bb;
+    MapFile::Save(&bb, mgr);
+    return MapData(bb.contents(), bb.contents() + bb.wpos()); // wpos is the effective data size
+}
+
+// like MapFile::Load(), but with the test tiles. NULL if the map is not valid.
+static LayerMgr *loadMap(const MapData& data)
+{
+    if(data.empty())
+        return NULL;
+    LayerMgr *mgr = NULL;
+    try
+    {
+        MapFileHeader hdr;
+        if(!MapFile::ReadHeader(&data[0], data.size(), hdr))
+            return NULL;
+        std::vector<BasicTile*> table(hdr.tiles.size(), (BasicTile*)NULL);
+        for(uint32 i = 1; i < table.size(); ++i)
+            for(uint32 t = 1; t < 4; ++t)
+                if(hdr.tiles[i] == g_tileNames[t])
+                    table[i] = g_tiles[t];
+        mgr = MapFile::PrepareLayers(hdr, NULL, NULL);
+        mgr->stringdata = hdr.stringdata;
+        if(!MapFile::LoadLayers(&data[0], data.size(), hdr, mgr, &table[0], table.size()))
+        {
+            delete mgr;
+            return NULL;
+        }
+    }
+    catch(ByteBufferException ex)
+    {
+        delete mgr;
+        return NULL;
+    }
+    return mgr;
+}
+
+static bool loads(const MapData& data)
+{
+    LayerMgr *mgr = loadMap(data);
+    delete mgr;
+    return mgr != NULL;
+}
+
+// 0 if both maps have the same size, layers, tiles and string data
+static int compareMaps(LayerMgr *a, LayerMgr *b)
+{
+    if(a->GetWidth() != b->GetWidth() || a->GetHeight() != b->GetHeight())
+        return 1;
+    if(a->stringdata != b->stringdata)
+        return 2;
+    for(uint32 i = 0; i < LAYER_MAX; ++i)
+    {
+        TileLayer *la = a->GetLayer(i), *lb = b->GetLayer(i);
+        bool useda = la && la->IsUsed(), usedb = lb && lb->IsUsed();
+        if(useda != usedb)
+            return 3;
+        if(!useda)
+            continue;
+        if(la->name != lb->name || la->UsedTiles() != lb->UsedTiles())
+            return 4;
+        for(uint32 y = 0; y < a->GetHeight(); ++y)
+            for(uint32 x = 0; x < a->GetWidth(); ++x)
+            {
+                BasicTile *ta = la->GetTile(x,y), *tb = lb->GetTile(x,y);
+                if(!ta != !tb || (ta && strcmp(ta->GetFilename(), tb->GetFilename())))
+                {
+                    printf("Layer %u differs at (%u, %u)\n", i, x, y);
+                    return 5;
+                }
+            }
+    }
+    return 0;
+}
+
+static uint32 getU32(const MapData& data, uint32 pos)
+{
+    return data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16) | (uint32(data[pos + 3]) << 24);
+}
+
+static void putU32(MapData& data, uint32 pos, uint32 val)
+{
+    for(uint32 i = 0; i < 4; ++i)
+        data[pos + i] = uint8(val >> (i * 8));
+}
+
+// offsets in the fixed header
+#define MAPHDR_VERSION 4
+#define MAPHDR_DATAHDR_OFFS (4 + 5 * 4 + 2 * 4)
+
+// writes a map in version 1, which MapFile::Save() can no longer do: the same headers, then all cells of each layer
+static MapData saveMapV1(LayerMgr *mgr)
+{
+    MapData data = saveMap(mgr);
+    putU32(data, MAPHDR_VERSION, 1);
+
+    uint32 w = mgr->GetWidth(), h = mgr->GetHeight();
+    uint32 pos = getU32(data, MAPHDR_DATAHDR_OFFS) + 6 * sizeof(uint32);
+    for(uint32 i = 0; i < LAYER_MAX; ++i) // skip layer names
+        while(data[pos++]);
+    data.resize(pos);
+
+    // tile names in the order of the file, see MapFile::Save()
+    MapFileHeader hdr;
+    MapFile::ReadHeader(&data[0], data.size(), hdr);
+    for(uint32 i = 0; i < LAYER_MAX; ++i)
+    {
+        TileLayer *layer = mgr->GetLayer(i);
+        if(!layer || !layer->IsUsed())
+            continue;
+        ByteBuffer bb;
+        bb << i;
+        for(uint32 y = 0; y < h; ++y)
+            for(uint32 x = 0; x < w; ++x)
+            {
+                uint16 id = 0;
+                if(BasicTile *tile = layer->GetTile(x,y))
+                    id = uint16(std::find(hdr.tiles.begin(), hdr.tiles.end(), std::string(tile->GetFilename())) - hdr.tiles.begin());
+                bb << id;
+            }
+        data.insert(data.end(), bb.contents(), bb.contents() + bb.wpos());
+    }
+    return data;
+}
+
+static int roundTrip(uint32 w, uint32 h, bool v1)
+{
+    LayerMgr *mgr = makeMap(w, h);
+    MapData data = v1 ? saveMapV1(mgr) : saveMap(mgr);
+    uint32 expectVersion = v1 ? 1 : (std::max(w, h) >= MAPFILE_CHUNKED_MIN_DIM ? MAPFILE_VERSION_CHUNKED : 2);
+    if(getU32(data, MAPHDR_VERSION) != expectVersion)
+    {
+        delete mgr;
+        return 10;
+    }
+    LayerMgr *loaded = loadMap(data);
+    int r = loaded ? compareMaps(mgr, loaded) : 11;
+    if(r)
+        printf("Map %ux%u, version %u: failed with %d\n", w, h, expectVersion, r);
+    delete loaded;
+    delete mgr;
+    return r;
+}
+
+int TestMap_V1()
+{
+    if(int r = roundTrip(20, 13, true)) return r;
+    if(int r = roundTrip(1, 70, true)) return r;
+
+    // cut off in the layer data
+    LayerMgr *mgr = makeMap(20, 13);
+    MapData data = saveMapV1(mgr);
+    delete mgr;
+    data.resize(data.size() - 3);
+    if(loads(data)) return 1;
+    return 0;
+}
+
+int TestMap_V2()
+{
+    if(int r = roundTrip(20, 13, false)) return r;
+    if(int r = roundTrip(100, 1, false)) return r;
+    if(int r = roundTrip(33, 70, false)) return r;
+    if(int r = roundTrip(MAPFILE_CHUNKED_MIN_DIM - 1, 3, false)) return r;
+
+    LayerMgr *mgr = makeMap(33, 70);
+    MapData data = saveMap(mgr);
+    delete mgr;
+
+    // not chunked, must not be streamed
+    if(MapFile::GetChunkedHeaderSize(&data[0], data.size())) return 1;
+    if(MapFile::GetChunkedHeaderSize(&data[0], MAPFILE_FIXED_HEADER_SIZE)) return 2;
+
+    // corrupt copies must be rejected, without reading outside of the data
+    for(uint32 cut = 1; cut < data.size(); cut += 7)
+        if(loads(MapData(data.begin(), data.end() - cut))) return 3;
+
+    // unknown layer encoding, and invalid layer index, of the first layer
+    uint32 pos = getU32(data, MAPHDR_DATAHDR_OFFS) + 6 * sizeof(uint32);
+    for(uint32 i = 0; i < LAYER_MAX; ++i)
+        while(data[pos++]);
+    MapData bad(data);
+    bad[pos + 4] = 42;
+    if(loads(bad)) return 4;
+    bad = data;
+    putU32(bad, pos, LAYER_MAX);
+    if(loads(bad)) return 5;
+
+    // bad headers
+    bad = data;
+    bad[0] = 'X';
+    if(loads(bad)) return 6;
+    bad = data;
+    putU32(bad, MAPHDR_VERSION, MAPFILE_VERSION + 1);
+    if(loads(bad)) return 7;
+    bad = data;
+    putU32(bad, MAPHDR_DATAHDR_OFFS, data.size() + 100);
+    if(loads(bad)) return 8;
+
+    if(!loads(data)) return 9; // the original is still fine
+    return 0;
+}
+
+int TestMap_V3()
+{
+    if(int r = roundTrip(MAPFILE_CHUNKED_MIN_DIM, 40, false)) return r;
+    if(int r = roundTrip(3, MAPFILE_CHUNKED_MIN_DIM + 1, false)) return r;
+    if(int r = roundTrip(300, 257, false)) return r;
+
+    LayerMgr *mgr = makeMap(300, 257);
+    MapData data = saveMap(mgr);
+    delete mgr;
+
+    MapFileHeader hdr;
+    if(!MapFile::ReadHeader(&data[0], data.size(), hdr)) return 1;
+    if(hdr.chunkDim != TILECHUNK_DIM || hdr.chunks.size() != 10 * 9) return 2;
+
+    // everything before the first chunk can be read at once
+    uint32 hdrSize = MapFile::GetChunkedHeaderSize(&data[0], MAPFILE_FIXED_HEADER_SIZE);
+    if(hdrSize < MAPFILE_FIXED_HEADER_SIZE || hdrSize > data.size()) return 3;
+    uint32 firstChunk = 0; // index of a chunk with tiles
+    for(uint32 i = 0; i < hdr.chunks.size(); ++i)
+    {
+        if(hdr.chunks[i].offset && hdr.chunks[i].offset < hdrSize) return 4;
+        if(!firstChunk && hdr.chunks[i].offset)
+            firstChunk = i;
+    }
+    MapFileHeader hdr2;
+    if(!MapFile::ReadHeader(&data[0], hdrSize, hdr2) || hdr2.chunks.size() != hdr.chunks.size()) return 5;
+
+    for(uint32 cut = 1; cut < data.size(); cut += 53)
+        if(loads(MapData(data.begin(), data.end() - cut))) return 6;
+    if(loads(MapData(data.begin(), data.begin() + hdrSize - 1))) return 7;
+
+    // the chunk index follows the chunk size, see writeChunks()
+    uint32 entryPos = hdr.layerDataOffs + sizeof(uint32) + firstChunk * 2 * sizeof(uint32);
+    const MapChunkEntry& e = hdr.chunks[firstChunk];
+    MapData bad(data);
+    putU32(bad, entryPos + sizeof(uint32), e.size - 1); // truncated
+    if(loads(bad)) return 8;
+    bad = data;
+    putU32(bad, entryPos, data.size() - 2); // past the end
+    if(loads(bad)) return 9;
+    bad = data;
+    putU32(bad, entryPos, 0xFFFFFFF0);
+    if(loads(bad)) return 10;
+    bad = data;
+    bad[e.offset + 1] = LAYER_MAX; // index of the first layer
+    if(loads(bad)) return 11;
+    bad = data;
+    bad[e.offset + 2] = 42; // encoding of the first layer
+    if(loads(bad)) return 12;
+    bad = data;
+    putU32(bad, hdr.layerDataOffs, 0); // chunk size
+    if(loads(bad)) return 13;
+
+    if(!loads(data)) return 14;
+    return 0;
+}
+
+int TestMap_Stream()
+{
+    // the tiles are not found without images, so this only checks which chunks are loaded
+    LayerMgr *mgr = makeMap(300, 257);
+    MapData chunked = saveMap(mgr);
+    delete mgr;
+    mgr = makeMap(33, 70);
+    MapData unchunked = saveMap(mgr);
+    delete mgr;
+
+    LayerMgr target(NULL);
+    target.SetSize(1, 1);
+    target.CreateCollisionMap();
+    MapStreamer streamer(&target);
+
+    VFSFileMem *vf = new VFSFileMem("test.map", &unchunked[0], unchunked.size());
+    bool opened = streamer.Open(vf);
+    vf->ref--;
+    if(opened || target.GetWidth() != 1 || target.IsStreamed()) return 1;
+
+    vf = new VFSFileMem("test.map", &chunked[0], chunked.size());
+    opened = streamer.Open(vf);
+    vf->ref--; // the streamer holds its own reference
+    if(!opened || !target.IsStreamed()) return 2;
+    if(target.GetWidth() != 300 || target.GetHeight() != 257 || target.GetChunksX() != 10 || target.GetChunksY() != 9) return 3;
+    if(streamer.GetLoadedCount() || target.GetCollisionMap()(8, 8) != LCF_WALL) return 4;
+
+    // the visible chunk and the ones around it, which are only 3 at the corner
+    const uint32 chunkPixels = TILECHUNK_DIM * 16;
+    streamer.Update(0, 0, 320, 240);
+    if(streamer.GetLoadedCount() != 4 || !target.IsChunkLoaded(1, 1) || target.IsChunkLoaded(2, 0)) return 5;
+    const CollisionMap& coll = target.GetCollisionMap();
+    if(coll(8, 8) != LCF_NONE || coll(2 * chunkPixels - 1, 2 * chunkPixels - 1) != LCF_NONE) return 6;
+    if(coll(2 * chunkPixels, 8) != LCF_WALL || coll(8, 2 * chunkPixels) != LCF_WALL) return 7;
+
+    // move to the other corner: the changed chunk stays, the other one is dropped
+    target.GetLayer(0)->SetTile(1, 1, g_tiles[1], false);
+    if(!target.IsChunkModified(0, 0) || target.IsChunkModified(1, 1)) return 8;
+    streamer.Update(9 * chunkPixels, 8 * chunkPixels, 320, 240);
+    if(!target.IsChunkLoaded(0, 0) || target.IsChunkLoaded(1, 1) || !target.IsChunkLoaded(9, 8) || !target.IsChunkLoaded(8, 7)) return 9;
+    if(streamer.GetLoadedCount() != 1 + 4) return 10;
+    if(target.GetLayer(0)->GetTile(1, 1) != g_tiles[1]) return 11;
+    if(coll(chunkPixels + 8, chunkPixels + 8) != LCF_WALL || coll(9 * chunkPixels + 8, 8 * chunkPixels + 8) != LCF_NONE) return 12;
+
+    streamer.Close();
+    if(target.IsStreamed() || streamer.IsOpen() || !target.IsChunkLoaded(1, 1)) return 13;
+    return 0;
+}
@@ -0,0 +1,11 @@
+#ifndef TESTS_MAP_H
+#define TESTS_MAP_H
+
+int MapTestsInit();
+
+int TestMap_V1();
+int TestMap_V2();
+int TestMap_V3();
+int TestMap_Stream();
+
+#endif
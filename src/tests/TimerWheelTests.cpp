@@ -0,0 +1,197 @@
+#include "common.h"
+#include "TimerWheel.h"
+#include "TimerWheelTests.h"
+
+// what a test timer does when it is called
+enum TestTimerAction
+{
+    TT_NONE,
+    TT_CANCEL, // cancels 'other'
+    TT_RESCHEDULE, // moves 'other' to 'when'
+    TT_SCHEDULE, // schedules a new timer at 'when', see s_scheduled
+};
+
+// time passed to the last Update(), and which timers were called then
+static uint32 s_now;
+static std::map<uint32, uint32> s_called; // id -> time
+static uint32 s_deleted;
+static bool s_actionResult;
+static uint32 s_scheduled; // by the last TT_SCHEDULE timer, which is deleted after its call
+
+class TestTimer : public TimerCallback
+{
+public:
+    TestTimer(TimerWheel *w = NULL, TestTimerAction a = TT_NONE, uint32 o = 0, uint32 t = 0)
+        : wheel(w), action(a), other(o), when(t) {}
+    virtual ~TestTimer() { ++s_deleted; }
+    virtual void Call(uint32 id)
+    {
+        if(s_called.find(id) != s_called.end())
+            s_actionResult = false; // called twice
+        s_called[id] = s_now;
+        switch(action)
+        {
+            case TT_CANCEL: s_actionResult = wheel->Cancel(other); break;
+            case TT_RESCHEDULE: s_actionResult = wheel->Reschedule(other, when); break;
+            case TT_SCHEDULE: s_scheduled = wheel->Schedule(when, new TestTimer); break;
+            default: break;
+        }
+    }
+
+    TimerWheel *wheel;
+    TestTimerAction action;
+    uint32 other;
+    uint32 when;
+};
+
+static void update(TimerWheel& w, uint32 now)
+{
+    s_now = now;
+    w.Update(now);
+}
+
+static void reset(void)
+{
+    s_called.clear();
+    s_deleted = 0;
+    s_actionResult = true;
+}
+
+// each timer must be called at the first Update() at or after its time, in steps of 'step' ms, starting at 'start'
+static int checkDelays(uint32 start, uint32 step, const uint32 *delays, uint32 count, uint32 maxDelay)
+{
+    reset();
+    TimerWheel w;
+    update(w, start);
+    std::vector<uint32> ids(count);
+    for(uint32 i = 0; i < count; ++i)
+        ids[i] = w.Schedule(start + delays[i], new TestTimer);
+
+    for(uint32 t = start; uint32(t - start) <= maxDelay + step; t += step)
+        update(w, t);
+
+    if(w.GetCount() || s_deleted != count || !s_actionResult)
+        return 1;
+    for(uint32 i = 0; i < count; ++i)
+    {
+        std::map<uint32, uint32>::iterator it = s_called.find(ids[i]);
+        uint32 steps = delays[i] ? (delays[i] + step - 1) / step : 1; // 'start' itself was processed already
+        uint32 expect = start + steps * step;
+        if(it == s_called.end() || it->second != expect)
+        {
+            printf("TimerWheel: start %u, step %u, delay %u: expected at %u, called at %u\n",
+                start, step, delays[i], expect, it == s_called.end() ? 0 : it->second);
+            return 2;
+        }
+    }
+    return 0;
+}
+
+// delays at the borders of the root wheel and the coarser levels, and beyond what the wheel covers
+static const uint32 s_delays[] = { 0, 1, 2, 255, 256, 257, 511, 4000, 16383, 16384, 16385, 20000,
+    (1 << 20) - 1, 1 << 20, (1 << 20) + 1, 3000000, (1 << 26) - 1, 1 << 26, (1 << 26) + 12345 };
+static const uint32 s_delayCount = sizeof(s_delays) / sizeof(s_delays[0]);
+
+int TestTimerWheel()
+{
+    if(int r = checkDelays(0, 1, s_delays, 12, 20000)) return r;
+    if(int r = checkDelays(1000, 7, s_delays, 12, 20000)) return 10 + r;
+    if(int r = checkDelays(123, 1000, s_delays, s_delayCount, s_delays[s_delayCount - 1])) return 20 + r;
+    if(int r = checkDelays(65535, 16, s_delays, s_delayCount - 3, 3000000)) return 30 + r;
+
+    // cancel and reschedule before they are due; Clear() deletes the rest
+    reset();
+    {
+        TimerWheel w;
+        update(w, 0);
+        uint32 a = w.Schedule(100, new TestTimer);
+        uint32 b = w.Schedule(20000, new TestTimer);
+        uint32 c = w.Schedule(30, new TestTimer);
+        w.Schedule(50000, new TestTimer);
+        if(!w.Cancel(a) || w.Cancel(a) || !w.Reschedule(b, 40) || !w.Reschedule(c, 20000) || w.Reschedule(a, 5)) return 40;
+        if(w.GetCount() != 3 || s_deleted != 1) return 41;
+        for(uint32 t = 1; t <= 20000; ++t)
+            update(w, t);
+        if(s_called.size() != 2 || s_called[b] != 40 || s_called[c] != 20000) return 42;
+        w.Clear();
+        if(w.GetCount() || s_deleted != 4) return 43;
+    }
+    return 0;
+}
+
+// the time wraps around at 2^32, or is reset to an earlier time
+int TestTimerWheelWrap()
+{
+    if(int r = checkDelays(0xFFFFFFFF - 300, 1, s_delays, 12, 20000)) return r;
+    if(int r = checkDelays(0xFFFFFFFF - 16384, 3, s_delays, 12, 20000)) return 10 + r;
+    if(int r = checkDelays(0xFFFFFFFF, 1000, s_delays, s_delayCount, s_delays[s_delayCount - 1])) return 20 + r;
+
+    // going back in time keeps the remaining time of each timer
+    reset();
+    TimerWheel w;
+    update(w, 50000);
+    uint32 a = w.Schedule(50100, new TestTimer);
+    uint32 b = w.Schedule(70000, new TestTimer);
+    update(w, 50050);
+    update(w, 10);
+    update(w, 59);
+    if(!s_called.empty()) return 30;
+    update(w, 60);
+    if(s_called.size() != 1 || s_called[a] != 60) return 31;
+    for(uint32 t = 61; t <= 19960; ++t)
+        update(w, t);
+    if(s_called.size() != 2 || s_called[b] != 19960) return 32;
+    return 0;
+}
+
+// callbacks that change other timers, while they are being called
+int TestTimerWheelDispatch()
+{
+    reset();
+    TimerWheel w;
+    update(w, 0);
+
+    // both due at the same time: the first one cancels the second one
+    TestTimer *first = new TestTimer(&w, TT_CANCEL);
+    uint32 a = w.Schedule(10, first);
+    first->other = w.Schedule(10, new TestTimer);
+    update(w, 10);
+    if(s_called.size() != 1 || !s_called.count(a) || !s_actionResult || s_deleted != 2) return 1;
+
+    // a timer can't cancel itself, it is already gone
+    TestTimer *self = new TestTimer(&w, TT_CANCEL);
+    self->other = w.Schedule(20, self);
+    update(w, 20);
+    if(s_actionResult || w.GetCount()) return 2;
+
+    // due at the same time: the first one moves the second one away
+    reset();
+    TestTimer *mover = new TestTimer(&w, TT_RESCHEDULE, 0, 400);
+    a = w.Schedule(30, mover);
+    uint32 b = mover->other = w.Schedule(30, new TestTimer);
+    update(w, 30);
+    if(s_called.size() != 1 || !s_actionResult) return 3;
+    for(uint32 t = 31; t <= 400; ++t)
+        update(w, t);
+    if(s_called.size() != 2 || s_called[b] != 400) return 4;
+
+    // scheduled for now from within a callback: called in the next update, not in the running one
+    reset();
+    w.Schedule(500, new TestTimer(&w, TT_SCHEDULE, 0, 500));
+    update(w, 500);
+    uint32 c = s_scheduled;
+    if(s_called.size() != 1 || s_called.count(c) || w.GetCount() != 1) return 5;
+    update(w, 501);
+    if(s_called.size() != 2 || s_called[c] != 501 || w.GetCount()) return 6;
+
+    // ids are never 0, and not reused while in use
+    std::map<uint32, bool> ids;
+    for(uint32 i = 0; i < 1000; ++i)
+    {
+        uint32 id = w.Schedule(1000 + i, new TestTimer);
+        if(!id || ids[id]) return 7;
+        ids[id] = true;
+    }
+    w.Clear();
+    return 0;
+}
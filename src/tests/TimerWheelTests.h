@@ -0,0 +1,8 @@
+#ifndef TESTS_TIMERWHEEL_H
+#define TESTS_TIMERWHEEL_H
+
+int TestTimerWheel();
+int TestTimerWheelWrap();
+int TestTimerWheelDispatch();
+
+#endif
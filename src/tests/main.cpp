@@ -1,6 +1,10 @@
 #include "common.h"
 #include "LVPATests.h"
 #include "LVPACipherTests.h"
+#include "CRCTests.h"
+#include "MapTests.h"
+#include "TimerWheelTests.h"
+#include "FlatHashMapTests.h"
 
 #define DO_TESTRUN(f) { printf("Running: %s\n", #f); int _r = (f); if(_r) { logerror("TEST FAILED: Func %s returned %d", #f, _r); return 1; } }
 
@@ -22,6 +26,13 @@ int main(int argc, char *argv[])
     DO_TESTRUN(TestHPRC4LikeWarm());
     //DO_TESTRUN(TestRC4Massive()); // RC4 not used and just kept for reference (is rather slow too)
     DO_TESTRUN(TestHPRC4LikeMassive());
+    DO_TESTRUN(TestChaCha20());
+    DO_TESTRUN(TestChaCha20Warm());
+    DO_TESTRUN(TestChaCha20Massive());
+
+    DO_TESTRUN(TestCRC32());
+    DO_TESTRUN(TestCRC32Modes());
+    DO_TESTRUN(BenchCRC32());
 
     DO_TESTRUN(TestLVPAUncompressed());
     DO_TESTRUN(TestLVPA_LZO());
@@ -29,13 +40,41 @@ int main(int argc, char *argv[])
     DO_TESTRUN(TestLVPA_Deflate());
     DO_TESTRUN(TestLVPAUncompressedSolid());
     DO_TESTRUN(TestLVPA_MixedSolid());
+    DO_TESTRUN(TestLVPA_Mapped());
     DO_TESTRUN(TestLVPAUncompressedEncrypted());
     DO_TESTRUN(TestLVPAUncompressedScrambled());
     DO_TESTRUN(TestLVPAUncompressedEncrScram());
     DO_TESTRUN(TestLVPA_LZMA_EncrScram());
     DO_TESTRUN(TestLVPA_Everything());
+    DO_TESTRUN(TestLVPA_Threaded());
+    DO_TESTRUN(TestLVPA_Async());
+    DO_TESTRUN(TestLVPA_Chunked());
+    DO_TESTRUN(TestLVPA_Stream());
+    DO_TESTRUN(TestLVPA_ChaCha());
     DO_TESTRUN(TestLVPA_VFS_ScrambledLoader());
     DO_TESTRUN(TestLVPA_VFS_ScrambledLoaderEncrypted());
+    DO_TESTRUN(TestLVPA_VFS_Index());
+    DO_TESTRUN(TestLVPA_VFS_Mount());
+    DO_TESTRUN(TestLVPA_CRCPolicy());
+    DO_TESTRUN(TestLVPA_Dedup());
+    DO_TESTRUN(TestLVPA_AutoCompression());
+    DO_TESTRUN(TestLVPA_Update());
+    DO_TESTRUN(TestLVPA_Rekey());
+    DO_TESTRUN(TestLVPA_Repack());
+
+    DO_TESTRUN(TestTimerWheel());
+    DO_TESTRUN(TestTimerWheelWrap());
+    DO_TESTRUN(TestTimerWheelDispatch());
+
+    DO_TESTRUN(TestFlatHashMap());
+    DO_TESTRUN(TestFlatHashMapErase());
+    DO_TESTRUN(TestFlatHashMapIterErase());
+
+    DO_TESTRUN(MapTestsInit());
+    DO_TESTRUN(TestMap_V1());
+    DO_TESTRUN(TestMap_V2());
+    DO_TESTRUN(TestMap_V3());
+    DO_TESTRUN(TestMap_Stream());
 
     printf("All tests successful!\n");
 